@@ -0,0 +1,373 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	fwdbench times the pieces of lib/fwd.c on their own: how well and
+ *	how fast hashmac spreads addresses over the cam, how long camlook
+ *	takes as the cam fills up, and how many buffers a queue moves per
+ *	second with several threads putting into it. every measurement
+ *	prints one line of json.
+ *
+ *	example use: bench/fwdbench -d 1
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <math.h>
+#include "fwd.h"
+
+enum {
+	Nmacs = Camsize,
+	Nlookups = 1<<20,
+	MaxProducers = 16,
+};
+
+enum {
+	Sequential,
+	Random,
+	Portpattern,
+	Npatterns,
+};
+
+static char *patnames[] = {
+	[Sequential] = "sequential",
+	[Random] = "random",
+	[Portpattern] = "portpattern",
+};
+
+struct Port {
+	int id;
+};
+
+typedef struct Producer Producer;
+struct Producer {
+	pthread_t thr;
+	Queue *q;
+	Buffer *bp;
+	volatile int *stop;
+	uint64_t nput;
+	uint64_t nfull;
+};
+
+static double duration = 1.0;
+static uint32_t rnd = 0x12345678;
+
+static uint32_t
+xorshift(uint32_t *state)
+{
+	uint32_t x;
+	x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static uint64_t
+nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ *	the i'th address of a pattern. sequential is what a generator
+ *	counting up makes, portpattern is a few ouis with the port number
+ *	in the low bytes, the way containode numbers its taps.
+ */
+static void
+mkmac(uint8_t *mac, int pattern, uint32_t i)
+{
+	uint32_t r;
+
+	switch(pattern){
+	case Sequential:
+		mac[0] = 0x02;
+		mac[1] = 0x00;
+		mac[2] = i >> 24;
+		mac[3] = i >> 16;
+		mac[4] = i >> 8;
+		mac[5] = i;
+		break;
+	case Random:
+		r = xorshift(&rnd);
+		mac[0] = (r & 0xfe) | 0x02;
+		mac[1] = r >> 8;
+		mac[2] = r >> 16;
+		r = xorshift(&rnd);
+		mac[3] = r;
+		mac[4] = r >> 8;
+		mac[5] = r >> 16;
+		break;
+	case Portpattern:
+		mac[0] = 0x52;
+		mac[1] = 0x54;
+		mac[2] = 0x00;
+		mac[3] = i & 7;
+		mac[4] = (i >> 3) >> 8;
+		mac[5] = i >> 3;
+		break;
+	}
+}
+
+/*
+ *	hash quality: the longest bucket and chi-square of Nmacs addresses
+ *	thrown into Camsize buckets (chi-square should be close to Camsize),
+ *	and the avalanche bias, which is how far from one half the chance
+ *	of an output bit flipping is when one input bit flips, worst bit.
+ */
+static void
+hashquality(int pattern)
+{
+	static uint32_t buckets[Camsize];
+	uint8_t mac[6];
+	double expect, chisq, flips[32], bias, worst;
+	uint32_t h, h2, maxload;
+	int i, j, b, ntrials;
+
+	memset(buckets, 0, sizeof buckets);
+	for(i = 0; i < Nmacs; i++){
+		mkmac(mac, pattern, i);
+		buckets[hashmac(mac) & (Camsize-1)]++;
+	}
+	maxload = 0;
+	chisq = 0.0;
+	expect = (double)Nmacs / Camsize;
+	for(i = 0; i < Camsize; i++){
+		if(buckets[i] > maxload)
+			maxload = buckets[i];
+		chisq += (buckets[i] - expect) * (buckets[i] - expect) / expect;
+	}
+
+	ntrials = 0;
+	memset(flips, 0, sizeof flips);
+	for(i = 0; i < 4096; i++){
+		mkmac(mac, pattern, i);
+		h = hashmac(mac);
+		for(j = 0; j < 48; j++){
+			mac[j/8] ^= 1 << (j%8);
+			h2 = hashmac(mac) ^ h;
+			mac[j/8] ^= 1 << (j%8);
+			for(b = 0; b < 32; b++)
+				flips[b] += (h2 >> b) & 1;
+			ntrials++;
+		}
+	}
+	worst = 0.0;
+	for(b = 0; b < 32; b++){
+		bias = fabs(flips[b] / ntrials - 0.5);
+		if(bias > worst)
+			worst = bias;
+	}
+
+	printf("{\"bench\":\"hashquality\",\"pattern\":\"%s\",\"keys\":%d,\"buckets\":%d,\"maxload\":%u,\"chisq\":%.1f,\"avalanche_bias\":%.4f}\n",
+		patnames[pattern], Nmacs, Camsize, maxload, chisq, worst);
+}
+
+static void
+hashspeed(void)
+{
+	static uint8_t macs[Nmacs][6];
+	uint64_t start, end;
+	uint32_t sink;
+	int i, n;
+
+	for(i = 0; i < Nmacs; i++)
+		mkmac(macs[i], Random, i);
+	sink = 0;
+	n = 0;
+	start = nsec();
+	do {
+		for(i = 0; i < Nmacs; i++)
+			sink += hashmac(macs[i]);
+		n += Nmacs;
+		end = nsec();
+	} while(end - start < duration * 1e9);
+
+	printf("{\"bench\":\"hashmac\",\"ops\":%d,\"ns_per_op\":%.2f,\"sink\":%u}\n",
+		n, (double)(end - start) / n, sink);
+}
+
+/*
+ *	fills the cam to a load factor and times lookups of addresses that
+ *	are in it and of addresses that are not. misses are the expensive
+ *	case in open addressing, they walk until an empty slot.
+ */
+static void
+camload(double load)
+{
+	static Cam cams[Camsize];
+	static uint8_t hits[Camsize][6], misses[Camsize][6];
+	struct Port port;
+	uint64_t start, mid, end;
+	uintptr_t sink;
+	Cam *cam;
+	int i, n, nfill, nfound;
+
+	memset(cams, 0, sizeof cams);
+	nfill = load * Camsize;
+	if(nfill >= Camsize)
+		nfill = Camsize-1;
+	for(i = 0; i < nfill; i++){
+		mkmac(hits[i], Random, i);
+		camlearn(cams, hits[i], &port, 0);
+	}
+	for(i = 0; i < Camsize; i++){
+		mkmac(misses[i], Sequential, i);
+		misses[i][0] = 0x06;
+	}
+
+	sink = 0;
+	nfound = 0;
+	start = nsec();
+	for(n = 0; n < Nlookups; n++){
+		cam = camlook(cams, hits[n % nfill]);
+		sink += (uintptr_t)cam;
+		nfound += cam != NULL && cam->port != NULL;
+	}
+	mid = nsec();
+	for(n = 0; n < Nlookups; n++){
+		cam = camlook(cams, misses[n & (Camsize-1)]);
+		sink += (uintptr_t)cam;
+		nfound += cam != NULL && cam->port != NULL;
+	}
+	end = nsec();
+
+	printf("{\"bench\":\"camlook\",\"load\":%.2f,\"entries\":%d,\"hit_ns\":%.2f,\"miss_ns\":%.2f,\"found\":%d,\"sink\":%u}\n",
+		load, nfill, (double)(mid - start) / Nlookups, (double)(end - mid) / Nlookups,
+		nfound, (unsigned)sink);
+}
+
+static void *
+producer(void *aprod)
+{
+	Producer *prod = (Producer *)aprod;
+
+	while(!*prod->stop){
+		if(qput(prod->q, prod->bp) == 0)
+			prod->nput++;
+		else {
+			// the reader drops here, but spinning would starve the consumer.
+			prod->nfull++;
+			sched_yield();
+		}
+	}
+	return prod;
+}
+
+/*
+ *	nprod threads put as fast as they can, this thread gets. the
+ *	interesting numbers are buffers moved per second and how often
+ *	the producers found the queue full.
+ */
+static void
+queuebench(int nprod)
+{
+	static Queue q;
+	Producer prods[MaxProducers];
+	Buffer buf;
+	volatile int stop;
+	uint64_t start, end, nget, nput, nfull;
+	int i;
+
+	qinit(&q, NULL);
+	memset(&buf, 0, sizeof buf);
+	stop = 0;
+	for(i = 0; i < nprod; i++){
+		memset(prods + i, 0, sizeof prods[0]);
+		prods[i].q = &q;
+		prods[i].bp = &buf;
+		prods[i].stop = &stop;
+		pthread_create(&prods[i].thr, NULL, producer, prods + i);
+	}
+
+	nget = 0;
+	start = nsec();
+	do {
+		if(qget(&q) != NULL)
+			nget++;
+		end = nsec();
+	} while(end - start < duration * 1e9);
+
+	stop = 1;
+	qclose(&q);
+	while(qget(&q) != NULL)
+		;
+	nput = 0;
+	nfull = 0;
+	for(i = 0; i < nprod; i++){
+		pthread_join(prods[i].thr, NULL);
+		nput += prods[i].nput;
+		nfull += prods[i].nfull;
+	}
+
+	printf("{\"bench\":\"queue\",\"producers\":%d,\"consumers\":1,\"gets\":%llu,\"mops\":%.3f,\"full_ratio\":%.4f}\n",
+		nprod, (unsigned long long)nget, nget / ((end - start) / 1e3),
+		nput + nfull > 0 ? (double)nfull / (nput + nfull) : 0.0);
+}
+
+static void
+usage(char *argv0)
+{
+	fprintf(stderr, "usage: %s [-d seconds] [-p maxproducers]\n", argv0);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	double loads[] = { 0.25, 0.5, 0.75, 0.9, 0.99 };
+	int i, opt, maxprod;
+
+	maxprod = 4;
+	while((opt = getopt(argc, argv, "d:p:")) != -1){
+		switch(opt){
+		case 'd':
+			duration = strtod(optarg, NULL);
+			break;
+		case 'p':
+			maxprod = strtol(optarg, NULL, 10);
+			if(maxprod < 1 || maxprod > MaxProducers)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	for(i = 0; i < Npatterns; i++)
+		hashquality(i);
+	hashspeed();
+	for(i = 0; i < (int)(sizeof loads / sizeof loads[0]); i++)
+		camload(loads[i]);
+	for(i = 1; i <= maxprod; i *= 2)
+		queuebench(i);
+
+	return 0;
+}
@@ -0,0 +1,706 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	switchbench runs the forwarding core of lib/fwd.c the way containet
+ *	does, with a reader and a writer thread for each port, against
+ *	socketpair(AF_UNIX, SOCK_SEQPACKET) ports instead of tap devices,
+ *	so it needs no root and no network namespaces. every workload
+ *	prints one line of json.
+ *
+ *	example use: bench/switchbench -n 64 -w unicast -s 1500 -d 5
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <math.h>
+#include "fwd.h"
+
+#define json(...) #__VA_ARGS__
+#define nelem(x) (sizeof(x)/sizeof((x)[0]))
+
+enum {
+	BenchMagic = 0x434e4231, // CNB1
+	WarmMagic = 0x5741524d, // WARM
+	BenchType = 0x88b5, // local experimental ethertype
+
+	Nlatency = 64*16,
+	MaxGens = 64,
+	MaxFrame = 16384,
+	MaxPorts = 4096, // as in containet
+	Nbuffers = 32, // per port, as in containet
+};
+
+enum {
+	Unicast,
+	Broadcast,
+	Incast,
+	Manymac,
+	Replay,
+	Nworkloads,
+};
+
+static char *wlnames[] = {
+	[Unicast] = "unicast",
+	[Broadcast] = "broadcast",
+	[Incast] = "incast",
+	[Manymac] = "manymac",
+	[Replay] = "replay",
+};
+
+typedef struct Frame Frame;
+struct Frame {
+	uint8_t *buf;
+	int len;
+	int port;
+};
+
+// what containet keeps of a tap port, and no more.
+struct Port {
+	pthread_t recvthr;
+	pthread_t xmitthr;
+	int fd;
+	uint64_t drops; // frames lost to a full xmitq
+	Queue freeq;
+	Queue xmitq;
+};
+
+typedef struct Gen Gen;
+struct Gen {
+	pthread_t thr;
+	int id;
+	uint64_t txframes;
+	uint64_t txbytes;
+	uint32_t rnd;
+};
+
+static int nbports = 16;
+static int framesize = 64;
+static int nmacs = 4096;
+static int ngens = 4;
+static double duration = 2.0;
+static int benchfds[MaxPorts];
+static int bufsize;
+
+static Port ports[MaxPorts];
+static int nports;
+static Cam cams[Camsize];
+
+static int workload;
+static volatile int running;
+static volatile int sinking;
+static volatile uint32_t epoch; // bumped for every run, stale frames don't count
+static volatile uint64_t rxseen;
+
+static Frame *replay;
+static int nreplay;
+
+static uint64_t rxframes;
+static uint64_t rxbytes;
+static uint64_t latency[Nlatency];
+
+static uint64_t
+nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static uint32_t
+xorshift(uint32_t *state)
+{
+	uint32_t x;
+
+	x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+// log-linear buckets, 16 per power of two, good to about 6%.
+static int
+latbucket(uint64_t ns)
+{
+	int e;
+
+	if(ns < 16)
+		return ns;
+	e = 63 - __builtin_clzll(ns);
+	return e*16 + ((ns >> (e-4)) & 15);
+}
+
+static uint64_t
+latvalue(int bucket)
+{
+	int e;
+
+	if(bucket < 16)
+		return bucket;
+	e = bucket / 16;
+	return ((uint64_t)16 + (bucket & 15)) << (e-4);
+}
+
+static double
+percentile(double p)
+{
+	uint64_t n, want, acc;
+	int i;
+
+	n = 0;
+	for(i = 0; i < Nlatency; i++)
+		n += latency[i];
+	if(n == 0)
+		return 0.0;
+	want = (uint64_t)ceil(p * n);
+	acc = 0;
+	for(i = 0; i < Nlatency; i++){
+		acc += latency[i];
+		if(acc >= want)
+			return latvalue(i) / 1000.0;
+	}
+	return latvalue(Nlatency-1) / 1000.0;
+}
+
+static void
+setmac(uint8_t *mac, int kind, int port, int idx)
+{
+	mac[0] = 0x02;
+	mac[1] = kind;
+	mac[2] = port >> 8;
+	mac[3] = port;
+	mac[4] = idx >> 8;
+	mac[5] = idx;
+}
+
+/*
+ *	frames carry the 4 byte packet information header that taps use,
+ *	the ethernet header, a magic, a transmit timestamp and the epoch.
+ */
+static int
+mkframe(uint8_t *buf, int len, uint8_t *dst, uint8_t *src, uint32_t magic)
+{
+	uint64_t now;
+
+	memset(buf, 0, 4+14+16);
+	copymac(buf+4, dst);
+	copymac(buf+10, src);
+	buf[16] = BenchType >> 8;
+	buf[17] = BenchType & 0xff;
+	memcpy(buf+18, &magic, 4);
+	now = nsec();
+	memcpy(buf+22, &now, 8);
+	memcpy(buf+30, (uint32_t *)&epoch, 4);
+	return 4 + len;
+}
+
+static void
+genframe(int port, uint8_t *buf, int len, Gen *gen)
+{
+	if(write(benchfds[port], buf, len) != len){
+		fprintf(stderr, "switchbench: write port %d: %s\n", port, strerror(errno));
+		exit(1);
+	}
+	if(gen != NULL){
+		gen->txframes++;
+		gen->txbytes += len - 4;
+	}
+}
+
+static void *
+generator(void *agen)
+{
+	Gen *gen = (Gen *)agen;
+	uint8_t buf[MaxFrame], dst[6], src[6];
+	int port, dport, len, permac;
+
+	permac = nmacs / nbports > 0 ? nmacs / nbports : 1;
+	port = gen->id;
+	while(running){
+		switch(workload){
+		case Unicast:
+			dport = (port + nbports/2) % nbports;
+			setmac(src, 0, port, 0);
+			setmac(dst, 0, dport, 0);
+			break;
+		case Broadcast:
+			setmac(src, 0, port, 0);
+			memset(dst, 0xff, 6);
+			break;
+		case Incast:
+			if(port == 0)
+				goto next;
+			setmac(src, 0, port, 0);
+			setmac(dst, 0, 0, 0);
+			break;
+		case Manymac:
+			dport = (port + 1 + xorshift(&gen->rnd) % (nbports-1)) % nbports;
+			setmac(src, 1, port, xorshift(&gen->rnd) % permac);
+			setmac(dst, 1, dport, xorshift(&gen->rnd) % permac);
+			break;
+		case Replay:
+			if(nreplay > 0){
+				Frame *fr = replay + (gen->txframes * ngens + gen->id) % nreplay;
+				memcpy(buf+4, fr->buf, fr->len);
+				memset(buf, 0, 4);
+				genframe(fr->port, buf, fr->len + 4, gen);
+			}
+			goto next;
+		}
+		len = mkframe(buf, framesize, dst, src, BenchMagic);
+		genframe(port, buf, len, gen);
+	next:
+		port += ngens;
+		if(port >= nbports)
+			port = gen->id;
+	}
+	return gen;
+}
+
+static void *
+sink(void *aux)
+{
+	struct epoll_event evs[64];
+	uint8_t buf[MaxFrame+4];
+	uint32_t magic, ep;
+	uint64_t then;
+	int i, n, epfd, nrd;
+
+	epfd = (int)(intptr_t)aux;
+	while(sinking){
+		n = epoll_wait(epfd, evs, nelem(evs), 10);
+		for(i = 0; i < n; i++){
+			// the generators write the same sockets blocking, so don't
+			// make them nonblocking, just don't wait here.
+			while((nrd = recv(evs[i].data.fd, buf, sizeof buf, MSG_DONTWAIT)) > 0){
+				rxseen++;
+				if(workload == Replay){
+					rxframes++;
+					rxbytes += nrd - 4;
+					continue;
+				}
+				// late warmup floods don't count.
+				if(nrd < 4+14+16 || buf[16] != BenchType>>8 || buf[17] != (BenchType & 0xff))
+					continue;
+				memcpy(&magic, buf+18, 4);
+				memcpy(&ep, buf+30, 4);
+				if(magic != BenchMagic || ep != epoch)
+					continue;
+				rxframes++;
+				rxbytes += nrd - 4;
+				memcpy(&then, buf+22, 8);
+				latency[latbucket(nsec() - then)]++;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ *	waits until nothing has come out of the switch for a while.
+ */
+static void
+quiesce(void)
+{
+	uint64_t seen;
+
+	do {
+		seen = rxseen;
+		usleep(100*1000);
+	} while(seen != rxseen);
+}
+
+/*
+ *	let the switch learn where every address lives before measuring.
+ */
+static void
+warmup(void)
+{
+	uint8_t buf[64+4], dst[6], src[6];
+	int i, k, permac, len;
+
+	memset(dst, 0xff, 6);
+	permac = nmacs / nbports > 0 ? nmacs / nbports : 1;
+	for(i = 0; i < nbports; i++){
+		setmac(src, 0, i, 0);
+		len = mkframe(buf, 64, dst, src, WarmMagic);
+		genframe(i, buf, len, NULL);
+		if(workload == Manymac){
+			for(k = 0; k < permac; k++){
+				setmac(src, 1, i, k);
+				len = mkframe(buf, 64, dst, src, WarmMagic);
+				genframe(i, buf, len, NULL);
+			}
+		}
+	}
+	quiesce();
+}
+
+/*
+ *	forward and reader are containet's, less the router, acls,
+ *	mirroring and events, and writer is its plain tap path.
+ */
+static void
+forward(Port *port, Buffer *bp)
+{
+	Port *outport;
+	int i;
+
+	bp->nref = 1;
+	switch(fwdframe(cams, port, 0, (uint8_t *)bp->buf + 4, bp->len - 4, &outport, NULL)){
+	case FwdUnicast:
+		bincref(bp);
+		if(qput(&outport->xmitq, bp) == -1){
+			__sync_add_and_fetch(&outport->drops, 1);
+			bdecref(bp);
+		}
+		break;
+	case FwdFlood:
+		for(i = 0; i < nports; i++){
+			if(port == ports+i)
+				continue;
+			bincref(bp);
+			if(qput(&ports[i].xmitq, bp) == -1){
+				__sync_add_and_fetch(&ports[i].drops, 1);
+				bdecref(bp);
+			}
+		}
+		break;
+	}
+	brelease(bp);
+}
+
+static void *
+reader(void *aport)
+{
+	Port *port = (Port *)aport;
+	Buffer *bp;
+	int nrd;
+
+	while((bp = qget(&port->freeq)) != NULL){
+		if((nrd = read(port->fd, bp->buf, bp->cap)) <= 0){
+			qput(bp->freeq, bp);
+			break;
+		}
+		bp->len = nrd;
+		forward(port, bp);
+	}
+	return port;
+}
+
+static void *
+writer(void *aport)
+{
+	Port *port = (Port *)aport;
+	Buffer *bp;
+	int len, nwr;
+
+	while((bp = qget(&port->xmitq)) != NULL){
+		*(uint32_t *)bp->buf = 0;
+		len = bp->len;
+		nwr = write(port->fd, bp->buf, len);
+		brelease(bp);
+		if(nwr != len)
+			break;
+	}
+	return port;
+}
+
+static Port *
+addport(int fd)
+{
+	Port *port;
+	Buffer *bp;
+	int i;
+
+	port = ports + nports;
+	port->fd = fd;
+	qinit(&port->freeq, port);
+	qinit(&port->xmitq, port);
+	for(i = 0; i < Nbuffers; i++){
+		bp = malloc(sizeof bp[0]);
+		memset(bp, 0, sizeof bp[0]);
+		bp->buf = malloc(bufsize);
+		bp->cap = bufsize;
+		bp->freeq = &port->freeq;
+		qput(&port->freeq, bp);
+	}
+	// the readers see nports, so the port is in place before it counts.
+	__sync_synchronize();
+	nports++;
+	pthread_create(&port->xmitthr, NULL, writer, port);
+	pthread_create(&port->recvthr, NULL, reader, port);
+	return port;
+}
+
+static uint64_t
+switchdrops(void)
+{
+	uint64_t drops;
+	int i;
+
+	drops = 0;
+	for(i = 0; i < nports; i++)
+		drops += ports[i].drops;
+	return drops;
+}
+
+static void
+run(int wl)
+{
+	Gen gens[MaxGens];
+	uint64_t t0, t1, tx, txb, drops0, drops, rxwin, rxwinbytes;
+	double secs, lost;
+	int i;
+
+	workload = wl;
+	epoch++;
+	if(wl != Replay)
+		warmup();
+
+	rxframes = 0;
+	rxbytes = 0;
+	memset(latency, 0, sizeof latency);
+	drops0 = switchdrops();
+
+	memset(gens, 0, sizeof gens);
+	running = 1;
+	t0 = nsec();
+	for(i = 0; i < ngens; i++){
+		gens[i].id = i;
+		gens[i].rnd = 0x9e3779b9 * (i+1);
+		pthread_create(&gens[i].thr, NULL, generator, gens + i);
+	}
+	usleep((useconds_t)(duration * 1e6));
+	running = 0;
+	tx = 0;
+	txb = 0;
+	for(i = 0; i < ngens; i++){
+		pthread_join(gens[i].thr, NULL);
+		tx += gens[i].txframes;
+		txb += gens[i].txbytes;
+	}
+	t1 = nsec();
+	rxwin = rxframes;
+	rxwinbytes = rxbytes;
+	// what is still queued counts as delivered, but not towards the rate.
+	quiesce();
+	epoch++;
+
+	secs = (t1 - t0) / 1e9;
+	drops = switchdrops() - drops0;
+	lost = rxframes + drops > 0 ? (double)drops / (rxframes + drops) : 0.0;
+	printf(json({"workload":"%s","ports":%d,"frame":%d,"seconds":%.3f,"txframes":%llu,"rxframes":%llu,"drops":%llu,"droprate":%.6f,"txmpps":%.4f,"mpps":%.4f,"gbps":%.4f,"lat_p50_us":%.2f,"lat_p90_us":%.2f,"lat_p99_us":%.2f,"lat_p999_us":%.2f}) "\n",
+		wlnames[wl], nbports, wl == Replay ? 0 : framesize, secs,
+		(unsigned long long)tx, (unsigned long long)rxframes, (unsigned long long)drops, lost,
+		tx / secs / 1e6, rxwin / secs / 1e6, rxwinbytes * 8 / secs / 1e9,
+		percentile(0.50), percentile(0.90), percentile(0.99), percentile(0.999));
+	fflush(stdout);
+	(void)txb;
+}
+
+static uint32_t
+rd32(uint8_t *p, int swap)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return swap ? __builtin_bswap32(v) : v;
+}
+
+static void
+addreplay(uint8_t *pkt, int len)
+{
+	if(len < 14 || len > MaxFrame)
+		return;
+	replay = realloc(replay, (nreplay+1) * sizeof replay[0]);
+	replay[nreplay].buf = malloc(len);
+	memcpy(replay[nreplay].buf, pkt, len);
+	replay[nreplay].len = len;
+	// the same source address always enters from the same port.
+	replay[nreplay].port = hashmac(pkt+6) % nbports;
+	nreplay++;
+}
+
+/*
+ *	reads ethernet frames from a pcap or pcapng file into memory.
+ */
+static int
+loadpcap(char *path)
+{
+	struct stat st;
+	uint8_t *buf, *p, *end;
+	uint32_t magic, type, blen, caplen;
+	int fd, swap;
+
+	if((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1){
+		fprintf(stderr, "switchbench: open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	buf = malloc(st.st_size);
+	if(read(fd, buf, st.st_size) != st.st_size){
+		fprintf(stderr, "switchbench: short read %s\n", path);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	end = buf + st.st_size;
+
+	memcpy(&magic, buf, 4);
+	if(magic == 0x0a0d0d0a){
+		// pcapng, in the byte order of the section header.
+		swap = rd32(buf+8, 0) != 0x1a2b3c4d;
+		for(p = buf; p + 12 <= end; p += blen){
+			type = rd32(p, swap);
+			blen = rd32(p+4, swap);
+			if(blen < 12 || p + blen > end)
+				break;
+			if(type == 6 && blen >= 32){
+				caplen = rd32(p+20, swap);
+				if(28 + caplen <= blen)
+					addreplay(p+28, caplen);
+			} else if(type == 3 && blen >= 16){
+				addreplay(p+12, blen - 16);
+			}
+		}
+	} else if(magic == 0xa1b2c3d4 || magic == 0xa1b23c4d || magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1){
+		swap = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+		if(rd32(buf+20, swap) != 1){
+			fprintf(stderr, "switchbench: %s: not ethernet\n", path);
+			return -1;
+		}
+		for(p = buf + 24; p + 16 <= end; p += 16 + caplen){
+			caplen = rd32(p+8, swap);
+			if(p + 16 + caplen > end)
+				break;
+			addreplay(p+16, caplen);
+		}
+	} else {
+		fprintf(stderr, "switchbench: %s: not a pcap file\n", path);
+		return -1;
+	}
+	free(buf);
+	return nreplay;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct epoll_event ev;
+	pthread_t sinkthr;
+	char *wlname, *pcapname;
+	int i, opt, epfd, sv[2], maxlen;
+
+	wlname = "all";
+	pcapname = NULL;
+	while((opt = getopt(argc, argv, "n:w:s:d:m:t:r:")) != -1){
+		switch(opt){
+		case 'n':
+			nbports = strtol(optarg, NULL, 10);
+			break;
+		case 'w':
+			wlname = optarg;
+			break;
+		case 's':
+			framesize = strtol(optarg, NULL, 10);
+			break;
+		case 'd':
+			duration = strtod(optarg, NULL);
+			break;
+		case 'm':
+			nmacs = strtol(optarg, NULL, 10);
+			break;
+		case 't':
+			ngens = strtol(optarg, NULL, 10);
+			break;
+		case 'r':
+			pcapname = optarg;
+			wlname = "replay";
+			break;
+		default:
+		caseusage:
+			fprintf(stderr, "usage: %s [-n ports] [-w unicast|broadcast|incast|manymac|all] [-s framesize] [-d seconds] [-m macs] [-t generators] [-r file.pcap]\n", argv[0]);
+			exit(1);
+		}
+	}
+	if(nbports < 2 || nbports > MaxPorts || framesize < 64 || framesize > MaxFrame || ngens < 1 || ngens > MaxGens)
+		goto caseusage;
+	if(ngens > nbports)
+		ngens = nbports;
+
+	maxlen = framesize;
+	if(pcapname != NULL){
+		if(loadpcap(pcapname) <= 0)
+			exit(1);
+		for(i = 0; i < nreplay; i++)
+			if(replay[i].len > maxlen)
+				maxlen = replay[i].len;
+	}
+	// the switch keeps Nbuffers per port, don't make them 64k each.
+	bufsize = 4 + maxlen;
+
+	// the switch writes to the ports from its own threads, which must not
+	// go quiet on us when the other end is slow.
+	signal(SIGPIPE, SIG_IGN);
+
+	if((epfd = epoll_create1(0)) == -1){
+		fprintf(stderr, "switchbench: epoll_create1: %s\n", strerror(errno));
+		exit(1);
+	}
+	for(i = 0; i < nbports; i++){
+		if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1){
+			fprintf(stderr, "switchbench: socketpair: %s\n", strerror(errno));
+			exit(1);
+		}
+		addport(sv[0]);
+		benchfds[i] = sv[1];
+		ev.events = EPOLLIN;
+		ev.data.fd = sv[1];
+		epoll_ctl(epfd, EPOLL_CTL_ADD, sv[1], &ev);
+	}
+	sinking = 1;
+	pthread_create(&sinkthr, NULL, sink, (void *)(intptr_t)epfd);
+
+	for(i = 0; i < Nworkloads; i++){
+		if(i == Replay && pcapname == NULL)
+			continue;
+		if(!strcmp(wlname, "all") || !strcmp(wlname, wlnames[i]))
+			run(i);
+	}
+
+	sinking = 0;
+	pthread_join(sinkthr, NULL);
+	return 0;
+}
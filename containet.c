@@ -21,22 +21,64 @@
  */
 #include "os.h"
 #include <pthread.h>
+#include <sys/epoll.h>
+#include <poll.h>
 #include "unsocket.h"
 #include "json.h"
 #include "auth.h"
+#include "evring.h"
+#include "shmport.h"
+#include "xsk.h"
+#include "tpacket.h"
+#include "vxlan.h"
+#include "netlink.h"
+#include "fwd.h"
+#include "acl.h"
+#include "lpm.h"
+#include "maglev.h"
+#include "snat.h"
+#include "route.h"
+#include "netem.h"
+#include "pktring.h"
+#include "sketch.h"
+#include "smprintf.h"
+#include "tun.h"
 
 #define json(...) #__VA_ARGS__
 
 enum {
-	MaxPorts = 1024,
-	Nbuffers = 32,
+	MaxPorts = 4096, // pktring.h has PktringNames names, one for each
+	Nbuffers = 32, // less than Qsize, so the free queue can hold them all
 
 	// space for maximum ipv4 + then some
 	Bufsize = 64*1024,
-	Camsize = 8192,
 
 	AgeInterval = 10, // seconds
 	MaxAge = 2, // maximum age of a cam entry (# of AgeIntervals)
+
+	MirrorSlots = 4096,
+	MirrorSnaplen = 2048,
+
+	MaxTalkers = SketchTopk,
+
+	CtlMaxmsg = 1024*1024, // largest control request
+	CtlMaxout = 1024*1024, // answers queued before a connection is not read
+	CtlReadsize = 64*1024,
+	CtlLogmsg = 512, // how much of a request to log
+
+	EvringSize = 4096,
+	SubMaxout = 64*1024, // events are held back while more than this is queued
+	SubPending = 256, // distinct events a subscriber can have held back
+
+	RingBatch = 32, // frames moved between doorbells or kicks
+	RingPollms = 1000, // how often a sleeping ring port checks if it is closing
+
+	UplinkMaxthreads = 16,
+
+	OffloadMax = XskPassmax, // paths handed to the kernel at once
+
+	HandoffTimeout = 5, // seconds to wait for a successor to take the ports
+	HandoffWrap = 64, // what a frame of ports has around the ports
 };
 
 enum {
@@ -46,33 +88,10 @@ enum {
 	PortClosed = 3,
 };
 
-typedef struct Buffer Buffer;
-typedef struct Cam Cam;
-typedef struct Port Port;
-typedef struct Queue Queue;
-
-struct Cam {
-	Port *port;
-	uint16_t age;
-	uint8_t mac[6];
-};
-
-struct Buffer {
-	Queue *freeq;
-	void *buf;
-	int len;
-	int cap;
-	int nref;
-};
-
-struct Queue {
-	Port *port;
-	pthread_cond_t kick;
-	pthread_mutex_t lock;
-	uint32_t head;
-	uint32_t tail;
-	Buffer *bufs[2*Nbuffers];
-};
+typedef struct Mirror Mirror;
+typedef struct Offload Offload;
+typedef struct Uplink Uplink;
+typedef struct Upthread Upthread;
 
 struct Port {
 	pthread_t recvthr;
@@ -80,19 +99,107 @@ struct Port {
 	char *ifname;
 	char *nodeid;
 	int fd;
+	Shmport *shm; // instead of fd for shared memory ports
+	Xsk *xsk; // or for AF_XDP ports
+	Uplink *uplink; // or for host interfaces
+	Vxlan *vxlan; // or for trunks to other switches
+	int tun; // fd is a tun, with ip packets and nothing in front of them
+	int ringbusy; // threads touching the ring right now
+	int ringstop; // and keep off it when set, see ringenter
+	void *owner; // control connection the port goes with, if any
 	int state;
+	int mirror;
+	uint64_t drops; // frames lost to a full xmitq
+	int evpending; // bits of coalesced event types not delivered yet
+	Netemconf netemconf; // what the control socket asked for, under portlock
+	int netemgen; // bumped when netemconf changes
+	Netem *netem; // owned by the writer
+	Acl *acl; // what comes in is checked against, or NULL
 	Queue freeq;
 	Queue xmitq;
 };
 
+/*
+ *	a port on a host interface has a TPACKET_V3 socket per reader thread,
+ *	all in one fanout group, so the kernel spreads flows over them. the
+ *	first one runs as the port's recvthr, and the writer sends on its
+ *	socket.
+ */
+struct Upthread {
+	Port *port;
+	Tpacket *tp;
+	pthread_t thr;
+};
+
+struct Uplink {
+	int nthreads;
+	Upthread t[UplinkMaxthreads];
+};
+
+/*
+ *	the mirror is a pseudo-port that is not in ports[]. readers queue
+ *	references to matching buffers on its xmitq, and its thread copies
+ *	them to a shared memory ring, so the forwarding path does no copies
+ *	and no file i/o for mirrored frames.
+ */
+struct Mirror {
+	Port port;
+	pthread_mutex_t lock;
+	Pktring *ring;
+	int allports;
+	int ethertype; // zero matches everything
+};
+
+/*
+ *	a path between two AF_XDP ports that the kernel forwards instead of
+ *	us. frames to dstmac coming in on in are let past the socket by the
+ *	xdp program, and a tc rule on the host side of in sends them out of
+ *	out. srcmac is the sender seen in the traffic matrix, its cam entry
+ *	is kept fresh while the kernel forwards for it.
+ */
+struct Offload {
+	Port *in;
+	Port *out;
+	uint8_t srcmac[6];
+	uint8_t dstmac[6];
+	uint64_t count; // frames the kernel forwarded, at the last look
+	int used;
+};
 
 static Cam g_cams[Camsize];
+static Host g_hosts[Hostsize]; // where packets from tun ports go
 static Port ports[MaxPorts];
 
+static Evring events;
+static int nsubs; // no events are made when nobody is listening
+
 static pthread_mutex_t portlock;
 static int aports = nelem(ports);
 static int nports;
+static int bufsize = Bufsize;
 static pthread_t agethr;
+static Mirror mirror;
+// lists taken off ports, freed when no reader can be in them any more.
+static Acl *aclretired;
+static Acl *aclold;
+
+// traffic matrix, the current interval and the one before it.
+static Sketch talkers[2];
+static int curtalkers;
+static int fivetuple;
+
+/*
+ *	the router, made with the first subnet. the gateway's mac is the same
+ *	on every switch, so hosts keep their gateway when they move between
+ *	them.
+ */
+static Router *router;
+static uint8_t gwmac[6] = {0x02, 0x63, 0x6e, 0x00, 0x00, 0x01};
+
+// paths in the kernel, and the rate in frames per second that puts one there.
+static pthread_mutex_t offloadlock;
+static Offload offloads[OffloadMax];
+static int offloadpps;
 
 static char *
 portname(Port *port)
@@ -102,156 +209,275 @@ portname(Port *port)
 	return buf;
 }
 
-static Buffer *
-qget(Queue *q)
+/*
+ *	tells subscribers about something that happened to port. overflow
+ *	and rate limit events come from the forwarding path, so while one
+ *	is on its way, more of the same from the port are left out.
+ */
+static void
+portevent(Port *port, int type, uint8_t *mac, uint64_t count)
 {
-	Buffer *bp;
-	uint32_t qtail;
-
-	bp = NULL;
-	pthread_mutex_lock(&q->lock);
-	while(q->port->state == PortOpen && q->head == q->tail)
-		pthread_cond_wait(&q->kick, &q->lock);
-	if(q->head != q->tail){
-		qtail = q->tail;
-		bp = q->bufs[qtail];
-		q->tail = (qtail + 1) % nelem(q->bufs);
-	}
-	pthread_mutex_unlock(&q->lock);
-
-	return bp;
+	if(nsubs == 0)
+		return;
+	if(type == EvOverflow || type == EvRatelimit)
+		if(__sync_fetch_and_or(&port->evpending, 1<<type) & (1<<type))
+			return;
+	evringput(&events, type, port - ports, mac, count);
 }
 
-static int
-qput(Queue *q, Buffer *bp)
+#if 0
+static void
+pktdump(Buffer *bp)
 {
-	uint32_t qhead;
+	static pthread_mutex_t lock;
+	uint8_t *pkt;
+	int i;
 
-	pthread_mutex_lock(&q->lock);
-	qhead = q->head;
-	if((qhead - q->tail) < nelem(q->bufs)-1){
-		q->bufs[qhead] = bp;
-		q->head = (qhead + 1) % nelem(q->bufs);
-		// signal while holding lock, so we don't lose wakeups.
-		pthread_cond_signal(&q->kick);
-		pthread_mutex_unlock(&q->lock);
-		return 0;
+	pthread_mutex_lock(&lock);
+	pkt = bp->buf;
+	for(i = 0; i < bp->len; i++){
+		if((i & 15) == 0)
+			fprintf(stderr, "%4d:", i);
+		fprintf(stderr, " %02x", pkt[i]);
+		if((i & 15) == 15)
+			fprintf(stderr, "\n");
 	}
-	pthread_mutex_unlock(&q->lock);
-
-	return -1;
+	if((i & 15) != 0)
+		fprintf(stderr, "\n");
+	pthread_mutex_unlock(&lock);
 }
+#endif
 
-static int
-bincref(Buffer *bp)
+/*
+ *	rotates the traffic matrix. the interval that just ended becomes
+ *	the one reported by top-talkers, the older one is cleared for reuse.
+ */
+static void
+rotatetalkers(void)
 {
-	return __sync_fetch_and_add(&bp->nref, 1) + 1;
+	sketchreset(talkers + (curtalkers^1));
+	curtalkers ^= 1;
 }
 
-static int
-bdecref(Buffer *bp)
+/*
+ *	opens nthreads sockets on the host interface ifname. a successor
+ *	taking the port over joins the same fanout group with its own.
+ */
+static Uplink *
+uplinkopen(char *ifname, int nthreads)
 {
-	return __sync_fetch_and_add(&bp->nref, -1) - 1;
+	Uplink *ul;
+	int i;
+
+	if(nthreads < 1)
+		nthreads = 1;
+	if(nthreads > UplinkMaxthreads)
+		nthreads = UplinkMaxthreads;
+	ul = malloc(sizeof ul[0]);
+	memset(ul, 0, sizeof ul[0]);
+	for(i = 0; i < nthreads; i++){
+		if((ul->t[i].tp = tpacketopen(ifname, 1)) == NULL){
+			while(--i >= 0)
+				tpacketclose(ul->t[i].tp);
+			free(ul);
+			return NULL;
+		}
+	}
+	ul->nthreads = nthreads;
+	return ul;
 }
 
-static uint32_t
-hashmac(uint8_t *buf)
+// after the port's own threads are gone, stops the rest and closes it all.
+static void
+uplinkclose(Uplink *ul)
 {
-	uint32_t a, b, c;
-
-	a = (uint32_t)buf[0] + ((uint32_t)buf[1]<<8);
-	b = (uint32_t)buf[2] + ((uint32_t)buf[3]<<8);
-	c = (uint32_t)buf[4] + ((uint32_t)buf[5]<<8);
+	int i;
 
-// from lookup3.c, by Bob Jenkins, May 2006, Public Domain.
-// http://burtleburtle.net/bob/c/lookup3.c
-#define rot32(x,k) (((x)<<(k)) | ((x)>>(32-(k))))
-	c ^= b; c -= rot32(b,14);
-	a ^= c; a -= rot32(c,11);
-	b ^= a; b -= rot32(a,25);
-	c ^= b; c -= rot32(b,16);
-	a ^= c; a -= rot32(c,4);
-	b ^= a; b -= rot32(a,14);
-	c ^= b; c -= rot32(b,24);
-#undef rot32
+	for(i = 1; i < ul->nthreads; i++){
+		pthread_kill(ul->t[i].thr, SIGHUP);
+		pthread_join(ul->t[i].thr, NULL);
+	}
+	for(i = 0; i < ul->nthreads; i++)
+		tpacketclose(ul->t[i].tp);
+	free(ul);
+}
 
-	return c;
+static char *
+fmtmac(uint8_t *mac)
+{
+	return smprintf("%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
 }
 
-static int
-cmpmac(uint8_t *a, uint8_t *b)
+// takes the path out of the kernel, the frames first back to the socket.
+static void
+offloadwithdraw(Offload *ol)
 {
-	int i, rv;
-	rv = 0;
-	for(i = 0; i < 6; i++)
-		rv += a[i] != b[i];
-	return rv;
+	char *mac;
+
+	xskpass(ol->in->xsk, ol->dstmac, 0);
+	if(tcdelete(ol->in->xsk->ifindex, ol - offloads + 1) == -1 && errno != ENODEV)
+		fprintf(stderr, "%s: offload: tc delete: %s\n", portname(ol->in), strerror(errno));
+	mac = fmtmac(ol->dstmac);
+	fprintf(stderr, "%s: offload to %s withdrawn\n", portname(ol->in), mac);
+	free(mac);
+	ol->used = 0;
 }
 
+// takes out the paths of port, or all of them if port is NULL.
 static void
-copymac(uint8_t *dst, uint8_t *src)
+offloaddrop(Port *port)
 {
 	int i;
-	for(i = 0; i < 6; i++)
-		dst[i] = src[i];
+
+	pthread_mutex_lock(&offloadlock);
+	for(i = 0; i < OffloadMax; i++)
+		if(offloads[i].used && (port == NULL || offloads[i].in == port || offloads[i].out == port))
+			offloadwithdraw(offloads + i);
+	pthread_mutex_unlock(&offloadlock);
 }
 
-static Cam *
-camlook(Cam *cams, uint8_t *mac)
+// only frames between two plain AF_XDP ports can skip the switch.
+static int
+offloadable(Port *port)
 {
-	Cam *cam;
-	uint32_t hash;
+	return port != NULL && port->state == PortOpen && port->xsk != NULL
+		&& !port->mirror && !mirror.allports && !netemactive(&port->netemconf)
+		&& port->acl == NULL;
+}
+
+/*
+ *	puts the path to dstmac from in into the kernel, the rule first, so
+ *	that frames let past the socket always have somewhere to go.
+ */
+static void
+offloadinstall(Port *in, Port *out, uint8_t *srcmac, uint8_t *dstmac)
+{
+	Offload *ol;
+	char *mac;
 	int i;
 
-	hash = hashmac(mac) & (Camsize-1);
-	for(i = 1; i <= Camsize; i++){
-		cam = cams + hash;
-		if(cmpmac(cam->mac, mac) == 0 || cam->port == NULL)
-			return cam;
-		hash = (hash+i) & (Camsize-1);
+	ol = NULL;
+	for(i = 0; i < OffloadMax; i++){
+		if(offloads[i].used && offloads[i].in == in && cmpmac(offloads[i].dstmac, dstmac) == 0)
+			return;
+		if(!offloads[i].used && ol == NULL)
+			ol = offloads + i;
 	}
-
-	return NULL;
+	if(ol == NULL)
+		return;
+	if(tcclsact(in->xsk->ifindex) == -1 || tcredirect(in->xsk->ifindex, ol - offloads + 1, dstmac, out->xsk->ifindex) == -1){
+		fprintf(stderr, "%s: offload: tc: %s\n", portname(in), strerror(errno));
+		return;
+	}
+	if(xskpass(in->xsk, dstmac, 1) == -1){
+		tcdelete(in->xsk->ifindex, ol - offloads + 1);
+		return;
+	}
+	ol->in = in;
+	ol->out = out;
+	copymac(ol->srcmac, srcmac);
+	copymac(ol->dstmac, dstmac);
+	ol->count = 0;
+	ol->used = 1;
+	mac = fmtmac(dstmac);
+	fprintf(stderr, "%s: offload to %s on %s-%s\n", portname(in), mac, out->nodeid, out->ifname);
+	free(mac);
 }
 
-#if 0
+/*
+ *	once an interval, right after the traffic matrix is rotated. paths
+ *	the kernel forwarded for keep their sender's cam entry from aging,
+ *	and are withdrawn when they went idle, or when the cam no longer
+ *	agrees with them. mac pairs in the interval that just ended going
+ *	over offloadpps between two AF_XDP ports are put into the kernel.
+ */
 static void
-pktdump(Buffer *bp)
+offloadscan(void)
 {
-	static pthread_mutex_t lock;
-	uint8_t *pkt;
-	int i;
+	Talker tab[MaxTalkers];
+	Offload *ol;
+	Cam *src, *dst;
+	uint64_t count, pkts;
+	int i, j, n;
+
+	pthread_mutex_lock(&offloadlock);
+	for(i = 0; i < OffloadMax; i++){
+		ol = offloads + i;
+		if(!ol->used)
+			continue;
+		dst = camlook(g_cams, ol->dstmac);
+		if(xskpasscount(ol->in->xsk, ol->dstmac, &count) == -1 || count == ol->count
+		|| !offloadable(ol->in) || !offloadable(ol->out) || dst == NULL || dst->port != ol->out){
+			offloadwithdraw(ol);
+			continue;
+		}
+		ol->count = count;
+		if((src = camlook(g_cams, ol->srcmac)) != NULL && src->port == ol->in)
+			src->age = 0;
+	}
 
-	pthread_mutex_lock(&lock);
-	pkt = bp->buf;
-	for(i = 0; i < bp->len; i++){
-		if((i & 15) == 0)
-			fprintf(stderr, "%4d:", i);
-		fprintf(stderr, " %02x", pkt[i]);
-		if((i & 15) == 15)
-			fprintf(stderr, "\n");
+	n = sketchtop(talkers + (curtalkers^1), tab, nelem(tab));
+	for(i = 0; i < n; i++){
+		if(tab[i].pkts == 0 || (tab[i].key.dstmac[0] & 1) != 0)
+			continue;
+		// routed frames have to go through the router.
+		if(router != NULL && (cmpmac(tab[i].key.dstmac, router->mac) == 0 || cmpmac(tab[i].key.dstmac, router->selfmac) == 0))
+			continue;
+		// the five tuples of one mac pair add up.
+		pkts = tab[i].pkts;
+		for(j = i+1; j < n; j++){
+			if(cmpmac(tab[j].key.srcmac, tab[i].key.srcmac) == 0 && cmpmac(tab[j].key.dstmac, tab[i].key.dstmac) == 0){
+				pkts += tab[j].pkts;
+				tab[j].pkts = 0;
+			}
+		}
+		if(pkts < (uint64_t)offloadpps * AgeInterval)
+			continue;
+		src = camlook(g_cams, tab[i].key.srcmac);
+		dst = camlook(g_cams, tab[i].key.dstmac);
+		if(src == NULL || dst == NULL || src->port == dst->port || !offloadable(src->port) || !offloadable(dst->port))
+			continue;
+		offloadinstall(src->port, dst->port, tab[i].key.srcmac, tab[i].key.dstmac);
 	}
-	if((i & 15) != 0)
-		fprintf(stderr, "\n");
-	pthread_mutex_unlock(&lock);
+	pthread_mutex_unlock(&offloadlock);
 }
-#endif
 
 static void *
 agecam(void *aux)
 {
+	Buffer *bp;
 	Cam *cam;
+	Acl *acl;
 	int i;
 	uint16_t age;
 	uint8_t zeromac[6] = {0};
 
 	for(;;){
 
+		// a reader is done with a list long before a whole interval.
+		pthread_mutex_lock(&portlock);
+		while((acl = aclold) != NULL){
+			aclold = acl->next;
+			aclfree(acl);
+		}
+		aclold = aclretired;
+		aclretired = NULL;
+		pthread_mutex_unlock(&portlock);
+
+		rotatetalkers();
+		if(offloadpps > 0)
+			offloadscan();
+		if(router != NULL)
+			routeage(router);
+		// the clock source nat expires connections by.
+		if(router != NULL && router->snat != NULL)
+			router->snat->now += AgeInterval;
 		for(i = 0; i < Camsize; i++){
 			cam = g_cams + i;
 			age = __sync_fetch_and_add(&cam->age, 1) + 1;
 			if(cam->port != NULL && (age >= MaxAge || cam->port->state != PortOpen)){
 				fprintf(stderr, "%s: aged cam entry\n", portname(cam->port));
+				portevent(cam->port, EvMacAge, cam->mac, 0);
 				cam->port = NULL;
 				copymac(cam->mac, zeromac);
 			}
@@ -264,11 +490,45 @@ agecam(void *aux)
 				if(port->fd >= 0)
 					close(port->fd);
 				port->fd = -1;
+				qclose(&port->xmitq);
+				qclose(&port->freeq);
 				pthread_kill(port->xmitthr, SIGHUP);
 				pthread_kill(port->recvthr, SIGHUP);
 				pthread_join(port->xmitthr, NULL);
 				pthread_join(port->recvthr, NULL);
+				if(port->shm != NULL){
+					shmportclose(port->shm);
+					port->shm = NULL;
+				}
+				if(port->xsk != NULL){
+					offloaddrop(port);
+					xskclose(port->xsk);
+					port->xsk = NULL;
+				}
+				if(port->uplink != NULL){
+					uplinkclose(port->uplink);
+					port->uplink = NULL;
+				}
+				if(port->vxlan != NULL){
+					vxlanclose(port->vxlan);
+					port->vxlan = NULL;
+				}
+				if(port->tun){
+					pthread_mutex_lock(&portlock);
+					hostdrop(g_hosts, port);
+					pthread_mutex_unlock(&portlock);
+				}
+				if(port->acl != NULL){
+					pthread_mutex_lock(&portlock);
+					aclfree(port->acl);
+					port->acl = NULL;
+					pthread_mutex_unlock(&portlock);
+				}
+				// give back what other ports had queued for this one.
+				while((bp = qget(&port->xmitq)) != NULL)
+					brelease(bp);
 				fprintf(stderr, "%s: closed fd\n", portname(ports+i));
+				portevent(port, EvPortClose, NULL, port->drops);
 				__sync_bool_compare_and_swap(&port->state, PortCloseWait, PortClosed);
 			}
 		}
@@ -278,327 +538,3374 @@ agecam(void *aux)
 	return aux;
 }
 
+static int
+mirrormatch(Buffer *bp)
+{
+	uint8_t *type;
+
+	if(mirror.ethertype == 0)
+		return 1;
+	if(bp->len < 4+14)
+		return 0;
+	type = (uint8_t *)bp->buf + 4 + 12;
+	return ((type[0]<<8) | type[1]) == mirror.ethertype;
+}
+
+// packets from tun ports have no macs, they go in with them zero.
+static void
+account(Buffer *bp, int tun)
+{
+	Flowkey key;
+	uint8_t *pkt, *ip;
+	int len, hlen, iplen;
+
+	pkt = (uint8_t *)bp->buf + 4;
+	len = bp->len - 4;
+	if(!tun && len < 14)
+		return;
+
+	memset(&key, 0, sizeof key);
+	ip = NULL;
+	iplen = 0;
+	if(tun){
+		if((pkt[0]>>4) == 4){
+			ip = pkt;
+			iplen = len;
+		}
+	} else {
+		copymac(key.dstmac, pkt);
+		copymac(key.srcmac, pkt+6);
+		if(pkt[12] == 0x08 && pkt[13] == 0x00){
+			ip = pkt + 14;
+			iplen = len - 14;
+		}
+	}
+	if(fivetuple && ip != NULL && iplen >= 20){
+		hlen = (ip[0] & 15) * 4;
+		memcpy(&key.srcip, ip+12, 4);
+		memcpy(&key.dstip, ip+16, 4);
+		key.proto = ip[9];
+		// ports only from the first fragment
+		if((key.proto == IPPROTO_TCP || key.proto == IPPROTO_UDP) && (ip[6] & 0x1f) == 0 && ip[7] == 0 && iplen >= hlen+4){
+			key.sport = (ip[hlen]<<8) | ip[hlen+1];
+			key.dport = (ip[hlen+2]<<8) | ip[hlen+3];
+		}
+	}
+	sketchadd(talkers + curtalkers, &key, len);
+}
+
+/*
+ *	shows the router a frame before it is switched. returns what
+ *	fwdframe would for what the frame was made into, after learning
+ *	where it came from, or -1 if it is to be switched as it is.
+ */
+static int
+routeswitch(Port *port, int peer, Buffer *bp, uint8_t *src, Port **outportp, int *learnp)
+{
+	uint8_t *frame;
+	Cam *cam;
+	int len, rv;
+
+	frame = (uint8_t *)bp->buf + 4;
+	len = bp->len - 4;
+	if((rv = routeframe(router, frame, &len)) == RouteSwitch)
+		return -1;
+	bp->len = len + 4;
+	if((*learnp = camlearn(g_cams, src, port, peer)) == -1)
+		fprintf(stderr, "cam presumably full..\n");
+	switch(rv){
+	case RouteForward:
+		cam = camlook(g_cams, frame);
+		if(cam == NULL || cam->port == NULL)
+			return FwdFlood;
+		*outportp = cam->port;
+		return FwdUnicast;
+	case RouteReply:
+		*outportp = port;
+		return FwdUnicast;
+	case RouteFlood:
+		return FwdFlood;
+	}
+	return FwdDrop;
+}
+
+/*
+ *	checks what comes in on port against its list, and marks it if a
+ *	rule says so. returns -1 if it is to be dropped, 1 if it is to be
+ *	mirrored, or 0.
+ */
+static int
+aclcheck(Port *port, Buffer *bp)
+{
+	static __thread Aclcache cache;
+	Acl *acl;
+	Aclkey key;
+	Aclrule *r;
+	uint8_t *frame;
+	int len, i;
+
+	if((acl = port->acl) == NULL)
+		return 0;
+	frame = (uint8_t *)bp->buf + 4;
+	len = bp->len - 4;
+	if(aclkey(&key, frame, len, port->tun) == -1 || (i = aclclassify(acl, &cache, &key)) == -1){
+		__sync_fetch_and_add(&acl->nomatch, 1);
+		return acl->action == AclDrop ? -1 : 0;
+	}
+	r = acl->rules + i;
+	__sync_fetch_and_add(&r->hits, 1);
+	switch(r->action){
+	case AclDrop:
+		return -1;
+	case AclMark:
+		aclmark(frame, len, port->tun, r->mark);
+		break;
+	case AclMirror:
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ *	hands a frame that came in from port, from its peer if it is a trunk,
+ *	to where it goes. bp holds the frame after the 4 bytes of packet
+ *	information a tap puts in front, and goes back to its free queue once
+ *	everyone is done with it.
+ */
+static void
+forward(Port *port, int peer, Buffer *bp)
+{
+	Port *outport;
+	uint8_t src[6];
+	int i, learn, rv, verdict;
+
+	// hold our own reference until we are done handing the buffer
+	// out, so a fast writer can't recycle it in the middle of a flood.
+	bp->nref = 1;
+
+	account(bp, port->tun);
+
+	if((verdict = aclcheck(port, bp)) == -1){
+		if(bdecref(bp) == 0)
+			qput(bp->freeq, bp);
+		return;
+	}
+
+	learn = CamKnown;
+	rv = -1;
+	if(port->tun){
+		// nothing to learn, and nothing but other tuns to go to.
+		rv = fwdpacket(g_hosts, port, (uint8_t *)bp->buf + 4, bp->len - 4, &outport);
+	} else if(bp->len >= 4+14){
+		// keep the sender, the router may write over it.
+		copymac(src, (uint8_t *)bp->buf + 10);
+		if(router != NULL)
+			rv = routeswitch(port, peer, bp, src, &outport, &learn);
+	}
+	if(rv == -1)
+		rv = fwdframe(g_cams, port, peer, (uint8_t *)bp->buf + 4, bp->len - 4, &outport, &learn);
+	switch(rv){
+	case FwdUnicast:
+		bincref(bp);
+		if(qput(&outport->xmitq, bp) == -1){
+			portevent(outport, EvOverflow, NULL, __sync_add_and_fetch(&outport->drops, 1));
+			bdecref(bp);
+		}
+		break;
+	case FwdFlood:
+		for(i = 0; i < nports; i++){
+			if(port == (ports+i) || ports[i].state != PortOpen || ports[i].tun)
+				continue;
+			bincref(bp);
+			if(qput(&ports[i].xmitq, bp) == -1){
+				portevent(ports+i, EvOverflow, NULL, __sync_add_and_fetch(&ports[i].drops, 1));
+				bdecref(bp);
+			}
+		}
+		break;
+	}
+	if(learn == CamNew)
+		portevent(port, EvMacLearn, src, 0);
+	else if(learn == CamMoved)
+		portevent(port, EvMacMove, src, 0);
+
+	if((port->mirror || (verdict == 1 && mirror.ring != NULL)) && !port->tun && mirrormatch(bp)){
+		bincref(bp);
+		if(qput(&mirror.port.xmitq, bp) == -1)
+			bdecref(bp);
+	}
+
+	// if ours was the last reference, it didn't go anywhere, so drop it.
+	if(bdecref(bp) == 0)
+		qput(bp->freeq, bp);
+}
+
 static void *
 reader(void *aport)
 {
 	Buffer *bp;
 	Port *port;
-	Cam *cam;
-	uint8_t *dstmac, *srcmac;
-	int i, nrd, nref;
+	int nrd, off;
 
 	port = (Port *)aport;
+	// packets from a tun go where a tap's frames go, after 4 bytes.
+	off = port->tun ? 4 : 0;
 	for(;;){
-		bp = qget(&port->freeq);
+		if((bp = qget(&port->freeq)) == NULL)
+			break;
 
-		nrd = read(port->fd, bp->buf, bp->cap);
+		nrd = read(port->fd, (uint8_t *)bp->buf + off, bp->cap - off);
 		if(port->state != PortOpen){
 			qput(bp->freeq, bp);
 			break;
 		}
-		bp->len = nrd;
+		if(nrd <= 0){
+			// the other end is gone, have agecam tear the port down.
+			fprintf(stderr, "%s: read: %s\n", portname(port), nrd == 0 ? "eof" : strerror(errno));
+			qput(bp->freeq, bp);
+			__sync_bool_compare_and_swap(&port->state, PortOpen, PortClosing);
+			break;
+		}
+		bp->len = nrd + off;
+		forward(port, 0, bp);
+	}
+	fprintf(stderr, "%s: reader exiting..\n", portname(port));
+	return port;
+}
 
-		dstmac = (uint8_t *)bp->buf + 4;
-		srcmac = (uint8_t *)bp->buf + 10;
+/*
+ *	the rings of shared memory and AF_XDP ports have one reader and one
+ *	writer at each end, so while a successor maps them, handoff keeps
+ *	this process's threads off them. the threads only touch the rings
+ *	between ringenter and ringleave.
+ */
+static int
+ringenter(Port *port)
+{
+	__sync_add_and_fetch(&port->ringbusy, 1);
+	if(port->ringstop){
+		__sync_sub_and_fetch(&port->ringbusy, 1);
+		return 0;
+	}
+	return 1;
+}
 
-		nref = 0;
-		cam = camlook(g_cams, dstmac);
-		if(cam != NULL && cam->port != NULL){
-			// port found in cam, forward only there...
-			nref = bincref(bp);
-			if(qput(&cam->port->xmitq, bp) == -1)
-				nref = bdecref(bp);
-		} else {
-			// broadcast..
-			for(i = 0; i < nports; i++){
-				if(port == (ports+i))
-					continue;
-				nref = bincref(bp);
-				if(qput(&ports[i].xmitq, bp) == -1)
-					nref = bdecref(bp);
-			}
-		}
+static void
+ringleave(Port *port)
+{
+	__sync_sub_and_fetch(&port->ringbusy, 1);
+}
 
-		// teach the switch about the source address we just saw
-		cam = camlook(g_cams, srcmac);
-		if(cam != NULL){
-			// always update the port, so if an address moves to a different port
-			// the cam will point to that port right away.
-			copymac(cam->mac, srcmac);
-			cam->age = 0;
-			cam->port = port;
-		} else {
-			fprintf(stderr, "cam presumably full..\n");
-		}
+/*
+ *	the reader of a shared memory port. frames are copied out of the
+ *	ring into buffers, and the slots given back a batch at a time.
+ */
+static void *
+shmreader(void *aport)
+{
+	Buffer *bp;
+	Port *port;
+	uint8_t *frame;
+	int len, n;
 
-		// ref is zero after the forward loop. it didn't go anywhere, so drop it.
-		if(nref == 0)
-			qput(bp->freeq, bp);
+	port = (Port *)aport;
+	while(port->state == PortOpen){
+		if(shmportwait(port->shm, RingPollms) <= 0)
+			continue;
+		if(!ringenter(port)){
+			usleep(1000);
+			continue;
+		}
+		for(n = 0; n < RingBatch && (len = shmportget(port->shm, &frame)) != -1; n++){
+			if((bp = qget(&port->freeq)) == NULL){
+				ringleave(port);
+				goto out;
+			}
+			if(len > bp->cap - 4)
+				len = bp->cap - 4;
+			*(uint32_t *)bp->buf = 0;
+			memcpy((uint8_t *)bp->buf + 4, frame, len);
+			bp->len = len + 4;
+			forward(port, 0, bp);
+		}
+		shmportrelease(port->shm);
+		ringleave(port);
 	}
+out:
 	fprintf(stderr, "%s: reader exiting..\n", portname(port));
 	return port;
 }
 
+/*
+ *	the reader of an AF_XDP port, the same as shmreader but for the
+ *	kernel's rings. the port goes when its interface does.
+ */
 static void *
-writer(void *aport)
+xdpreader(void *aport)
 {
-	Port *port = (Port *)aport;
 	Buffer *bp;
-	int nwr, nref;
+	Port *port;
+	uint8_t *frame;
+	int len, n, rv;
 
-	for(;;){
-		bp = qget(&port->xmitq);
-		if(bp == NULL)
+	port = (Port *)aport;
+	while(port->state == PortOpen){
+		if((rv = xskwait(port->xsk, RingPollms)) == -1){
+			fprintf(stderr, "%s: xsk: interface is gone\n", portname(port));
+			__sync_bool_compare_and_swap(&port->state, PortOpen, PortClosing);
 			break;
-		if(bp->len > 0){
-			*(uint32_t *)bp->buf = 0;
-			nwr = write(port->fd, bp->buf, bp->len);
-			if(nwr != bp->len){
-				fprintf(stderr, "%s: short write, got %d wanted %d\n", portname(port), nwr, bp->len);
-				break;
+		}
+		if(rv == 0)
+			continue;
+		if(!ringenter(port)){
+			usleep(1000);
+			continue;
+		}
+		for(n = 0; n < RingBatch && (len = xskrecv(port->xsk, &frame)) != -1; n++){
+			if(len == 0)
+				continue;
+			if((bp = qget(&port->freeq)) == NULL){
+				ringleave(port);
+				goto out;
 			}
+			if(len > bp->cap - 4)
+				len = bp->cap - 4;
+			*(uint32_t *)bp->buf = 0;
+			memcpy((uint8_t *)bp->buf + 4, frame, len);
+			bp->len = len + 4;
+			forward(port, 0, bp);
 		}
-		nref = bdecref(bp);
-		if(nref == 0)
-			qput(bp->freeq, bp);
+		xskrelease(port->xsk);
+		ringleave(port);
 	}
-	fprintf(stderr, "%s: writer exiting\n", portname(port));
+out:
+	fprintf(stderr, "%s: reader exiting..\n", portname(port));
 	return port;
 }
 
-typedef struct Ctrlconn Ctrlconn;
-struct Ctrlconn {
-	Auth auth;
-	pthread_t thr;
+/*
+ *	the reader of one socket of an uplink. a block of frames is handed
+ *	over at a time, and copied out to buffers before it goes back.
+ */
+static void *
+uplinkreader(void *aup)
+{
+	Upthread *up;
+	Buffer *bp;
+	Port *port;
+	int len, rv;
+
+	up = (Upthread *)aup;
+	port = up->port;
+	while(port->state == PortOpen){
+		if((rv = tpacketwait(up->tp, RingPollms)) == -1){
+			fprintf(stderr, "%s: uplink: interface is gone\n", portname(port));
+			__sync_bool_compare_and_swap(&port->state, PortOpen, PortClosing);
+			break;
+		}
+		if(rv == 0)
+			continue;
+		for(;;){
+			if((bp = qget(&port->freeq)) == NULL)
+				goto out;
+			if((len = tpacketrecv(up->tp, (uint8_t *)bp->buf + 4, bp->cap - 4)) <= 0){
+				qput(bp->freeq, bp);
+				if(len == -1)
+					break;
+				continue;
+			}
+			*(uint32_t *)bp->buf = 0;
+			bp->len = len + 4;
+			forward(port, 0, bp);
+		}
+		tpacketrelease(up->tp);
+	}
+out:
+	fprintf(stderr, "%s: reader exiting..\n", portname(port));
+	return port;
+}
+
+/*
+ *	the reader of a trunk. frames come a batch of datagrams at a time,
+ *	and are copied out to buffers as they are cut out of them.
+ */
+static void *
+trunkreader(void *aport)
+{
+	Buffer *bp;
+	Port *port;
+	uint8_t *frame;
+	int len, peer;
+
+	port = (Port *)aport;
+	while(port->state == PortOpen){
+		if(vxlanwait(port->vxlan, RingPollms) == 0 || vxlanrecv(port->vxlan) == 0)
+			continue;
+		while((len = vxlannext(port->vxlan, &frame, &peer)) != -1){
+			if(len == 0)
+				continue;
+			if((bp = qget(&port->freeq)) == NULL)
+				goto out;
+			if(len > bp->cap - 4)
+				len = bp->cap - 4;
+			*(uint32_t *)bp->buf = 0;
+			memcpy((uint8_t *)bp->buf + 4, frame, len);
+			bp->len = len + 4;
+			forward(port, peer, bp);
+		}
+	}
+out:
+	fprintf(stderr, "%s: reader exiting..\n", portname(port));
+	return port;
+}
+
+static uint64_t
+monotime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+// a frame with its packet information in front to a ring, or a drop.
+static void
+ringput(Port *port, void *buf, int len)
+{
+	int rv;
+
+	if(len <= 4)
+		return;
+	if(port->shm != NULL)
+		rv = shmportput(port->shm, (uint8_t *)buf + 4, len - 4);
+	else if(port->uplink != NULL)
+		rv = tpacketput(port->uplink->t[0].tp, (uint8_t *)buf + 4, len - 4);
+	else
+		rv = xskput(port->xsk, (uint8_t *)buf + 4, len - 4);
+	if(rv == -1)
+		portevent(port, EvOverflow, NULL, __sync_add_and_fetch(&port->drops, 1));
+}
+
+static void
+ringflush(Port *port)
+{
+	if(port->shm != NULL)
+		shmportflush(port->shm);
+	else if(port->uplink != NULL)
+		tpacketflush(port->uplink->t[0].tp);
+	else
+		xskflush(port->xsk);
+}
+
+/*
+ *	the peer of a trunk that frame goes to, or -1 for all of them when
+ *	the destination is not known to be behind one.
+ */
+static int
+trunkpeer(Port *port, uint8_t *frame)
+{
+	Cam *cam;
+
+	cam = camlook(g_cams, frame);
+	if(cam != NULL && cam->port == port)
+		return cam->peer;
+	return -1;
+}
+
+/*
+ *	sends bp and whatever else is queued for a trunk, up to a batch,
+ *	with one system call. the frames are not copied, so the buffers
+ *	are held until they are sent.
+ */
+static void
+trunkxmit(Port *port, Buffer *bp)
+{
+	Buffer *bps[RingBatch];
+	uint8_t *frame;
+	int i, n, drops;
+
+	n = 0;
+	drops = 0;
+	do {
+		frame = (uint8_t *)bp->buf + 4;
+		if(bp->len > 4 && vxlanput(port->vxlan, trunkpeer(port, frame), frame, bp->len - 4) == -1)
+			drops++;
+		bps[n++] = bp;
+	} while(n < RingBatch && (bp = qtimedget(&port->xmitq, 1)) != NULL);
+	drops += vxlanflush(port->vxlan);
+	if(drops > 0)
+		portevent(port, EvOverflow, NULL, __sync_add_and_fetch(&port->drops, drops));
+	for(i = 0; i < n; i++)
+		brelease(bps[i]);
+}
+
+static int
+xmit(Port *port, void *buf, int len)
+{
+	uint8_t *frame;
+	int nwr;
+
+	if(port->vxlan != NULL){
+		frame = (uint8_t *)buf + 4;
+		if(len <= 4)
+			return 0;
+		if(vxlanput(port->vxlan, trunkpeer(port, frame), frame, len - 4) == -1 || vxlanflush(port->vxlan) > 0)
+			portevent(port, EvOverflow, NULL, __sync_add_and_fetch(&port->drops, 1));
+		return 0;
+	}
+
+	if(port->shm != NULL || port->xsk != NULL || port->uplink != NULL){
+		if(!ringenter(port))
+			return 0;
+		ringput(port, buf, len);
+		ringflush(port);
+		ringleave(port);
+		return 0;
+	}
+	if(port->tun){
+		buf = (uint8_t *)buf + 4;
+		len -= 4;
+	} else if(len > 0){
+		*(uint32_t *)buf = 0;
+	}
+	if(len > 0){
+		nwr = write(port->fd, buf, len);
+		if(nwr != len){
+			fprintf(stderr, "%s: short write, got %d wanted %d\n", portname(port), nwr, len);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ *	puts bp and whatever else is queued for a shared memory, AF_XDP or
+ *	uplink port in its ring, up to a batch, and rings the doorbell or kicks the
+ *	kernel once for all of them.
+ *	a full ring means the other side is not keeping up, so it drops,
+ *	as it does while handoff keeps it off the ring.
+ */
+static void
+ringxmit(Port *port, Buffer *bp)
+{
+	int n;
+
+	if(!ringenter(port)){
+		brelease(bp);
+		return;
+	}
+	n = 0;
+	do {
+		ringput(port, bp->buf, bp->len);
+		brelease(bp);
+	} while(++n < RingBatch && (bp = qtimedget(&port->xmitq, 1)) != NULL);
+	ringflush(port);
+	ringleave(port);
+}
+
+/*
+ *	picks up a new netem configuration for the port. the emulator stays
+ *	around once created, so its counters can be read, and frames that
+ *	are held back when it is turned off still go out on time.
+ */
+static void
+netemupdate(Port *port, int *genp)
+{
+	Netemconf conf;
+
+	pthread_mutex_lock(&portlock);
+	conf = port->netemconf;
+	*genp = port->netemgen;
+	pthread_mutex_unlock(&portlock);
+	if(port->netem != NULL)
+		netemconfig(port->netem, &conf);
+	else if(netemactive(&conf))
+		port->netem = netemcreate(&conf, monotime());
+}
+
+static void *
+writer(void *aport)
+{
+	Port *port = (Port *)aport;
+	Netemnode *np;
+	Netem *ne;
+	Buffer *bp;
+	uint64_t overlimit;
+	int gen, rv;
+
+	gen = 0;
+	for(;;){
+		if(port->netemgen != gen)
+			netemupdate(port, &gen);
+		ne = port->netem;
+		if(ne != NULL && (ne->npending > 0 || netemactive(&ne->conf))){
+			while((np = netemget(ne, monotime())) != NULL){
+				rv = xmit(port, np->data, np->len);
+				netemrelease(ne, np);
+				if(rv == -1)
+					goto out;
+			}
+			bp = qtimedget(&port->xmitq, netemnext(ne));
+			if(bp == NULL){
+				if(port->xmitq.closed)
+					break;
+				continue;
+			}
+			overlimit = ne->overlimit;
+			netemput(ne, bp->buf, bp->len, monotime());
+			if(ne->overlimit != overlimit)
+				portevent(port, EvRatelimit, NULL, ne->overlimit);
+			brelease(bp);
+			continue;
+		}
+
+		bp = qget(&port->xmitq);
+		if(bp == NULL)
+			break;
+		if(port->shm != NULL || port->xsk != NULL || port->uplink != NULL){
+			ringxmit(port, bp);
+			continue;
+		}
+		if(port->vxlan != NULL){
+			trunkxmit(port, bp);
+			continue;
+		}
+		rv = xmit(port, bp->buf, bp->len);
+		brelease(bp);
+		if(rv == -1)
+			break;
+	}
+out:
+	// a port that can't be written to is as good as closed.
+	__sync_bool_compare_and_swap(&port->state, PortOpen, PortClosing);
+	if((ne = port->netem) != NULL){
+		port->netem = NULL;
+		netemfree(ne);
+	}
+	fprintf(stderr, "%s: writer exiting\n", portname(port));
+	return port;
+}
+
+static void *
+mirrorer(void *aport)
+{
+	Port *port = (Port *)aport;
+	Port *inport;
+	Pktring *ring;
+	Buffer *bp;
+	int idx;
+
+	for(;;){
+		bp = qget(&port->xmitq);
+		if(bp == NULL)
+			break;
+		pthread_mutex_lock(&mirror.lock);
+		ring = mirror.ring;
+		if(ring != NULL && bp->len > 4){
+			// the buffer belongs to the free queue of the port it came in from.
+			inport = bp->freeq->port;
+			idx = inport - ports;
+			if(idx < PktringNames){
+				if(strcmp(ring->names[idx], portname(inport)) != 0)
+					snprintf(ring->names[idx], sizeof ring->names[idx], "%.31s", portname(inport));
+				pktringput(ring, idx, (uint8_t *)bp->buf + 4, bp->len - 4);
+			}
+		}
+		pthread_mutex_unlock(&mirror.lock);
+		if(bdecref(bp) == 0)
+			qput(bp->freeq, bp);
+	}
+	fprintf(stderr, "%s: mirrorer exiting\n", portname(port));
+	return port;
+}
+
+static void
+mirrorstop(void)
+{
+	int i;
+
+	for(i = 0; i < nports; i++)
+		ports[i].mirror = 0;
+	mirror.allports = 0;
+
+	pthread_mutex_lock(&mirror.lock);
+	if(mirror.ring != NULL){
+		mirror.ring->closed = 1;
+		pktringfree(mirror.ring);
+		mirror.ring = NULL;
+	}
+	pthread_mutex_unlock(&mirror.lock);
+}
+
+/*
+ *	starts mirroring the ports of nodeid, or all ports if nodeid is NULL,
+ *	into a fresh ring. any previous ring is closed. returns the memfd
+ *	of the ring, for passing to whoever is going to drain it.
+ */
+static int
+mirrorstart(char *nodeid, int ethertype, int nslots, int snaplen)
+{
+	Pktring *ring;
+	int i, ringfd;
+
+	if((ring = pktringcreate(nslots, snaplen, &ringfd)) == NULL)
+		return -1;
+
+	pthread_mutex_lock(&portlock);
+	mirrorstop();
+	if(mirror.port.nodeid == NULL){
+		pthread_mutex_init(&mirror.lock, NULL);
+		qinit(&mirror.port.xmitq, &mirror.port);
+		mirror.port.nodeid = strdup("mirror");
+		mirror.port.ifname = strdup("pcap");
+		mirror.port.fd = -1;
+		mirror.port.state = PortOpen;
+		pthread_create(&mirror.port.xmitthr, NULL, mirrorer, &mirror.port);
+	}
+
+	pthread_mutex_lock(&mirror.lock);
+	mirror.ring = ring;
+	mirror.ethertype = ethertype;
+	pthread_mutex_unlock(&mirror.lock);
+
+	mirror.allports = nodeid == NULL;
+	for(i = 0; i < nports; i++)
+		ports[i].mirror = nodeid == NULL || (ports[i].nodeid != NULL && !strcmp(nodeid, ports[i].nodeid));
+	pthread_mutex_unlock(&portlock);
+
+	return ringfd;
+}
+
+// numbers are not strings, so we pick them straight from the message.
+static int
+jsonint(JsonRoot *root, char *buf, int off, int def)
+{
+	JsonAst *ast;
+
+	if(off == -1)
+		return def;
+	ast = root->ast.buf;
+	if(ast[off].type != JsonNumber)
+		return def;
+	return strtol(buf + ast[off].off, NULL, 0);
+}
+
+static double
+jsonfloat(JsonRoot *root, char *buf, int off, double def)
+{
+	JsonAst *ast;
+
+	if(off == -1)
+		return def;
+	ast = root->ast.buf;
+	if(ast[off].type != JsonNumber)
+		return def;
+	return strtod(buf + ast[off].off, NULL);
+}
+
+// counters, which would lose their low bits in a double.
+static uint64_t
+jsonu64(JsonRoot *root, char *buf, int off, uint64_t def)
+{
+	JsonAst *ast;
+
+	if(off == -1)
+		return def;
+	ast = root->ast.buf;
+	if(ast[off].type != JsonNumber)
+		return def;
+	return strtoull(buf + ast[off].off, NULL, 10);
+}
+
+static char *
+fmttalker(Talker *tk)
+{
+	char srcip[INET_ADDRSTRLEN], dstip[INET_ADDRSTRLEN];
+	char *src, *dst, *str;
+
+	src = fmtmac(tk->key.srcmac);
+	dst = fmtmac(tk->key.dstmac);
+	if(fivetuple){
+		inet_ntop(AF_INET, &tk->key.srcip, srcip, sizeof srcip);
+		inet_ntop(AF_INET, &tk->key.dstip, dstip, sizeof dstip);
+		str = smprintf(
+			json({"src":"%s","dst":"%s","srcip":"%s","dstip":"%s","proto":%u,"sport":%u,"dport":%u,"pkts":%llu,"bytes":%llu}),
+			src, dst, srcip, dstip,
+			tk->key.proto, tk->key.sport, tk->key.dport,
+			(unsigned long long)tk->pkts, (unsigned long long)tk->bytes
+		);
+	} else {
+		str = smprintf(
+			json({"src":"%s","dst":"%s","pkts":%llu,"bytes":%llu}),
+			src, dst,
+			(unsigned long long)tk->pkts, (unsigned long long)tk->bytes
+		);
+	}
+	free(src);
+	free(dst);
+	return str;
+}
+
+/*
+ *	top talkers of the last complete interval, as a json response.
+ */
+static char *
+toptalkers(int count)
+{
+	Talker tab[MaxTalkers];
+	char *str, *tk, *nstr;
+	int i, n;
+
+	n = sketchtop(talkers + (curtalkers^1), tab, count < nelem(tab) ? count : nelem(tab));
+	str = strdup("");
+	for(i = 0; i < n; i++){
+		tk = fmttalker(tab + i);
+		nstr = smprintf("%s%s%s", str, i > 0 ? "," : "", tk);
+		free(tk);
+		free(str);
+		str = nstr;
+	}
+	nstr = smprintf(json({"interval":%d,"talkers":[%s]}), AgeInterval, str);
+	free(str);
+	return nstr;
+}
+
+/*
+ *	sets the link emulation of the ports of nodeid, and returns their
+ *	counters as they were before the change, or NULL if there are no
+ *	such ports. the writers pick the setting up with their next frame.
+ */
+static char *
+setnetem(char *nodeid, Netemconf *conf)
+{
+	Netem *ne;
+	char *str, *nstr;
+	int i, n;
+
+	str = strdup("");
+	n = 0;
+	pthread_mutex_lock(&portlock);
+	for(i = 0; i < nports; i++){
+		Port *port = ports + i;
+		if(port->state != PortOpen || strcmp(nodeid, port->nodeid))
+			continue;
+		port->netemconf = *conf;
+		port->netemgen++;
+		ne = port->netem;
+		nstr = smprintf(json(%s%s{"ifname":"%s","lost":%llu,"duplicated":%llu,"reordered":%llu,"overlimit":%llu,"held":%d}),
+			str, n > 0 ? "," : "", port->ifname,
+			ne != NULL ? (unsigned long long)ne->lost : 0ull,
+			ne != NULL ? (unsigned long long)ne->duplicated : 0ull,
+			ne != NULL ? (unsigned long long)ne->reordered : 0ull,
+			ne != NULL ? (unsigned long long)ne->overlimit : 0ull,
+			ne != NULL ? ne->npending : 0);
+		free(str);
+		str = nstr;
+		n++;
+	}
+	pthread_mutex_unlock(&portlock);
+	if(n == 0){
+		free(str);
+		return NULL;
+	}
+	nstr = smprintf(json({"ports":[%s]}), str);
+	free(str);
+	return nstr;
+}
+
+/*
+ *	the router, made the first time it is given a subnet or a route,
+ *	with a mac of its own to find hosts from.
+ */
+static Router *
+routerget(void)
+{
+	Router *r;
+	uint8_t selfmac[6];
+	int fd;
+
+	if(router != NULL)
+		return router;
+	if((fd = open("/dev/urandom", O_RDONLY|O_CLOEXEC)) == -1 || read(fd, selfmac, 6) != 6){
+		fprintf(stderr, "router: /dev/urandom: %s\n", strerror(errno));
+		if(fd != -1)
+			close(fd);
+		return NULL;
+	}
+	close(fd);
+	// unicast and locally administered.
+	selfmac[0] = (selfmac[0] & 0xfe) | 0x02;
+	if((r = malloc(sizeof r[0])) == NULL || routeinit(r, gwmac, selfmac) == -1){
+		fprintf(stderr, "router: out of memory\n");
+		free(r);
+		return NULL;
+	}
+	__sync_synchronize();
+	router = r;
+	return r;
+}
+
+// parses an address, with a prefix length after a / if lenp is not NULL.
+static int
+parseaddr(char *str, int *familyp, uint8_t *addr, int *lenp)
+{
+	char buf[INET6_ADDRSTRLEN+4], *p;
+	int family, max;
+
+	if(str == NULL || strlen(str) >= sizeof buf)
+		return -1;
+	strcpy(buf, str);
+	family = strchr(buf, ':') != NULL ? AF_INET6 : AF_INET;
+	max = family == AF_INET ? 32 : 128;
+	if((p = strchr(buf, '/')) != NULL){
+		if(lenp == NULL)
+			return -1;
+		*p++ = '\0';
+		*lenp = strtol(p, &p, 10);
+		if(*p != '\0' || *lenp < 0 || *lenp > max)
+			return -1;
+	} else if(lenp != NULL){
+		*lenp = max;
+	}
+	memset(addr, 0, 16);
+	if(inet_pton(family, buf, addr) != 1)
+		return -1;
+	*familyp = family;
+	return 0;
+}
+
+/*
+ *	adds the subnet or route in the request at obji, or removes the
+ *	route with its prefix if del is set.
+ */
+static int
+routeop(JsonRoot *root, int obji, int connected, int del)
+{
+	Router *r;
+	uint8_t prefix[16], gw[16];
+	char *str, *gwstr;
+	int family, gwfamily, len, rv;
+
+	str = jsoncstr(root, jsonwalk(root, obji, "prefix"));
+	gwstr = del ? NULL : jsoncstr(root, jsonwalk(root, obji, connected ? "gateway" : "via"));
+	rv = -1;
+	if(parseaddr(str, &family, prefix, &len) == -1){
+		fprintf(stderr, "router: bad prefix %s\n", str != NULL ? str : "(none)");
+	} else if(!del && (parseaddr(gwstr, &gwfamily, gw, NULL) == -1 || gwfamily != family)){
+		fprintf(stderr, "router: bad %s %s\n", connected ? "gateway" : "via", gwstr != NULL ? gwstr : "(none)");
+	} else if((r = routerget()) != NULL){
+		rv = del ? routedel(r, family, prefix, len) : routeadd(r, family, prefix, len, connected, gw);
+		if(rv == -1)
+			fprintf(stderr, "router: could not %s %s\n", del ? "remove" : "add", str);
+	}
+	free(gwstr);
+	free(str);
+	return rv;
+}
+
+/*
+ *	the subnets and routes as a json array, in the form the requests
+ *	that make them take.
+ */
+static char *
+fmtroutes(void)
+{
+	Route *rt;
+	char prefix[INET6_ADDRSTRLEN], gw[INET6_ADDRSTRLEN];
+	char *str, *nstr;
+	int i;
+
+	str = strdup("");
+	for(i = 0; router != NULL && i < RouteMax; i++){
+		rt = router->routes + i;
+		if(rt->family == 0)
+			continue;
+		inet_ntop(rt->family, rt->prefix, prefix, sizeof prefix);
+		inet_ntop(rt->family, rt->gw, gw, sizeof gw);
+		nstr = smprintf(json(%s%s{"prefix":"%s/%d","%s":"%s"}), str, str[0] != '\0' ? "," : "",
+			prefix, rt->len, rt->connected ? "gateway" : "via", gw);
+		free(str);
+		str = nstr;
+	}
+	nstr = smprintf("[%s]", str);
+	free(str);
+	return nstr;
+}
+
+/*
+ *	puts backendstr behind the service at vipstr, protostr and port, or
+ *	takes it away if del is set, or the whole service if backendstr is
+ *	NULL.
+ */
+static int
+vipset(char *vipstr, char *protostr, int port, char *backendstr, int del)
+{
+	Router *r;
+	uint8_t vip[16], backend[16];
+	int family, bfamily, proto, rv;
+
+	proto = 0;
+	if(protostr != NULL && strcmp(protostr, "tcp") == 0)
+		proto = IPPROTO_TCP;
+	else if(protostr != NULL && strcmp(protostr, "udp") == 0)
+		proto = IPPROTO_UDP;
+	rv = -1;
+	if(parseaddr(vipstr, &family, vip, NULL) == -1){
+		fprintf(stderr, "router: bad vip %s\n", vipstr != NULL ? vipstr : "(none)");
+	} else if(proto == 0 || port <= 0 || port > 65535){
+		fprintf(stderr, "router: %s: bad proto or port\n", vipstr);
+	} else if((backendstr != NULL || !del) && (parseaddr(backendstr, &bfamily, backend, NULL) == -1 || bfamily != family)){
+		fprintf(stderr, "router: bad backend %s\n", backendstr != NULL ? backendstr : "(none)");
+	} else if((r = routerget()) != NULL){
+		if(del)
+			rv = routevipdel(r, family, vip, proto, port, backendstr != NULL ? backend : NULL);
+		else
+			rv = routevipadd(r, family, vip, proto, port, backend);
+		if(rv == -1)
+			fprintf(stderr, "router: could not %s %s for %s %s:%d\n", del ? "remove" : "add",
+				backendstr != NULL ? backendstr : "backends", protostr, vipstr, port);
+	}
+	return rv;
+}
+
+/*
+ *	makes the router a source nat gateway from the address in the
+ *	request at obji, on its subnet, with the ports between minport and
+ *	maxport. the switch's own mac goes with it if mac is not NULL.
+ */
+static int
+snatop(JsonRoot *root, char *buf, int obji)
+{
+	Router *r;
+	uint8_t addr[16], mac[6];
+	char *str, *macstr;
+	int family, len, minport, maxport, rv;
+
+	str = jsoncstr(root, jsonwalk(root, obji, "addr"));
+	macstr = jsoncstr(root, jsonwalk(root, obji, "mac"));
+	minport = jsonint(root, buf, jsonwalk(root, obji, "minport"), 1024);
+	maxport = jsonint(root, buf, jsonwalk(root, obji, "maxport"), 65535);
+	rv = -1;
+	if(parseaddr(str, &family, addr, &len) == -1 || family != AF_INET || len == 32){
+		fprintf(stderr, "router: bad snat address %s, it takes an ipv4 address and its subnet\n", str != NULL ? str : "(none)");
+	} else if(macstr != NULL && sscanf(macstr, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", mac, mac+1, mac+2, mac+3, mac+4, mac+5) != 6){
+		fprintf(stderr, "router: bad snat mac %s\n", macstr);
+	} else if((r = routerget()) != NULL){
+		if((rv = routesnat(r, addr, len, minport, maxport)) == -1)
+			fprintf(stderr, "router: could not make %s with ports %d-%d the snat gateway\n", str, minport, maxport);
+		else if(macstr != NULL)
+			memcpy(r->selfmac, mac, 6);
+	}
+	free(macstr);
+	free(str);
+	return rv;
+}
+
+// the source nat gateway as a json object, empty if there is none.
+static char *
+fmtsnat(void)
+{
+	Snat *s;
+	char addr[INET_ADDRSTRLEN], *mac, *str;
+
+	if(router == NULL || (s = router->snat) == NULL)
+		return strdup("{}");
+	inet_ntop(AF_INET, s->addr, addr, sizeof addr);
+	mac = fmtmac(router->selfmac);
+	str = smprintf(json({"addr":"%s/%d","minport":%d,"maxport":%d,"mac":"%s","conns":%d}),
+		addr, router->snatlen, s->minport, s->maxport, mac, snatcount(s));
+	free(mac);
+	return str;
+}
+
+static int
+vipop(JsonRoot *root, char *buf, int obji, int del)
+{
+	char *vip, *proto, *backend;
+	int rv;
+
+	vip = jsoncstr(root, jsonwalk(root, obji, "vip"));
+	proto = jsoncstr(root, jsonwalk(root, obji, "proto"));
+	backend = jsoncstr(root, jsonwalk(root, obji, "backend"));
+	rv = vipset(vip, proto, jsonint(root, buf, jsonwalk(root, obji, "port"), 0), backend, del);
+	free(backend);
+	free(proto);
+	free(vip);
+	return rv;
+}
+
+/*
+ *	the services as a json array, with their backends in the order of
+ *	their slots.
+ */
+static char *
+fmtvips(void)
+{
+	Vip *v;
+	char ip[INET6_ADDRSTRLEN], backend[INET6_ADDRSTRLEN];
+	char *str, *nstr, *backends;
+	int i, j;
+
+	str = strdup("");
+	for(i = 0; router != NULL && i < RouteVips; i++){
+		v = router->vips + i;
+		if(v->family == 0)
+			continue;
+		backends = strdup("");
+		for(j = 0; j < MaglevMax; j++){
+			if(!v->mg.used[j])
+				continue;
+			inet_ntop(v->family, v->mg.keys[j], backend, sizeof backend);
+			nstr = smprintf("%s%s\"%s\"", backends, backends[0] != '\0' ? "," : "", backend);
+			free(backends);
+			backends = nstr;
+		}
+		inet_ntop(v->family, v->ip, ip, sizeof ip);
+		nstr = smprintf(json(%s%s{"vip":"%s","proto":"%s","port":%d,"backends":[%s]}), str, str[0] != '\0' ? "," : "",
+			ip, v->proto == IPPROTO_TCP ? "tcp" : "udp", v->port, backends);
+		free(backends);
+		free(str);
+		str = nstr;
+	}
+	nstr = smprintf("[%s]", str);
+	free(str);
+	return nstr;
+}
+
+// puts back the routes and services a handoff came with.
+static void
+takeroutes(JsonRoot *root, char *buf)
+{
+	JsonAst *ast;
+	char *vip, *proto, *backend;
+	int i, j, port, routesi, vipsi, backendsi;
+
+	ast = root->ast.buf;
+	if((routesi = jsonwalk(root, 0, "routes")) != -1 && ast[routesi].type == '[')
+		for(i = routesi+1; ast[i].type == '{'; i = ast[i].next)
+			routeop(root, i, jsonwalk(root, i, "gateway") != -1, 0);
+	// with our mac, which hosts outside know the address by.
+	if((i = jsonwalk(root, 0, "snat")) != -1 && jsonwalk(root, i, "addr") != -1)
+		snatop(root, buf, i);
+	if((vipsi = jsonwalk(root, 0, "vips")) == -1 || ast[vipsi].type != '[')
+		return;
+	for(i = vipsi+1; ast[i].type == '{'; i = ast[i].next){
+		if((backendsi = jsonwalk(root, i, "backends")) == -1 || ast[backendsi].type != '[')
+			continue;
+		vip = jsoncstr(root, jsonwalk(root, i, "vip"));
+		proto = jsoncstr(root, jsonwalk(root, i, "proto"));
+		port = jsonint(root, buf, jsonwalk(root, i, "port"), 0);
+		for(j = backendsi+1; ast[j].type == JsonString; j = ast[j].next){
+			backend = jsoncstr(root, j);
+			vipset(vip, proto, port, backend, 0);
+			free(backend);
+		}
+		free(proto);
+		free(vip);
+	}
+}
+
+static char *aclactions[] = {
+	[AclAllow] = "allow",
+	[AclDrop] = "drop",
+	[AclMark] = "mark",
+	[AclMirror] = "mirror",
+};
+
+static int
+aclaction(char *str)
+{
+	int i;
+
+	for(i = 0; str != NULL && i < nelem(aclactions); i++)
+		if(strcmp(str, aclactions[i]) == 0)
+			return i;
+	return -1;
+}
+
+// a port, or ports lo-hi, as a number or a string. none is all of them.
+static int
+aclports(JsonRoot *root, char *buf, int off, int *lop, int *hip)
+{
+	char *str, *p;
+
+	*lop = 0;
+	*hip = 65535;
+	if(off == -1)
+		return 0;
+	if(root->ast.buf[off].type == JsonNumber){
+		*lop = *hip = jsonint(root, buf, off, -1);
+		return 0;
+	}
+	if((str = jsoncstr(root, off)) == NULL)
+		return -1;
+	*lop = *hip = strtol(str, &p, 10);
+	if(*p == '-')
+		*hip = strtol(p+1, &p, 10);
+	if(p == str || *p != '\0'){
+		free(str);
+		return -1;
+	}
+	free(str);
+	return 0;
+}
+
+// a prefix in value and mask, with the family of the rule.
+static int
+aclprefix(char *str, Aclrule *r, uint8_t *value, uint8_t *mask)
+{
+	int family, len;
+
+	if(parseaddr(str, &family, value, &len) == -1)
+		return -1;
+	family = family == AF_INET ? 4 : 6;
+	if(r->mask.family != 0 && r->value.family != family)
+		return -1;
+	r->value.family = family;
+	r->mask.family = 0xff;
+	memset(mask, 0xff, len/8);
+	if(len % 8)
+		mask[len/8] = 0xff << (8 - len%8);
+	return 0;
+}
+
+/*
+ *	the rule in the request at obji. what it leaves out matches anything,
+ *	and a vlan of 0 is for untagged frames.
+ */
+static int
+aclparse(JsonRoot *root, char *buf, int obji, Aclrule *r)
+{
+	char *srcmac, *dstmac, *src, *dst, *proto, *action, *bad;
+	int off, vlan;
+
+	memset(r, 0, sizeof r[0]);
+	srcmac = jsoncstr(root, jsonwalk(root, obji, "srcmac"));
+	dstmac = jsoncstr(root, jsonwalk(root, obji, "dstmac"));
+	src = jsoncstr(root, jsonwalk(root, obji, "src"));
+	dst = jsoncstr(root, jsonwalk(root, obji, "dst"));
+	action = jsoncstr(root, jsonwalk(root, obji, "action"));
+	bad = NULL;
+	if(srcmac != NULL){
+		memset(r->mask.srcmac, 0xff, 6);
+		if(sscanf(srcmac, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", r->value.srcmac, r->value.srcmac+1, r->value.srcmac+2,
+		r->value.srcmac+3, r->value.srcmac+4, r->value.srcmac+5) != 6)
+			bad = "srcmac";
+	}
+	if(dstmac != NULL){
+		memset(r->mask.dstmac, 0xff, 6);
+		if(sscanf(dstmac, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", r->value.dstmac, r->value.dstmac+1, r->value.dstmac+2,
+		r->value.dstmac+3, r->value.dstmac+4, r->value.dstmac+5) != 6)
+			bad = "dstmac";
+	}
+	if((off = jsonwalk(root, obji, "vlan")) != -1){
+		vlan = jsonint(root, buf, off, -1);
+		r->mask.vlan = 0xffff;
+		r->value.vlan = vlan > 0 ? AclTagged | vlan : 0;
+		if(vlan < 0 || vlan > 4094)
+			bad = "vlan";
+	}
+	if(src != NULL && aclprefix(src, r, r->value.src, r->mask.src) == -1)
+		bad = "src";
+	if(dst != NULL && aclprefix(dst, r, r->value.dst, r->mask.dst) == -1)
+		bad = "dst";
+	if((off = jsonwalk(root, obji, "proto")) != -1){
+		r->mask.proto = 0xff;
+		if(root->ast.buf[off].type == JsonNumber){
+			r->value.proto = jsonint(root, buf, off, 0);
+		} else {
+			proto = jsoncstr(root, off);
+			if(proto != NULL && strcmp(proto, "tcp") == 0)
+				r->value.proto = IPPROTO_TCP;
+			else if(proto != NULL && strcmp(proto, "udp") == 0)
+				r->value.proto = IPPROTO_UDP;
+			else if(proto != NULL && strcmp(proto, "icmp") == 0)
+				r->value.proto = IPPROTO_ICMP;
+			else if(proto != NULL && strcmp(proto, "icmpv6") == 0)
+				r->value.proto = IPPROTO_ICMPV6;
+			else
+				bad = "proto";
+			free(proto);
+		}
+	}
+	if(aclports(root, buf, jsonwalk(root, obji, "sport"), &r->sportlo, &r->sporthi) == -1)
+		bad = "sport";
+	if(aclports(root, buf, jsonwalk(root, obji, "dport"), &r->dportlo, &r->dporthi) == -1)
+		bad = "dport";
+	// ports are only looked for in tcp and udp.
+	if((r->sportlo != 0 || r->sporthi != 65535 || r->dportlo != 0 || r->dporthi != 65535)
+	&& (r->mask.proto == 0 || (r->value.proto != IPPROTO_TCP && r->value.proto != IPPROTO_UDP)))
+		bad = "ports without tcp or udp";
+	if((r->action = aclaction(action)) == -1)
+		bad = "action";
+	r->mark = jsonint(root, buf, jsonwalk(root, obji, "mark"), -1);
+	if(bad != NULL)
+		fprintf(stderr, "acl: bad %s in rule\n", bad);
+	free(action);
+	free(dst);
+	free(src);
+	free(dstmac);
+	free(srcmac);
+	return bad != NULL ? -1 : 0;
+}
+
+/*
+ *	compiles the list in the request at obji, its rules in order and what
+ *	is done with frames none matches. the counters it comes with are only
+ *	taken when counters is set, which is for a list handed over by the
+ *	process we take over from, not for one a client sets.
+ */
+static Acl *
+aclmake(JsonRoot *root, char *buf, int obji, int counters)
+{
+	JsonAst *ast;
+	Aclrule rule;
+	Acl *acl;
+	char *str;
+	int i, n, action, rulesi;
+
+	ast = root->ast.buf;
+	str = jsoncstr(root, jsonwalk(root, obji, "default"));
+	action = str != NULL ? aclaction(str) : AclAllow;
+	free(str);
+	if(action != AclAllow && action != AclDrop){
+		fprintf(stderr, "acl: the default is allow or drop\n");
+		return NULL;
+	}
+	if((acl = aclnew(action)) == NULL){
+		fprintf(stderr, "acl: out of memory\n");
+		return NULL;
+	}
+	if(counters)
+		acl->nomatch = jsonu64(root, buf, jsonwalk(root, obji, "nomatch"), 0);
+	if((rulesi = jsonwalk(root, obji, "rules")) != -1 && ast[rulesi].type == '['){
+		for(i = rulesi+1; ast[i].type == '{'; i = ast[i].next){
+			if(aclparse(root, buf, i, &rule) == -1){
+				aclfree(acl);
+				return NULL;
+			}
+			if((n = aclrule(acl, &rule)) == -1){
+				fprintf(stderr, "acl: rule %d not taken, a list holds %d and marks are 0-63\n", acl->nrules, AclRulemax);
+				aclfree(acl);
+				return NULL;
+			}
+			if(counters)
+				acl->rules[n].hits = jsonu64(root, buf, jsonwalk(root, i, "hits"), 0);
+		}
+	}
+	if(aclcompile(acl) == -1){
+		fprintf(stderr, "acl: out of memory\n");
+		aclfree(acl);
+		return NULL;
+	}
+	return acl;
+}
+
+static int
+prefixlen(uint8_t *mask, int n)
+{
+	int i, len;
+
+	len = 0;
+	for(i = 0; i < n; i++)
+		len += __builtin_popcount(mask[i]);
+	return len;
+}
+
+static char *
+fmtaclrule(Aclrule *r)
+{
+	char ip[INET6_ADDRSTRLEN], *str, *nstr, *mac;
+	int family, n;
+
+	str = strdup("");
+	family = r->value.family == 4 ? AF_INET : AF_INET6;
+	n = r->value.family == 4 ? 4 : 16;
+	if(r->mask.srcmac[0] != 0){
+		mac = fmtmac(r->value.srcmac);
+		nstr = smprintf(json(%s"srcmac":"%s",), str, mac);
+		free(mac);
+		free(str);
+		str = nstr;
+	}
+	if(r->mask.dstmac[0] != 0){
+		mac = fmtmac(r->value.dstmac);
+		nstr = smprintf(json(%s"dstmac":"%s",), str, mac);
+		free(mac);
+		free(str);
+		str = nstr;
+	}
+	if(r->mask.vlan != 0){
+		nstr = smprintf(json(%s"vlan":%d,), str, r->value.vlan & 0xfff);
+		free(str);
+		str = nstr;
+	}
+	// a /0 still says which family the rule is for.
+	if(r->mask.family != 0 && (prefixlen(r->mask.src, n) > 0 || prefixlen(r->mask.dst, n) == 0)){
+		inet_ntop(family, r->value.src, ip, sizeof ip);
+		nstr = smprintf(json(%s"src":"%s/%d",), str, ip, prefixlen(r->mask.src, n));
+		free(str);
+		str = nstr;
+	}
+	if(r->mask.family != 0 && prefixlen(r->mask.dst, n) > 0){
+		inet_ntop(family, r->value.dst, ip, sizeof ip);
+		nstr = smprintf(json(%s"dst":"%s/%d",), str, ip, prefixlen(r->mask.dst, n));
+		free(str);
+		str = nstr;
+	}
+	if(r->mask.proto != 0){
+		nstr = smprintf(json(%s"proto":%d,), str, r->value.proto);
+		free(str);
+		str = nstr;
+	}
+	if(r->sportlo == r->sporthi){
+		nstr = smprintf(json(%s"sport":%d,), str, r->sportlo);
+		free(str);
+		str = nstr;
+	} else if(r->sportlo != 0 || r->sporthi != 65535){
+		nstr = smprintf(json(%s"sport":"%d-%d",), str, r->sportlo, r->sporthi);
+		free(str);
+		str = nstr;
+	}
+	if(r->dportlo == r->dporthi){
+		nstr = smprintf(json(%s"dport":%d,), str, r->dportlo);
+		free(str);
+		str = nstr;
+	} else if(r->dportlo != 0 || r->dporthi != 65535){
+		nstr = smprintf(json(%s"dport":"%d-%d",), str, r->dportlo, r->dporthi);
+		free(str);
+		str = nstr;
+	}
+	if(r->action == AclMark){
+		nstr = smprintf(json(%s"mark":%d,), str, r->mark);
+		free(str);
+		str = nstr;
+	}
+	nstr = smprintf(json({%s"action":"%s","hits":%llu}), str, aclactions[r->action], (unsigned long long)r->hits);
+	free(str);
+	return nstr;
+}
+
+// a list as a json object, in the form set-acl takes, empty for none.
+static char *
+fmtacl(Acl *acl)
+{
+	char *str, *nstr, *rule;
+	int i;
+
+	if(acl == NULL)
+		return strdup("{}");
+	str = strdup("");
+	for(i = 0; i < acl->nrules; i++){
+		rule = fmtaclrule(acl->rules + i);
+		nstr = smprintf("%s%s%s", str, i > 0 ? "," : "", rule);
+		free(rule);
+		free(str);
+		str = nstr;
+	}
+	nstr = smprintf(json({"default":"%s","nomatch":%llu,"rules":[%s]}),
+		aclactions[acl->action], (unsigned long long)acl->nomatch, str);
+	free(str);
+	return nstr;
+}
+
+/*
+ *	puts acl on port in place of the list it had, which is freed once
+ *	its readers are sure to be out of it. a list that allows everything
+ *	takes it off. called with portlock held.
+ */
+static void
+aclset(Port *port, Acl *acl)
+{
+	Acl *old;
+
+	if(acl != NULL && acl->nrules == 0 && acl->action == AclAllow){
+		aclfree(acl);
+		acl = NULL;
+	}
+	old = port->acl;
+	__sync_synchronize();
+	port->acl = acl;
+	if(old != NULL){
+		old->next = aclretired;
+		aclretired = old;
+	}
+}
+
+/*
+ *	sets the list in the request at obji on the ports of its nodeid, or
+ *	just the one with its ifname, each with a copy of its own to count
+ *	in. paths the kernel forwards for them are taken back, as they would
+ *	go past the list.
+ */
+static int
+aclop(JsonRoot *root, char *buf, int obji)
+{
+	Acl *acl;
+	char *nodeid, *ifname;
+	int i, n;
+
+	nodeid = jsoncstr(root, jsonwalk(root, obji, "nodeid"));
+	ifname = jsoncstr(root, jsonwalk(root, obji, "ifname"));
+	n = 0;
+	if(nodeid == NULL){
+		fprintf(stderr, "acl: set-acl without nodeid\n");
+		n = -1;
+	}
+	pthread_mutex_lock(&portlock);
+	for(i = 0; n != -1 && i < nports; i++){
+		Port *port = ports + i;
+		if(port->state != PortOpen || strcmp(nodeid, port->nodeid) || (ifname != NULL && strcmp(ifname, port->ifname)))
+			continue;
+		if((acl = aclmake(root, buf, obji, 0)) == NULL){
+			n = -1;
+			break;
+		}
+		aclset(port, acl);
+		if(port->acl != NULL)
+			offloaddrop(port);
+		n++;
+	}
+	pthread_mutex_unlock(&portlock);
+	if(n == 0)
+		fprintf(stderr, "acl: %s: not found\n", nodeid);
+	free(ifname);
+	free(nodeid);
+	return n > 0 ? 0 : -1;
+}
+
+// the lists on the ports of nodeid, with their counters.
+static char *
+fmtacls(char *nodeid)
+{
+	char *str, *nstr, *acl;
+	int i, n;
+
+	str = strdup("");
+	n = 0;
+	pthread_mutex_lock(&portlock);
+	for(i = 0; i < nports; i++){
+		Port *port = ports + i;
+		if(port->state != PortOpen || strcmp(nodeid, port->nodeid))
+			continue;
+		acl = fmtacl(port->acl);
+		nstr = smprintf(json(%s%s{"ifname":"%s","acl":%s}), str, n > 0 ? "," : "", port->ifname, acl);
+		free(acl);
+		free(str);
+		str = nstr;
+		n++;
+	}
+	pthread_mutex_unlock(&portlock);
+	nstr = smprintf(json({"ports":[%s]}), str);
+	free(str);
+	return nstr;
+}
+
+static void
+startthreads(Port *port)
+{
+	Uplink *ul;
+	int i;
+
+	if((ul = port->uplink) != NULL){
+		for(i = 0; i < ul->nthreads; i++)
+			ul->t[i].port = port;
+		pthread_create(&port->recvthr, NULL, uplinkreader, ul->t);
+		for(i = 1; i < ul->nthreads; i++)
+			pthread_create(&ul->t[i].thr, NULL, uplinkreader, ul->t + i);
+	} else {
+		pthread_create(&port->recvthr, NULL, port->shm != NULL ? shmreader : port->xsk != NULL ? xdpreader : port->vxlan != NULL ? trunkreader : reader, port);
+	}
+	pthread_create(&port->xmitthr, NULL, writer, port);
+}
+
+/*
+ *	puts fd, or shm, xsk, ul or vx if one is not NULL, to use as a new
+ *	port, reusing a closed slot when there is one. the port takes
+ *	ownership of ifname, nodeid, shm, xsk, ul and vx. an fd that is a
+ *	tun makes a port for ip packets, see hostsadd.
+ */
+static Port *
+addport(char *ifname, char *nodeid, int fd, Shmport *shm, Xsk *xsk, Uplink *ul, Vxlan *vx)
+{
+	Port *port;
+	int i, flags, tun;
+
+	// a tun has to leave the packet information out, it would be in the way.
+	tun = 0;
+	if(fd >= 0 && (flags = tunflags(fd)) != -1 && (flags & IFF_TUN) != 0){
+		if((flags & IFF_NO_PI) == 0){
+			fprintf(stderr, "%s: tun with packet information\n", ifname);
+			return NULL;
+		}
+		tun = 1;
+	}
+
+	pthread_mutex_lock(&portlock);
+	for(i = 0; i < nports; i++){
+		port = ports + i;
+		if(__sync_bool_compare_and_swap(&port->state, PortClosed, PortOpen)){
+			free(port->nodeid);
+			free(port->ifname);
+			port->ifname = ifname;
+			port->nodeid = nodeid;
+			port->fd = fd;
+			port->shm = shm;
+			port->xsk = xsk;
+			port->uplink = ul;
+			port->vxlan = vx;
+			port->tun = tun;
+			port->owner = NULL;
+			port->mirror = mirror.allports;
+			port->drops = 0;
+			memset(&port->netemconf, 0, sizeof port->netemconf);
+			qreopen(&port->xmitq);
+			qreopen(&port->freeq);
+			port->evpending = 0;
+			startthreads(port);
+			pthread_mutex_unlock(&portlock);
+			portevent(port, EvPortOpen, NULL, 0);
+			return port;
+		}
+	}
+
+	if(nports == aports){
+		fprintf(stderr, "out of ports\n");
+		pthread_mutex_unlock(&portlock);
+		return NULL;
+	}
+
+	port = ports + nports;
+	memset(port, 0, sizeof port[0]);
+	qinit(&port->xmitq, port);
+	qinit(&port->freeq, port);
+	port->state = PortOpen;
+	port->ifname = ifname;
+	port->nodeid = nodeid;
+	port->fd = fd;
+	port->shm = shm;
+	port->xsk = xsk;
+	port->uplink = ul;
+	port->vxlan = vx;
+	port->tun = tun;
+	port->mirror = mirror.allports;
+	for(i = 0; i < Nbuffers; i++){
+		Buffer *bp;
+		bp = malloc(sizeof bp[0]);
+		memset(bp, 0, sizeof bp[0]);
+		bp->buf = malloc(bufsize);
+		bp->len = 0;
+		bp->cap = bufsize;
+		bp->freeq = &port->freeq;
+		if(qput(bp->freeq, bp) == -1)
+			fprintf(stderr, "%s: addport: could not qput\n", portname(port));
+	}
+	startthreads(port);
+	__sync_fetch_and_add(&nports, 1);
+	pthread_mutex_unlock(&portlock);
+	portevent(port, EvPortOpen, NULL, 0);
+	return port;
+}
+
+typedef struct Ctlconn Ctlconn;
+typedef struct Ctlout Ctlout;
+typedef struct Subev Subev;
+
+/*
+ *	the control plane is one thread with an epoll set of every listening
+ *	and connected control socket. a connection reads framed requests as
+ *	they come and answers them in order, so a client can pipeline as
+ *	many as it likes. answers that don't fit in the socket wait in outq,
+ *	and while there is more than CtlMaxout of them, the connection is
+ *	not read from.
+ */
+struct Ctlconn {
+	Auth auth;
 	int fd;
+	int listening;
+	Ctlconn *lnext; // in listeners, if listening
+
+	char *in; // what has been read but not handled yet
+	int inlen;
+	int incap;
+	int fds[2*FrameMaxfds]; // fds that came ahead of their requests
+	int nfds;
+
+	Ctlout *outq;
+	Ctlout **outtail;
+	int outlen;
+	uint32_t events;
+
+	// for subscribers, events wait in pend until the answers before
+	// them are out, and repeats of one are counted instead of queued.
+	Ctlconn *subnext;
+	int subscribed;
+	uint32_t evmask;
+	char *evnodeid;
+	Subev *pend;
+	int npend;
+	uint64_t evlost;
+};
+
+struct Subev {
+	Event ev;
+	uint64_t n;
+};
+
+struct Ctlout {
+	Ctlout *next;
+	int fd; // goes with the first byte
+	int len;
+	int off;
+	char buf[];
+};
+
+static int ctlepfd = -1;
+static Ctlconn *listeners;
+static Ctlconn *subs;
+static uint64_t subcursor;
+
+static struct {
+	char *name;
+	uint32_t mask;
+} evnames[] = {
+	{"port-open", 1<<EvPortOpen},
+	{"port-close", 1<<EvPortClose},
+	{"mac-learn", 1<<EvMacLearn},
+	{"mac-move", 1<<EvMacMove},
+	{"mac-age", 1<<EvMacAge},
+	{"overflow", 1<<EvOverflow},
+	{"ratelimit", 1<<EvRatelimit},
+	{"lost", 1<<EvLost},
+	{"port", 1<<EvPortOpen | 1<<EvPortClose},
+	{"mac", 1<<EvMacLearn | 1<<EvMacMove | 1<<EvMacAge},
+};
+
+static Ctlconn *
+ctladd(int fd, int listening)
+{
+	struct epoll_event ev;
+	Ctlconn *conn;
+	int fl;
+
+	fl = fcntl(fd, F_GETFL);
+	fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	conn = malloc(sizeof conn[0]);
+	memset(conn, 0, sizeof conn[0]);
+	conn->fd = fd;
+	conn->listening = listening;
+	conn->outtail = &conn->outq;
+	conn->events = EPOLLIN;
+
+	memset(&ev, 0, sizeof ev);
+	ev.events = conn->events;
+	ev.data.ptr = conn;
+	if(epoll_ctl(ctlepfd, EPOLL_CTL_ADD, fd, &ev) == -1){
+		fprintf(stderr, "ctladd: epoll_ctl: %s\n", strerror(errno));
+		free(conn);
+		return NULL;
+	}
+	if(listening){
+		conn->lnext = listeners;
+		listeners = conn;
+	}
+	return conn;
+}
+
+// listens for what the connection is ready for now.
+static void
+ctlevents(Ctlconn *conn)
+{
+	struct epoll_event ev;
+	uint32_t events;
+
+	events = 0;
+	if(conn->outlen < CtlMaxout)
+		events |= EPOLLIN;
+	if(conn->outq != NULL)
+		events |= EPOLLOUT;
+	if(events == conn->events)
+		return;
+	memset(&ev, 0, sizeof ev);
+	ev.events = events;
+	ev.data.ptr = conn;
+	epoll_ctl(ctlepfd, EPOLL_CTL_MOD, conn->fd, &ev);
+	conn->events = events;
+}
+
+// writes out what it can of the queued answers, -1 if the connection is gone.
+static int
+ctlflush(Ctlconn *conn)
+{
+	Ctlout *out;
+	int nwr;
+
+	while((out = conn->outq) != NULL){
+		if(out->fd != -1){
+			nwr = sendfd(conn->fd, out->fd, out->buf, out->len);
+			if(nwr > 0){
+				close(out->fd);
+				out->fd = -1;
+			}
+		} else {
+			nwr = send(conn->fd, out->buf + out->off, out->len - out->off, MSG_DONTWAIT|MSG_NOSIGNAL);
+		}
+		if(nwr == -1){
+			if(errno == EAGAIN || errno == EINTR)
+				break;
+			return -1;
+		}
+		out->off += nwr;
+		conn->outlen -= nwr;
+		if(out->off < out->len)
+			break;
+		conn->outq = out->next;
+		if(conn->outq == NULL)
+			conn->outtail = &conn->outq;
+		free(out);
+	}
+	return 0;
+}
+
+// queues a framed answer, the connection takes over respfd.
+static void
+ctlrespond(Ctlconn *conn, char *resp, int respfd)
+{
+	Ctlout *out;
+	int len;
+
+	len = strlen(resp);
+	out = malloc(sizeof out[0] + FrameHdrlen + len);
+	out->next = NULL;
+	out->fd = respfd;
+	out->len = FrameHdrlen + len;
+	out->off = 0;
+	out->buf[0] = len >> 24;
+	out->buf[1] = len >> 16;
+	out->buf[2] = len >> 8;
+	out->buf[3] = len;
+	out->buf[4] = 0;
+	out->buf[5] = 0;
+	out->buf[6] = 0;
+	out->buf[7] = respfd != -1;
+	memcpy(out->buf + FrameHdrlen, resp, len);
+	*conn->outtail = out;
+	conn->outtail = &out->next;
+	conn->outlen += out->len;
+}
+
+/*
+ *	starts sending events to the connection. "events" is a list of event
+ *	names, or port and mac for all of those, and "nodeid" leaves out
+ *	events of other containers. lost events are always sent.
+ */
+static int
+subscribe(Ctlconn *conn, JsonRoot *root, int obji)
+{
+	JsonAst *ast;
+	char *name;
+	uint32_t mask;
+	int i, j, namesi, nodeidi;
+
+	mask = ~0u;
+	namesi = jsonwalk(root, obji, "events");
+	if(namesi != -1 && root->ast.buf[namesi].type == '['){
+		ast = root->ast.buf;
+		mask = 1<<EvLost;
+		for(i = namesi+1; ast[i].type == JsonString; i = ast[i].next){
+			name = jsoncstr(root, i);
+			for(j = 0; j < nelem(evnames); j++)
+				if(!strcmp(name, evnames[j].name))
+					break;
+			if(j == nelem(evnames)){
+				fprintf(stderr, "ctrl: subscribe: unknown event %s\n", name);
+				free(name);
+				return -1;
+			}
+			mask |= evnames[j].mask;
+			free(name);
+		}
+	}
+
+	free(conn->evnodeid);
+	conn->evnodeid = NULL;
+	if((nodeidi = jsonwalk(root, obji, "nodeid")) != -1)
+		conn->evnodeid = jsoncstr(root, nodeidi);
+	conn->evmask = mask;
+	if(!conn->subscribed){
+		conn->pend = malloc(SubPending * sizeof conn->pend[0]);
+		conn->npend = 0;
+		conn->evlost = 0;
+		conn->subnext = subs;
+		subs = conn;
+		conn->subscribed = 1;
+		__sync_fetch_and_add(&nsubs, 1);
+	}
+	return 0;
+}
+
+static void
+unsubscribe(Ctlconn *conn)
+{
+	Ctlconn **cpp;
+
+	if(!conn->subscribed)
+		return;
+	for(cpp = &subs; *cpp != NULL; cpp = &(*cpp)->subnext){
+		if(*cpp == conn){
+			*cpp = conn->subnext;
+			break;
+		}
+	}
+	__sync_fetch_and_sub(&nsubs, 1);
+	conn->subscribed = 0;
+	free(conn->pend);
+	conn->pend = NULL;
+	free(conn->evnodeid);
+	conn->evnodeid = NULL;
+}
+
+// holds ev back for the subscriber, folding it into one just like it.
+static void
+subqueue(Ctlconn *conn, Event *ev)
+{
+	Subev *sp;
+	int i;
+
+	if(!(conn->evmask & (1<<ev->type)))
+		return;
+	if(conn->evnodeid != NULL && ev->type != EvLost && strcmp(conn->evnodeid, ports[ev->port].nodeid))
+		return;
+	if(ev->type == EvLost){
+		conn->evlost += ev->count;
+		return;
+	}
+	for(i = 0; i < conn->npend; i++){
+		sp = conn->pend + i;
+		if(sp->ev.type == ev->type && sp->ev.port == ev->port && cmpmac(sp->ev.mac, ev->mac) == 0){
+			sp->ev.nsec = ev->nsec;
+			sp->ev.count = ev->count;
+			sp->n++;
+			return;
+		}
+	}
+	if(conn->npend == SubPending){
+		conn->evlost++;
+		return;
+	}
+	sp = conn->pend + conn->npend++;
+	sp->ev = *ev;
+	sp->n = 1;
+}
+
+static char *
+fmtevent(Subev *sp)
+{
+	Port *port;
+	char *mac, *str;
+	int i;
+
+	for(i = 0; i < nelem(evnames); i++)
+		if(evnames[i].mask == 1u<<sp->ev.type)
+			break;
+	port = ports + sp->ev.port;
+	mac = fmtmac(sp->ev.mac);
+	str = smprintf(json({"event":"%s","nodeid":"%s","ifname":"%s","mac":"%s","count":%llu,"n":%llu,"nsec":%llu}),
+		evnames[i].name, port->nodeid, port->ifname, mac,
+		(unsigned long long)sp->ev.count, (unsigned long long)sp->n, (unsigned long long)sp->ev.nsec);
+	free(mac);
+	return str;
+}
+
+/*
+ *	sends what the subscriber has pending as one message, unless it is
+ *	behind on reading, in which case the events keep getting folded.
+ */
+static void
+subflush(Ctlconn *conn)
+{
+	char *str, *nstr, *ev;
+	int i;
+
+	if(conn->outlen >= SubMaxout || (conn->npend == 0 && conn->evlost == 0))
+		return;
+	str = strdup("");
+	for(i = 0; i < conn->npend; i++){
+		ev = fmtevent(conn->pend + i);
+		nstr = smprintf("%s%s%s", str, i > 0 ? "," : "", ev);
+		free(ev);
+		free(str);
+		str = nstr;
+	}
+	if(conn->evlost > 0){
+		nstr = smprintf(json(%s%s{"event":"lost","n":%llu}), str, conn->npend > 0 ? "," : "", (unsigned long long)conn->evlost);
+		free(str);
+		str = nstr;
+	}
+	nstr = smprintf(json({"events":[%s]}), str);
+	free(str);
+	ctlrespond(conn, nstr, -1);
+	free(nstr);
+	conn->npend = 0;
+	conn->evlost = 0;
+}
+
+static void
+ctlclose(Ctlconn *conn)
+{
+	Ctlconn **cpp;
+	Ctlout *out;
+	int i;
+
+	unsubscribe(conn);
+	for(i = 0; i < nports; i++){
+		if(ports[i].owner == conn){
+			ports[i].owner = NULL;
+			__sync_bool_compare_and_swap(&ports[i].state, PortOpen, PortClosing);
+		}
+	}
+	for(cpp = &listeners; conn->listening && *cpp != NULL; cpp = &(*cpp)->lnext){
+		if(*cpp == conn){
+			*cpp = conn->lnext;
+			break;
+		}
+	}
+	epoll_ctl(ctlepfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	for(i = 0; i < conn->nfds; i++)
+		close(conn->fds[i]);
+	while((out = conn->outq) != NULL){
+		conn->outq = out->next;
+		if(out->fd != -1)
+			close(out->fd);
+		free(out);
+	}
+	free(conn->in);
+	free(conn);
+}
+
+// hands what is new in the ring to the subscribers.
+static void
+subdispatch(void)
+{
+	Ctlconn *conn, *next;
+	Event ev;
+	int i;
+
+	evringarm(&events);
+	while(evringget(&events, &subcursor, &ev)){
+		if(ev.type == EvLost){
+			for(i = 0; i < nports; i++)
+				__sync_fetch_and_and(&ports[i].evpending, ~(1<<EvOverflow | 1<<EvRatelimit));
+		} else {
+			__sync_fetch_and_and(&ports[ev.port].evpending, ~(1<<ev.type));
+		}
+		for(conn = subs; conn != NULL; conn = conn->subnext)
+			subqueue(conn, &ev);
+	}
+	for(conn = subs; conn != NULL; conn = next){
+		next = conn->subnext;
+		subflush(conn);
+		if(ctlflush(conn) == -1){
+			ctlclose(conn);
+			continue;
+		}
+		ctlevents(conn);
+	}
+}
+
+/*
+ *	gives port the host routes to the addresses in the addrs array of
+ *	the object at obji, or only checks them if port is NULL. packets
+ *	from tun ports go to whichever port has their destination.
+ */
+static int
+hostsadd(JsonRoot *root, int obji, Port *port)
+{
+	JsonAst *ast;
+	uint8_t addr[16];
+	char *str;
+	int i, family, addrsi, rv;
+
+	ast = root->ast.buf;
+	if((addrsi = jsonwalk(root, obji, "addrs")) == -1 || ast[addrsi].type != '[')
+		return 0;
+	for(i = addrsi+1; ast[i].type == JsonString; i = ast[i].next){
+		str = jsoncstr(root, i);
+		rv = parseaddr(str, &family, addr, NULL);
+		if(rv == -1){
+			fprintf(stderr, "ctrl: bad address %s\n", str != NULL ? str : "(none)");
+		} else if(port != NULL){
+			pthread_mutex_lock(&portlock);
+			if((rv = hostadd(g_hosts, family == AF_INET ? 4 : 6, addr, port)) == -1)
+				fprintf(stderr, "%s: out of host routes for %s\n", portname(port), str);
+			pthread_mutex_unlock(&portlock);
+		}
+		free(str);
+		if(rv == -1)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ *	adds fd as a port for an add-etherfd object at obji. on success the
+ *	port owns fd, on failure it is left to the caller.
+ */
+static int
+etheradd(JsonRoot *root, int obji, int fd)
+{
+	Port *port;
+	char *ifname, *nodeid;
+	int ifnamei, nodeidi;
+
+	ifnamei = jsonwalk(root, obji, "ifname");
+	if(ifnamei == -1){
+		fprintf(stderr, "ctrl: add request without ifname\n");
+		return -1;
+	}
+
+	nodeidi = jsonwalk(root, obji, "nodeid");
+	if(nodeidi == -1){
+		fprintf(stderr, "ctrl: add request without nodeid\n");
+		return -1;
+	}
+
+	if(hostsadd(root, obji, NULL) == -1)
+		return -1;
+
+	ifname = jsoncstr(root, ifnamei);
+	nodeid = jsoncstr(root, nodeidi);
+
+	if((port = addport(ifname, nodeid, fd, NULL, NULL, NULL, NULL)) == NULL){
+		free(ifname);
+		free(nodeid);
+		return -1;
+	}
+	// the port has the fd now, so a route that doesn't fit only loses the route.
+	if(port->tun)
+		hostsadd(root, obji, port);
+	return 0;
+}
+
+/*
+ *	maps the ring of a shared memory port from the memfd and doorbells in
+ *	fds, and adds it. the port lasts as long as conn does. the fds are
+ *	used up either way.
+ */
+static int
+shmadd(Ctlconn *conn, JsonRoot *root, int obji, int *fds)
+{
+	Shmport *shm;
+	Port *port;
+	char *ifname, *nodeid;
+	int i, ifnamei, nodeidi;
+
+	ifnamei = jsonwalk(root, obji, "ifname");
+	nodeidi = jsonwalk(root, obji, "nodeid");
+	if(ifnamei == -1 || nodeidi == -1){
+		fprintf(stderr, "ctrl: add-shmport request without ifname or nodeid\n");
+		goto fail;
+	}
+	if((shm = shmportopen(fds[0], fds[1], fds[2])) == NULL)
+		goto fail;
+
+	ifname = jsoncstr(root, ifnamei);
+	nodeid = jsoncstr(root, nodeidi);
+	if((port = addport(ifname, nodeid, -1, shm, NULL, NULL, NULL)) == NULL){
+		free(ifname);
+		free(nodeid);
+		shmportclose(shm);
+		return -1;
+	}
+	port->owner = conn;
+	return 0;
+
+fail:
+	for(i = 0; i < 3; i++)
+		close(fds[i]);
+	return -1;
+}
+
+/*
+ *	takes over the host end of a veth pair with an AF_XDP socket, the
+ *	container having the other end as ifname. there are no fds to pass,
+ *	the interface is found by its name in containet's namespace.
+ */
+static int
+xdpadd(JsonRoot *root, int obji)
+{
+	Xsk *xsk;
+	char *ifname, *nodeid, *hostif;
+	int ifnamei, nodeidi, hostifi;
+
+	ifnamei = jsonwalk(root, obji, "ifname");
+	nodeidi = jsonwalk(root, obji, "nodeid");
+	hostifi = jsonwalk(root, obji, "hostif");
+	if(ifnamei == -1 || nodeidi == -1 || hostifi == -1){
+		fprintf(stderr, "ctrl: add-xdpport request without ifname, nodeid or hostif\n");
+		return -1;
+	}
+	hostif = jsoncstr(root, hostifi);
+	xsk = xskopen(hostif);
+	free(hostif);
+	if(xsk == NULL)
+		return -1;
+
+	ifname = jsoncstr(root, ifnamei);
+	nodeid = jsoncstr(root, nodeidi);
+	if(addport(ifname, nodeid, -1, NULL, xsk, NULL, NULL) == NULL){
+		free(ifname);
+		free(nodeid);
+		xskclose(xsk);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *	bridges the host interface ifname onto the switch, with threads
+ *	sockets reading it.
+ */
+static int
+uplinkadd(JsonRoot *root, char *buf, int obji)
+{
+	Uplink *ul;
+	char *ifname, *nodeid;
+	int ifnamei, nodeidi;
+
+	ifnamei = jsonwalk(root, obji, "ifname");
+	nodeidi = jsonwalk(root, obji, "nodeid");
+	if(ifnamei == -1 || nodeidi == -1){
+		fprintf(stderr, "ctrl: add-uplink request without ifname or nodeid\n");
+		return -1;
+	}
+	ifname = jsoncstr(root, ifnamei);
+	if((ul = uplinkopen(ifname, jsonint(root, buf, jsonwalk(root, obji, "threads"), 1))) == NULL){
+		free(ifname);
+		return -1;
+	}
+	nodeid = jsoncstr(root, nodeidi);
+	if(addport(ifname, nodeid, -1, NULL, NULL, ul, NULL) == NULL){
+		free(ifname);
+		free(nodeid);
+		uplinkclose(ul);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *	opens a trunk to other switches, {"listen":"a.b.c.d:port","vni":n,
+ *	"peers":["a.b.c.d:port",...]}. the peers have to be all the other
+ *	switches on the vni, since frames that come in from one are not sent
+ *	on to another.
+ */
+static int
+trunkadd(JsonRoot *root, char *buf, int obji)
+{
+	JsonAst *ast;
+	Vxlan *vx;
+	char *peers[VxlanMaxpeers];
+	char *ifname, *nodeid, *laddr;
+	int i, ifnamei, nodeidi, peersi, npeers, vni;
+
+	ast = root->ast.buf;
+	ifnamei = jsonwalk(root, obji, "ifname");
+	nodeidi = jsonwalk(root, obji, "nodeid");
+	peersi = jsonwalk(root, obji, "peers");
+	vni = jsonint(root, buf, jsonwalk(root, obji, "vni"), -1);
+	if(ifnamei == -1 || nodeidi == -1 || peersi == -1 || ast[peersi].type != '[' || vni < 0){
+		fprintf(stderr, "ctrl: add-trunk request without ifname, nodeid, vni or peers\n");
+		return -1;
+	}
+	npeers = 0;
+	for(i = peersi+1; ast[i].type == JsonString && npeers < nelem(peers); i = ast[i].next)
+		peers[npeers++] = jsoncstr(root, i);
+	laddr = jsoncstr(root, jsonwalk(root, obji, "listen"));
+	vx = vxlanopen(laddr != NULL ? laddr : "0.0.0.0", vni, peers, npeers);
+	free(laddr);
+	for(i = 0; i < npeers; i++)
+		free(peers[i]);
+	if(vx == NULL)
+		return -1;
+
+	ifname = jsoncstr(root, ifnamei);
+	nodeid = jsoncstr(root, nodeidi);
+	if(addport(ifname, nodeid, -1, NULL, NULL, NULL, vx) == NULL){
+		free(ifname);
+		free(nodeid);
+		vxlanclose(vx);
+		return -1;
+	}
+	return 0;
+}
+
+// has agecam tear down every port of a remove-etherfd object at obji.
+static int
+etherremove(JsonRoot *root, int obji)
+{
+	char *nodeid;
+	int i, ncloses, nfound, nodeidi;
+
+	nodeidi = jsonwalk(root, obji, "nodeid");
+	if(nodeidi == -1){
+		fprintf(stderr, "ctrl: remove request without nodeid\n");
+		return -1;
+	}
+	nodeid = jsoncstr(root, nodeidi);
+	ncloses = 0;
+	nfound = 0;
+	for(i = 0; i < nports; i++){
+		Port *port = ports + i;
+		if(!strcmp(nodeid, port->nodeid)){
+			if(__sync_bool_compare_and_swap(&port->state, PortOpen, PortClosing))
+				ncloses++;
+			nfound++;
+		}
+	}
+	if(nfound == 0)
+		fprintf(stderr, "ctrl: remove-etherfd %s: not found\n", nodeid);
+	else if(ncloses == 0)
+		fprintf(stderr, "ctrl: remove-etherfd %s: already state\n", nodeid);
+	free(nodeid);
+	return 0;
+}
+
+/*
+ *	runs a batch of add-etherfd and remove-etherfd operations from the
+ *	array at arri, in order. each add-etherfd takes the next of the fds
+ *	that came with the request, and fds that are left over are closed.
+ *	the answer has a result for every operation, {} or an error, so one
+ *	bad item doesn't fail the rest.
+ */
+static char *
+ctlops(JsonRoot *root, int arri, int *fds, int nfds)
+{
+	JsonAst *ast;
+	char *resp, *err;
+	int i, obji, nops, fdi, off;
+
+	ast = root->ast.buf;
+	nops = 0;
+	for(i = arri+1; ast[i].type == '{'; i = ast[i].next)
+		nops++;
+
+	resp = malloc(sizeof json({"results":[]}) + nops * sizeof json({"error":"unknown op"},));
+	off = sprintf(resp, "{\"results\":[");
+	fdi = 0;
+	for(i = arri+1; ast[i].type == '{'; i = ast[i].next){
+		err = NULL;
+		if((obji = jsonwalk(root, i, "add-etherfd")) != -1){
+			if(fdi == nfds){
+				err = "no fd";
+			} else if(etheradd(root, obji, fds[fdi]) == -1){
+				close(fds[fdi++]);
+				err = "add";
+			} else {
+				fdi++;
+			}
+		} else if((obji = jsonwalk(root, i, "remove-etherfd")) != -1){
+			if(etherremove(root, obji) == -1)
+				err = "remove";
+		} else if((obji = jsonwalk(root, i, "add-xdpport")) != -1){
+			if(xdpadd(root, obji) == -1)
+				err = "add";
+		} else {
+			fprintf(stderr, "ctrl: unknown op in batch\n");
+			err = "unknown op";
+		}
+		if(i != arri+1)
+			resp[off++] = ',';
+		if(err != NULL)
+			off += sprintf(resp + off, "{\"error\":\"%s\"}", err);
+		else
+			off += sprintf(resp + off, "{}");
+	}
+	sprintf(resp + off, "]}");
+
+	for(; fdi < nfds; fdi++)
+		close(fds[fdi]);
+	return resp;
+}
+
+static char *
+fmtport(Port *port)
+{
+	Netemconf *nc = &port->netemconf;
+
+	Xsk *xsk = port->xsk;
+	Vxlan *vx = port->vxlan;
+	char peers[VxlanMaxpeers * 32], ip[INET6_ADDRSTRLEN];
+	char *str, *addrs, *naddrs, *acl;
+	int i, off;
+
+	acl = fmtacl(port->acl);
+	// a trunk has the peers, in order, as the cam refers to them by index.
+	off = 0;
+	for(i = 0; vx != NULL && i < vx->npeers; i++){
+		off += snprintf(peers + off, sizeof peers - off, "%s\"", i > 0 ? "," : "");
+		off += vxlanpeername(vx, i, peers + off, sizeof peers - off);
+		off += snprintf(peers + off, sizeof peers - off, "\"");
+	}
+	peers[off] = '\0';
+	// and a tun the addresses that are routed to it.
+	addrs = strdup("");
+	for(i = 0; port->tun && i < Hostsize; i++){
+		if(g_hosts[i].port != port)
+			continue;
+		inet_ntop(g_hosts[i].version == 4 ? AF_INET : AF_INET6, g_hosts[i].ip, ip, sizeof ip);
+		naddrs = smprintf("%s%s\"%s\"", addrs, addrs[0] != '\0' ? "," : "", ip);
+		free(addrs);
+		addrs = naddrs;
+	}
+	str = smprintf(json({"nodeid":"%s","ifname":"%s","addrs":[%s],"shm":%d,"xdpif":%d,"xdpmode":%d,"uplink":%d,"vni":%d,"peers":[%s],"drops":%llu,"acl":%s,"netem":{"delay":%llu,"jitter":%llu,"rate":%llu,"loss":%u,"reorder":%u,"duplicate":%u,"limit":%d}}),
+		port->nodeid, port->ifname, addrs, port->shm != NULL, xsk != NULL ? xsk->ifindex : 0, xsk != NULL ? xsk->mode : 0,
+		port->uplink != NULL ? port->uplink->nthreads : 0,
+		vx != NULL ? (int)vx->vni : -1, peers,
+		(unsigned long long)port->drops, acl,
+		(unsigned long long)nc->delay, (unsigned long long)nc->jitter, (unsigned long long)nc->rate,
+		nc->loss, nc->reorder, nc->duplicate, nc->limit);
+	free(acl);
+	free(addrs);
+	return str;
+}
+
+/*
+ *	keeps the threads of shared memory and AF_XDP ports off their rings
+ *	while a successor maps them, or lets them back. frames for those
+ *	ports are dropped in the meantime. uplinks are not handed over, so
+ *	they carry on. gives up after HandoffTimeout if
+ *	a thread doesn't get out.
+ */
+static int
+ringhold(int hold)
+{
+	uint64_t deadline;
+	int i;
+
+	for(i = 0; i < nports; i++)
+		ports[i].ringstop = hold && ports[i].uplink == NULL;
+	__sync_synchronize();
+	if(!hold)
+		return 0;
+	deadline = monotime() + HandoffTimeout*1000000000ull;
+	for(i = 0; i < nports; i++){
+		while(ports[i].ringbusy > 0){
+			if(monotime() > deadline){
+				fprintf(stderr, "%s: still busy, not handing off\n", portname(ports+i));
+				ringhold(0);
+				return -1;
+			}
+			usleep(100);
+		}
+	}
+	return 0;
+}
+
+/*
+ *	a frame of the handoff, made while portlock is held and sent after,
+ *	with copies of the fds so that a port closing in between takes none
+ *	of them away.
+ */
+typedef struct Handoff Handoff;
+struct Handoff {
+	Handoff *next;
+	char *msg;
+	int fds[FrameMaxfds];
+	int nfds;
 };
 
-static void *acceptor(void *dsockp);
+static Handoff *
+handoffframe(Handoff ***tailp, char *msg, int *fds, int nfds)
+{
+	Handoff *hp;
+	int i;
 
-static void *
-ctrlhandler(void *actrl)
+	hp = malloc(sizeof hp[0]);
+	hp->next = NULL;
+	hp->msg = msg;
+	for(hp->nfds = 0; hp->nfds < nfds; hp->nfds++){
+		if((hp->fds[hp->nfds] = fcntl(fds[hp->nfds], F_DUPFD_CLOEXEC, 0)) == -1){
+			for(i = 0; i < hp->nfds; i++)
+				close(hp->fds[i]);
+			free(msg);
+			free(hp);
+			return NULL;
+		}
+	}
+	**tailp = hp;
+	*tailp = &hp->next;
+	return hp;
+}
+
+static Handoff *
+handoffports(Handoff ***tailp, char *str, int *fds, int nfds, int nlisten)
+{
+	return handoffframe(tailp, smprintf(json({"ports":[%s],"ctrlsocks":%d}), str, nlisten), fds, nfds);
+}
+
+static void
+handofffree(Handoff *hp)
+{
+	Handoff *next;
+	int i;
+
+	for(; hp != NULL; hp = next){
+		next = hp->next;
+		for(i = 0; i < hp->nfds; i++)
+			close(hp->fds[i]);
+		free(hp->msg);
+		free(hp);
+	}
+}
+
+/*
+ *	hands every open port, the cam and the listening control sockets to
+ *	a new containet on conn, and exits when it says it has them. until
+ *	then this process keeps forwarding on its copies of the fds, so the
+ *	two overlap rather than leave a gap. ports go in frames of up to
+ *	FrameMaxfds fds and CtlMaxmsg bytes, {"ports":[...],"ctrlsocks":n}
+ *	with the fds of the ports first, three for a shared memory port: the
+ *	memfd, the bell containet sleeps on and the other one, and three for
+ *	an AF_XDP port: the socket, its umem and the pass map. paths
+ *	offloaded to the kernel are withdrawn first. a trunk has its udp
+ *	socket, and uplinks have none, the successor opens its own sockets
+ *	on the interface. a last frame has the cam, with ports numbered in
+ *	the order they were sent, and trunk peers by their index, and the
+ *	routes, services and source nat gateway, but not its connections.
+ *	ring ports can't be shared, so they are held from the start instead.
+ *	returns -1 if the successor didn't take them, and carries on as if
+ *	nothing happened.
+ */
+static int
+handoff(Ctlconn *conn)
+{
+	struct timeval tv = {HandoffTimeout, 0};
+	struct pollfd pfd;
+	Ctlconn *lconn;
+	Shmport *shm;
+	Handoff *frames, **tail, *hp;
+	char *str, *nstr, *port, *mac, *routes, *vips, *snat;
+	char ack[64];
+	int fds[FrameMaxfds];
+	int *sent;
+	int i, nfds, nlisten, nsent, fd, nrd;
+
+	// whatever was answered before goes out first.
+	while(conn->outq != NULL){
+		if(ctlflush(conn) == -1)
+			return -1;
+		pfd.fd = conn->fd;
+		pfd.events = POLLOUT;
+		if(conn->outq != NULL && poll(&pfd, 1, HandoffTimeout*1000) != 1)
+			return -1;
+	}
+	// the successor finds its own hot paths.
+	offloaddrop(NULL);
+	if(ringhold(1) == -1)
+		return -1;
+
+	sent = malloc(MaxPorts * sizeof sent[0]);
+	str = strdup("");
+	nfds = 0;
+	nsent = 0;
+	frames = NULL;
+	tail = &frames;
+	pthread_mutex_lock(&portlock);
+	for(i = 0; i < nports; i++){
+		sent[i] = -1;
+		if(ports[i].state != PortOpen)
+			continue;
+		shm = ports[i].shm;
+		// the successor reads frames of up to CtlMaxmsg, and acls make ports long.
+		port = fmtport(ports + i);
+		if(1 + strlen(port) + HandoffWrap > CtlMaxmsg){
+			fprintf(stderr, "handoff: %s doesn't fit in a frame\n", portname(ports + i));
+			free(port);
+			errno = EMSGSIZE;
+			goto fail;
+		}
+		if(nfds + (shm != NULL || ports[i].xsk != NULL ? 3 : ports[i].uplink != NULL ? 0 : 1) > FrameMaxfds
+		|| strlen(str) + 1 + strlen(port) + HandoffWrap > CtlMaxmsg){
+			if(handoffports(&tail, str, fds, nfds, 0) == NULL){
+				free(port);
+				goto fail;
+			}
+			free(str);
+			str = strdup("");
+			nfds = 0;
+		}
+		nstr = smprintf("%s%s%s", str, str[0] != '\0' ? "," : "", port);
+		free(port);
+		free(str);
+		str = nstr;
+		if(shm != NULL){
+			fds[nfds++] = shm->memfd;
+			fds[nfds++] = shm->rxbell;
+			fds[nfds++] = shm->txbell;
+		} else if(ports[i].xsk != NULL){
+			fds[nfds++] = ports[i].xsk->fd;
+			fds[nfds++] = ports[i].xsk->memfd;
+			fds[nfds++] = ports[i].xsk->passfd;
+		} else if(ports[i].vxlan != NULL){
+			fds[nfds++] = ports[i].vxlan->fd;
+		} else if(ports[i].uplink == NULL){
+			fds[nfds++] = ports[i].fd;
+		}
+		sent[i] = nsent++;
+	}
+	nlisten = 0;
+	for(lconn = listeners; lconn != NULL; lconn = lconn->lnext){
+		if(nfds == FrameMaxfds){
+			if(handoffports(&tail, str, fds, nfds, nlisten) == NULL)
+				goto fail;
+			free(str);
+			str = strdup("");
+			nfds = 0;
+			nlisten = 0;
+		}
+		fds[nfds++] = lconn->fd;
+		nlisten++;
+	}
+	if((nfds > 0 || str[0] != '\0') && handoffports(&tail, str, fds, nfds, nlisten) == NULL)
+		goto fail;
+	free(str);
+
+	str = strdup("");
+	for(i = 0; i < Camsize; i++){
+		Cam *cam = g_cams + i;
+		Port *cport = cam->port;
+		if(cport == NULL || sent[cport - ports] == -1)
+			continue;
+		mac = fmtmac(cam->mac);
+		nstr = smprintf(json(%s%s{"mac":"%s","port":%d,"peer":%d}), str, str[0] != '\0' ? "," : "", mac, sent[cport - ports], cam->peer);
+		free(mac);
+		free(str);
+		str = nstr;
+	}
+	pthread_mutex_unlock(&portlock);
+	routes = fmtroutes();
+	vips = fmtvips();
+	snat = fmtsnat();
+	nstr = smprintf(json({"cams":[%s],"routes":%s,"vips":%s,"snat":%s,"done":1}), str, routes, vips, snat);
+	free(snat);
+	free(vips);
+	free(routes);
+	free(str);
+	str = NULL;
+	handoffframe(&tail, nstr, NULL, 0);
+
+	// blocking from here on, so frames that don't fit in the socket wait for room.
+	fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) & ~O_NONBLOCK);
+	setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+	setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+	for(hp = frames; hp != NULL; hp = hp->next){
+		if(sendframefds(conn->fd, hp->fds, hp->nfds, hp->msg, strlen(hp->msg)) == -1)
+			goto fail_unlocked;
+	}
+	handofffree(frames);
+	frames = NULL;
+	free(sent);
+
+	nrd = recvframe(conn->fd, &fd, ack, sizeof ack - 1);
+	if(fd != -1)
+		close(fd);
+	if(nrd <= 0){
+		fprintf(stderr, "handoff: no answer from the successor: %s\n", nrd == 0 ? "eof" : strerror(errno));
+		fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+		ringhold(0);
+		return -1;
+	}
+	fprintf(stderr, "handoff: %d ports taken over, exiting\n", nsent);
+	exit(0);
+
+fail:
+	pthread_mutex_unlock(&portlock);
+fail_unlocked:
+	fprintf(stderr, "handoff: send: %s\n", strerror(errno));
+	fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+	ringhold(0);
+	handofffree(frames);
+	free(str);
+	free(sent);
+	return -1;
+}
+
+/*
+ *	handles one request. buf is nul terminated, fds are the nfds fds that
+ *	came with it, and are either used up or closed. a batch of ops uses
+ *	all of them, other requests only the first. returns the answer, and
+ *	an fd to send with it in *respfdp.
+ */
+static char *
+ctlrequest(Ctlconn *conn, char *buf, int nrd, int *fds, int nfds, int *respfdp)
 {
+	static JsonRoot jsroot;
 	Auth *auth;
-	Ctrlconn *ctrl;
-	JsonRoot jsroot;
-	char buf[256];
-	int fd, newfd;
-	int i, nrd;
+	char *resp, *token;
+	int i, newfd, respfd, obji, tokeni;
+
+	auth = &conn->auth;
+	token = NULL;
+	resp = NULL;
+	respfd = -1;
+	newfd = nfds > 0 ? fds[0] : -1;
+	// batches can be long, the start of one is enough for the log.
+	fprintf(stderr, "ctrl message: '%.*s'%s\n", CtlLogmsg, buf, nrd > CtlLogmsg ? "..." : "");
+
+	jsonparse(&jsroot, buf, nrd);
+
+	tokeni = jsonwalk(&jsroot, 0, "authtoken");
+	if(tokeni == -1){
+		fprintf(stderr, "ctrl: no authtoken in request\n");
+		goto respond_err;
+	}
+	token = jsoncstr(&jsroot, tokeni);
+	if(token == NULL){
+		fprintf(stderr, "ctrl: authtoken is not a string\n");
+		goto respond_err;
+	}
+	if(validtoken(auth, token) != 1){
+		fprintf(stderr, "ctrl: invalid authtoken\n");
+		goto respond_err;
+	}
 
-	ctrl = (Ctrlconn *)actrl;
-	fd = ctrl->fd;
-	auth = &ctrl->auth;
+	obji = jsonwalk(&jsroot, 0, "ops");
+	if(obji != -1 && jsroot.ast.buf[obji].type == '['){
+		resp = ctlops(&jsroot, obji, fds, nfds);
+		newfd = -1;
+		goto respond_ok;
+	}
 
-	memset(&jsroot, 0, sizeof jsroot);
-	for(;;){
-		char *token;
+	obji = jsonwalk(&jsroot, 0, "add-shmport");
+	if(obji != -1){
+		if(nfds != 3){
+			fprintf(stderr, "ctrl: add-shmport with %d fds, wants 3\n", nfds);
+			goto respond_err;
+		}
+		nfds = 0;
+		newfd = -1;
+		if(shmadd(conn, &jsroot, obji, fds) == -1)
+			goto respond_err;
+		goto respond_ok;
+	}
+	for(i = 1; i < nfds; i++)
+		close(fds[i]);
+	nfds = 0;
+
+	obji = jsonwalk(&jsroot, 0, "add-etherfd");
+	if(obji != -1 && newfd != -1){
+		if(etheradd(&jsroot, obji, newfd) == -1)
+			goto respond_err;
+		newfd = -1;
+		goto respond_ok;
+	}
 
-		token = NULL;
-		memset(buf, 0, sizeof buf);
-		nrd = recvfd(fd, &newfd, buf, sizeof buf-1);
-		if(nrd == -1){
-			fprintf(stderr, "recvfd: %s\n", strerror(errno));
-			break;
+	obji = jsonwalk(&jsroot, 0, "remove-etherfd");
+	if(obji != -1){
+		if(etherremove(&jsroot, obji) == -1)
+			goto respond_err;
+		goto respond_ok;
+	}
+
+	obji = jsonwalk(&jsroot, 0, "add-xdpport");
+	if(obji != -1){
+		if(xdpadd(&jsroot, obji) == -1)
+			goto respond_err;
+		goto respond_ok;
+	}
+
+	obji = jsonwalk(&jsroot, 0, "add-uplink");
+	if(obji != -1){
+		if(uplinkadd(&jsroot, buf, obji) == -1)
+			goto respond_err;
+		goto respond_ok;
+	}
+
+	obji = jsonwalk(&jsroot, 0, "add-trunk");
+	if(obji != -1){
+		if(trunkadd(&jsroot, buf, obji) == -1)
+			goto respond_err;
+		goto respond_ok;
+	}
+
+	obji = jsonwalk(&jsroot, 0, "add-ctrlsock");
+	if(obji != -1){
+		char *nodeid;
+		int nodeidi;
+
+		if(newfd == -1){
+			fprintf(stderr, "ctrl: add-ctrlsock without fd\n");
+			goto respond_err;
 		}
-		fprintf(stderr, "ctrl message: '%s'\n", buf);
-		if(nrd == 0)
-			break;
-		if(nrd > 0){
-			int obji, tokeni;
+		nodeidi = jsonwalk(&jsroot, obji, "nodeid");
+		if(nodeidi == -1){
+			fprintf(stderr, "ctrl: add-ctrlsock request without nodeid\n");
+			goto respond_err;
+		}
+		nodeid = jsoncstr(&jsroot, nodeidi);
+		fprintf(stderr, "listening for %s\n", nodeid);
 
-			jsonparse(&jsroot, buf, nrd);
+		if(listen(newfd, 5) == -1){
+			fprintf(stderr, "%s: listen: %s\n", nodeid, strerror(errno));
+			goto respond_err;
+		}
 
-			tokeni = jsonwalk(&jsroot, 0, "authtoken");
-			if(tokeni == -1){
-				fprintf(stderr, "acceptor: no authtoken in request\n");
-				goto respond_err;
-			}
-			token = jsoncstr(&jsroot, tokeni);
-			if(token == NULL){
-				fprintf(stderr, "acceptor: authtoken is not a string\n");
-				goto respond_err;
-			}
-			if(validtoken(auth, token) != 1){
-				fprintf(stderr, "acceptor: invalid authtoken\n");
-				goto respond_err;
-			}
+		if(ctladd(newfd, 1) == NULL)
+			goto respond_err;
+		newfd = -1;
+		goto respond_ok;
+	}
 
-			obji = jsonwalk(&jsroot, 0, "add-etherfd");
-			if(obji != -1 && newfd != -1){
-				Port *port;
-				char *ifname, *nodeid;
-				int ifnamei, nodeidi;
+	obji = jsonwalk(&jsroot, 0, "mirror");
+	if(obji != -1){
+		char *nodeid;
+		int ethertype, nslots, snaplen, nodeidi;
+
+		nodeid = NULL;
+		nodeidi = jsonwalk(&jsroot, obji, "nodeid");
+		if(nodeidi != -1)
+			nodeid = jsoncstr(&jsroot, nodeidi);
+		ethertype = jsonint(&jsroot, buf, jsonwalk(&jsroot, obji, "ethertype"), 0);
+		nslots = jsonint(&jsroot, buf, jsonwalk(&jsroot, obji, "slots"), MirrorSlots);
+		snaplen = jsonint(&jsroot, buf, jsonwalk(&jsroot, obji, "snaplen"), MirrorSnaplen);
+		respfd = mirrorstart(nodeid, ethertype, nslots, snaplen);
+		free(nodeid);
+		if(respfd == -1){
+			fprintf(stderr, "ctrl: mirror: %s\n", strerror(errno));
+			goto respond_err;
+		}
+		goto respond_ok;
+	}
 
-				ifnamei = jsonwalk(&jsroot, obji, "ifname");
-				if(ifnamei == -1){
-					fprintf(stderr, "acceptor: add request without ifname\n");
-					goto respond_err;
-				}
+	obji = jsonwalk(&jsroot, 0, "unmirror");
+	if(obji != -1){
+		pthread_mutex_lock(&portlock);
+		mirrorstop();
+		pthread_mutex_unlock(&portlock);
+		goto respond_ok;
+	}
 
-				nodeidi = jsonwalk(&jsroot, obji, "nodeid");
-				if(nodeidi == -1){
-					fprintf(stderr, "acceptor: add request without nodeid\n");
-					goto respond_err;
-				}
+	obji = jsonwalk(&jsroot, 0, "netem");
+	if(obji != -1){
+		Netemconf conf;
+		char *nodeid;
+		int nodeidi;
 
-				ifname = jsoncstr(&jsroot, ifnamei);
-				nodeid = jsoncstr(&jsroot, nodeidi);
+		nodeidi = jsonwalk(&jsroot, obji, "nodeid");
+		if(nodeidi == -1){
+			fprintf(stderr, "ctrl: netem request without nodeid\n");
+			goto respond_err;
+		}
+		// same units as tc netem: ms, percent and kbit/s.
+		memset(&conf, 0, sizeof conf);
+		conf.delay = jsonfloat(&jsroot, buf, jsonwalk(&jsroot, obji, "delay"), 0) * 1e6;
+		conf.jitter = jsonfloat(&jsroot, buf, jsonwalk(&jsroot, obji, "jitter"), 0) * 1e6;
+		conf.loss = jsonfloat(&jsroot, buf, jsonwalk(&jsroot, obji, "loss"), 0) * 1e4;
+		conf.reorder = jsonfloat(&jsroot, buf, jsonwalk(&jsroot, obji, "reorder"), 0) * 1e4;
+		conf.duplicate = jsonfloat(&jsroot, buf, jsonwalk(&jsroot, obji, "duplicate"), 0) * 1e4;
+		conf.rate = jsonfloat(&jsroot, buf, jsonwalk(&jsroot, obji, "rate"), 0) * 1e3;
+		conf.limit = jsonint(&jsroot, buf, jsonwalk(&jsroot, obji, "limit"), NetemLimit);
+		nodeid = jsoncstr(&jsroot, nodeidi);
+		resp = setnetem(nodeid, &conf);
+		if(resp == NULL){
+			fprintf(stderr, "ctrl: netem %s: not found\n", nodeid);
+			free(nodeid);
+			goto respond_err;
+		}
+		free(nodeid);
+		goto respond_ok;
+	}
 
-				pthread_mutex_lock(&portlock);
-				for(i = 0; i < nports; i++){
-					port = ports + i;
-					if(__sync_bool_compare_and_swap(&port->state, PortClosed, PortOpen)){
-						free(port->nodeid);
-						free(port->ifname);
-						port->ifname = ifname;
-						port->nodeid = nodeid;
-						port->fd = newfd;
-						pthread_create(&port->recvthr, NULL, reader, port);
-						pthread_create(&port->xmitthr, NULL, writer, port);
-						pthread_mutex_unlock(&portlock);
-						break;
-					}
-				}
-				if(i < nports)
-					goto respond_ok;
+	obji = jsonwalk(&jsroot, 0, "set-acl");
+	if(obji != -1){
+		if(aclop(&jsroot, buf, obji) == -1)
+			goto respond_err;
+		goto respond_ok;
+	}
 
-				if(nports == aports){
-					fprintf(stderr, "out of ports\n");
-					pthread_mutex_unlock(&portlock);
-					free(ifname);
-					free(nodeid);
-					goto respond_err;
-				}
+	obji = jsonwalk(&jsroot, 0, "acl");
+	if(obji != -1){
+		char *nodeid;
 
-				port = ports + nports;
-				memset(port, 0, sizeof port[0]);
-				pthread_mutex_init(&port->xmitq.lock, NULL);
-				pthread_mutex_init(&port->freeq.lock, NULL);
-				port->state = PortOpen;
-				port->xmitq.port = port;
-				port->freeq.port = port;
-				port->ifname = ifname;
-				port->nodeid = nodeid;
-				port->fd = newfd;
-				for(i = 0; i < Nbuffers; i++){
-					Buffer *bp;
-					bp = malloc(sizeof bp[0]);
-					memset(bp, 0, sizeof bp[0]);
-					bp->buf = malloc(Bufsize);
-					bp->len = 0;
-					bp->cap = Bufsize;
-					bp->freeq = &port->freeq;
-					if(qput(bp->freeq, bp) == -1)
-						fprintf(stderr, "%s: acceptor: could not qput\n", portname(port));
-				}
-				pthread_create(&port->recvthr, NULL, reader, port);
-				pthread_create(&port->xmitthr, NULL, writer, port);
-				__sync_fetch_and_add(&nports, 1);
-				pthread_mutex_unlock(&portlock);
-				goto respond_ok;
-			}
+		nodeid = jsoncstr(&jsroot, jsonwalk(&jsroot, obji, "nodeid"));
+		if(nodeid == NULL){
+			fprintf(stderr, "ctrl: acl request without nodeid\n");
+			goto respond_err;
+		}
+		resp = fmtacls(nodeid);
+		free(nodeid);
+		goto respond_ok;
+	}
 
-			obji = jsonwalk(&jsroot, 0, "remove-etherfd");
-			if(obji != -1){
-				char *nodeid;
-				int ncloses, nfound, nodeidi;
+	obji = jsonwalk(&jsroot, 0, "subscribe");
+	if(obji != -1){
+		if(subscribe(conn, &jsroot, obji) == -1)
+			goto respond_err;
+		goto respond_ok;
+	}
 
-				nodeidi = jsonwalk(&jsroot, obji, "nodeid");
-				if(nodeidi == -1){
-					fprintf(stderr, "acceptor: remove request without nodeid\n");
-					goto respond_err;
-				}
-				nodeid = jsoncstr(&jsroot, nodeidi);
-				ncloses = 0;
-				nfound = 0;
-				for(i = 0; i < nports; i++){
-					Port *port = ports + i;
-					if(!strcmp(nodeid, port->nodeid)){
-						if(__sync_bool_compare_and_swap(&port->state, PortOpen, PortClosing))
-							ncloses++;
-						nfound++;
-					}
-				}
-				if(nfound == 0)
-					fprintf(stderr, "acceptor: remove-etherfd %s: not found\n", nodeid);
-				else if(ncloses == 0)
-					fprintf(stderr, "acceptor: remove-etherfd %s: already state\n", nodeid);
-				free(nodeid);
-				goto respond_ok;
-			}
+	obji = jsonwalk(&jsroot, 0, "unsubscribe");
+	if(obji != -1){
+		unsubscribe(conn);
+		goto respond_ok;
+	}
 
-			obji = jsonwalk(&jsroot, 0, "add-ctrlsock");
-			if(obji != -1){
-				char *nodeid;
-				int nodeidi;
+	obji = jsonwalk(&jsroot, 0, "takeover");
+	if(obji != -1){
+		if(handoff(conn) == -1)
+			goto respond_err;
+		goto respond_ok;
+	}
 
-				if(newfd == -1){
-					fprintf(stderr, "acceptor: add-ctrlsock without fd\n");
-					goto respond_err;
-				}
-				nodeidi = jsonwalk(&jsroot, obji, "nodeid");
-				if(nodeidi == -1){
-					fprintf(stderr, "acceptor: add-ctrlsock request without nodeid\n");
-					goto respond_err;
-				}
-				nodeid = jsoncstr(&jsroot, nodeidi);
-				fprintf(stderr, "creating acceptor for %s\n", nodeid);
+	obji = jsonwalk(&jsroot, 0, "add-subnet");
+	if(obji != -1){
+		if(routeop(&jsroot, obji, 1, 0) == -1)
+			goto respond_err;
+		goto respond_ok;
+	}
 
-				if(listen(newfd, 5) == -1){
-					fprintf(stderr, "%s: listen: %s\n", nodeid, strerror(errno));
-					goto respond_err;
-				}
+	obji = jsonwalk(&jsroot, 0, "add-route");
+	if(obji != -1){
+		if(routeop(&jsroot, obji, 0, 0) == -1)
+			goto respond_err;
+		goto respond_ok;
+	}
 
-				Ctrlconn *nctrl;
-				nctrl = malloc(sizeof nctrl[0]);
-				memset(nctrl, 0, sizeof nctrl[0]);
-				nctrl->fd = newfd;
-				pthread_create(&nctrl->thr, NULL, acceptor, nctrl);
-				goto respond_ok;
-			}
-			char msg[256];
+	obji = jsonwalk(&jsroot, 0, "remove-route");
+	if(obji != -1){
+		if(routeop(&jsroot, obji, 0, 1) == -1)
+			goto respond_err;
+		goto respond_ok;
+	}
+
+	obji = jsonwalk(&jsroot, 0, "add-snat");
+	if(obji != -1){
+		if(snatop(&jsroot, buf, obji) == -1)
+			goto respond_err;
+		goto respond_ok;
+	}
+
+	obji = jsonwalk(&jsroot, 0, "add-backend");
+	if(obji != -1){
+		if(vipop(&jsroot, buf, obji, 0) == -1)
+			goto respond_err;
+		goto respond_ok;
+	}
+
+	obji = jsonwalk(&jsroot, 0, "remove-backend");
+	if(obji != -1){
+		if(vipop(&jsroot, buf, obji, 1) == -1)
+			goto respond_err;
+		goto respond_ok;
+	}
+
+	obji = jsonwalk(&jsroot, 0, "vips");
+	if(obji != -1){
+		char *vips;
+
+		vips = fmtvips();
+		resp = smprintf(json({"vips":%s}), vips);
+		free(vips);
+		goto respond_ok;
+	}
+
+	obji = jsonwalk(&jsroot, 0, "routes");
+	if(obji != -1){
+		char *mac, *routes, *snat;
+
+		mac = fmtmac(gwmac);
+		routes = fmtroutes();
+		snat = fmtsnat();
+		resp = smprintf(json({"mac":"%s","routes":%s,"snat":%s}), mac, routes, snat);
+		free(snat);
+		free(routes);
+		free(mac);
+		goto respond_ok;
+	}
+
+	obji = jsonwalk(&jsroot, 0, "top-talkers");
+	if(obji != -1){
+		int count;
+
+		count = jsonint(&jsroot, buf, jsonwalk(&jsroot, obji, "count"), 10);
+		if(count < 0)
+			count = 0;
+		if(count > MaxTalkers)
+			count = MaxTalkers;
+		resp = toptalkers(count);
+		goto respond_ok;
+	}
 respond_ok:
-			if(token != NULL)
-				free(token);
-			snprintf(msg, sizeof msg, json({}));
-			write(fd, msg, strlen(msg));
-			continue;
+	if(token != NULL)
+		free(token);
+	if(newfd != -1)
+		close(newfd);
+	if(resp == NULL)
+		resp = strdup(json({}));
+	*respfdp = respfd;
+	return resp;
+
 respond_err:
-			if(token != NULL)
-				free(token);
-			if(newfd != -1)
-				close(newfd);
-			snprintf(msg, sizeof msg, json({"error":"error"}));
-			write(fd, msg, strlen(msg));
+	if(token != NULL)
+		free(token);
+	for(i = 0; i < nfds; i++)
+		close(fds[i]);
+	if(nfds == 0 && newfd != -1)
+		close(newfd);
+	free(resp);
+	*respfdp = -1;
+	return strdup(json({"error":"error"}));
+}
+
+static uint32_t
+ctlhdr(char *p)
+{
+	uint8_t *up = (uint8_t *)p;
+	return ((uint32_t)up[0]<<24) | ((uint32_t)up[1]<<16) | ((uint32_t)up[2]<<8) | up[3];
+}
+
+// handles every complete request read so far. -1 on a protocol error.
+static int
+ctlrequests(Ctlconn *conn)
+{
+	uint32_t len, nfds;
+	int fds[FrameMaxfds];
+	char *msg, *resp;
+	int off, n, respfd;
+
+	for(off = 0; conn->inlen - off >= FrameHdrlen; off += FrameHdrlen + len){
+		len = ctlhdr(conn->in + off);
+		nfds = ctlhdr(conn->in + off + 4);
+		if(len > CtlMaxmsg || nfds > FrameMaxfds){
+			fprintf(stderr, "ctrl: bad frame, %u bytes %u fds\n", len, nfds);
+			return -1;
+		}
+		if(conn->inlen - off < FrameHdrlen + (int)len)
+			break;
+
+		// the fds ride on the header, so they are all here by now.
+		if((int)nfds > conn->nfds){
+			fprintf(stderr, "ctrl: frame wants %u fds, %d came\n", nfds, conn->nfds);
+			return -1;
 		}
+		n = nfds;
+		memcpy(fds, conn->fds, n * sizeof fds[0]);
+		conn->nfds -= n;
+		memmove(conn->fds, conn->fds + n, conn->nfds * sizeof conn->fds[0]);
+		msg = malloc(len + 1);
+		memcpy(msg, conn->in + off + FrameHdrlen, len);
+		msg[len] = '\0';
+		resp = ctlrequest(conn, msg, len, fds, n, &respfd);
+		ctlrespond(conn, resp, respfd);
+		free(resp);
+		free(msg);
 	}
-	close(fd);
-	free(ctrl);
-	return NULL;
+	conn->inlen -= off;
+	memmove(conn->in, conn->in + off, conn->inlen);
+	return 0;
 }
 
-static void *
-acceptor(void *actrl)
+// reads what there is. -1 when the connection is done for.
+static int
+ctlread(Ctlconn *conn)
+{
+	int nrd, nfds;
+
+	while(conn->outlen < CtlMaxout){
+		if(conn->incap - conn->inlen < CtlReadsize){
+			conn->incap = conn->inlen + 2*CtlReadsize;
+			conn->in = realloc(conn->in, conn->incap);
+		}
+		// more fds than fit fails with EMSGSIZE, which ends the connection.
+		nrd = recvfds(conn->fd, conn->in + conn->inlen, conn->incap - conn->inlen,
+			conn->fds + conn->nfds, nelem(conn->fds) - conn->nfds, &nfds);
+		conn->nfds += nfds;
+		if(nrd == -1){
+			if(errno == EAGAIN || errno == EINTR)
+				return 0;
+			fprintf(stderr, "ctrl: recv: %s\n", strerror(errno));
+			return -1;
+		}
+		if(nrd == 0)
+			return -1;
+		conn->inlen += nrd;
+		if(ctlrequests(conn) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static void
+ctlaccept(Ctlconn *lconn)
 {
-	Ctrlconn *ctrl;
-	Ctrlconn *nctrl;
 	int fd;
 
-	ctrl = (Ctrlconn *)actrl;
 	for(;;){
-		if((fd = accept(ctrl->fd, NULL, NULL)) == -1){
-			fprintf(stderr, "accept: %s\n", strerror(errno));
+		if((fd = accept4(lconn->fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC)) == -1){
+			if(errno != EAGAIN && errno != EINTR)
+				fprintf(stderr, "accept: %s\n", strerror(errno));
+			return;
+		}
+		if(ctladd(fd, 0) == NULL)
+			close(fd);
+	}
+}
+
+static void
+ctlinit(void)
+{
+	struct epoll_event ev;
+
+	if((ctlepfd = epoll_create1(EPOLL_CLOEXEC)) == -1){
+		fprintf(stderr, "epoll_create1: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	// the event ring goes in the set as a NULL connection.
+	memset(&ev, 0, sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if(epoll_ctl(ctlepfd, EPOLL_CTL_ADD, events.fd, &ev) == -1){
+		fprintf(stderr, "epoll_ctl: %s\n", strerror(errno));
+		exit(1);
+	}
+	evringarm(&events);
+}
+
+static void
+ctlloop(void)
+{
+	struct epoll_event evs[64];
+	Ctlconn *conn;
+	int i, n;
+
+	for(;;){
+		if((n = epoll_wait(ctlepfd, evs, nelem(evs), -1)) == -1){
+			if(errno != EINTR)
+				fprintf(stderr, "epoll_wait: %s\n", strerror(errno));
 			continue;
 		}
-		nctrl = malloc(sizeof nctrl[0]);
-		memset(nctrl, 0, sizeof nctrl[0]);
-		nctrl->fd = fd;
-		pthread_create(&nctrl->thr, NULL, ctrlhandler, nctrl);
+		for(i = 0; i < n; i++){
+			conn = evs[i].data.ptr;
+			if(conn == NULL){
+				subdispatch();
+				continue;
+			}
+			if(conn->listening){
+				ctlaccept(conn);
+				continue;
+			}
+			if((evs[i].events & EPOLLIN) && ctlread(conn) == -1){
+				ctlclose(conn);
+				continue;
+			}
+			if(ctlflush(conn) == -1 || (evs[i].events & (EPOLLERR|EPOLLHUP) && !(evs[i].events & EPOLLIN))){
+				ctlclose(conn);
+				continue;
+			}
+			if(conn->subscribed)
+				subflush(conn);
+			ctlevents(conn);
+		}
+	}
+}
+
+static int
+takeports(JsonRoot *root, char *buf, int *fds, int nfds, Port **took, int *ntookp)
+{
+	JsonAst *ast;
+	Netemconf conf;
+	Shmport *shm;
+	Xsk *xsk;
+	Uplink *ul;
+	Vxlan *vx;
+	Port *port;
+	char *peers[VxlanMaxpeers];
+	char *ifname, *nodeid;
+	int i, j, fdi, netemi, acli, portsi, peersi, nlisten, xdpif, xdpmode, nthreads, vni, npeers;
+
+	ast = root->ast.buf;
+	fdi = 0;
+	if((portsi = jsonwalk(root, 0, "ports")) != -1 && ast[portsi].type == '['){
+		for(i = portsi+1; ast[i].type == '{'; i = ast[i].next){
+			ifname = jsoncstr(root, jsonwalk(root, i, "ifname"));
+			nodeid = jsoncstr(root, jsonwalk(root, i, "nodeid"));
+			shm = NULL;
+			xsk = NULL;
+			ul = NULL;
+			vx = NULL;
+			xdpif = jsonint(root, buf, jsonwalk(root, i, "xdpif"), 0);
+			nthreads = jsonint(root, buf, jsonwalk(root, i, "uplink"), 0);
+			vni = jsonint(root, buf, jsonwalk(root, i, "vni"), -1);
+			if(jsonint(root, buf, jsonwalk(root, i, "shm"), 0)){
+				if(fdi + 3 > nfds || (shm = shmportopen(fds[fdi], fds[fdi+1], fds[fdi+2])) == NULL){
+					fprintf(stderr, "takeover: could not map shm port %d\n", *ntookp);
+					return -1;
+				}
+				fdi += 2;
+			} else if(xdpif > 0){
+				xdpmode = jsonint(root, buf, jsonwalk(root, i, "xdpmode"), 0);
+				if(fdi + 3 > nfds || (xsk = xskadopt(fds[fdi], fds[fdi+1], fds[fdi+2], xdpif, xdpmode)) == NULL){
+					fprintf(stderr, "takeover: could not map xdp port %d\n", *ntookp);
+					return -1;
+				}
+				fdi += 2;
+			} else if(nthreads > 0){
+				if(ifname == NULL || (ul = uplinkopen(ifname, nthreads)) == NULL){
+					fprintf(stderr, "takeover: could not open uplink %d\n", *ntookp);
+					return -1;
+				}
+				fdi--;
+			} else if(vni >= 0){
+				npeers = 0;
+				if((peersi = jsonwalk(root, i, "peers")) != -1 && ast[peersi].type == '[')
+					for(j = peersi+1; ast[j].type == JsonString && npeers < nelem(peers); j = ast[j].next)
+						peers[npeers++] = jsoncstr(root, j);
+				if(fdi < nfds)
+					vx = vxlanadopt(fds[fdi], vni, peers, npeers);
+				for(j = 0; j < npeers; j++)
+					free(peers[j]);
+				if(vx == NULL){
+					fprintf(stderr, "takeover: could not adopt trunk %d\n", *ntookp);
+					return -1;
+				}
+			} else if(fdi >= nfds){
+				fprintf(stderr, "takeover: no fd for port %d\n", *ntookp);
+				return -1;
+			}
+			if(ifname == NULL || nodeid == NULL || (port = addport(ifname, nodeid, shm != NULL || xsk != NULL || ul != NULL || vx != NULL ? -1 : fds[fdi], shm, xsk, ul, vx)) == NULL){
+				fprintf(stderr, "takeover: could not add port %d\n", *ntookp);
+				return -1;
+			}
+			fdi++;
+			took[(*ntookp)++] = port;
+			if(port->tun && hostsadd(root, i, port) == -1)
+				return -1;
+			port->drops = jsonu64(root, buf, jsonwalk(root, i, "drops"), 0);
+			if((netemi = jsonwalk(root, i, "netem")) != -1){
+				memset(&conf, 0, sizeof conf);
+				conf.delay = jsonu64(root, buf, jsonwalk(root, netemi, "delay"), 0);
+				conf.jitter = jsonu64(root, buf, jsonwalk(root, netemi, "jitter"), 0);
+				conf.rate = jsonu64(root, buf, jsonwalk(root, netemi, "rate"), 0);
+				conf.loss = jsonint(root, buf, jsonwalk(root, netemi, "loss"), 0);
+				conf.reorder = jsonint(root, buf, jsonwalk(root, netemi, "reorder"), 0);
+				conf.duplicate = jsonint(root, buf, jsonwalk(root, netemi, "duplicate"), 0);
+				conf.limit = jsonint(root, buf, jsonwalk(root, netemi, "limit"), NetemLimit);
+				if(netemactive(&conf)){
+					pthread_mutex_lock(&portlock);
+					port->netemconf = conf;
+					port->netemgen++;
+					pthread_mutex_unlock(&portlock);
+				}
+			}
+			if((acli = jsonwalk(root, i, "acl")) != -1 && jsonwalk(root, acli, "default") != -1){
+				pthread_mutex_lock(&portlock);
+				aclset(port, aclmake(root, buf, acli, 1));
+				pthread_mutex_unlock(&portlock);
+			}
+		}
+	}
+	nlisten = jsonint(root, buf, jsonwalk(root, 0, "ctrlsocks"), 0);
+	for(; nlisten > 0 && fdi < nfds; nlisten--)
+		if(ctladd(fds[fdi++], 1) == NULL)
+			return -1;
+	if(fdi != nfds){
+		fprintf(stderr, "takeover: %d fds left over\n", nfds - fdi);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+takecams(JsonRoot *root, char *buf, Port **took, int ntook)
+{
+	JsonAst *ast;
+	uint8_t mac[6];
+	char *str;
+	int i, camsi, idx;
+
+	ast = root->ast.buf;
+	if((camsi = jsonwalk(root, 0, "cams")) == -1 || ast[camsi].type != '[')
+		return;
+	for(i = camsi+1; ast[i].type == '{'; i = ast[i].next){
+		idx = jsonint(root, buf, jsonwalk(root, i, "port"), -1);
+		str = jsoncstr(root, jsonwalk(root, i, "mac"));
+		if(str != NULL && idx >= 0 && idx < ntook &&
+				sscanf(str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", mac, mac+1, mac+2, mac+3, mac+4, mac+5) == 6)
+			camlearn(g_cams, mac, took[idx], jsonint(root, buf, jsonwalk(root, i, "peer"), 0));
+		free(str);
+	}
+}
+
+/*
+ *	asks the containet on path for its ports, starts forwarding on them
+ *	and tells it to go. see handoff for the other side.
+ */
+static int
+takeover(char *path, char *authtoken)
+{
+	static JsonRoot root;
+	struct timespec t0, t1;
+	Port **took;
+	char *buf, *req;
+	int fds[FrameMaxfds];
+	int fd, nfds, nrd, ntook;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if((fd = unsocket(SOCK_STREAM, NULL, path)) == -1)
+		return -1;
+	req = smprintf(json({"authtoken":"%s","takeover":{}}), authtoken);
+	if(sendframe(fd, -1, req, strlen(req)) == -1){
+		fprintf(stderr, "takeover: send: %s\n", strerror(errno));
+		free(req);
+		close(fd);
+		return -1;
+	}
+	free(req);
+
+	buf = malloc(CtlMaxmsg + 1);
+	took = malloc(MaxPorts * sizeof took[0]);
+	ntook = 0;
+	for(;;){
+		nrd = recvframefds(fd, fds, nelem(fds), &nfds, buf, CtlMaxmsg);
+		if(nrd <= 0){
+			fprintf(stderr, "takeover: recv: %s\n", nrd == 0 ? "eof" : strerror(errno));
+			goto fail;
+		}
+		buf[nrd] = '\0';
+		jsonparse(&root, buf, nrd);
+		if(jsonwalk(&root, 0, "error") != -1){
+			fprintf(stderr, "takeover: refused: %s\n", buf);
+			goto fail;
+		}
+		if(takeports(&root, buf, fds, nfds, took, &ntook) == -1)
+			goto fail;
+		if(jsonwalk(&root, 0, "done") != -1){
+			takecams(&root, buf, took, ntook);
+			takeroutes(&root, buf);
+			break;
+		}
+	}
+	if(sendframe(fd, -1, "{}", 2) == -1){
+		fprintf(stderr, "takeover: could not tell %s to go: %s\n", path, strerror(errno));
+		goto fail;
 	}
+	close(fd);
+	free(took);
+	free(buf);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	fprintf(stderr, "took over %d ports from %s in %.1f ms\n", ntook, path,
+		(t1.tv_sec - t0.tv_sec)*1e3 + (t1.tv_nsec - t0.tv_nsec)/1e6);
+	return 0;
 
-	close(ctrl->fd);
-	free(ctrl);
-	return NULL;
+fail:
+	// the old switch still has everything, and these are its fds too.
+	close(fd);
+	return -1;
 }
 
 static void
@@ -613,7 +3920,7 @@ int
 main(int argc, char *argv[])
 {
 	struct sigaction sa;
-	char *swtchname;
+	char *swtchname, *oldname, *authtoken;
 	int opt;
 	int dsock;
 
@@ -626,37 +3933,64 @@ main(int argc, char *argv[])
 	}
 
 	swtchname = NULL;
-	while((opt = getopt(argc, argv, "s:")) != -1) {
+	oldname = NULL;
+	authtoken = "containet";
+	while((opt = getopt(argc, argv, "s:T:a:O:5")) != -1) {
 		switch(opt){
 		case 's':
 			swtchname = optarg;
 			break;
+		case 'T':
+			oldname = optarg;
+			break;
+		case 'a':
+			authtoken = optarg;
+			break;
+		case '5':
+			fivetuple = 1;
+			break;
+		case 'O':
+			offloadpps = atoi(optarg);
+			break;
 		default:
 		caseusage:
-			fprintf(stderr, "usage: %s -s path/to/switch-sock\n", argv[0]);
+			fprintf(stderr, "usage: %s [-5] [-a authtoken] [-O pps] -s path/to/switch-sock | -T path/to/old-switch-sock\n", argv[0]);
 			exit(1);
 		}
 	}
-	if(swtchname == NULL)
+	if(swtchname == NULL && oldname == NULL)
 		goto caseusage;
 
-	if((dsock = unsocket(SOCK_STREAM, swtchname, NULL)) == -1){
-		fprintf(stderr, "could not post %s\n", swtchname);
-		goto caseusage;
+	sketchinit(talkers + 0);
+	sketchinit(talkers + 1);
+	if(evringinit(&events, EvringSize) == -1){
+		fprintf(stderr, "could not make the event ring: %s\n", strerror(errno));
+		exit(1);
 	}
+	ctlinit();
 
-	if(listen(dsock, 5) == -1){
-		fprintf(stderr, "could not listen %s\n", swtchname);
-		goto caseusage;
-	}
+	// a successor gets the listening sockets with the ports.
+	if(oldname != NULL){
+		if(takeover(oldname, authtoken) == -1){
+			fprintf(stderr, "could not take over from %s\n", oldname);
+			exit(1);
+		}
+	} else {
+		if((dsock = unsocket(SOCK_STREAM, swtchname, NULL)) == -1){
+			fprintf(stderr, "could not post %s\n", swtchname);
+			goto caseusage;
+		}
 
+		if(listen(dsock, 5) == -1){
+			fprintf(stderr, "could not listen %s\n", swtchname);
+			goto caseusage;
+		}
+		if(ctladd(dsock, 1) == NULL)
+			exit(1);
+	}
 	pthread_create(&agethr, NULL, agecam, NULL);
 
-	Ctrlconn *nctrl;
-	nctrl = malloc(sizeof nctrl[0]);
-	memset(nctrl, 0, sizeof nctrl[0]);
-	nctrl->fd = dsock;
-	acceptor((void*)nctrl);
+	ctlloop();
 
 	return 0;
 }
@@ -27,8 +27,12 @@
 #include "smprintf.h"
 #include "seccomp.h"
 #include "container.h"
+#include "json.h"
 
 #include <sys/syscall.h> /* For SYS_xxx definitions, pivot_root.. */
+#include <sys/epoll.h>
+#include <signal.h>
+#include <time.h>
 
 // not sure this is in the standard, but it is too handy for json templating to ignore.
 #define json(...) #__VA_ARGS__
@@ -37,6 +41,46 @@ static char *authtoken;
 static char *swtchname;
 static char *identity;
 
+// with -T, what the start and teardown took.
+static Args *timed;
+static uint64_t tmain, tstarted, texited;
+
+static char *phasenames[NPhases] = {
+	[PhaseClone] = "clone",
+	[PhaseTun] = "tun",
+	[PhaseSendfd] = "sendfd",
+	[PhaseMount] = "mount",
+	[PhasePivot] = "pivot",
+	[PhaseMounts] = "mounts",
+	[PhaseMknod] = "mknod",
+	[PhasePost] = "post",
+	[PhaseExec] = "exec",
+};
+
+static uint64_t
+monotime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+// one json line of microseconds, the phases and all of start and teardown.
+static void
+printtimes(void)
+{
+	int i;
+
+	fprintf(stderr, "{\"identity\":\"%s\"", identity);
+	for(i = 0; i < NPhases; i++)
+		fprintf(stderr, ",\"%s\":%.1f", phasenames[i], timed->phases[i]/1e3);
+	fprintf(stderr, ",\"start\":%.1f", (tstarted-tmain)/1e3);
+	if(texited != 0)
+		fprintf(stderr, ",\"teardown\":%.1f", (monotime()-texited)/1e3);
+	fprintf(stderr, "}\n");
+}
+
 static void
 die(int sig)
 {
@@ -60,19 +104,22 @@ die(int sig)
 			identity
 		);
 		len = strlen(buf);
-		if(write(ctrlsock, buf, len) != len){
+		if(sendframe(ctrlsock, -1, buf, len) != len){
 			fprintf(stderr, "failed to send: '%s' to switch: %s\n", buf, strerror(errno));
 		}
 		free(buf);
 
 		// read response
+		int respfd;
 		buf = malloc(256);
-		if(read(ctrlsock, buf, 256) == -1)
+		if(recvframe(ctrlsock, &respfd, buf, 256) == -1)
 			fprintf(stderr, "failed to read response: %s\n", strerror(errno));
 		free(buf);
 
 		close(ctrlsock);
 	}
+	if(timed != NULL && tstarted != 0)
+		printtimes();
 	exit(sig);
 }
 
@@ -114,15 +161,935 @@ strid(char *str)
 	return id;
 }
 
+// a fresh random identity, or NULL.
+static char *
+randomid(void)
+{
+	char *str;
+	uint64_t id;
+	int rndfd;
+
+	rndfd = open("/dev/urandom", O_RDONLY|O_CLOEXEC);
+	if(rndfd == -1){
+		fprintf(stderr, "open /dev/urandom: %s\n", strerror(errno));
+		return NULL;
+	}
+	if(read(rndfd, &id, sizeof id) != sizeof id){
+		fprintf(stderr, "read /dev/urandom: %s\n", strerror(errno));
+		close(rndfd);
+		return NULL;
+	}
+	close(rndfd);
+	str = idstr(id);
+	if(strid(str) != id){
+		fprintf(stderr, "strid-idstr scheme is broken\n");
+		exit(1);
+	}
+	return str;
+}
+
+/*
+ *	with -D, containode stays up and starts containers for whoever asks
+ *	on its socket, watching all of them from one epoll set with a pidfd
+ *	for each. a container talks to containet through a socketpair to us,
+ *	and we pass its requests on over the one connection we keep to
+ *	containet. that answers in order, so the answers go back the same way.
+ *	the requests that come in one round of events go out together, with
+ *	the ports added and removed in one ops request where they can be.
+ */
+enum {
+	WatchListen = 0,
+	WatchClient,
+	WatchSwitch,
+	WatchRelay,
+	WatchTube,
+	WatchPidfd,
+
+	MaxMsg = 4096,
+	MaxArgs = 256,
+	MaxOutbox = 256,
+};
+
+typedef struct Watch Watch;
+typedef struct Node Node;
+typedef struct Pending Pending;
+typedef struct Outmsg Outmsg;
+typedef struct Spec Spec;
+
+struct Watch {
+	int kind;
+	int fd; // -1 once it is closed
+	Node *node; // for relays, tubes and pidfds
+	Watch *next; // for clients, in gone
+};
+
+struct Node {
+	Args args;
+	int pid;
+	Watch relay; // our end of its socketpair for containet
+	Watch tube;
+	Watch pidfd;
+	Watch *client; // who started it, NULL once they are gone
+	Node *next;
+};
+
+// a request passed on to containet, waiting for its answer.
+struct Pending {
+	Pending *next;
+	int n; // more than one for a batch
+	Node *nodes[]; // the answers go to, NULL for our own
+};
+
+// a request for containet, until the end of the round.
+struct Outmsg {
+	Node *node; // NULL for our own
+	int fd; // goes with it, or -1
+	char *msg;
+	int len;
+	char *op; // its op alone, if it can go in a batch
+	char *authtoken; // of the batch it can go in
+};
+
+/*
+ *	with -B, the containers of a spec file, started parallel at a time
+ *	until count of them have, with their addresses counting up from ip4.
+ */
+struct Spec {
+	int count;
+	int parallel;
+	int argc;
+	char **argv;
+	char *root;
+	char *top; // directory of their top dirs, or NULL
+	char *prefix; // of their identities, or NULL for random ones
+	char *gateway;
+	char *authtoken;
+	uint32_t ip4; // host order, 0 for none
+	int ip4len; // -1 for no /len
+	uint64_t idbase;
+
+	int next;
+	int starting;
+	int started;
+	int failed;
+	int exited;
+	int nonzero;
+	uint64_t t0;
+	uint64_t tstarted;
+};
+
+static int epfd = -1;
+static int dflags; // clone flags of the containers
+static int dxdp, dl3, dhostns = -1, ddevfd = -1;
+static Watch swtch = { .fd = -1 };
+static Node *nodes;
+static Pending *pending, **pendtail = &pending;
+static Outmsg outbox[MaxOutbox];
+static int noutbox;
+static Spec *spec;
+
+// freed after the events they might still have in a batch.
+static Node *gonenodes;
+static Watch *goneclients;
+
+static int
+watch(Watch *w, int kind, int fd, Node *node)
+{
+	struct epoll_event ev;
+
+	w->kind = kind;
+	w->fd = fd;
+	w->node = node;
+	memset(&ev, 0, sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.ptr = w;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1){
+		fprintf(stderr, "epoll_ctl: %s\n", strerror(errno));
+		w->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static void
+unwatch(Watch *w)
+{
+	if(w->fd == -1)
+		return;
+	epoll_ctl(epfd, EPOLL_CTL_DEL, w->fd, NULL);
+	close(w->fd);
+	w->fd = -1;
+}
+
+static void
+reply(Watch *client, char *msg)
+{
+	if(client != NULL && client->fd != -1 && sendframe(client->fd, -1, msg, strlen(msg)) == -1)
+		fprintf(stderr, "containode: reply: %s\n", strerror(errno));
+	free(msg);
+}
+
+// an optional string from the launch object at obji, NULL when absent.
+static char *
+launchstr(JsonRoot *root, int obji, char *key)
+{
+	int off;
+
+	if((off = jsonwalk(root, obji, key)) == -1 || root->ast.buf[off].type != JsonString)
+		return NULL;
+	return jsoncstr(root, off);
+}
+
+// sends a request to containet, with the answers going to the n nodes.
+static void
+sendswitch(Node **nodes, int n, int *fds, int nfds, char *msg, int len)
+{
+	Pending *pp;
+
+	if(sendframefds(swtch.fd, fds, nfds, msg, len) == -1){
+		fprintf(stderr, "containode: lost the switch: %s\n", strerror(errno));
+		exit(1);
+	}
+	pp = malloc(sizeof pp[0] + n * sizeof pp->nodes[0]);
+	pp->next = NULL;
+	pp->n = n;
+	memcpy(pp->nodes, nodes, n * sizeof nodes[0]);
+	*pendtail = pp;
+	pendtail = &pp->next;
+}
+
+/*
+ *	the op of a request that has nothing but its authtoken and the one
+ *	op, as an object of its own for an ops array, or NULL if it is some
+ *	other kind of request.
+ */
+static char *
+opslice(char *buf, char **authtokenp)
+{
+	static char *ops[] = {"add-etherfd", "remove-etherfd", "add-xdpport"};
+	static JsonRoot root;
+	JsonAst *ast;
+	char *op;
+	int i, n, obji, endi, tokeni;
+
+	*authtokenp = NULL;
+	if(jsonparse(&root, buf, strlen(buf)) == -1 || root.ast.buf[0].type != '{')
+		return NULL;
+	ast = root.ast.buf;
+	n = 0;
+	for(i = 1; ast[i].type != '}'; i = ast[ast[i].next].next)
+		n++;
+	if(n != 2 || (tokeni = jsonwalk(&root, 0, "authtoken")) == -1 || ast[tokeni].type != JsonString)
+		return NULL;
+	op = NULL;
+	obji = -1;
+	for(i = 0; i < nelem(ops) && obji == -1; i++)
+		if((obji = jsonwalk(&root, 0, ops[i])) != -1)
+			op = ops[i];
+	if(obji == -1 || ast[obji].type != '{')
+		return NULL;
+	// the op's object runs from its { to the } that closes it.
+	for(endi = obji+1; ast[endi].type != '}'; endi = ast[ast[endi].next].next)
+		;
+	*authtokenp = jsoncstr(&root, tokeni);
+	return smprintf("{\"%s\":%.*s}", op, ast[endi].off + 1 - ast[obji].off, buf + ast[obji].off);
+}
+
+/*
+ *	sends what is in the outbox, with runs of ops of one authtoken going
+ *	as one request, up to the fds one frame can carry.
+ */
+static void
+flushout(void)
+{
+	Node *batch[MaxOutbox];
+	int fds[FrameMaxfds];
+	char *msg, *nmsg;
+	int i, j, k, nfds;
+
+	for(i = 0; i < noutbox; i = j){
+		nfds = 0;
+		for(j = i; j < noutbox && outbox[j].op != NULL; j++){
+			if(strcmp(outbox[j].authtoken, outbox[i].authtoken) != 0)
+				break;
+			if(outbox[j].fd != -1 && nfds == FrameMaxfds)
+				break;
+			if(outbox[j].fd != -1)
+				fds[nfds++] = outbox[j].fd;
+		}
+		if(j - i < 2){
+			j = i+1;
+			sendswitch(&outbox[i].node, 1, &outbox[i].fd, outbox[i].fd != -1, outbox[i].msg, outbox[i].len);
+		} else {
+			msg = smprintf("{\"authtoken\":\"%s\",\"ops\":[", outbox[i].authtoken);
+			for(k = i; k < j; k++){
+				nmsg = smprintf("%s%s%s", msg, k != i ? "," : "", outbox[k].op);
+				free(msg);
+				msg = nmsg;
+				batch[k-i] = outbox[k].node;
+			}
+			nmsg = smprintf("%s]}", msg);
+			free(msg);
+			msg = nmsg;
+			sendswitch(batch, j-i, fds, nfds, msg, strlen(msg));
+			free(msg);
+		}
+		for(k = i; k < j; k++){
+			if(outbox[k].fd != -1)
+				close(outbox[k].fd);
+			free(outbox[k].msg);
+			free(outbox[k].op);
+			free(outbox[k].authtoken);
+		}
+	}
+	noutbox = 0;
+}
+
+// queues a request for containet, with its answer going to node.
+static void
+relayout(Node *node, int passfd, char *buf, int len)
+{
+	Outmsg *om;
+	int i;
+
+	if(noutbox == MaxOutbox)
+		flushout();
+	om = outbox + noutbox++;
+	om->node = node;
+	om->fd = passfd;
+	om->msg = malloc(len + 1);
+	memcpy(om->msg, buf, len);
+	om->msg[len] = '\0';
+	om->len = len;
+	om->op = NULL;
+	om->authtoken = NULL;
+	for(i = 0; i < len && buf[i] != '\0'; i++)
+		;
+	if(i == len)
+		om->op = opslice(om->msg, &om->authtoken);
+}
+
+// hands an answer from containet to whoever asked, a result each for a batch.
+static void
+relayin(void)
+{
+	static JsonRoot root;
+	JsonAst *ast;
+	Pending *pp;
+	Node *node;
+	char buf[MaxMsg], *err, *res;
+	int i, k, nrd, passfd, resultsi;
+
+	if((nrd = recvframe(swtch.fd, &passfd, buf, sizeof buf - 1)) <= 0 || (pp = pending) == NULL){
+		fprintf(stderr, "containode: lost the switch\n");
+		exit(1);
+	}
+	if(passfd != -1)
+		close(passfd);
+	if((pending = pp->next) == NULL)
+		pendtail = &pending;
+	buf[nrd] = '\0';
+	resultsi = -1;
+	if(pp->n > 1 && jsonparse(&root, buf, nrd) != -1 && (resultsi = jsonwalk(&root, 0, "results")) != -1 && root.ast.buf[resultsi].type != '[')
+		resultsi = -1;
+	ast = root.ast.buf;
+	i = resultsi != -1 ? resultsi+1 : -1;
+	for(k = 0; k < pp->n; k++){
+		res = NULL;
+		if(resultsi != -1 && ast[i].type == '{'){
+			if((err = launchstr(&root, i, "error")) != NULL)
+				res = smprintf(json({"error":"%s"}), err);
+			else
+				res = strdup(json({}));
+			free(err);
+			i = ast[i].next;
+		}
+		node = pp->nodes[k];
+		if(node != NULL && node->relay.fd != -1){
+			if(res != NULL)
+				sendframe(node->relay.fd, -1, res, strlen(res));
+			else
+				sendframe(node->relay.fd, -1, buf, nrd);
+		}
+		free(res);
+	}
+	free(pp);
+}
+
+static void
+relay(Node *node)
+{
+	char buf[MaxMsg];
+	int nrd, passfd;
+
+	if((nrd = recvframe(node->relay.fd, &passfd, buf, sizeof buf)) <= 0){
+		unwatch(&node->relay);
+		return;
+	}
+	relayout(node, passfd, buf, nrd);
+}
+
+static void
+nodefree(Node *node)
+{
+	Node **npp;
+	Pending *pp;
+	int i;
+
+	unwatch(&node->relay);
+	unwatch(&node->tube);
+	unwatch(&node->pidfd);
+	for(npp = &nodes; *npp != NULL; npp = &(*npp)->next){
+		if(*npp == node){
+			*npp = node->next;
+			break;
+		}
+	}
+	for(pp = pending; pp != NULL; pp = pp->next)
+		for(i = 0; i < pp->n; i++)
+			if(pp->nodes[i] == node)
+				pp->nodes[i] = NULL;
+	for(i = 0; i < noutbox; i++)
+		if(outbox[i].node == node)
+			outbox[i].node = NULL;
+	node->next = gonenodes;
+	gonenodes = node;
+	for(i = 0; i < node->args.argc; i++)
+		free(node->args.argv[i]);
+	free(node->args.argv);
+	free(node->args.root);
+	free(node->args.toproot);
+	free(node->args.ip4addr);
+	free(node->args.gateway);
+	free(node->args.identity);
+	free(node->args.postname);
+	free(node->args.authtoken);
+}
+
+static int
+goodid(char *id)
+{
+	size_t i, n;
+
+	n = strlen(id);
+	if(n == 0 || n > 63)
+		return 0;
+	for(i = 0; i < n; i++)
+		if(strchr("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._-", id[i]) == NULL)
+			return 0;
+	return 1;
+}
+
+static Node *
+nodenew(void)
+{
+	Node *node;
+
+	node = malloc(sizeof node[0]);
+	memset(node, 0, sizeof node[0]);
+	node->relay.fd = -1;
+	node->tube.fd = -1;
+	node->pidfd.fd = -1;
+	node->args.argv = malloc(MaxArgs * sizeof node->args.argv[0]);
+	node->args.argv[0] = NULL;
+	node->args.ctrlsock = -1;
+	node->args.xdp = dxdp;
+	node->args.l3 = dl3;
+	node->args.hostns = dhostns;
+	node->args.netns = -1;
+	node->args.tapfd = -1;
+	node->args.devfd = ddevfd;
+	return node;
+}
+
+// starts the container of node, or answers why not and frees it.
+static int
+nodestart(Node *node)
+{
+	Node *other;
+	char *err;
+	int sv[2], pidfd;
+
+	err = NULL;
+	if(node->args.identity == NULL)
+		node->args.identity = randomid();
+	if(node->args.argc == 0)
+		err = "no argv";
+	else if(node->args.identity == NULL || !goodid(node->args.identity))
+		err = "bad identity";
+	else if(node->args.postname != NULL && swtch.fd == -1)
+		err = "post without switch";
+	for(other = nodes; err == NULL && other != NULL; other = other->next)
+		if(!strcmp(other->args.identity, node->args.identity))
+			err = "identity in use";
+	if(err != NULL){
+		fprintf(stderr, "containode: %s: %s\n", node->args.identity != NULL ? node->args.identity : "launch", err);
+		reply(node->client, smprintf(json({"error":"%s"}), err));
+		nodefree(node);
+		return -1;
+	}
+	if(node->args.root != NULL && node->args.toproot == NULL)
+		node->args.toproot = smprintf("%s.%s", node->args.root, node->args.identity);
+	if(node->args.authtoken == NULL)
+		node->args.authtoken = strdup(authtoken != NULL ? authtoken : node->args.identity);
+
+	sv[0] = sv[1] = -1;
+	if(swtch.fd != -1 && socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, sv) == -1){
+		fprintf(stderr, "containode: socketpair: %s\n", strerror(errno));
+		reply(node->client, smprintf(json({"error":"socketpair","identity":"%s"}), node->args.identity));
+		nodefree(node);
+		return -1;
+	}
+	node->args.ctrlsock = sv[1];
+	node->pid = startcontainer(&node->args, dflags, &pidfd);
+	if(sv[1] != -1)
+		close(sv[1]);
+	if(node->pid == -1){
+		fprintf(stderr, "containode: clone: %s\n", strerror(errno));
+		if(sv[0] != -1)
+			close(sv[0]);
+		reply(node->client, smprintf(json({"error":"clone","identity":"%s"}), node->args.identity));
+		nodefree(node);
+		return -1;
+	}
+	if(sv[0] != -1)
+		watch(&node->relay, WatchRelay, sv[0], node);
+	watch(&node->tube, WatchTube, node->args.tube[0], node);
+	watch(&node->pidfd, WatchPidfd, pidfd, node);
+	node->next = nodes;
+	nodes = node;
+	return 0;
+}
+
+static void
+launch(Watch *client, JsonRoot *root, int obji)
+{
+	JsonAst *ast;
+	Node *node;
+	int i, argvi;
+
+	ast = root->ast.buf;
+	node = nodenew();
+	if((argvi = jsonwalk(root, obji, "argv")) != -1 && ast[argvi].type == '['){
+		for(i = argvi+1; ast[i].type == JsonString && node->args.argc < MaxArgs-1; i = ast[i].next)
+			node->args.argv[node->args.argc++] = jsoncstr(root, i);
+	}
+	node->args.argv[node->args.argc] = NULL;
+	node->args.root = launchstr(root, obji, "root");
+	node->args.toproot = launchstr(root, obji, "top");
+	node->args.ip4addr = launchstr(root, obji, "ip4");
+	node->args.gateway = launchstr(root, obji, "gateway");
+	node->args.identity = launchstr(root, obji, "identity");
+	node->args.postname = launchstr(root, obji, "post");
+	node->args.authtoken = launchstr(root, obji, "authtoken");
+	node->client = client;
+	nodestart(node);
+}
+
+// something came up the tube. 0 while the start goes on, -1 if it failed.
+static int
+started(Node *node)
+{
+	int fd;
+
+	// a slow exec must not hold up the others, so only read what is there.
+	if(startpoll(&node->args) == 0)
+		return 0;
+	// startdone closes the tube, after it can't come up here any more.
+	fd = node->tube.fd;
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+	node->tube.fd = -1;
+	if(spec != NULL)
+		spec->starting--;
+	if(startdone(&node->args, node->pid) == -1){
+		if(spec != NULL)
+			spec->failed++;
+		reply(node->client, smprintf(json({"error":"exec","identity":"%s"}), node->args.identity));
+		nodefree(node);
+		return -1;
+	}
+	if(spec != NULL)
+		spec->started++;
+	reply(node->client, smprintf(json({"started":{"identity":"%s","pid":%d}}), node->args.identity, node->pid));
+	return 0;
+}
+
+static void
+exited(Node *node)
+{
+	char *buf;
+	int status;
+
+	// the exit can come in the same round as the start, and the tube is at its end by then.
+	if(node->tube.fd != -1 && started(node) == -1)
+		return;
+	if(waitpid(node->pid, &status, 0) == -1){
+		fprintf(stderr, "containode: waitpid %d: %s\n", node->pid, strerror(errno));
+		status = 0;
+	}
+	if(spec != NULL){
+		spec->exited++;
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			spec->nonzero++;
+	}
+	if(swtch.fd != -1){
+		buf = smprintf(
+			json({
+				"authtoken": "%s",
+				"remove-etherfd":{
+					"nodeid":"%s"
+				}
+			}),
+			node->args.authtoken,
+			node->args.identity
+		);
+		relayout(NULL, -1, buf, strlen(buf));
+		free(buf);
+	}
+	if(node->args.root != NULL)
+		cleancontainer(&node->args);
+	reply(node->client, smprintf(json({"exited":{"identity":"%s","pid":%d,"status":%d}}),
+		node->args.identity, node->pid, WIFEXITED(status) ? WEXITSTATUS(status) : 128+WTERMSIG(status)));
+	nodefree(node);
+}
+
+static void
+killnode(Watch *client, JsonRoot *root, char *buf, int obji)
+{
+	Node *node;
+	char *id;
+	int off, sig;
+
+	sig = SIGTERM;
+	if((off = jsonwalk(root, obji, "signal")) != -1 && root->ast.buf[off].type == JsonNumber)
+		sig = strtol(buf + root->ast.buf[off].off, NULL, 0);
+	if((id = launchstr(root, obji, "identity")) == NULL){
+		reply(client, strdup(json({"error":"no identity"})));
+		return;
+	}
+	for(node = nodes; node != NULL; node = node->next)
+		if(!strcmp(node->args.identity, id))
+			break;
+	if(node == NULL)
+		reply(client, strdup(json({"error":"not found"})));
+	else if(syscall(SYS_pidfd_send_signal, node->pidfd.fd, sig, NULL, 0) == -1)
+		reply(client, smprintf(json({"error":"%s","identity":"%s"}), strerror(errno), id));
+	else
+		reply(client, smprintf(json({"killed":{"identity":"%s","signal":%d}}), id, sig));
+	free(id);
+}
+
+static void
+request(Watch *client)
+{
+	static JsonRoot root;
+	Node *node;
+	char buf[MaxMsg];
+	int nrd, obji, passfd;
+
+	if((nrd = recvframe(client->fd, &passfd, buf, sizeof buf - 1)) <= 0){
+		unwatch(client);
+		for(node = nodes; node != NULL; node = node->next)
+			if(node->client == client)
+				node->client = NULL;
+		client->next = goneclients;
+		goneclients = client;
+		return;
+	}
+	if(passfd != -1)
+		close(passfd);
+	buf[nrd] = '\0';
+	jsonparse(&root, buf, nrd);
+	if((obji = jsonwalk(&root, 0, "launch")) != -1)
+		launch(client, &root, obji);
+	else if((obji = jsonwalk(&root, 0, "kill")) != -1)
+		killnode(client, &root, buf, obji);
+	else
+		reply(client, strdup(json({"error":"unknown request"})));
+}
+
+static int
+specint(JsonRoot *root, char *buf, char *key, int def)
+{
+	int off;
+
+	if((off = jsonwalk(root, 0, key)) == -1 || root->ast.buf[off].type != JsonNumber)
+		return def;
+	return strtol(buf + root->ast.buf[off].off, NULL, 0);
+}
+
+static Spec *
+specload(char *path)
+{
+	static JsonRoot root;
+	JsonAst *ast;
+	Spec *sp;
+	struct in_addr in;
+	uint32_t mask;
+	char *buf, *ip4, *slash;
+	int i, argvi, bufsize, nrd, rndfd;
+
+	bufsize = 65536;
+	buf = malloc(bufsize);
+	if((nrd = readfile(path, buf, bufsize-1)) == -1){
+		fprintf(stderr, "read %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	buf[nrd] = '\0';
+	if(jsonparse(&root, buf, nrd) == -1){
+		fprintf(stderr, "%s: bad json\n", path);
+		return NULL;
+	}
+	ast = root.ast.buf;
+
+	sp = malloc(sizeof sp[0]);
+	memset(sp, 0, sizeof sp[0]);
+	sp->count = specint(&root, buf, "count", 1);
+	sp->parallel = specint(&root, buf, "parallel", 16);
+	sp->argv = malloc(MaxArgs * sizeof sp->argv[0]);
+	if((argvi = jsonwalk(&root, 0, "argv")) != -1 && ast[argvi].type == '['){
+		for(i = argvi+1; ast[i].type == JsonString && sp->argc < MaxArgs-1; i = ast[i].next)
+			sp->argv[sp->argc++] = jsoncstr(&root, i);
+	}
+	sp->argv[sp->argc] = NULL;
+	sp->root = launchstr(&root, 0, "root");
+	sp->top = launchstr(&root, 0, "top");
+	sp->prefix = launchstr(&root, 0, "identity");
+	sp->gateway = launchstr(&root, 0, "gateway");
+	sp->authtoken = launchstr(&root, 0, "authtoken");
+	sp->ip4len = -1;
+	if((ip4 = launchstr(&root, 0, "ip4")) != NULL){
+		if((slash = strchr(ip4, '/')) != NULL){
+			*slash++ = '\0';
+			sp->ip4len = strtol(slash, NULL, 10);
+		}
+		if(inet_pton(AF_INET, ip4, &in) != 1 || sp->ip4len < -1 || sp->ip4len > 32){
+			fprintf(stderr, "%s: bad ip4 %s\n", path, ip4);
+			return NULL;
+		}
+		sp->ip4 = ntohl(in.s_addr);
+		// the last one has to be in the same subnet, and not its broadcast address.
+		mask = sp->ip4len > 0 ? ~(uint32_t)0 << (32 - sp->ip4len) : 0;
+		if(sp->ip4len == -1)
+			mask = 0;
+		if(sp->ip4 + (uint32_t)(sp->count-1) < sp->ip4
+		|| ((sp->ip4 + sp->count-1) & mask) != (sp->ip4 & mask)
+		|| (sp->ip4len > 0 && sp->ip4len < 31 && ((sp->ip4 + sp->count-1) & ~mask) == ~mask)){
+			fprintf(stderr, "%s: %d addresses from %s don't fit in /%d\n", path, sp->count, ip4, sp->ip4len);
+			return NULL;
+		}
+		free(ip4);
+	}
+	if(sp->count < 1 || sp->parallel < 1 || sp->argc == 0){
+		fprintf(stderr, "%s: needs argv, and a count and parallel of 1 or more\n", path);
+		return NULL;
+	}
+	if(sp->prefix != NULL && !goodid(sp->prefix)){
+		fprintf(stderr, "%s: bad identity %s\n", path, sp->prefix);
+		return NULL;
+	}
+
+	// one read of /dev/urandom for all of the random identities.
+	if(sp->prefix == NULL){
+		if((rndfd = open("/dev/urandom", O_RDONLY|O_CLOEXEC)) == -1 || read(rndfd, &sp->idbase, sizeof sp->idbase) != sizeof sp->idbase){
+			fprintf(stderr, "read /dev/urandom: %s\n", strerror(errno));
+			return NULL;
+		}
+		close(rndfd);
+	}
+	free(buf);
+	return sp;
+}
+
+// starts containers from the spec until parallel of them are starting.
+static void
+specnext(Spec *sp)
+{
+	Node *node;
+	struct in_addr in;
+	char addr[INET_ADDRSTRLEN];
+	int i;
+
+	while(sp->next < sp->count && sp->starting < sp->parallel){
+		node = nodenew();
+		for(i = 0; i < sp->argc; i++)
+			node->args.argv[i] = strdup(sp->argv[i]);
+		node->args.argv[i] = NULL;
+		node->args.argc = sp->argc;
+		if(sp->prefix != NULL)
+			node->args.identity = smprintf("%s%d", sp->prefix, sp->next);
+		else
+			node->args.identity = idstr(sp->idbase + sp->next);
+		if(sp->root != NULL)
+			node->args.root = strdup(sp->root);
+		if(sp->top != NULL)
+			node->args.toproot = smprintf("%s/%s", sp->top, node->args.identity);
+		if(sp->ip4 != 0){
+			in.s_addr = htonl(sp->ip4 + sp->next);
+			inet_ntop(AF_INET, &in, addr, sizeof addr);
+			if(sp->ip4len != -1)
+				node->args.ip4addr = smprintf("%s/%d", addr, sp->ip4len);
+			else
+				node->args.ip4addr = strdup(addr);
+		}
+		if(sp->gateway != NULL)
+			node->args.gateway = strdup(sp->gateway);
+		if(sp->authtoken != NULL)
+			node->args.authtoken = strdup(sp->authtoken);
+		sp->next++;
+		if(nodestart(node) == 0)
+			sp->starting++;
+		else
+			sp->failed++;
+	}
+}
+
+/*
+ *	one json line when all of the spec has started, or failed to, and
+ *	another when it has all exited. 1 when it is done.
+ */
+static int
+specreport(Spec *sp)
+{
+	double secs;
+
+	if(sp->tstarted == 0 && sp->started + sp->failed == sp->count){
+		sp->tstarted = monotime();
+		secs = (sp->tstarted - sp->t0)/1e9;
+		fprintf(stderr, "{\"containers\":%d,\"started\":%d,\"failed\":%d,\"parallel\":%d,\"secs\":%.3f,\"rate\":%.1f}\n",
+			sp->count, sp->started, sp->failed, sp->parallel, secs, secs > 0 ? sp->started/secs : 0);
+	}
+	if(sp->tstarted == 0 || sp->exited < sp->started || noutbox > 0 || pending != NULL)
+		return 0;
+	secs = (monotime() - sp->t0)/1e9;
+	fprintf(stderr, "{\"containers\":%d,\"exited\":%d,\"nonzero\":%d,\"secs\":%.3f}\n",
+		sp->count, sp->exited, sp->nonzero, secs);
+	return 1;
+}
+
+/*
+ *	the loop of -D, serving launch requests on name, and of -B, starting
+ *	the containers of a spec when name is NULL.
+ */
+static void
+serve(char *name, int ctrlsock, int cloneflags, int xdp, int l3, int devfd)
+{
+	struct epoll_event evs[64];
+	Watch listener, *w;
+	Node *node;
+	int i, n, fd, lsock;
+
+	dflags = cloneflags;
+	dxdp = xdp;
+	dl3 = l3;
+	ddevfd = devfd;
+	if(xdp && (dhostns = open("/proc/self/ns/net", O_RDONLY|O_CLOEXEC)) == -1){
+		fprintf(stderr, "open /proc/self/ns/net: %s\n", strerror(errno));
+		exit(1);
+	}
+	if((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1){
+		fprintf(stderr, "epoll_create1: %s\n", strerror(errno));
+		exit(1);
+	}
+	if(name != NULL){
+		if((lsock = unsocket(SOCK_STREAM, name, NULL)) == -1 || listen(lsock, 64) == -1){
+			fprintf(stderr, "could not post %s\n", name);
+			exit(1);
+		}
+		fcntl(lsock, F_SETFD, FD_CLOEXEC);
+		if(watch(&listener, WatchListen, lsock, NULL) == -1)
+			exit(1);
+	}
+	if(ctrlsock != -1){
+		fcntl(ctrlsock, F_SETFD, FD_CLOEXEC);
+		if(watch(&swtch, WatchSwitch, ctrlsock, NULL) == -1)
+			exit(1);
+	}
+	writefile("/sys/kernel/rcu_expedited", "1", 1);
+
+	// a client that goes away mid-answer is not a reason to exit.
+	signal(SIGPIPE, SIG_IGN);
+
+	if(spec != NULL){
+		spec->t0 = monotime();
+		specnext(spec);
+		flushout();
+	}
+	for(;;){
+		if(spec != NULL && specreport(spec))
+			exit(spec->failed != 0 || spec->nonzero != 0);
+		if((n = epoll_wait(epfd, evs, nelem(evs), -1)) == -1){
+			if(errno != EINTR)
+				fprintf(stderr, "epoll_wait: %s\n", strerror(errno));
+			continue;
+		}
+		for(i = 0; i < n; i++){
+			w = evs[i].data.ptr;
+			if(w->fd == -1)
+				continue;
+			switch(w->kind){
+			case WatchListen:
+				if((fd = accept4(w->fd, NULL, NULL, SOCK_CLOEXEC)) == -1)
+					break;
+				w = malloc(sizeof w[0]);
+				memset(w, 0, sizeof w[0]);
+				if(watch(w, WatchClient, fd, NULL) == -1){
+					close(fd);
+					free(w);
+				}
+				break;
+			case WatchClient:
+				request(w);
+				break;
+			case WatchSwitch:
+				relayin();
+				break;
+			case WatchRelay:
+				relay(w->node);
+				break;
+			case WatchTube:
+				started(w->node);
+				break;
+			case WatchPidfd:
+				exited(w->node);
+				break;
+			}
+		}
+		if(spec != NULL)
+			specnext(spec);
+		flushout();
+		while((node = gonenodes) != NULL){
+			gonenodes = node->next;
+			free(node);
+		}
+		while((w = goneclients) != NULL){
+			goneclients = w->next;
+			free(w);
+		}
+	}
+}
+
 int
 main(int argc, char *argv[])
 {
 	char *root = NULL;
 	char *toproot = NULL;
 	char *ip4addr = NULL;
+	char *gateway = NULL;
 	char *postname = NULL;
+	char *daemonname = NULL;
+	char *specname = NULL;
 	int ctrlsock = -1;
+	int hostns = -1;
+	int poolsock = -1;
+	int netns = -1;
+	int tapfd = -1;
+	int devfd = -1;
 	int Cflag = 0;
+	int Xflag = 0;
+	int Lflag = 0;
+	int Tflag = 0;
+	int Mflag = 0;
 
 	int cloneflags =
 		SIGCHLD |	// new process
@@ -133,7 +1100,9 @@ main(int argc, char *argv[])
 		CLONE_NEWNET;	// new network namespace
 
 	int opt, status;
-	while((opt = getopt(argc, argv, "r:t:w:4:s:i:NIp:a:")) != -1) {
+
+	tmain = monotime();
+	while((opt = getopt(argc, argv, "r:t:w:4:g:s:i:NIXLTMp:a:P:D:B:")) != -1) {
 		switch(opt){
 		case 's':
 			swtchname = optarg;
@@ -148,6 +1117,9 @@ main(int argc, char *argv[])
 		case '4':
 			ip4addr = optarg;
 			break;
+		case 'g':
+			gateway = optarg;
+			break;
 		case 'r':
 			root = optarg;
 			break;
@@ -166,13 +1138,62 @@ main(int argc, char *argv[])
 		case 'C':
 			Cflag++;
 			break;
+		case 'X':
+			Xflag++;
+			break;
+		case 'L':
+			Lflag++;
+			break;
+		case 'T':
+			Tflag = 1;
+			break;
+		case 'M':
+			Mflag = 1;
+			break;
+		case 'D':
+			daemonname = optarg;
+			break;
+		case 'B':
+			specname = optarg;
+			break;
 		case 'a':
 			authtoken = optarg;
 			break;
+		case 'P':
+			if((poolsock = unsocket(SOCK_STREAM, NULL, optarg)) == -1){
+				fprintf(stderr, "could not connect to pool %s\n", optarg);
+				exit(1);
+			}
+			break;
 		default:
-			fprintf(stderr, "usage: %s [-a authtoken] [-i identity] [-r path/to/root] [-t path/to/top-dir] [-4 ip4 address] [-s path/to/switch-sock] [-p where/to/post/ctrl-sock] [-I] [-N] [-C]\n", argv[0]);
+			fprintf(stderr, "usage: %s [-a authtoken] [-i identity] [-r path/to/root] [-t path/to/top-dir] [-4 ip4 address] [-g gateway] [-s path/to/switch-sock] [-P path/to/pool-sock] [-p where/to/post/ctrl-sock] [-D path/to/daemon-sock | -B path/to/spec.json] [-I] [-N] [-C] [-T] [-M] [-X | -L]\n"
+				"-M clones /dev from a template, which takes linux 6.15 or later\n", argv[0]);
+			exit(1);
+		}
+	}
+	if(Xflag && Lflag){
+		fprintf(stderr, "%s: -X and -L don't go together\n", argv[0]);
+		exit(1);
+	}
+	if(poolsock != -1 && (Xflag || Lflag || (cloneflags & CLONE_NEWNET) == 0)){
+		fprintf(stderr, "%s: -P only goes with a tap in a namespace of its own\n", argv[0]);
+		exit(1);
+	}
+	if(daemonname != NULL || specname != NULL){
+		if(daemonname != NULL && specname != NULL){
+			fprintf(stderr, "%s: -D and -B don't go together\n", argv[0]);
 			exit(1);
 		}
+		if(poolsock != -1 || Tflag || Cflag || root != NULL || toproot != NULL || ip4addr != NULL
+		|| gateway != NULL || identity != NULL || postname != NULL || optind < argc){
+			fprintf(stderr, "%s: with -D or -B, what goes with each container comes with its launch request or spec\n", argv[0]);
+			exit(1);
+		}
+		if(specname != NULL && (spec = specload(specname)) == NULL)
+			exit(1);
+		if(Mflag && (devfd = devtemplate()) == -1)
+			fprintf(stderr, "%s: making /dev in each container instead\n", argv[0]);
+		serve(daemonname, ctrlsock, cloneflags, Xflag, Lflag, devfd);
 	}
 
 	// if toproot specified and is of root.foobar format, take the part after '.' as identity.
@@ -185,25 +1206,8 @@ main(int argc, char *argv[])
 		}
 	}
 
-	if(identity == NULL){
-		uint64_t id;
-		int rndfd;
-		rndfd = open("/dev/urandom", O_RDONLY);
-		if(rndfd == -1){
-			fprintf(stderr, "open /dev/urandom: %s\n", strerror(errno));
-			exit(1);
-		}
-		if(read(rndfd, &id, sizeof id) != sizeof id){
-			fprintf(stderr, "read /dev/urandom: %s\n", strerror(errno));
-			exit(1);
-		}
-		identity = idstr(id);
-		if(strid(identity) != id){
-			fprintf(stderr, "strid-idstr scheme is broken\n");
-			exit(1);
-		}
-		close(rndfd);
-	}
+	if(identity == NULL && (identity = randomid()) == NULL)
+		exit(1);
 
 	if(Cflag == 0 && root != NULL && toproot == NULL){
 		toproot = smprintf("%s.%s", root, identity);
@@ -213,6 +1217,35 @@ main(int argc, char *argv[])
 	if(authtoken == NULL)
 		authtoken = identity;
 
+	// the container makes its veth pair, with the host end going here.
+	if(Xflag && (hostns = open("/proc/self/ns/net", O_RDONLY)) == -1){
+		fprintf(stderr, "open /proc/self/ns/net: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	/*
+	 *	a lease on a namespace with a tap in it, which netpool takes
+	 *	back when we exit and the connection goes with us.
+	 */
+	if(poolsock != -1){
+		char buf[256], *req;
+		int fds[2], nfds, nrd;
+
+		fcntl(poolsock, F_SETFD, FD_CLOEXEC);
+		req = json({"lease":{}});
+		if(sendframe(poolsock, -1, req, strlen(req)) == -1
+		|| (nrd = recvframefds(poolsock, fds, nelem(fds), &nfds, buf, sizeof buf)) <= 0 || nfds != 2){
+			fprintf(stderr, "could not lease a namespace from the pool\n");
+			exit(1);
+		}
+		netns = fds[0];
+		tapfd = fds[1];
+		cloneflags &= ~CLONE_NEWNET;
+	}
+
+	if(Mflag && (devfd = devtemplate()) == -1)
+		fprintf(stderr, "%s: making /dev in the container instead\n", argv[0]);
+
 	// gives a perf kick for namespace creation and teardown.
 	// having iptables around at all is a major time suck too, but we can't fix that here.
 	writefile("/sys/kernel/rcu_expedited", "1", 1);
@@ -224,10 +1257,17 @@ main(int argc, char *argv[])
 		.root = root,
 		.toproot = toproot,
 		.ip4addr = ip4addr,
+		.gateway = gateway,
 		.identity = identity,
 		.ctrlsock = ctrlsock,
 		.postname = postname,
 		.authtoken = authtoken,
+		.xdp = Xflag,
+		.l3 = Lflag,
+		.hostns = hostns,
+		.netns = netns,
+		.tapfd = tapfd,
+		.devfd = devfd,
 	};
 
 	int pid = runcontainer(&args, cloneflags);
@@ -235,16 +1275,28 @@ main(int argc, char *argv[])
 		fprintf(stderr, "runcontainer: %s\n", strerror(errno));
 		exit(1);
 	}
+	tstarted = monotime();
+	if(Tflag)
+		timed = &args;
+	if(hostns != -1)
+		close(hostns);
+	if(netns != -1){
+		close(netns);
+		close(tapfd);
+	}
 	if(waitpid(pid, &status, 0) == -1) {
 		fprintf(stderr, "waitpid: %s\n", strerror(errno));
 		die(1);
 	}
+	texited = monotime();
 	if(!WIFEXITED(status)){
 		fprintf(stderr, "error: child did not exit normally\n");
 		die(1);
 	}
-	cleancontainer(&args);
-	fprintf(stderr, "fs modifications saved to %s\n", args.toproot);
+	if(args.toproot != NULL){
+		cleancontainer(&args);
+		fprintf(stderr, "fs modifications saved to %s\n", args.toproot);
+	}
 	die(0);
 	return 0;
 }
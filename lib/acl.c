@@ -0,0 +1,364 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include "acl.h"
+
+enum {
+	EtherIp = 0x0800,
+	EtherIp6 = 0x86dd,
+	EtherVlan = 0x8100,
+};
+
+static uint32_t gens;
+
+static uint32_t
+hashkey(Aclkey *key)
+{
+	uint8_t *p;
+	uint32_t hash, w;
+	int i;
+
+	p = (uint8_t *)key;
+	hash = 2166136261u;
+	for(i = 0; i+4 <= (int)sizeof key[0]; i += 4){
+		memcpy(&w, p+i, 4);
+		hash = (hash ^ w) * 16777619u;
+		hash ^= hash >> 13;
+	}
+	return hash ^ hash >> 16;
+}
+
+static void
+maskkey(Aclkey *dst, Aclkey *key, Aclkey *mask)
+{
+	uint8_t *d, *k, *m;
+	int i;
+
+	d = (uint8_t *)dst;
+	k = (uint8_t *)key;
+	m = (uint8_t *)mask;
+	for(i = 0; i < (int)sizeof dst[0]; i++)
+		d[i] = k[i] & m[i];
+}
+
+// a list with no rules, that does action with what none matches.
+Acl *
+aclnew(int action)
+{
+	Acl *acl;
+
+	if((acl = calloc(1, sizeof acl[0])) == NULL)
+		return NULL;
+	acl->action = action;
+	acl->gen = __sync_add_and_fetch(&gens, 1);
+	return acl;
+}
+
+/*
+ *	adds rule after the others. its ports are taken from the ranges,
+ *	and the rest of value is masked here. returns its index, or -1 if
+ *	the list is full or the rule makes no sense.
+ */
+int
+aclrule(Acl *acl, Aclrule *rule)
+{
+	Aclrule *r;
+
+	if(acl->nrules == AclRulemax || rule->action < AclAllow || rule->action > AclMirror)
+		return -1;
+	if(rule->sportlo < 0 || rule->sportlo > rule->sporthi || rule->sporthi > 65535)
+		return -1;
+	if(rule->dportlo < 0 || rule->dportlo > rule->dporthi || rule->dporthi > 65535)
+		return -1;
+	if(rule->action == AclMark && (rule->mark < 0 || rule->mark > 63))
+		return -1;
+	r = acl->rules + acl->nrules;
+	*r = *rule;
+	maskkey(&r->value, &rule->value, &rule->mask);
+	r->mask.sport = r->mask.dport = 0;
+	r->value.sport = r->value.dport = 0;
+	r->hits = 0;
+	return acl->nrules++;
+}
+
+// the group of rules looking at mask, made if need be.
+static Acltuple *
+tuplefor(Acl *acl, Aclkey *mask, int rule)
+{
+	Acltuple *t;
+	int i;
+
+	for(i = 0; i < acl->ntuples; i++)
+		if(memcmp(&acl->tuples[i].mask, mask, sizeof mask[0]) == 0)
+			return acl->tuples + i;
+	t = acl->tuples + acl->ntuples++;
+	memset(t, 0, sizeof t[0]);
+	t->mask = *mask;
+	t->first = rule;
+	return t;
+}
+
+static int
+inrange(Aclrule *r, Aclkey *key)
+{
+	return key->sport >= r->sportlo && key->sport <= r->sporthi
+		&& key->dport >= r->dportlo && key->dport <= r->dporthi;
+}
+
+/*
+ *	a port is in a rule's key if it is a single one. a range is not, and
+ *	is checked on the entries a lookup comes across, in the order of the
+ *	rules, as an entry goes after those of the same key in the probe
+ *	sequence. whatever a rule without a range shadows is left out.
+ */
+static void
+tupleadd(Acl *acl, Acltuple *t, Aclkey *key, int rule)
+{
+	Aclentry *e;
+	Aclrule *r;
+	uint32_t h;
+
+	for(h = hashkey(key) & (t->size-1);; h = (h+1) & (t->size-1)){
+		e = t->entries + h;
+		if(e->rule == -1){
+			e->key = *key;
+			e->rule = rule;
+			return;
+		}
+		r = acl->rules + e->rule;
+		if(memcmp(&e->key, key, sizeof key[0]) == 0 && r->sportlo == 0 && r->sporthi == 65535
+		&& r->dportlo == 0 && r->dporthi == 65535)
+			return;
+	}
+}
+
+static void
+portmask(Aclrule *r, Aclkey *mask, Aclkey *key)
+{
+	*mask = r->mask;
+	*key = r->value;
+	mask->sport = r->sportlo == r->sporthi ? 0xffff : 0;
+	mask->dport = r->dportlo == r->dporthi ? 0xffff : 0;
+	key->sport = r->sportlo & mask->sport;
+	key->dport = r->dportlo & mask->dport;
+}
+
+// makes the tuple space of the rules, once they are all in.
+int
+aclcompile(Acl *acl)
+{
+	Acltuple *t, tmp;
+	Aclkey mask, key;
+	int i, j, n;
+
+	if((acl->tuples = calloc(acl->nrules > 0 ? acl->nrules : 1, sizeof acl->tuples[0])) == NULL)
+		return -1;
+
+	// the groups and their sizes first, then their tables.
+	for(i = 0; i < acl->nrules; i++){
+		portmask(acl->rules + i, &mask, &key);
+		tuplefor(acl, &mask, i)->size++;
+	}
+	for(i = 0; i < acl->ntuples; i++){
+		t = acl->tuples + i;
+		for(n = 2; n < 2*t->size; n *= 2)
+			;
+		t->size = n;
+		if((t->entries = malloc(n * sizeof t->entries[0])) == NULL)
+			return -1;
+		for(j = 0; j < n; j++)
+			t->entries[j].rule = -1;
+	}
+	for(i = 0; i < acl->nrules; i++){
+		portmask(acl->rules + i, &mask, &key);
+		tupleadd(acl, tuplefor(acl, &mask, i), &key, i);
+	}
+
+	// the groups with the earliest rules are looked in first.
+	for(i = 1; i < acl->ntuples; i++){
+		tmp = acl->tuples[i];
+		for(j = i; j > 0 && acl->tuples[j-1].first > tmp.first; j--)
+			acl->tuples[j] = acl->tuples[j-1];
+		acl->tuples[j] = tmp;
+	}
+	return 0;
+}
+
+void
+aclfree(Acl *acl)
+{
+	int i;
+
+	if(acl == NULL)
+		return;
+	for(i = 0; acl->tuples != NULL && i < acl->ntuples; i++)
+		free(acl->tuples[i].entries);
+	free(acl->tuples);
+	free(acl);
+}
+
+/*
+ *	fills key in from a frame, or an ip packet with nothing in front of
+ *	it if l3 is set. returns -1 for a frame too short to have macs.
+ */
+int
+aclkey(Aclkey *key, uint8_t *frame, int len, int l3)
+{
+	uint8_t *p;
+	int type, hlen, n;
+
+	memset(key, 0, sizeof key[0]);
+	if(l3){
+		p = frame;
+		type = len > 0 && (p[0] >> 4) == 6 ? EtherIp6 : EtherIp;
+	} else {
+		if(len < 14)
+			return -1;
+		memcpy(key->dstmac, frame, 6);
+		memcpy(key->srcmac, frame+6, 6);
+		type = frame[12]<<8 | frame[13];
+		p = frame+14;
+		if(type == EtherVlan && len >= 18){
+			key->vlan = AclTagged | ((frame[14]<<8 | frame[15]) & 0xfff);
+			type = frame[16]<<8 | frame[17];
+			p = frame+18;
+		}
+	}
+	n = len - (p - frame);
+	if(type == EtherIp && n >= 20 && (p[0] >> 4) == 4){
+		key->family = 4;
+		key->proto = p[9];
+		memcpy(key->src, p+12, 4);
+		memcpy(key->dst, p+16, 4);
+		hlen = (p[0] & 15) * 4;
+		// ports only from the first fragment.
+		if((p[6] & 0x1f) != 0 || p[7] != 0)
+			return 0;
+		p += hlen;
+		n -= hlen;
+	} else if(type == EtherIp6 && n >= 40 && (p[0] >> 4) == 6){
+		key->family = 6;
+		key->proto = p[6];
+		memcpy(key->src, p+8, 16);
+		memcpy(key->dst, p+24, 16);
+		p += 40;
+		n -= 40;
+	} else {
+		return 0;
+	}
+	if((key->proto == IPPROTO_TCP || key->proto == IPPROTO_UDP) && n >= 4){
+		key->sport = p[0]<<8 | p[1];
+		key->dport = p[2]<<8 | p[3];
+	}
+	return 0;
+}
+
+/*
+ *	the index of the first rule that matches key, or -1 if none does.
+ *	cache is the calling thread's own, or NULL.
+ */
+int
+aclclassify(Acl *acl, Aclcache *cache, Aclkey *key)
+{
+	Acltuple *t;
+	Aclentry *e;
+	Aclkey masked;
+	uint32_t h, slot;
+	int i, best;
+
+	slot = 0;
+	if(cache != NULL){
+		if(cache->acl != acl || cache->gen != acl->gen){
+			for(i = 0; i < AclCachesize; i++)
+				cache->ents[i].rule = -2;
+			cache->acl = acl;
+			cache->gen = acl->gen;
+		}
+		slot = hashkey(key) & (AclCachesize-1);
+		if(cache->ents[slot].rule != -2 && memcmp(&cache->ents[slot].key, key, sizeof key[0]) == 0)
+			return cache->ents[slot].rule;
+	}
+	best = -1;
+	for(i = 0; i < acl->ntuples; i++){
+		t = acl->tuples + i;
+		if(best != -1 && t->first >= best)
+			break;
+		maskkey(&masked, key, &t->mask);
+		for(h = hashkey(&masked) & (t->size-1);; h = (h+1) & (t->size-1)){
+			e = t->entries + h;
+			if(e->rule == -1)
+				break;
+			if(memcmp(&e->key, &masked, sizeof masked) == 0 && inrange(acl->rules + e->rule, key)){
+				if(best == -1 || e->rule < best)
+					best = e->rule;
+				break;
+			}
+		}
+	}
+	if(cache != NULL){
+		cache->ents[slot].key = *key;
+		cache->ents[slot].rule = best;
+	}
+	return best;
+}
+
+// sets the dscp of the ip packet in a frame, or in an ip packet if l3 is set.
+void
+aclmark(uint8_t *frame, int len, int l3, int dscp)
+{
+	uint8_t *p;
+	uint32_t sum;
+	int type, old;
+
+	if(l3){
+		p = frame;
+		type = len > 0 && (p[0] >> 4) == 6 ? EtherIp6 : EtherIp;
+	} else {
+		if(len < 14)
+			return;
+		type = frame[12]<<8 | frame[13];
+		p = frame+14;
+		if(type == EtherVlan && len >= 18){
+			type = frame[16]<<8 | frame[17];
+			p = frame+18;
+		}
+	}
+	len -= p - frame;
+	if(type == EtherIp && len >= 20 && (p[0] >> 4) == 4){
+		old = p[0]<<8 | p[1];
+		p[1] = dscp << 2 | (p[1] & 3);
+		// rfc 1624, the first word of the header changed.
+		sum = (~(p[10]<<8 | p[11]) & 0xffff) + (~old & 0xffff) + (p[0]<<8 | p[1]);
+		while(sum > 0xffff)
+			sum = (sum & 0xffff) + (sum >> 16);
+		sum = ~sum & 0xffff;
+		p[10] = sum >> 8;
+		p[11] = sum & 0xff;
+	} else if(type == EtherIp6 && len >= 40 && (p[0] >> 4) == 6){
+		// the traffic class straddles the first two bytes.
+		p[0] = (p[0] & 0xf0) | dscp >> 2;
+		p[1] = (dscp & 3) << 6 | (p[1] & 0x3f);
+	}
+}
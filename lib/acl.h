@@ -0,0 +1,129 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	access control lists for what comes in on a port. a list is rules in
+ *	order, each matching on any of the macs, the vlan, the source and
+ *	destination prefixes, the protocol and ranges of ports, and the first
+ *	rule that matches a frame says what is done with it.
+ *
+ *	a list is compiled into a tuple space: the rules are grouped by which
+ *	bits of a frame they look at, and every group is a hash table of the
+ *	masked keys its rules want. a frame's key is masked and looked up in
+ *	every group, from the one with the earliest rule on, until no group
+ *	left has a rule before what was found, so it costs a probe per group
+ *	and not a comparison per rule. single ports are part of the keys,
+ *	and ranges of them are checked on what a probe finds. in front of
+ *	that, a cache of the verdicts for whole keys, one for each thread,
+ *	has most frames of a flow looked up with a single probe. a compiled
+ *	list doesn't change, a new one is made for every change. none of it
+ *	does i/o.
+ */
+enum {
+	AclRulemax = 1024,
+	AclCachesize = 1024, // power of two
+};
+
+// what a rule does with a frame.
+enum {
+	AclAllow = 0,
+	AclDrop,
+	AclMark, // sets the dscp of an ip packet to the rule's mark
+	AclMirror, // and allows it, copying it to the mirror
+};
+
+typedef struct Acl Acl;
+typedef struct Aclcache Aclcache;
+typedef struct Aclentry Aclentry;
+typedef struct Aclkey Aclkey;
+typedef struct Aclrule Aclrule;
+typedef struct Acltuple Acltuple;
+
+/*
+ *	what rules look at in a frame, with no holes, as masks are applied
+ *	to it byte by byte. vlan has AclTagged set if there is a tag, and
+ *	the ports are 0 for all but tcp and udp and the first fragment.
+ */
+enum {
+	AclTagged = 0x8000,
+};
+struct Aclkey {
+	uint8_t dstmac[6];
+	uint8_t srcmac[6];
+	uint16_t vlan;
+	uint8_t family; // 4 or 6, as in the ip header, 0 for anything else
+	uint8_t proto;
+	uint16_t sport;
+	uint16_t dport;
+	uint8_t src[16];
+	uint8_t dst[16];
+};
+
+struct Aclrule {
+	Aclkey value; // masked already
+	Aclkey mask;
+	int sportlo, sporthi;
+	int dportlo, dporthi;
+	int action;
+	int mark;
+	uint64_t hits; // frames it matched, counted by the user
+};
+
+struct Aclentry {
+	Aclkey key;
+	int rule; // -1 for a free slot
+};
+
+struct Acltuple {
+	Aclkey mask;
+	int first; // earliest rule in the group
+	int size; // power of two
+	Aclentry *entries;
+};
+
+struct Acl {
+	uint32_t gen; // tells this list from others at the same address
+	int action; // when no rule matches, AclAllow or AclDrop
+	uint64_t nomatch; // and frames none matched
+	int nrules;
+	Aclrule rules[AclRulemax];
+	int ntuples;
+	Acltuple *tuples;
+	Acl *next; // for the user, to keep replaced lists on until nobody is in them
+};
+
+struct Aclcache {
+	Acl *acl; // what the verdicts are from
+	uint32_t gen;
+	struct {
+		Aclkey key;
+		int rule; // -1 for none, -2 for a free slot
+	} ents[AclCachesize];
+};
+
+Acl *aclnew(int action);
+int aclrule(Acl *acl, Aclrule *rule);
+int aclcompile(Acl *acl);
+void aclfree(Acl *acl);
+int aclkey(Aclkey *key, uint8_t *frame, int len, int l3);
+int aclclassify(Acl *acl, Aclcache *cache, Aclkey *key);
+void aclmark(uint8_t *frame, int len, int l3, int dscp);
@@ -42,6 +42,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/mman.h>
+#include <time.h>
+#include <signal.h>
+#include <poll.h>
 
 
 #include <sys/sysmacros.h> /* for makedev */
@@ -56,6 +59,7 @@
 #include "strsplit.h"
 #include "container.h"
 #include "tun.h"
+#include "netlink.h"
 #include "smprintf.h"
 
 // not sure this is in the standard, but it is too handy for json templating to ignore.
@@ -106,6 +110,107 @@ static struct {
 
 
 
+static uint64_t
+monotime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+// adds the time since t to a phase and returns the time it ended.
+static uint64_t
+phasedone(Args *ap, int phase, uint64_t t)
+{
+	uint64_t now;
+
+	now = monotime();
+	ap->phases[phase] += now - t;
+	return now;
+}
+
+/*
+ *	makes /dev once with the mount api, as a detached read-only tmpfs with
+ *	the dirs and devices in it, for containers to clone and attach with
+ *	attachdev instead of making their own. returns its fd, or -1, also
+ *	when the kernel can't clone it, which takes linux 6.15 or later.
+ */
+int
+devtemplate(void)
+{
+	mode_t oldmask;
+	int i, fd, fsfd, mntfd;
+
+	if((fsfd = fsopen("tmpfs", FSOPEN_CLOEXEC)) == -1){
+		fprintf(stderr, "fsopen tmpfs: %s\n", strerror(errno));
+		return -1;
+	}
+	if(fsconfig(fsfd, FSCONFIG_SET_STRING, "mode", "0755", 0) == -1
+	|| fsconfig(fsfd, FSCONFIG_CMD_CREATE, NULL, NULL, 0) == -1){
+		fprintf(stderr, "fsconfig tmpfs: %s\n", strerror(errno));
+		close(fsfd);
+		return -1;
+	}
+	mntfd = fsmount(fsfd, FSMOUNT_CLOEXEC, MOUNT_ATTR_NOSUID|MOUNT_ATTR_NOEXEC);
+	close(fsfd);
+	if(mntfd == -1){
+		fprintf(stderr, "fsmount tmpfs: %s\n", strerror(errno));
+		return -1;
+	}
+
+	// the paths in the tables start with /dev/, the template is /dev.
+	oldmask = umask(0);
+	if(mkdirat(mntfd, "pts", 0755) == -1)
+		fprintf(stderr, "mkdir /dev/pts: %s\n", strerror(errno));
+	for(i = 0; i < nelem(dirs); i++){
+		if(mkdirat(mntfd, dirs[i].path + 5, dirs[i].mode) == -1)
+			fprintf(stderr, "mkdir(\"%s\"): %s\n", dirs[i].path, strerror(errno));
+	}
+	for(i = 0; i < nelem(devices); i++){
+		if(mknodat(mntfd, devices[i].path + 5, devices[i].mode, makedev(devices[i].major, devices[i].minor)) == -1)
+			fprintf(stderr, "mknod(\"%s\"): %s\n", devices[i].path, strerror(errno));
+	}
+	umask(oldmask);
+
+	// every container gets the same one, so nobody gets to change it.
+	struct mount_attr attr = { .attr_set = MOUNT_ATTR_RDONLY };
+	if(mount_setattr(mntfd, "", AT_EMPTY_PATH, &attr, sizeof attr) == -1){
+		fprintf(stderr, "mount_setattr /dev: %s\n", strerror(errno));
+		close(mntfd);
+		return -1;
+	}
+
+	// older kernels say EINVAL to cloning a detached mount, find out here
+	// rather than in every container.
+	if((fd = open_tree(mntfd, "", OPEN_TREE_CLONE|OPEN_TREE_CLOEXEC|AT_EMPTY_PATH)) == -1){
+		fprintf(stderr, "open_tree /dev template: %s, cloning it takes linux 6.15\n", strerror(errno));
+		close(mntfd);
+		return -1;
+	}
+	close(fd);
+	return mntfd;
+}
+
+// attaches a clone of the template from devtemplate at /dev.
+static int
+attachdev(int devfd)
+{
+	int fd;
+
+	if((fd = open_tree(devfd, "", OPEN_TREE_CLONE|OPEN_TREE_CLOEXEC|AT_EMPTY_PATH)) == -1){
+		fprintf(stderr, "open_tree /dev: %s\n", strerror(errno));
+		return -1;
+	}
+	if(move_mount(fd, "", AT_FDCWD, "/dev", MOVE_MOUNT_F_EMPTY_PATH) == -1){
+		fprintf(stderr, "move_mount /dev: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
 static void
 detachbut(char *path)
 {
@@ -141,45 +246,120 @@ static int
 enterchild(void *arg){
 	Args *ap = (Args *)arg;
 	char ifname[256];
+	uint64_t t;
 	int i;
 
+	// the monotonic clock is the same on both sides of the clone.
+	t = phasedone(ap, PhaseClone, ap->start);
+
 	close(ap->tube[0]); // close parent's end of the pipe
-	fcntl(ap->tube[1], O_CLOEXEC); // ... so caller is unblocked on successful exec
+	fcntl(ap->tube[1], F_SETFD, FD_CLOEXEC); // ... so caller is unblocked on successful exec
 
 	sethostname(ap->identity, strlen(ap->identity));
 
+	// a warm namespace from netpool instead of a new one.
+	if(ap->netns != -1){
+		if(setns(ap->netns, CLONE_NEWNET) == -1){
+			fprintf(stderr, "setns: %s\n", strerror(errno));
+			exit(1);
+		}
+		close(ap->netns);
+	}
+
 	ifconfig("lo", "127.0.0.1/8");
 
-	if(ap->ctrlsock != -1){
-		char *buf;
-		int tunfd;
+	if(ap->ctrlsock != -1 && ap->xdp){
+		char *buf, *hostif;
+		int respfd;
+
+		/*
+		 *	the host end is named after the container, and moved to
+		 *	the namespace containet is in, where it takes it over.
+		 */
+		hostif = smprintf("cx%.13s", ap->identity);
+		if(vethpair("eth0", hostif, ap->hostns) == -1)
+			exit(1);
+		close(ap->hostns);
+		ifconfig("eth0", ap->ip4addr);
+		ifmtu("eth0", 1500);
+		ifnocsum("eth0");
+		t = phasedone(ap, PhaseTun, t);
+		buf = smprintf(
+			json({
+				"authtoken": "%s",
+				"add-xdpport":{
+					"ifname":"eth0",
+					"nodeid":"%s",
+					"hostif":"%s"
+				}
+			}),
+			ap->authtoken,
+			ap->identity,
+			hostif
+		);
+		if(sendframe(ap->ctrlsock, -1, buf, strlen(buf)) == -1)
+			fprintf(stderr, "send fail\n");
+		free(buf);
+		free(hostif);
 
-		if((tunfd = tunopen(ifname, "eth0", ap->ip4addr)) == -1)
+		// read response
+		buf = malloc(256);
+		if(recvframe(ap->ctrlsock, &respfd, buf, 256) == -1)
+			fprintf(stderr, "failed to read response: %s\n", strerror(errno));
+		free(buf);
+		t = phasedone(ap, PhaseSendfd, t);
+	} else if(ap->ctrlsock != -1){
+		char *buf, *addrs;
+		int tunfd, respfd, n;
+
+		if(ap->tapfd != -1){
+			tunfd = ap->tapfd;
+			strcpy(ifname, "eth0");
+			ifconfig(ifname, ap->ip4addr);
+		} else if((tunfd = tunopen(ifname, "eth0", ap->ip4addr, ap->l3)) == -1){
 			exit(1);
+		}
+		/*
+		 *	the switch sends packets to a tun by their destination,
+		 *	so it has to be told the address that goes here.
+		 */
+		addrs = strdup("");
+		if(ap->l3 && ap->ip4addr != NULL){
+			n = strcspn(ap->ip4addr, "/");
+			free(addrs);
+			addrs = smprintf("\"%.*s\"", n, ap->ip4addr);
+		}
 		buf = smprintf(
 			json({
 				"authtoken": "%s",
 				"add-etherfd":{
 					"ifname":"%s",
-					"nodeid":"%s"
+					"nodeid":"%s",
+					"addrs":[%s]
 				}
 			}),
 			ap->authtoken,
 			ifname,
-			ap->identity
+			ap->identity,
+			addrs
 		);
-		if(sendfd(ap->ctrlsock, tunfd, buf, strlen(buf)) == -1)
+		free(addrs);
+		t = phasedone(ap, PhaseTun, t);
+		if(sendframe(ap->ctrlsock, tunfd, buf, strlen(buf)) == -1)
 			fprintf(stderr, "sendfd fail\n");
 		close(tunfd);
 		free(buf);
 
 		// read response
 		buf = malloc(256);
-		if(read(ap->ctrlsock, buf, 256) == -1)
+		if(recvframe(ap->ctrlsock, &respfd, buf, 256) == -1)
 			fprintf(stderr, "failed to read response: %s\n", strerror(errno));
 		free(buf);
-
+		t = phasedone(ap, PhaseSendfd, t);
 	}
+	if(ap->ctrlsock != -1 && ap->gateway != NULL && ifgateway("eth0", ap->gateway) == -1)
+		exit(1);
+	t = phasedone(ap, PhaseTun, t);
 
 	/*
 	 *	remount root as a slave before we do anything. stupid systemd made it shared
@@ -189,6 +369,7 @@ enterchild(void *arg){
 		fprintf(stderr, "mount(\"/\"): %s\n", strerror(errno));
 		exit(1);
 	}
+	t = phasedone(ap, PhaseMount, t);
 
 	if(ap->root != NULL){
 		/*
@@ -224,6 +405,7 @@ enterchild(void *arg){
 				free(work);
 				free(mountflags);
 			}
+			t = phasedone(ap, PhaseMount, t);
 
 			{
 				char *mntdir = smprintf("%s/mnt", ap->root);
@@ -271,13 +453,17 @@ enterchild(void *arg){
 			exit(1);
 		}
 	}
+	t = phasedone(ap, PhasePivot, t);
 
 	for(i = 0; i < nelem(mounts); i++){
 		if(mkdir(mounts[i].to, 0777) == -1 && errno != EEXIST){
 			fprintf(stderr, "mkdir(\"%s\"): %s\n", mounts[i].to, strerror(errno));
 			exit(1);
 		}
-		if(strcmp(mounts[i].type, "mkdir") != 0){
+		if(ap->devfd != -1 && strcmp(mounts[i].to, "/dev") == 0){
+			if(attachdev(ap->devfd) == -1)
+				exit(1);
+		} else if(strcmp(mounts[i].type, "mkdir") != 0){
 			if(mount(mounts[i].from, mounts[i].to, mounts[i].type, mounts[i].flags, NULL) == -1){
 				fprintf(stderr, "mount(\"%s\"): %s\n", mounts[i].to, strerror(errno));
 				exit(1);
@@ -285,16 +471,18 @@ enterchild(void *arg){
 		}
 	}
 
+	t = phasedone(ap, PhaseMounts, t);
+
 	mode_t oldmask = umask(0);
 
-	for(i = 0; i < nelem(dirs); i++){
+	for(i = 0; i < nelem(dirs) && ap->devfd == -1; i++){
 		if(mkdir(dirs[i].path, dirs[i].mode) == -1 && errno != EEXIST){
 			fprintf(stderr, "mkdir(\"%s\"): %s\n", dirs[i].path, strerror(errno));
 			exit(1);
 		}
 	}
 
-	for(i = 0; i < nelem(devices); i++){
+	for(i = 0; i < nelem(devices) && ap->devfd == -1; i++){
 		if(mknod(devices[i].path, devices[i].mode, makedev(devices[i].major, devices[i].minor)) == -1){
 			fprintf(stderr, "mknod(\"%s\"): %s\n", devices[i].path, strerror(errno));
 			exit(1);
@@ -302,10 +490,11 @@ enterchild(void *arg){
 	}
 
 	umask(oldmask);
+	t = phasedone(ap, PhaseMknod, t);
 
 	if(ap->postname != NULL){
 		char *buf;
-		int postfd;
+		int postfd, respfd;
 
 		if((postfd = unsocket(SOCK_STREAM, ap->postname, NULL)) == -1){
 			fprintf(stderr, "could not post %s\n", ap->postname);
@@ -322,13 +511,13 @@ enterchild(void *arg){
 			ap->authtoken,
 			ap->identity
 		);
-		if(sendfd(ap->ctrlsock, postfd, buf, strlen(buf)) == -1)
+		if(sendframe(ap->ctrlsock, postfd, buf, strlen(buf)) == -1)
 			fprintf(stderr, "sendfd fail\n");
 		free(buf);
 
 		// read response
 		buf = malloc(256);
-		if(read(ap->ctrlsock, buf, 256) == -1)
+		if(recvframe(ap->ctrlsock, &respfd, buf, 256) == -1)
 			fprintf(stderr, "failed to read response: %s\n", strerror(errno));
 		free(buf);
 
@@ -337,20 +526,32 @@ enterchild(void *arg){
 
 	if(ap->ctrlsock != -1)
 		close(ap->ctrlsock);
+	phasedone(ap, PhasePost, t);
+
+	// the times go up the tube first, the exec closes it after them.
+	write(ap->tube[1], ap->phases, sizeof ap->phases);
 
 
 	// wow, linux programs make a lot of weird system calls, many of which I'd prefer didn't exist,
 	// this part will have to wait until a lot later.
 	//seccomp();
 
+	// an ignored SIGPIPE would stay ignored over the exec.
+	signal(SIGPIPE, SIG_DFL);
 	execve(ap->argv[0], ap->argv, ap->environ);
 	fprintf(stderr, "exec(\"%s\"): %s\n", ap->argv[0], strerror(errno));
 	write(ap->tube[1], "exec", 4); // todo: replace with a slightly more general error signaling system.
 	exit(1);
 }
 
+/*
+ *	clones the container and returns its pid, with a pidfd for it in
+ *	*pidfdp if that isn't NULL. the start goes on in the child while
+ *	the caller does what it likes, and startdone waits for the rest,
+ *	or startpoll reads it as it comes, from args->tube[0].
+ */
 int
-runcontainer(Args *args, int cloneflags)
+startcontainer(Args *args, int cloneflags, int *pidfdp)
 {
 	size_t stacksize = 16384;
 	char *childstack = malloc(stacksize);
@@ -359,25 +560,95 @@ runcontainer(Args *args, int cloneflags)
 		exit(1);
 	}
 
-	if(pipe(args->tube) == -1){
+	// close-on-exec, so the tubes of other starts don't go to this one.
+	if(pipe2(args->tube, O_CLOEXEC) == -1){
 		fprintf(stderr, "could not create pipe: %s\n", strerror(errno));
 		exit(1);
 	}
 
+	if(pidfdp != NULL)
+		cloneflags |= CLONE_PIDFD;
+	// the parent's end doesn't block, for startpoll.
+	fcntl(args->tube[0], F_SETFL, O_NONBLOCK);
+	args->tubelen = 0;
+	memset(args->phases, 0, sizeof args->phases);
+	args->start = monotime();
 	int pid = clone(
 		enterchild, stackalign(childstack + stacksize),
 		cloneflags,
-		(void*)args
+		(void*)args,
+		pidfdp
 	);
 
 	close(args->tube[1]); // close the child's end right away
-	if(pid == -1)
+	free(childstack); // the child has a copy of it, there is no CLONE_VM.
+	if(pid == -1){
+		close(args->tube[0]);
 		return -1;
+	}
+	return pid;
+}
+
+/*
+ *	reads what the child has sent up the tube so far, without waiting.
+ *	the child sends its times just before the exec, and an error after
+ *	them if the exec fails. the exec takes until the tube closes, so
+ *	returns 1 once it has, and 0 while it hasn't.
+ */
+int
+startpoll(Args *args)
+{
+	size_t ntimes = sizeof args->phases;
+	char skip[64];
+	ssize_t nrd;
+
+	for(;;){
+		if(args->tubelen < (int)sizeof args->tubebuf)
+			nrd = read(args->tube[0], args->tubebuf + args->tubelen, sizeof args->tubebuf - args->tubelen);
+		else
+			nrd = read(args->tube[0], skip, sizeof skip); // an error too long to keep
+		if(nrd == -1 && errno == EINTR)
+			continue;
+		if(nrd == -1 && errno == EAGAIN)
+			return 0;
+		if(nrd == -1)
+			fprintf(stderr, "runcontainer: read: %s\n", strerror(errno));
+		if(nrd <= 0)
+			return 1;
+		if(args->tubelen < (int)sizeof args->tubebuf){
+			if(args->tubelen < (int)ntimes && args->tubelen + nrd >= (int)ntimes)
+				args->timesat = monotime();
+			args->tubelen += nrd;
+		}
+	}
+}
 
-	char *errbuf = malloc(256);
-	ssize_t err = read(args->tube[0], errbuf, 256);
+/*
+ *	waits for the container at pid to exec, and returns pid, or -1 if
+ *	it didn't make it, in which case it has been waited for. it doesn't
+ *	wait once startpoll has returned 1.
+ */
+int
+startdone(Args *args, int pid)
+{
+	struct pollfd pfd;
+	size_t ntimes = sizeof args->phases;
+	int err;
+
+	pfd.fd = args->tube[0];
+	pfd.events = POLLIN;
+	while(startpoll(args) == 0)
+		poll(&pfd, 1, -1);
 	close(args->tube[0]); // .. close our end here.. the child has closed by now anyway.
-	if(err != 0){
+	args->tube[0] = -1;
+
+	// a child that went before sending all its times didn't start either.
+	err = args->tubelen != (int)ntimes;
+	if(args->tubelen >= (int)ntimes){
+		memcpy(args->phases, args->tubebuf, ntimes);
+		args->phases[PhaseExec] = monotime() - args->timesat;
+	}
+	if(err){
 		int status;
 		if(waitpid(pid, &status, 0) == -1) {
 			fprintf(stderr, "waitpid: %s\n", strerror(errno));
@@ -385,16 +656,27 @@ runcontainer(Args *args, int cloneflags)
 		if(!WIFEXITED(status)){
 			fprintf(stderr, "error: child did not exit normally\n");
 		}
-		fprintf(stderr, "runcontainer error message: %.*s\n", (int)err, errbuf);
-		free(errbuf);
+		if(args->tubelen < (int)ntimes)
+			fprintf(stderr, "runcontainer error message: exited before exec\n");
+		else
+			fprintf(stderr, "runcontainer error message: %.*s\n", args->tubelen - (int)ntimes, args->tubebuf + ntimes);
+		errno = ECHILD; // not the EAGAIN of the last read
 		return -1;
 	}
-	free(errbuf);
-	free(childstack);
 
 	return pid;
 }
 
+int
+runcontainer(Args *args, int cloneflags)
+{
+	int pid;
+
+	if((pid = startcontainer(args, cloneflags, NULL)) == -1)
+		return -1;
+	return startdone(args, pid);
+}
+
 void
 cleancontainer(Args *ap)
 {
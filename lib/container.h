@@ -1,4 +1,19 @@
 typedef struct Args Args;
+
+// what starting a container takes, timed in nanoseconds into Args.
+enum {
+	PhaseClone = 0, // clone, until the child runs
+	PhaseTun, // its network, tunopen or the veth and the addresses
+	PhaseSendfd, // the round trip to containet with its port
+	PhaseMount, // the overlay of its root
+	PhasePivot, // pivot_root or chroot into it
+	PhaseMounts, // proc, dev and dev/pts
+	PhaseMknod, // the device files
+	PhasePost, // posting its control socket
+	PhaseExec, // execve, until it closes the tube
+	NPhases,
+};
+
 struct Args {
 	int argc;
 	char **argv;
@@ -7,15 +22,32 @@ struct Args {
 	char *toproot;
 	char *topwork;
 	char *ip4addr;
+	char *gateway; // default route, through the switch's router
 	char *identity;
 	int ctrlsock; // domain socket to switch
 	char *postname;
 	char *authtoken;
+	int xdp; // a veth served over AF_XDP instead of a tap
+	int l3; // a tun carrying ip packets instead of a tap
+	int hostns; // network namespace the host end of the veth goes to
+	int netns; // network namespace to go in instead of a new one, or -1
+	int tapfd; // the tap named eth0 in it, or -1
+	int devfd; // a template of /dev from devtemplate to clone, or -1
+
+	uint64_t phases[NPhases]; // filled in by runcontainer
 
 	// private variables..
 	int tube[2];
+	uint64_t start; // of the clone
+	char tubebuf[NPhases*sizeof(uint64_t) + 256]; // what came up the tube so far
+	int tubelen;
+	uint64_t timesat; // when the times had all come
 };
 
 
 int runcontainer(Args *Args, int cloneflags);
+int startcontainer(Args *args, int cloneflags, int *pidfdp);
+int startpoll(Args *args);
+int startdone(Args *args, int pid);
+int devtemplate(void);
 void cleancontainer(Args *ap);
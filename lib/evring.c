@@ -0,0 +1,162 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "evring.h"
+
+// high bits of Event.seq while a slot is being written, or was given up.
+#define Writing (1ull<<63)
+#define Dropped (1ull<<62)
+
+int
+evringinit(Evring *ring, int nevs)
+{
+	if(nevs <= 0 || (nevs & (nevs-1)) != 0)
+		return -1;
+	memset(ring, 0, sizeof ring[0]);
+	if((ring->evs = calloc(nevs, sizeof ring->evs[0])) == NULL)
+		return -1;
+	if((ring->fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) == -1){
+		free(ring->evs);
+		return -1;
+	}
+	ring->nevs = nevs;
+	return 0;
+}
+
+/*
+ *	the slot is marked as being written before it is filled in, so a
+ *	reader that gets there at the same time sees either the old event,
+ *	a slot that is not ready, or the new event, never half of each.
+ *	a producer that stalls for a whole lap of the ring finds its slot
+ *	taken by a later one. the later one gives the slot up rather than
+ *	write over a half written event, and the reader counts it as lost.
+ *	the sequence numbers in a slot only ever go up, so a late producer
+ *	can't leave an older one behind for the reader to wait on forever.
+ */
+void
+evringput(Evring *ring, int type, int port, uint8_t *mac, uint64_t count)
+{
+	struct timespec ts;
+	uint64_t seq, cur, one;
+	Event *ev;
+
+	seq = __sync_fetch_and_add(&ring->head, 1) + 1;
+	ev = ring->evs + ((seq-1) & (ring->nevs-1));
+	for(;;){
+		cur = ev->seq;
+		if((cur & ~(Writing|Dropped)) >= seq)
+			return;
+		if((cur & Writing) != 0){
+			if(__sync_bool_compare_and_swap(&ev->seq, cur, seq|Dropped))
+				goto wake;
+			continue;
+		}
+		if(__sync_bool_compare_and_swap(&ev->seq, cur, seq|Writing))
+			break;
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ev->nsec = (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+	ev->count = count;
+	ev->type = type;
+	ev->port = port;
+	if(mac != NULL)
+		memcpy(ev->mac, mac, sizeof ev->mac);
+	else
+		memset(ev->mac, 0, sizeof ev->mac);
+	__sync_synchronize();
+	__sync_bool_compare_and_swap(&ev->seq, seq|Writing, seq);
+
+wake:
+	if(ring->armed && __sync_bool_compare_and_swap(&ring->armed, 1, 0)){
+		one = 1;
+		write(ring->fd, &one, sizeof one);
+	}
+}
+
+/*
+ *	copies out the event at *cursorp and moves the cursor past it.
+ *	returns 0 when there is nothing to read yet. when the producers have
+ *	lapped the cursor, it jumps to the oldest event still in the ring and
+ *	the event read is EvLost, with the number skipped in count.
+ */
+int
+evringget(Evring *ring, uint64_t *cursorp, Event *ev)
+{
+	uint64_t cursor, head, seq;
+	Event *slot;
+
+	cursor = *cursorp;
+	for(;;){
+		head = ring->head;
+		if(cursor >= head)
+			return 0;
+		if(head - cursor > ring->nevs){
+			memset(ev, 0, sizeof ev[0]);
+			ev->type = EvLost;
+			ev->count = head - ring->nevs - cursor;
+			*cursorp = head - ring->nevs;
+			return 1;
+		}
+		slot = ring->evs + (cursor & (ring->nevs-1));
+		seq = slot->seq;
+		__sync_synchronize();
+		*ev = *slot;
+		__sync_synchronize();
+		if(seq == cursor + 1 && slot->seq == seq)
+			break;
+		if(seq == ((cursor + 1)|Dropped)){
+			memset(ev, 0, sizeof ev[0]);
+			ev->type = EvLost;
+			ev->count = 1;
+			break;
+		}
+		// not written yet, unless it was overwritten while we looked.
+		if(ring->head - cursor <= ring->nevs)
+			return 0;
+	}
+	*cursorp = cursor + 1;
+	return 1;
+}
+
+// drains the eventfd and asks the next producer to write to it again.
+void
+evringarm(Evring *ring)
+{
+	uint64_t val;
+
+	read(ring->fd, &val, sizeof val);
+	__sync_lock_test_and_set(&ring->armed, 1);
+}
+
+void
+evringfree(Evring *ring)
+{
+	free(ring->evs);
+	ring->evs = NULL;
+	close(ring->fd);
+	ring->fd = -1;
+}
@@ -0,0 +1,66 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	many producer, single consumer ring of small fixed size events.
+ *	producers never wait and never make a system call unless the
+ *	consumer is asleep: a consumer that falls behind loses the oldest
+ *	events and is told how many when it reads past them. the consumer
+ *	sleeps on an eventfd, which a producer writes only once per arming.
+ */
+enum {
+	EvPortOpen = 1,
+	EvPortClose,
+	EvMacLearn,
+	EvMacMove,
+	EvMacAge,
+	EvOverflow, // a queue was full and frames were dropped
+	EvRatelimit, // netem went over its limit
+	EvLost, // the reader fell behind by count events
+	EvNtypes,
+};
+
+typedef struct Event Event;
+typedef struct Evring Evring;
+
+struct Event {
+	volatile uint64_t seq; // sequence number + 1 once written, see evringput
+	uint64_t nsec; // CLOCK_REALTIME
+	uint64_t count;
+	uint32_t type;
+	uint32_t port;
+	uint8_t mac[6];
+};
+
+struct Evring {
+	Event *evs;
+	uint32_t nevs; // power of two
+	uint64_t head; // next sequence number to hand out
+	int armed;
+	int fd; // eventfd, readable when there are events after arming
+};
+
+int evringinit(Evring *ring, int nevs);
+void evringput(Evring *ring, int type, int port, uint8_t *mac, uint64_t count);
+int evringget(Evring *ring, uint64_t *cursorp, Event *ev);
+void evringarm(Evring *ring);
+void evringfree(Evring *ring);
@@ -0,0 +1,385 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "fwd.h"
+
+void
+qinit(Queue *q, Port *port)
+{
+	pthread_condattr_t attr;
+
+	memset(q, 0, sizeof q[0]);
+	pthread_mutex_init(&q->lock, NULL);
+	// qtimedget deadlines are on the monotonic clock.
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&q->kick, &attr);
+	pthread_condattr_destroy(&attr);
+	q->port = port;
+}
+
+/*
+ *	blocks until there is something in the queue. returns NULL only
+ *	once the queue has been closed and drained.
+ */
+Buffer *
+qget(Queue *q)
+{
+	Buffer *bp;
+	uint32_t qtail;
+
+	bp = NULL;
+	pthread_mutex_lock(&q->lock);
+	while(!q->closed && q->head == q->tail)
+		pthread_cond_wait(&q->kick, &q->lock);
+	if(q->head != q->tail){
+		qtail = q->tail;
+		bp = q->bufs[qtail];
+		q->tail = (qtail + 1) & (Qsize-1);
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return bp;
+}
+
+/*
+ *	like qget, but gives up at deadline, in CLOCK_MONOTONIC ns, and
+ *	returns NULL. a zero deadline waits for ever.
+ */
+Buffer *
+qtimedget(Queue *q, uint64_t deadline)
+{
+	struct timespec ts;
+	Buffer *bp;
+	uint32_t qtail;
+
+	if(deadline == 0)
+		return qget(q);
+	ts.tv_sec = deadline / 1000000000;
+	ts.tv_nsec = deadline % 1000000000;
+
+	bp = NULL;
+	pthread_mutex_lock(&q->lock);
+	while(!q->closed && q->head == q->tail)
+		if(pthread_cond_timedwait(&q->kick, &q->lock, &ts) != 0)
+			break;
+	if(q->head != q->tail){
+		qtail = q->tail;
+		bp = q->bufs[qtail];
+		q->tail = (qtail + 1) & (Qsize-1);
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return bp;
+}
+
+int
+qput(Queue *q, Buffer *bp)
+{
+	uint32_t qhead;
+
+	pthread_mutex_lock(&q->lock);
+	qhead = q->head;
+	if(((qhead + 1) & (Qsize-1)) != q->tail){
+		q->bufs[qhead] = bp;
+		q->head = (qhead + 1) & (Qsize-1);
+		// signal while holding lock, so we don't lose wakeups.
+		pthread_cond_signal(&q->kick);
+		pthread_mutex_unlock(&q->lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return -1;
+}
+
+// wakes up everyone waiting, qget returns NULL from here on when empty.
+void
+qclose(Queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->closed = 1;
+	pthread_cond_broadcast(&q->kick);
+	pthread_mutex_unlock(&q->lock);
+}
+
+void
+qreopen(Queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->closed = 0;
+	pthread_mutex_unlock(&q->lock);
+}
+
+int
+bincref(Buffer *bp)
+{
+	return __sync_fetch_and_add(&bp->nref, 1) + 1;
+}
+
+int
+bdecref(Buffer *bp)
+{
+	return __sync_fetch_and_add(&bp->nref, -1) - 1;
+}
+
+// drops a reference, and gives the buffer back to its owner if it was the last.
+void
+brelease(Buffer *bp)
+{
+	if(bdecref(bp) == 0)
+		qput(bp->freeq, bp);
+}
+
+uint32_t
+hashmac(uint8_t *buf)
+{
+	uint32_t a, b, c;
+
+	a = (uint32_t)buf[0] + ((uint32_t)buf[1]<<8);
+	b = (uint32_t)buf[2] + ((uint32_t)buf[3]<<8);
+	c = (uint32_t)buf[4] + ((uint32_t)buf[5]<<8);
+
+// from lookup3.c, by Bob Jenkins, May 2006, Public Domain.
+// http://burtleburtle.net/bob/c/lookup3.c
+#define rot32(x,k) (((x)<<(k)) | ((x)>>(32-(k))))
+	c ^= b; c -= rot32(b,14);
+	a ^= c; a -= rot32(c,11);
+	b ^= a; b -= rot32(a,25);
+	c ^= b; c -= rot32(b,16);
+	a ^= c; a -= rot32(c,4);
+	b ^= a; b -= rot32(a,14);
+	c ^= b; c -= rot32(b,24);
+#undef rot32
+
+	return c;
+}
+
+int
+cmpmac(uint8_t *a, uint8_t *b)
+{
+	int i, rv;
+	rv = 0;
+	for(i = 0; i < 6; i++)
+		rv += a[i] != b[i];
+	return rv;
+}
+
+void
+copymac(uint8_t *dst, uint8_t *src)
+{
+	int i;
+	for(i = 0; i < 6; i++)
+		dst[i] = src[i];
+}
+
+/*
+ *	returns the entry for mac, or the empty slot where it would go,
+ *	or NULL if the table is full and mac is not in it.
+ */
+Cam *
+camlook(Cam *cams, uint8_t *mac)
+{
+	Cam *cam;
+	uint32_t hash;
+	int i;
+
+	hash = hashmac(mac) & (Camsize-1);
+	for(i = 1; i <= Camsize; i++){
+		cam = cams + hash;
+		if(cmpmac(cam->mac, mac) == 0 || cam->port == NULL)
+			return cam;
+		hash = (hash+i) & (Camsize-1);
+	}
+
+	return NULL;
+}
+
+/*
+ *	remembers that mac is behind peer of port, which is 0 for ports that
+ *	only have one. returns CamKnown, CamNew or CamMoved for an address
+ *	that was behind some other port or peer, and -1 if the table is full.
+ */
+int
+camlearn(Cam *cams, uint8_t *mac, Port *port, int peer)
+{
+	Port *oldport;
+	int oldpeer;
+	Cam *cam;
+
+	cam = camlook(cams, mac);
+	if(cam == NULL)
+		return -1;
+	// always update the port, so if an address moves to a different port
+	// the cam will point to that port right away.
+	oldport = cam->port;
+	oldpeer = cam->peer;
+	copymac(cam->mac, mac);
+	cam->age = 0;
+	cam->peer = peer;
+	cam->port = port;
+	if(oldport == port && oldpeer == peer)
+		return CamKnown;
+	return oldport == NULL ? CamNew : CamMoved;
+}
+
+/*
+ *	decides where an ethernet frame that came in from inport, from its
+ *	peer inpeer, goes, and teaches the cam about its source address. for FwdUnicast, the port
+ *	to send to is put in *outportp. what camlearn made of the source goes
+ *	in *learnp, if it is not NULL.
+ */
+int
+fwdframe(Cam *cams, Port *inport, int inpeer, uint8_t *frame, int len, Port **outportp, int *learnp)
+{
+	Cam *cam;
+	int learn, rv;
+
+	if(len < 14)
+		return FwdDrop;
+
+	rv = FwdFlood;
+	cam = camlook(cams, frame);
+	if(cam != NULL && cam->port != NULL){
+		*outportp = cam->port;
+		rv = FwdUnicast;
+	}
+
+	if((learn = camlearn(cams, frame+6, inport, inpeer)) == -1)
+		fprintf(stderr, "cam presumably full..\n");
+	if(learnp != NULL)
+		*learnp = learn;
+
+	return rv;
+}
+
+static uint32_t
+haship(int version, uint8_t *ip)
+{
+	uint32_t hash;
+	int i;
+
+	hash = 2166136261u;
+	for(i = 0; i < (version == 4 ? 4 : 16); i++)
+		hash = (hash ^ ip[i]) * 16777619u;
+	return hash;
+}
+
+// the slot ip is in, whether its route was given up or not, or NULL.
+static Host *
+hostfind(Host *hosts, int version, uint8_t *ip)
+{
+	Host *h;
+	uint32_t hash;
+	int i;
+
+	hash = haship(version, ip) & (Hostsize-1);
+	for(i = 1; i <= Hostsize; i++){
+		h = hosts + hash;
+		if(h->version == 0)
+			return NULL;
+		if(h->version == version && memcmp(h->ip, ip, version == 4 ? 4 : 16) == 0)
+			return h;
+		hash = (hash+i) & (Hostsize-1);
+	}
+	return NULL;
+}
+
+// the host route to ip, or NULL if there is none.
+Host *
+hostlook(Host *hosts, int version, uint8_t *ip)
+{
+	Host *h;
+
+	h = hostfind(hosts, version, ip);
+	return h != NULL && h->port != NULL ? h : NULL;
+}
+
+/*
+ *	sends packets to ip, version 4 or 6, to port. slots given up by
+ *	hostdrop keep their address, so lookups go on past them, and are
+ *	taken again for the same address or by a new one.
+ */
+int
+hostadd(Host *hosts, int version, uint8_t *ip, Port *port)
+{
+	Host *h;
+	uint32_t hash;
+	int i;
+
+	if(version != 4 && version != 6)
+		return -1;
+	if((h = hostfind(hosts, version, ip)) == NULL){
+		hash = haship(version, ip) & (Hostsize-1);
+		for(i = 1; i <= Hostsize; i++){
+			h = hosts + hash;
+			if(h->port == NULL)
+				break;
+			hash = (hash+i) & (Hostsize-1);
+		}
+		if(i > Hostsize)
+			return -1;
+		memcpy(h->ip, ip, version == 4 ? 4 : 16);
+		h->version = version;
+	}
+	__sync_synchronize();
+	h->port = port;
+	return 0;
+}
+
+// gives up the host routes to port.
+void
+hostdrop(Host *hosts, Port *port)
+{
+	int i;
+
+	for(i = 0; i < Hostsize; i++)
+		if(hosts[i].port == port)
+			hosts[i].port = NULL;
+}
+
+/*
+ *	decides where an ip packet that came in from inport goes, by its
+ *	destination address alone. there is nothing to learn and no
+ *	flooding, packets to addresses without a host route are dropped.
+ */
+int
+fwdpacket(Host *hosts, Port *inport, uint8_t *pkt, int len, Port **outportp)
+{
+	Host *h;
+	Port *port;
+
+	if(len >= 20 && pkt[0]>>4 == 4)
+		h = hostlook(hosts, 4, pkt+16);
+	else if(len >= 40 && pkt[0]>>4 == 6)
+		h = hostlook(hosts, 6, pkt+24);
+	else
+		return FwdDrop;
+	if(h == NULL || (port = h->port) == NULL || port == inport)
+		return FwdDrop;
+	*outportp = port;
+	return FwdUnicast;
+}
@@ -0,0 +1,106 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	the forwarding core of the switch: buffers, queues between threads,
+ *	the mac address table, the host routes of ports that carry ip
+ *	packets instead of frames, and the decision of where a frame goes.
+ *	none of it does i/o, so it can be tested and timed on its own.
+ *	Port is whatever the user of the library makes of it.
+ */
+enum {
+	Camsize = 8192, // power of two
+	Hostsize = 4096, // power of two
+	Qsize = 64, // power of two
+};
+
+enum {
+	CamKnown = 0,
+	CamNew = 1,
+	CamMoved = 2,
+};
+
+enum {
+	FwdDrop = 0,
+	FwdFlood = 1,
+	FwdUnicast = 2,
+};
+
+typedef struct Buffer Buffer;
+typedef struct Cam Cam;
+typedef struct Host Host;
+typedef struct Port Port;
+typedef struct Queue Queue;
+
+struct Cam {
+	Port *port;
+	int peer; // which of the peers of a trunk port the address is behind
+	uint16_t age;
+	uint8_t mac[6];
+};
+
+struct Host {
+	Port *port; // NULL for a free slot, or one given up if version is set
+	uint8_t version; // 4 or 6, as in the ip header
+	uint8_t ip[16];
+};
+
+struct Buffer {
+	Queue *freeq;
+	void *buf;
+	int len;
+	int cap;
+	int nref;
+};
+
+struct Queue {
+	Port *port;
+	pthread_cond_t kick;
+	pthread_mutex_t lock;
+	int closed;
+	uint32_t head;
+	uint32_t tail;
+	Buffer *bufs[Qsize];
+};
+
+void qinit(Queue *q, Port *port);
+Buffer *qget(Queue *q);
+Buffer *qtimedget(Queue *q, uint64_t deadline);
+int qput(Queue *q, Buffer *bp);
+void qclose(Queue *q);
+void qreopen(Queue *q);
+
+int bincref(Buffer *bp);
+int bdecref(Buffer *bp);
+void brelease(Buffer *bp);
+
+uint32_t hashmac(uint8_t *mac);
+int cmpmac(uint8_t *a, uint8_t *b);
+void copymac(uint8_t *dst, uint8_t *src);
+Cam *camlook(Cam *cams, uint8_t *mac);
+int camlearn(Cam *cams, uint8_t *mac, Port *port, int peer);
+Host *hostlook(Host *hosts, int version, uint8_t *ip);
+int hostadd(Host *hosts, int version, uint8_t *ip, Port *port);
+void hostdrop(Host *hosts, Port *port);
+
+int fwdframe(Cam *cams, Port *inport, int inpeer, uint8_t *frame, int len, Port **outportp, int *learnp);
+int fwdpacket(Host *hosts, Port *inport, uint8_t *pkt, int len, Port **outportp);
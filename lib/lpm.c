@@ -0,0 +1,287 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lpm.h"
+
+#define entry(len, value) ((uint32_t)(len)<<23 | (value))
+#define entrylen(e) (((e)>>23) & 0xff)
+
+/*
+ *	bits is 32 or 128, and maxgroups how many groups of 256 entries
+ *	there can be, which one prefix longer than the first level needs one
+ *	of for each byte past it, less what it shares with the others.
+ */
+int
+lpminit(Lpm *lpm, int bits, int maxgroups)
+{
+	int i;
+
+	if(bits != 32 && bits != 128)
+		return -1;
+	memset(lpm, 0, sizeof lpm[0]);
+	lpm->bits = bits;
+	lpm->first = bits == 32 ? 24 : 16;
+	lpm->maxgroups = maxgroups;
+	// big, but calloc maps it on demand, and most of it is never touched.
+	lpm->tbl = calloc((size_t)1 << lpm->first, sizeof lpm->tbl[0]);
+	lpm->groups = calloc((size_t)maxgroups * 256, sizeof lpm->groups[0]);
+	lpm->freegroups = malloc(maxgroups * sizeof lpm->freegroups[0]);
+	if(lpm->tbl == NULL || lpm->groups == NULL || lpm->freegroups == NULL){
+		lpmfree(lpm);
+		return -1;
+	}
+	for(i = 0; i < maxgroups; i++)
+		lpm->freegroups[i] = maxgroups-1 - i;
+	lpm->nfree = maxgroups;
+	return 0;
+}
+
+void
+lpmfree(Lpm *lpm)
+{
+	free(lpm->tbl);
+	free(lpm->groups);
+	free(lpm->freegroups);
+	free(lpm->rules);
+	memset(lpm, 0, sizeof lpm[0]);
+}
+
+// the n bits of addr from off, both multiples of 8.
+static uint32_t
+addrbits(uint8_t *addr, int off, int n)
+{
+	uint32_t v;
+	int i;
+
+	v = 0;
+	for(i = off/8; i < (off+n)/8; i++)
+		v = v<<8 | addr[i];
+	return v;
+}
+
+// clears the bits of prefix past len.
+static void
+maskprefix(uint8_t *dst, uint8_t *prefix, int len, int bits)
+{
+	int i;
+
+	memset(dst, 0, 16);
+	for(i = 0; i < bits/8; i++){
+		if(len >= 8*(i+1))
+			dst[i] = prefix[i];
+		else if(len > 8*i)
+			dst[i] = prefix[i] & (0xff << (8*(i+1) - len));
+	}
+}
+
+static uint32_t *
+group(Lpm *lpm, uint32_t e)
+{
+	return lpm->groups + (size_t)(e & ~LpmExt)*256;
+}
+
+/*
+ *	sets e, an entry of a level that ends at bit end, and the entries
+ *	of the groups under it, to want where they hold what was there for
+ *	a prefix of length oldlen or shorter. adding passes its own length,
+ *	deleting the length it had, and only for exactly that. a group left
+ *	all the same goes back in its parent's entry, the way it came.
+ */
+static void
+setentry(Lpm *lpm, uint32_t *ep, int end, uint32_t want, int oldlen, int exact)
+{
+	uint32_t e, *g;
+	int i;
+
+	e = *ep;
+	if((e & LpmExt) != 0){
+		g = group(lpm, e);
+		for(i = 0; i < 256; i++)
+			setentry(lpm, g+i, end+8, want, oldlen, exact);
+		for(i = 1; i < 256 && g[i] == g[0]; i++)
+			;
+		if(i == 256 && (g[0] & LpmExt) == 0){
+			*ep = g[0];
+			lpm->freegroups[lpm->nfree++] = e & ~LpmExt;
+		}
+		return;
+	}
+	if(exact ? (e != 0 && (int)entrylen(e) == oldlen) : (e == 0 || (int)entrylen(e) <= oldlen))
+		*ep = want;
+}
+
+/*
+ *	walks tab, the level of n bits from off, down to where prefix of
+ *	len ends, making groups on the way when adding, and sets the entries
+ *	it covers there.
+ */
+static int
+walk(Lpm *lpm, uint32_t *tab, int off, int n, uint8_t *prefix, int len, uint32_t want, int exact)
+{
+	uint32_t idx, e, *g;
+	int i, gi, span;
+
+	idx = addrbits(prefix, off, n);
+	if(len <= off+n){
+		span = off+n - len;
+		idx &= ~((1u << span) - 1);
+		for(i = 0; i < 1 << span; i++)
+			setentry(lpm, tab + idx + i, off+n, want, len, exact);
+		return 0;
+	}
+	e = tab[idx];
+	if((e & LpmExt) == 0){
+		if(exact)
+			return 0;
+		if(lpm->nfree == 0){
+			fprintf(stderr, "lpm: out of groups\n");
+			return -1;
+		}
+		gi = lpm->freegroups[--lpm->nfree];
+		g = lpm->groups + (size_t)gi*256;
+		for(i = 0; i < 256; i++)
+			g[i] = e;
+		// readers only see the group once it is filled in.
+		__sync_synchronize();
+		tab[idx] = LpmExt | gi;
+		e = tab[idx];
+	}
+	if(walk(lpm, group(lpm, e), off+n, 8, prefix, len, want, exact) == -1)
+		return -1;
+	if(exact){
+		g = group(lpm, e);
+		for(i = 1; i < 256 && g[i] == g[0]; i++)
+			;
+		if(i == 256 && (g[0] & LpmExt) == 0){
+			tab[idx] = g[0];
+			lpm->freegroups[lpm->nfree++] = e & ~LpmExt;
+		}
+	}
+	return 0;
+}
+
+static Lpmrule *
+findrule(Lpm *lpm, uint8_t *prefix, int len)
+{
+	int i;
+
+	for(i = 0; i < lpm->nrules; i++)
+		if(lpm->rules[i].len == len && memcmp(lpm->rules[i].prefix, prefix, lpm->bits/8) == 0)
+			return lpm->rules + i;
+	return NULL;
+}
+
+/*
+ *	adds prefix of len bits, or changes the value it has. value is from
+ *	1 to LpmMaxvalue. returns -1 if it doesn't fit.
+ */
+int
+lpmadd(Lpm *lpm, uint8_t *prefix, int len, uint32_t value)
+{
+	uint8_t masked[16];
+	Lpmrule *rule;
+
+	if(len < 0 || len > lpm->bits || value == 0 || value > LpmMaxvalue)
+		return -1;
+	maskprefix(masked, prefix, len, lpm->bits);
+	if((rule = findrule(lpm, masked, len)) == NULL){
+		if(lpm->nrules == lpm->arules){
+			lpm->arules = lpm->arules ? 2*lpm->arules : 16;
+			lpm->rules = realloc(lpm->rules, lpm->arules * sizeof lpm->rules[0]);
+		}
+		rule = lpm->rules + lpm->nrules++;
+		memcpy(rule->prefix, masked, sizeof rule->prefix);
+		rule->len = len;
+	}
+	rule->value = value;
+	if(walk(lpm, lpm->tbl, 0, lpm->first, masked, len, entry(len, value), 0) == -1){
+		// it is in the table as far as it got, so take it out again.
+		lpmdel(lpm, masked, len);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *	takes prefix of len bits out, and gives the addresses it had to the
+ *	longest of the rest that covers them. returns -1 if it wasn't there.
+ */
+int
+lpmdel(Lpm *lpm, uint8_t *prefix, int len)
+{
+	uint8_t masked[16], cmask[16];
+	Lpmrule *rule, *cover;
+	uint32_t want;
+	int i;
+
+	if(len < 0 || len > lpm->bits)
+		return -1;
+	maskprefix(masked, prefix, len, lpm->bits);
+	if((rule = findrule(lpm, masked, len)) == NULL)
+		return -1;
+	*rule = lpm->rules[--lpm->nrules];
+
+	cover = NULL;
+	for(i = 0; i < lpm->nrules; i++){
+		if(lpm->rules[i].len >= len || (cover != NULL && lpm->rules[i].len <= cover->len))
+			continue;
+		maskprefix(cmask, masked, lpm->rules[i].len, lpm->bits);
+		if(memcmp(cmask, lpm->rules[i].prefix, lpm->bits/8) == 0)
+			cover = lpm->rules + i;
+	}
+	want = cover != NULL ? entry(cover->len, cover->value) : 0;
+	walk(lpm, lpm->tbl, 0, lpm->first, masked, len, want, 1);
+	return 0;
+}
+
+// the value prefix of len bits was added with, or 0.
+uint32_t
+lpmget(Lpm *lpm, uint8_t *prefix, int len)
+{
+	uint8_t masked[16];
+	Lpmrule *rule;
+
+	if(len < 0 || len > lpm->bits)
+		return 0;
+	maskprefix(masked, prefix, len, lpm->bits);
+	rule = findrule(lpm, masked, len);
+	return rule != NULL ? rule->value : 0;
+}
+
+// the value of the longest prefix that addr starts with, or 0.
+uint32_t
+lpmlookup(Lpm *lpm, uint8_t *addr)
+{
+	uint32_t e;
+	int off;
+
+	if(lpm->first == 24)
+		e = lpm->tbl[addr[0]<<16 | addr[1]<<8 | addr[2]];
+	else
+		e = lpm->tbl[addr[0]<<8 | addr[1]];
+	for(off = lpm->first/8; (e & LpmExt) != 0; off++)
+		e = lpm->groups[(size_t)(e & ~LpmExt)*256 + addr[off]];
+	return e & LpmMaxvalue;
+}
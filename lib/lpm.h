@@ -0,0 +1,67 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	longest prefix match laid out like DIR-24-8: a first level table
+ *	indexed by the top bits of the address, and a group of 256 entries
+ *	for each further byte of the prefixes that go past it. most lookups
+ *	are one load, and one more for each byte after that. ipv4 has 24
+ *	bits in the first level, ipv6 16, and then up to 14 more levels.
+ *	every entry has the value of the longest prefix covering it and how
+ *	long that is, so a prefix added only writes over shorter ones, and
+ *	a prefix deleted is replaced by the next longest covering it. one
+ *	writer at a time, lookups can go on while it writes.
+ */
+enum {
+	LpmExt = 0x80000000, // the entry is a group
+	LpmMaxvalue = (1<<23) - 1, // values are 1 to this, 0 is no match
+};
+
+typedef struct Lpm Lpm;
+typedef struct Lpmrule Lpmrule;
+
+struct Lpmrule {
+	uint8_t prefix[16];
+	int len;
+	uint32_t value;
+};
+
+struct Lpm {
+	int bits; // of the addresses, 32 or 128
+	int first; // bits in the first level
+	uint32_t *tbl; // 1<<first entries
+	uint32_t *groups; // maxgroups groups of 256 entries
+	int *freegroups; // unused groups, to take from the end
+	int nfree;
+	int maxgroups;
+	Lpmrule *rules; // what was added, to find what covers a deleted prefix
+	int nrules;
+	int arules;
+};
+
+int lpminit(Lpm *lpm, int bits, int maxgroups);
+void lpmfree(Lpm *lpm);
+int lpmadd(Lpm *lpm, uint8_t *prefix, int len, uint32_t value);
+int lpmdel(Lpm *lpm, uint8_t *prefix, int len);
+uint32_t lpmget(Lpm *lpm, uint8_t *prefix, int len);
+uint32_t lpmlookup(Lpm *lpm, uint8_t *addr);
+
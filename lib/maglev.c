@@ -0,0 +1,146 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "maglev.h"
+
+static uint32_t
+fnv(uint8_t *key, uint32_t hash)
+{
+	int i;
+
+	for(i = 0; i < MaglevKeylen; i++)
+		hash = (hash ^ key[i]) * 16777619u;
+	return hash;
+}
+
+void
+maglevinit(Maglev *m)
+{
+	memset(m, 0, sizeof m[0]);
+	memset(m->table, MaglevNone, sizeof m->table);
+}
+
+/*
+ *	fills the table in again. an entry is written once, with its new
+ *	backend, so a lookup in the middle of it sees the old one or the
+ *	new one.
+ */
+static void
+build(Maglev *m)
+{
+	uint8_t taken[MaglevSize];
+	uint32_t next[MaglevMax], pos;
+	int order[MaglevMax], i, j, k, n, filled;
+
+	n = 0;
+	for(i = 0; i < MaglevMax; i++){
+		if(!m->used[i])
+			continue;
+		// in the order of the keys, not of the slots.
+		for(j = n; j > 0 && memcmp(m->keys[order[j-1]], m->keys[i], MaglevKeylen) > 0; j--)
+			order[j] = order[j-1];
+		order[j] = i;
+		n++;
+	}
+	if(n == 0){
+		memset(m->table, MaglevNone, sizeof m->table);
+		return;
+	}
+	memset(taken, 0, sizeof taken);
+	memset(next, 0, sizeof next);
+	filled = 0;
+	for(;;){
+		for(j = 0; j < n; j++){
+			k = order[j];
+			do {
+				pos = (m->offset[k] + (uint64_t)next[k]*m->skip[k]) % MaglevSize;
+				next[k]++;
+			} while(taken[pos]);
+			taken[pos] = 1;
+			m->table[pos] = k;
+			if(++filled == MaglevSize)
+				return;
+		}
+	}
+}
+
+// the slot of the backend with key, or -1.
+int
+maglevfind(Maglev *m, uint8_t *key)
+{
+	int i;
+
+	for(i = 0; i < MaglevMax; i++)
+		if(m->used[i] && memcmp(m->keys[i], key, MaglevKeylen) == 0)
+			return i;
+	return -1;
+}
+
+/*
+ *	adds a backend with MaglevKeylen bytes of key, and returns its
+ *	slot, which stays the same until it is deleted, or -1 if there is
+ *	no room.
+ */
+int
+maglevadd(Maglev *m, uint8_t *key)
+{
+	int i;
+
+	if((i = maglevfind(m, key)) != -1)
+		return i;
+	for(i = 0; i < MaglevMax && m->used[i]; i++)
+		;
+	if(i == MaglevMax)
+		return -1;
+	memcpy(m->keys[i], key, MaglevKeylen);
+	m->offset[i] = fnv(key, 2166136261u) % MaglevSize;
+	m->skip[i] = fnv(key, 0x9e3779b9u) % (MaglevSize-1) + 1;
+	m->used[i] = 1;
+	m->n++;
+	build(m);
+	return i;
+}
+
+// deletes the backend with key, returns the slot it had or -1.
+int
+maglevdel(Maglev *m, uint8_t *key)
+{
+	int i;
+
+	if((i = maglevfind(m, key)) == -1)
+		return -1;
+	m->used[i] = 0;
+	m->n--;
+	build(m);
+	return i;
+}
+
+// the slot of the backend for a flow with hash, or -1 if there are none.
+int
+maglevlookup(Maglev *m, uint32_t hash)
+{
+	int slot;
+
+	slot = m->table[hash % MaglevSize];
+	return slot != MaglevNone ? slot : -1;
+}
@@ -0,0 +1,57 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	maglev consistent hashing: a table of a prime number of entries,
+ *	each naming one of the backends, filled by letting the backends
+ *	take turns at claiming the next free entry in a permutation of
+ *	their own. every backend ends up with about the same share, and a
+ *	backend coming or going moves little more than its own share. the
+ *	permutations come from the backends' keys, and the turns go in the
+ *	order of the keys, so a table made of the same backends is the same
+ *	wherever and in whatever order they were added. lookups go on while
+ *	the table is rebuilt, and always find a backend that was there
+ *	before or after.
+ */
+enum {
+	MaglevSize = 8191, // prime, and well over a hundred times MaglevMax
+	MaglevMax = 64, // backends
+	MaglevKeylen = 16,
+	MaglevNone = 0xff, // entry of an empty table
+};
+
+typedef struct Maglev Maglev;
+
+struct Maglev {
+	int n; // backends
+	uint8_t used[MaglevMax];
+	uint8_t keys[MaglevMax][MaglevKeylen];
+	uint32_t offset[MaglevMax];
+	uint32_t skip[MaglevMax];
+	uint8_t table[MaglevSize]; // slots of backends
+};
+
+void maglevinit(Maglev *m);
+int maglevadd(Maglev *m, uint8_t *key);
+int maglevfind(Maglev *m, uint8_t *key);
+int maglevdel(Maglev *m, uint8_t *key);
+int maglevlookup(Maglev *m, uint32_t hash);
@@ -0,0 +1,261 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "netem.h"
+
+static uint32_t
+xorshift(uint32_t *state)
+{
+	uint32_t x;
+
+	x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+// true with probability ppm parts per million.
+static int
+chance(Netem *ne, uint32_t ppm)
+{
+	if(ppm == 0)
+		return 0;
+	return xorshift(&ne->rnd) % 1000000 < ppm;
+}
+
+int
+netemactive(Netemconf *conf)
+{
+	return conf->delay != 0 || conf->jitter != 0 || conf->rate != 0 ||
+		conf->loss != 0 || conf->reorder != 0 || conf->duplicate != 0;
+}
+
+Netem *
+netemcreate(Netemconf *conf, uint64_t now)
+{
+	Netem *ne;
+
+	if((ne = malloc(sizeof ne[0])) == NULL)
+		return NULL;
+	memset(ne, 0, sizeof ne[0]);
+	ne->cursor = now / NetemTick;
+	ne->rnd = (uint32_t)now | 1;
+	netemconfig(ne, conf);
+	return ne;
+}
+
+// takes effect for buffers put from now on, the ones held keep their times.
+void
+netemconfig(Netem *ne, Netemconf *conf)
+{
+	ne->conf = *conf;
+	if(ne->conf.limit <= 0)
+		ne->conf.limit = NetemLimit;
+}
+
+// frees the frames still held too.
+void
+netemfree(Netem *ne)
+{
+	Netemchunk *cp;
+	int i;
+
+	while((cp = ne->chunks) != NULL){
+		ne->chunks = cp->next;
+		for(i = 0; i < NetemChunk; i++)
+			free(cp->nodes[i].data);
+		free(cp);
+	}
+	free(ne);
+}
+
+static Netemnode *
+nodealloc(Netem *ne)
+{
+	Netemchunk *cp;
+	Netemnode *np;
+	int i;
+
+	if(ne->free == NULL){
+		if((cp = malloc(sizeof cp[0])) == NULL)
+			return NULL;
+		memset(cp, 0, sizeof cp[0]);
+		cp->next = ne->chunks;
+		ne->chunks = cp;
+		for(i = 0; i < NetemChunk; i++){
+			cp->nodes[i].next = ne->free;
+			ne->free = cp->nodes + i;
+		}
+	}
+	np = ne->free;
+	ne->free = np->next;
+	return np;
+}
+
+void
+netemrelease(Netem *ne, Netemnode *np)
+{
+	np->next = ne->free;
+	ne->free = np;
+}
+
+static void
+schedule(Netem *ne, uint8_t *frame, int len, uint64_t due)
+{
+	Netemnode *np;
+	uint8_t *data;
+	int slot;
+
+	if(ne->npending >= ne->conf.limit || (np = nodealloc(ne)) == NULL){
+		ne->overlimit++;
+		return;
+	}
+	if(np->cap < len){
+		if((data = realloc(np->data, len)) == NULL){
+			netemrelease(ne, np);
+			ne->overlimit++;
+			return;
+		}
+		np->data = data;
+		np->cap = len;
+	}
+	memcpy(np->data, frame, len);
+	np->len = len;
+	due /= NetemTick;
+	if(due < ne->cursor)
+		due = ne->cursor;
+	np->due = due;
+	np->next = NULL;
+	slot = due & (NetemSlots-1);
+	if(ne->head[slot] == NULL)
+		ne->head[slot] = np;
+	else
+		ne->tail[slot]->next = np;
+	ne->tail[slot] = np;
+	ne->npending++;
+}
+
+// drops the frame, or keeps a copy of it until it is due.
+void
+netemput(Netem *ne, uint8_t *frame, int len, uint64_t now)
+{
+	Netemconf *conf;
+	uint64_t due, txtime;
+	int64_t jit;
+	int i, ncopies;
+
+	conf = &ne->conf;
+	if(chance(ne, conf->loss)){
+		ne->lost++;
+		return;
+	}
+	ncopies = 1;
+	if(chance(ne, conf->duplicate)){
+		ne->duplicated++;
+		ncopies = 2;
+	}
+	for(i = 0; i < ncopies; i++){
+		if(conf->delay != 0 && chance(ne, conf->reorder)){
+			ne->reordered++;
+			schedule(ne, frame, len, now);
+			continue;
+		}
+		due = now + conf->delay;
+		if(conf->jitter != 0){
+			jit = (int64_t)(xorshift(&ne->rnd) % (2*conf->jitter + 1)) - (int64_t)conf->jitter;
+			if(jit < 0 && (uint64_t)-jit > due - now)
+				due = now;
+			else
+				due += jit;
+		}
+		if(conf->rate != 0){
+			// the line is busy until the one before has been clocked out.
+			txtime = (uint64_t)len * 8 * 1000000000 / conf->rate;
+			if(ne->linefree < now)
+				ne->linefree = now;
+			if(due < ne->linefree)
+				due = ne->linefree;
+			ne->linefree = due + txtime;
+		}
+		schedule(ne, frame, len, due);
+	}
+}
+
+// the caller gives np back with netemrelease.
+static Netemnode *
+dequeue(Netem *ne, int slot, Netemnode *prev, Netemnode *np)
+{
+	if(prev == NULL)
+		ne->head[slot] = np->next;
+	else
+		prev->next = np->next;
+	if(ne->tail[slot] == np)
+		ne->tail[slot] = prev;
+	ne->npending--;
+	return np;
+}
+
+// the next frame that is due by now, or NULL.
+Netemnode *
+netemget(Netem *ne, uint64_t now)
+{
+	Netemnode *np, *prev;
+	uint64_t nowtick;
+	int slot;
+
+	nowtick = now / NetemTick;
+	if(ne->npending == 0){
+		if(ne->cursor < nowtick)
+			ne->cursor = nowtick;
+		return NULL;
+	}
+	for(; ne->cursor <= nowtick; ne->cursor++){
+		slot = ne->cursor & (NetemSlots-1);
+		prev = NULL;
+		for(np = ne->head[slot]; np != NULL; np = np->next){
+			if(np->due <= nowtick)
+				return dequeue(ne, slot, prev, np);
+			prev = np;
+		}
+		if(ne->cursor == nowtick)
+			break;
+	}
+	return NULL;
+}
+
+// when to call netemget next, in ns. zero if nothing is held.
+uint64_t
+netemnext(Netem *ne)
+{
+	uint64_t tick;
+
+	if(ne->npending == 0)
+		return 0;
+	for(tick = ne->cursor; tick < ne->cursor + NetemSlots; tick++)
+		if(ne->head[tick & (NetemSlots-1)] != NULL)
+			return tick * NetemTick;
+	return ne->cursor * NetemTick;
+}
@@ -0,0 +1,94 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	wan link emulation for one port: delay with jitter, loss, reordering,
+ *	duplication and a rate cap. delayed buffers wait on a timer wheel of
+ *	NetemTick slots, each slot a list in arrival order. a node whose due
+ *	time is more than a turn of the wheel away just stays in its slot
+ *	until the wheel comes around to it again.
+ *
+ *	frames are copied in, so that holding them back does not starve the
+ *	port they came from of buffers. a Netem belongs to the thread that
+ *	writes to the port, there is no locking.
+ */
+enum {
+	NetemTick = 100000, // ns per slot
+	NetemSlots = 4096, // power of two
+	NetemLimit = 1000, // default number of buffers held back
+	NetemChunk = 256, // nodes are allocated this many at a time
+};
+
+typedef struct Netem Netem;
+typedef struct Netemconf Netemconf;
+typedef struct Netemnode Netemnode;
+typedef struct Netemchunk Netemchunk;
+
+// probabilities are in parts per million.
+struct Netemconf {
+	uint64_t delay; // ns
+	uint64_t jitter; // ns, delay varies uniformly by this much either way
+	uint64_t rate; // bits per second, zero is no cap
+	uint32_t loss;
+	uint32_t reorder; // sent right away, ahead of delayed ones
+	uint32_t duplicate;
+	int limit; // buffers held, more than that are dropped
+};
+
+struct Netemnode {
+	Netemnode *next;
+	uint64_t due; // in ticks
+	uint8_t *data;
+	int len;
+	int cap;
+};
+
+struct Netemchunk {
+	Netemchunk *next;
+	Netemnode nodes[NetemChunk];
+};
+
+struct Netem {
+	Netemconf conf;
+	Netemnode *head[NetemSlots];
+	Netemnode *tail[NetemSlots];
+	Netemnode *free;
+	Netemchunk *chunks;
+	uint64_t cursor; // the first tick not expired yet
+	uint64_t linefree; // ns, when the rate cap lets the next one go
+	uint32_t rnd;
+	int npending;
+
+	uint64_t lost;
+	uint64_t duplicated;
+	uint64_t reordered;
+	uint64_t overlimit;
+};
+
+int netemactive(Netemconf *conf);
+Netem *netemcreate(Netemconf *conf, uint64_t now);
+void netemconfig(Netem *ne, Netemconf *conf);
+void netemfree(Netem *ne);
+void netemput(Netem *ne, uint8_t *frame, int len, uint64_t now);
+Netemnode *netemget(Netem *ne, uint64_t now);
+void netemrelease(Netem *ne, Netemnode *np);
+uint64_t netemnext(Netem *ne);
@@ -0,0 +1,264 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/veth.h>
+#include <linux/pkt_sched.h>
+#include <linux/pkt_cls.h>
+#include <linux/if_ether.h>
+#include <linux/tc_act/tc_mirred.h>
+#include <arpa/inet.h>
+#include "netlink.h"
+
+enum {
+	Nlbufsize = 1024,
+	TcPrio = 1, // all the redirects share one u32 classifier
+	TcHtid = 0x80000000, // and its root hash table
+};
+
+typedef struct Nlreq Nlreq;
+struct Nlreq {
+	struct nlmsghdr hdr;
+	union {
+		struct ifinfomsg ifi;
+		struct tcmsg tcm;
+	};
+	char attrs[Nlbufsize];
+};
+
+static struct rtattr *
+addattr(Nlreq *req, int type, void *data, int len)
+{
+	struct rtattr *rta;
+
+	rta = (struct rtattr *)((char *)req + NLMSG_ALIGN(req->hdr.nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	if(len > 0)
+		memcpy(RTA_DATA(rta), data, len);
+	req->hdr.nlmsg_len = NLMSG_ALIGN(req->hdr.nlmsg_len) + RTA_ALIGN(rta->rta_len);
+	return rta;
+}
+
+// closes an attribute opened with addattr(req, type, NULL, 0).
+static void
+endnest(Nlreq *req, struct rtattr *nest)
+{
+	nest->rta_len = (char *)req + req->hdr.nlmsg_len - (char *)nest;
+}
+
+static void
+reqinit(Nlreq *req, int type, int flags)
+{
+	memset(req, 0, sizeof req[0]);
+	req->hdr.nlmsg_len = NLMSG_LENGTH(sizeof req->ifi);
+	req->hdr.nlmsg_type = type;
+	req->hdr.nlmsg_flags = NLM_F_REQUEST|NLM_F_ACK|flags;
+	req->ifi.ifi_family = AF_UNSPEC;
+}
+
+// the same for the traffic control requests, on the ingress of ifindex.
+static void
+tcinit(Nlreq *req, int type, int flags, int ifindex)
+{
+	memset(req, 0, sizeof req[0]);
+	req->hdr.nlmsg_len = NLMSG_LENGTH(sizeof req->tcm);
+	req->hdr.nlmsg_type = type;
+	req->hdr.nlmsg_flags = NLM_F_REQUEST|NLM_F_ACK|flags;
+	req->tcm.tcm_family = AF_UNSPEC;
+	req->tcm.tcm_ifindex = ifindex;
+	req->tcm.tcm_parent = TC_H_MAKE(TC_H_CLSACT, TC_H_MIN_INGRESS);
+	req->tcm.tcm_info = TC_H_MAKE(TcPrio<<16, htons(ETH_P_ALL));
+}
+
+// sends req and returns 0 if the kernel acks it, -1 with errno if not.
+static int
+nlrequest(Nlreq *req)
+{
+	struct nlmsghdr *hdr;
+	struct nlmsgerr *err;
+	char buf[Nlbufsize];
+	int fd, nrd;
+
+	if((fd = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE)) == -1)
+		return -1;
+	if(send(fd, req, req->hdr.nlmsg_len, 0) == -1 || (nrd = recv(fd, buf, sizeof buf, 0)) == -1){
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	hdr = (struct nlmsghdr *)buf;
+	if(!NLMSG_OK(hdr, (unsigned)nrd) || hdr->nlmsg_type != NLMSG_ERROR){
+		errno = EPROTO;
+		return -1;
+	}
+	err = NLMSG_DATA(hdr);
+	if(err->error != 0){
+		errno = -err->error;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *	makes a veth pair of name in this network namespace and peer in the
+ *	one peernsfd is open on.
+ */
+int
+vethpair(char *name, char *peer, int peernsfd)
+{
+	Nlreq req;
+	struct ifinfomsg peerifi;
+	struct rtattr *linkinfo, *data, *peerinfo;
+
+	reqinit(&req, RTM_NEWLINK, NLM_F_CREATE|NLM_F_EXCL);
+	addattr(&req, IFLA_IFNAME, name, strlen(name)+1);
+	linkinfo = addattr(&req, IFLA_LINKINFO, NULL, 0);
+	addattr(&req, IFLA_INFO_KIND, "veth", 4);
+	data = addattr(&req, IFLA_INFO_DATA, NULL, 0);
+	memset(&peerifi, 0, sizeof peerifi);
+	peerifi.ifi_family = AF_UNSPEC;
+	peerinfo = addattr(&req, VETH_INFO_PEER, &peerifi, sizeof peerifi);
+	addattr(&req, IFLA_IFNAME, peer, strlen(peer)+1);
+	addattr(&req, IFLA_NET_NS_FD, &peernsfd, sizeof peernsfd);
+	endnest(&req, peerinfo);
+	endnest(&req, data);
+	endnest(&req, linkinfo);
+	if(nlrequest(&req) == -1){
+		fprintf(stderr, "vethpair %s %s: %s\n", name, peer, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ *	attaches the xdp program progfd to the interface, or detaches what
+ *	is there when progfd is -1. flags are the XDP_FLAGS_ ones, and pick
+ *	the mode.
+ */
+int
+linkxdp(int ifindex, int progfd, uint32_t flags)
+{
+	Nlreq req;
+	struct rtattr *xdp;
+
+	reqinit(&req, RTM_SETLINK, 0);
+	req.ifi.ifi_index = ifindex;
+	xdp = addattr(&req, IFLA_XDP, NULL, 0);
+	addattr(&req, IFLA_XDP_FD, &progfd, sizeof progfd);
+	addattr(&req, IFLA_XDP_FLAGS, &flags, sizeof flags);
+	endnest(&req, xdp);
+	return nlrequest(&req);
+}
+
+/*
+ *	adds the clsact qdisc to the interface, to hang filters on its
+ *	ingress. it being there already is fine.
+ */
+int
+tcclsact(int ifindex)
+{
+	Nlreq req;
+
+	tcinit(&req, RTM_NEWQDISC, NLM_F_CREATE|NLM_F_EXCL, ifindex);
+	req.tcm.tcm_parent = TC_H_CLSACT;
+	req.tcm.tcm_handle = TC_H_MAKE(TC_H_CLSACT, 0);
+	req.tcm.tcm_info = 0;
+	addattr(&req, TCA_KIND, "clsact", 7);
+	if(nlrequest(&req) == -1 && errno != EEXIST)
+		return -1;
+	return 0;
+}
+
+/*
+ *	adds filter n to the ingress of ifindex, sending every frame to
+ *	dstmac out of toifindex in the kernel. it is a u32 match rather than
+ *	flower, which is a module fewer kernels have. u32 keys are aligned
+ *	words from the ip header, so the address is the last two bytes of
+ *	the one at -16 and all of the one at -12.
+ */
+int
+tcredirect(int ifindex, int n, uint8_t *dstmac, int toifindex)
+{
+	Nlreq req;
+	struct rtattr *opts, *acts, *act, *actopts;
+	struct {
+		struct tc_u32_sel sel;
+		struct tc_u32_key keys[2];
+	} sel;
+	struct tc_mirred mirred;
+	uint8_t *val, *mask;
+	uint32_t flags;
+
+	tcinit(&req, RTM_NEWTFILTER, NLM_F_CREATE, ifindex);
+	req.tcm.tcm_handle = TcHtid | n;
+	addattr(&req, TCA_KIND, "u32", 4);
+	opts = addattr(&req, TCA_OPTIONS, NULL, 0);
+	memset(&sel, 0, sizeof sel);
+	sel.sel.flags = TC_U32_TERMINAL;
+	sel.sel.nkeys = 2;
+	sel.keys[0].off = -16;
+	val = (uint8_t *)&sel.keys[0].val;
+	mask = (uint8_t *)&sel.keys[0].mask;
+	memcpy(val+2, dstmac, 2);
+	memset(mask+2, 0xff, 2);
+	sel.keys[1].off = -12;
+	memcpy(&sel.keys[1].val, dstmac+2, 4);
+	sel.keys[1].mask = 0xffffffff;
+	addattr(&req, TCA_U32_SEL, &sel, sizeof sel);
+	flags = TCA_CLS_FLAGS_SKIP_HW;
+	addattr(&req, TCA_U32_FLAGS, &flags, sizeof flags);
+	acts = addattr(&req, TCA_U32_ACT, NULL, 0);
+	act = addattr(&req, 1, NULL, 0);
+	addattr(&req, TCA_ACT_KIND, "mirred", 7);
+	actopts = addattr(&req, TCA_ACT_OPTIONS, NULL, 0);
+	memset(&mirred, 0, sizeof mirred);
+	mirred.action = TC_ACT_STOLEN;
+	mirred.eaction = TCA_EGRESS_REDIR;
+	mirred.ifindex = toifindex;
+	addattr(&req, TCA_MIRRED_PARMS, &mirred, sizeof mirred);
+	endnest(&req, actopts);
+	endnest(&req, act);
+	endnest(&req, acts);
+	endnest(&req, opts);
+	return nlrequest(&req);
+}
+
+// removes filter n from the ingress of ifindex.
+int
+tcdelete(int ifindex, int n)
+{
+	Nlreq req;
+
+	tcinit(&req, RTM_DELTFILTER, 0, ifindex);
+	req.tcm.tcm_handle = TcHtid | n;
+	addattr(&req, TCA_KIND, "u32", 4);
+	return nlrequest(&req);
+}
@@ -0,0 +1,163 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "pktring.h"
+
+static size_t
+ringsize(uint32_t nslots, uint32_t slotsize)
+{
+	return sizeof(Pktring) + (size_t)nslots*slotsize;
+}
+
+static Pktslot *
+ringslot(Pktring *ring, uint32_t i)
+{
+	uint8_t *base;
+
+	base = (uint8_t *)(ring + 1);
+	return (Pktslot *)(base + (size_t)(i & (ring->nslots-1))*ring->slotsize);
+}
+
+Pktring *
+pktringcreate(int nslots, int snaplen, int *fdp)
+{
+	Pktring *ring;
+	uint32_t slotsize;
+	size_t size;
+	int fd;
+
+	if(nslots <= 0 || (nslots & (nslots-1)) != 0 || snaplen <= 0){
+		errno = EINVAL;
+		return NULL;
+	}
+	slotsize = (sizeof(Pktslot) + snaplen + 7) & ~7;
+	size = ringsize(nslots, slotsize);
+
+	if((fd = memfd_create("pktring", MFD_CLOEXEC)) == -1){
+		fprintf(stderr, "pktringcreate: memfd_create: %s\n", strerror(errno));
+		return NULL;
+	}
+	if(ftruncate(fd, size) == -1){
+		fprintf(stderr, "pktringcreate: ftruncate: %s\n", strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	ring = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if(ring == MAP_FAILED){
+		fprintf(stderr, "pktringcreate: mmap: %s\n", strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	ring->nslots = nslots;
+	ring->slotsize = slotsize;
+	ring->magic = PktringMagic;
+
+	*fdp = fd;
+	return ring;
+}
+
+Pktring *
+pktringmap(int fd)
+{
+	Pktring hdr, *ring;
+
+	if(pread(fd, &hdr, sizeof hdr, 0) != sizeof hdr){
+		fprintf(stderr, "pktringmap: short read\n");
+		return NULL;
+	}
+	if(hdr.magic != PktringMagic){
+		fprintf(stderr, "pktringmap: bad magic 0x%x\n", hdr.magic);
+		return NULL;
+	}
+	ring = mmap(NULL, ringsize(hdr.nslots, hdr.slotsize), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if(ring == MAP_FAILED){
+		fprintf(stderr, "pktringmap: mmap: %s\n", strerror(errno));
+		return NULL;
+	}
+	return ring;
+}
+
+void
+pktringfree(Pktring *ring)
+{
+	munmap(ring, ringsize(ring->nslots, ring->slotsize));
+}
+
+/*
+ *	copies the packet in if there is room, otherwise counts a drop.
+ *	the consumer sees the slot only after head has moved past it.
+ */
+int
+pktringput(Pktring *ring, int port, uint8_t *pkt, int len)
+{
+	struct timespec ts;
+	Pktslot *slot;
+	uint32_t head, caplen;
+
+	head = ring->head;
+	if(head - ring->tail >= ring->nslots){
+		__sync_fetch_and_add(&ring->drops, 1);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	caplen = ring->slotsize - sizeof(Pktslot);
+	if(caplen > (uint32_t)len)
+		caplen = len;
+
+	slot = ringslot(ring, head);
+	slot->nsec = (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+	slot->port = port;
+	slot->caplen = caplen;
+	slot->len = len;
+	memcpy(slot->data, pkt, caplen);
+
+	__sync_synchronize();
+	ring->head = head+1;
+	return 0;
+}
+
+Pktslot *
+pktringpeek(Pktring *ring)
+{
+	uint32_t tail;
+
+	tail = ring->tail;
+	if(tail == ring->head)
+		return NULL;
+	__sync_synchronize();
+	return ringslot(ring, tail);
+}
+
+void
+pktringpop(Pktring *ring)
+{
+	__sync_synchronize();
+	ring->tail = ring->tail+1;
+}
@@ -0,0 +1,61 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	single producer, single consumer ring of packet slots in a memfd,
+ *	so one process can hand frames to another without any system calls
+ *	on the producer side. containet fills it, netdump drains it.
+ */
+enum {
+	PktringMagic = 0x70726e67,
+	PktringNames = 4096, // a name for each of containet's MaxPorts ports
+};
+
+typedef struct Pktring Pktring;
+typedef struct Pktslot Pktslot;
+
+struct Pktslot {
+	uint64_t nsec; // CLOCK_REALTIME
+	uint32_t port;
+	uint32_t caplen;
+	uint32_t len;
+	uint32_t pad;
+	uint8_t data[];
+};
+
+struct Pktring {
+	uint32_t magic;
+	uint32_t nslots; // power of two
+	uint32_t slotsize; // including the Pktslot header
+	volatile uint32_t closed;
+	volatile uint32_t head; // written by the producer only
+	volatile uint32_t tail; // written by the consumer only
+	uint64_t drops;
+	char names[PktringNames][32];
+};
+
+Pktring *pktringcreate(int nslots, int snaplen, int *fdp);
+Pktring *pktringmap(int fd);
+void pktringfree(Pktring *ring);
+int pktringput(Pktring *ring, int port, uint8_t *pkt, int len);
+Pktslot *pktringpeek(Pktring *ring);
+void pktringpop(Pktring *ring);
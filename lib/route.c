@@ -0,0 +1,996 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "lpm.h"
+#include "maglev.h"
+#include "snat.h"
+#include "route.h"
+
+enum {
+	NeighFree = 0,
+	NeighAsked, // a request went out, nothing came back yet
+	NeighKnown,
+};
+
+enum {
+	EtherArp = 0x0806,
+	EtherIp = 0x0800,
+	EtherIp6 = 0x86dd,
+
+	IcmpEchoreply = 0,
+	IcmpEcho = 8,
+	Icmp6 = 58,
+	NdSolicit = 135,
+	NdAdvert = 136,
+	NdSrclladdr = 1,
+	NdTgtlladdr = 2,
+
+	Ndsize = 14+40+32, // a solicitation or an advertisement with our address
+	Arpsize = 60, // an arp frame, padded to the shortest there is
+};
+
+static uint8_t broadcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+static int
+addrlen(int family)
+{
+	return family == AF_INET ? 4 : 16;
+}
+
+int
+routeinit(Router *r, uint8_t *mac, uint8_t *selfmac)
+{
+	memset(r, 0, sizeof r[0]);
+	memcpy(r->mac, mac, 6);
+	memcpy(r->selfmac, selfmac, 6);
+	if(lpminit(&r->lpm4, 32, RouteGroups) == -1)
+		return -1;
+	if(lpminit(&r->lpm6, 128, RouteGroups) == -1){
+		lpmfree(&r->lpm4);
+		return -1;
+	}
+	return 0;
+}
+
+void
+routefree(Router *r)
+{
+	lpmfree(&r->lpm4);
+	lpmfree(&r->lpm6);
+	if(r->snat != NULL){
+		snatfree(r->snat);
+		free(r->snat);
+	}
+}
+
+static Route *
+findroute(Router *r, int family, uint8_t *prefix, int len)
+{
+	uint32_t v;
+
+	v = lpmget(family == AF_INET ? &r->lpm4 : &r->lpm6, prefix, len);
+	return v != 0 ? r->routes + v-1 : NULL;
+}
+
+/*
+ *	adds a subnet of ours when connected is set, with gw the gateway's
+ *	address on it, or a route through the router at gw otherwise. gw
+ *	has to be on one of our subnets by the time a frame is routed.
+ *	adding what is there already changes it.
+ */
+int
+routeadd(Router *r, int family, uint8_t *prefix, int len, int connected, uint8_t *gw)
+{
+	Route *rt;
+	int i, n;
+
+	n = addrlen(family);
+	if(len < 0 || len > 8*n)
+		return -1;
+	if((rt = findroute(r, family, prefix, len)) == NULL){
+		for(i = 0; i < RouteMax && r->routes[i].family != 0; i++)
+			;
+		if(i == RouteMax)
+			return -1;
+		rt = r->routes + i;
+	}
+	memset(rt->prefix, 0, sizeof rt->prefix);
+	for(i = 0; i < n; i++){
+		if(len >= 8*(i+1))
+			rt->prefix[i] = prefix[i];
+		else if(len > 8*i)
+			rt->prefix[i] = prefix[i] & (0xff << (8*(i+1) - len));
+	}
+	rt->len = len;
+	rt->connected = connected;
+	memset(rt->gw, 0, sizeof rt->gw);
+	memcpy(rt->gw, gw, n);
+	rt->family = family;
+	if(lpmadd(family == AF_INET ? &r->lpm4 : &r->lpm6, prefix, len, rt - r->routes + 1) == -1){
+		rt->family = 0;
+		return -1;
+	}
+	return 0;
+}
+
+int
+routedel(Router *r, int family, uint8_t *prefix, int len)
+{
+	Route *rt;
+
+	if((rt = findroute(r, family, prefix, len)) == NULL)
+		return -1;
+	lpmdel(family == AF_INET ? &r->lpm4 : &r->lpm6, prefix, len);
+	rt->family = 0;
+	return 0;
+}
+
+static Route *
+lookup(Router *r, int family, uint8_t *addr)
+{
+	uint32_t v;
+
+	v = lpmlookup(family == AF_INET ? &r->lpm4 : &r->lpm6, addr);
+	return v != 0 ? r->routes + v-1 : NULL;
+}
+
+// the subnet of ours addr is on, if it is not the gateway itself.
+static Route *
+onlink(Router *r, int family, uint8_t *addr)
+{
+	Route *rt;
+
+	rt = lookup(r, family, addr);
+	if(rt == NULL || !rt->connected || memcmp(rt->gw, addr, addrlen(family)) == 0)
+		return NULL;
+	return rt;
+}
+
+// is addr the gateway of one of our subnets.
+static int
+isgateway(Router *r, int family, uint8_t *addr)
+{
+	Route *rt;
+
+	rt = lookup(r, family, addr);
+	return rt != NULL && rt->connected && memcmp(rt->gw, addr, addrlen(family)) == 0;
+}
+
+/*
+ *	the neighbour with ip, or the free slot where it goes, in the same
+ *	open addressing as the cam.
+ */
+static Neigh *
+neighlook(Router *r, int family, uint8_t *ip)
+{
+	Neigh *n;
+	uint32_t hash;
+	int i, len;
+
+	len = addrlen(family);
+	hash = 2166136261u;
+	for(i = 0; i < len; i++)
+		hash = (hash ^ ip[i]) * 16777619u;
+	hash &= RouteNeighs-1;
+	for(i = 1; i <= RouteNeighs; i++){
+		n = r->neighs + hash;
+		if(n->state == NeighFree || (n->family == family && memcmp(n->ip, ip, len) == 0))
+			return n;
+		hash = (hash+i) & (RouteNeighs-1);
+	}
+	return NULL;
+}
+
+// remembers where a host on one of our subnets is.
+static void
+glean(Router *r, int family, uint8_t *ip, uint8_t *mac)
+{
+	Neigh *n;
+
+	if(onlink(r, family, ip) == NULL || (mac[0] & 1) != 0 || (n = neighlook(r, family, ip)) == NULL)
+		return;
+	if(n->state != NeighKnown || memcmp(n->mac, mac, 6) != 0){
+		memcpy(n->ip, ip, addrlen(family));
+		n->family = family;
+		memcpy(n->mac, mac, 6);
+		n->state = NeighKnown;
+	}
+	n->age = 0;
+}
+
+// forgets neighbours not heard from for a while, once an interval.
+void
+routeage(Router *r)
+{
+	Neigh *n;
+	int i;
+
+	for(i = 0; i < RouteNeighs; i++){
+		n = r->neighs + i;
+		if(n->state == NeighFree)
+			continue;
+		if(n->state == NeighAsked || ++n->age >= RouteNeighage)
+			memset(n, 0, sizeof n[0]);
+	}
+}
+
+static uint32_t
+vipkeyhash(int family, uint8_t *ip, int proto, int port)
+{
+	uint32_t hash;
+	int i;
+
+	hash = (2166136261u ^ family) * 16777619u;
+	hash = (hash ^ proto) * 16777619u;
+	hash = (hash ^ (port >> 8)) * 16777619u;
+	hash = (hash ^ (port & 0xff)) * 16777619u;
+	for(i = 0; i < addrlen(family); i++)
+		hash = (hash ^ ip[i]) * 16777619u;
+	return hash;
+}
+
+// the key for ip, proto and port, given up or not, or NULL.
+static Vipkey *
+vipkeyfind(Router *r, int family, uint8_t *ip, int proto, int port)
+{
+	Vipkey *k;
+	uint32_t hash;
+	int i;
+
+	hash = vipkeyhash(family, ip, proto, port) & (RouteVipkeys-1);
+	for(i = 1; i <= RouteVipkeys; i++){
+		k = r->vipkeys + hash;
+		if(k->family == 0)
+			return NULL;
+		if(k->family == family && k->proto == proto && k->port == port && memcmp(k->ip, ip, addrlen(family)) == 0)
+			return k;
+		hash = (hash+i) & (RouteVipkeys-1);
+	}
+	return NULL;
+}
+
+static Vipkey *
+vipkeylook(Router *r, int family, uint8_t *ip, int proto, int port)
+{
+	Vipkey *k;
+
+	k = vipkeyfind(r, family, ip, proto, port);
+	return k != NULL && k->vip != -1 ? k : NULL;
+}
+
+/*
+ *	points the key for ip, proto and port at vip and slot, or gives it
+ *	up if vip is -1. given up keys stay in the probe sequence, as the
+ *	host routes in fwd do.
+ */
+static int
+vipkeyset(Router *r, int family, uint8_t *ip, int proto, int port, int vip, int slot)
+{
+	Vipkey *k;
+	uint32_t hash;
+	int i;
+
+	if((k = vipkeyfind(r, family, ip, proto, port)) == NULL){
+		if(vip == -1)
+			return 0;
+		hash = vipkeyhash(family, ip, proto, port) & (RouteVipkeys-1);
+		for(i = 1; i <= RouteVipkeys; i++){
+			k = r->vipkeys + hash;
+			if(k->family == 0 || k->vip == -1)
+				break;
+			hash = (hash+i) & (RouteVipkeys-1);
+		}
+		if(i > RouteVipkeys)
+			return -1;
+		k->vip = -1;
+		k->proto = proto;
+		k->port = port;
+		memcpy(k->ip, ip, addrlen(family));
+		k->family = family;
+	}
+	k->slot = slot;
+	__sync_synchronize();
+	k->vip = vip;
+	return 0;
+}
+
+static int
+isvip(Router *r, int family, uint8_t *addr)
+{
+	return r->nvips > 0 && vipkeylook(r, family, addr, 0, 0) != NULL;
+}
+
+/*
+ *	puts backend behind the service at vip, proto and port, making the
+ *	service if it is new. a backend can only be behind one service on
+ *	the same port, so its answers can be told apart.
+ */
+int
+routevipadd(Router *r, int family, uint8_t *vip, int proto, int port, uint8_t *backend)
+{
+	uint8_t key[MaglevKeylen];
+	Vipkey *k;
+	Vip *v;
+	int i, slot;
+
+	if((proto != IPPROTO_TCP && proto != IPPROTO_UDP) || port <= 0 || port > 65535)
+		return -1;
+	if(memcmp(vip, backend, addrlen(family)) == 0)
+		return -1;
+	if((k = vipkeylook(r, family, vip, proto, port)) != NULL){
+		i = k->vip;
+	} else {
+		if(isgateway(r, family, vip))
+			return -1;
+		for(i = 0; i < RouteVips && r->vips[i].family != 0; i++)
+			;
+		if(i == RouteVips)
+			return -1;
+	}
+	v = r->vips + i;
+	if((k = vipkeylook(r, family, backend, proto, port)) != NULL && (k->vip != i || k->slot == -1))
+		return -1;
+	if(v->family == 0){
+		memset(v, 0, sizeof v[0]);
+		memcpy(v->ip, vip, addrlen(family));
+		v->proto = proto;
+		v->port = port;
+		maglevinit(&v->mg);
+	}
+	memset(key, 0, sizeof key);
+	memcpy(key, backend, addrlen(family));
+	if((slot = maglevadd(&v->mg, key)) == -1)
+		return -1;
+	if(vipkeyset(r, family, backend, proto, port, i, slot) == -1){
+		maglevdel(&v->mg, key);
+		return -1;
+	}
+	if(v->family == 0){
+		if(vipkeyset(r, family, vip, proto, port, i, -1) == -1
+		|| (vipkeylook(r, family, vip, 0, 0) == NULL && vipkeyset(r, family, vip, 0, 0, i, -1) == -1)){
+			vipkeyset(r, family, vip, proto, port, -1, -1);
+			vipkeyset(r, family, backend, proto, port, -1, -1);
+			return -1;
+		}
+		v->family = family;
+		r->nvips++;
+	}
+	return 0;
+}
+
+/*
+ *	takes backend from behind the service, or all of them if it is
+ *	NULL. the service goes with its last backend.
+ */
+int
+routevipdel(Router *r, int family, uint8_t *vip, int proto, int port, uint8_t *backend)
+{
+	uint8_t key[MaglevKeylen];
+	Vipkey *k;
+	Vip *v;
+	int i, vi;
+
+	if((k = vipkeylook(r, family, vip, proto, port)) == NULL)
+		return -1;
+	vi = k->vip;
+	v = r->vips + vi;
+	for(i = 0; i < MaglevMax; i++){
+		if(!v->mg.used[i] || (backend != NULL && memcmp(v->mg.keys[i], backend, addrlen(family)) != 0))
+			continue;
+		memcpy(key, v->mg.keys[i], sizeof key);
+		vipkeyset(r, family, key, proto, port, -1, -1);
+		maglevdel(&v->mg, key);
+		if(backend != NULL)
+			break;
+	}
+	if(backend != NULL && i == MaglevMax)
+		return -1;
+	if(v->mg.n > 0)
+		return 0;
+
+	vipkeyset(r, family, vip, proto, port, -1, -1);
+	v->family = 0;
+	r->nvips--;
+	// the address stays while another service has it.
+	if((k = vipkeylook(r, family, vip, 0, 0)) != NULL && k->vip == vi){
+		for(i = 0; i < RouteVips; i++)
+			if(r->vips[i].family == family && memcmp(r->vips[i].ip, vip, addrlen(family)) == 0)
+				break;
+		vipkeyset(r, family, vip, 0, 0, i < RouteVips ? i : -1, -1);
+	}
+	return 0;
+}
+
+/*
+ *	makes the router a source nat gateway from addr, on the subnet of len
+ *	bits around it, with outside ports from minport to maxport. the
+ *	subnet is added as one of ours, with addr its gateway. the gateway
+ *	stays once it is made, and making it again is only allowed the same.
+ */
+int
+routesnat(Router *r, uint8_t *addr, int len, int minport, int maxport)
+{
+	Snat *s;
+
+	if(r->snat != NULL){
+		s = r->snat;
+		if(memcmp(s->addr, addr, 4) != 0 || r->snatlen != len || s->minport != minport || s->maxport != maxport)
+			return -1;
+		return routeadd(r, AF_INET, addr, len, 1, addr);
+	}
+	if(len < 1 || len > 30 || (s = malloc(sizeof s[0])) == NULL)
+		return -1;
+	if(snatinit(s, addr, minport, maxport) == -1){
+		free(s);
+		return -1;
+	}
+	if(routeadd(r, AF_INET, addr, len, 1, addr) == -1){
+		snatfree(s);
+		free(s);
+		return -1;
+	}
+	r->snatlen = len;
+	__sync_synchronize();
+	r->snat = s;
+	return 0;
+}
+
+static int
+issnat(Router *r, uint8_t *addr)
+{
+	return r->snat != NULL && memcmp(r->snat->addr, addr, 4) == 0;
+}
+
+/*
+ *	the ip packet in a frame, as far as the load balancer and source nat
+ *	care. l4 is NULL for fragments, whose ports, if they have them, don't
+ *	tell a flow apart from the others of the same hosts, and for all but
+ *	tcp, udp and icmp echoes, whose identifier stands for both ports.
+ */
+typedef struct Flow Flow;
+struct Flow {
+	int family;
+	uint8_t *ip;
+	uint8_t *src;
+	uint8_t *dst;
+	int proto;
+	uint8_t *l4;
+	int l4len;
+	int sport;
+	int dport;
+};
+
+static int
+parseflow(uint8_t *frame, int len, Flow *f)
+{
+	uint8_t *ip;
+	int type, hlen;
+
+	type = frame[12]<<8 | frame[13];
+	ip = frame+14;
+	f->ip = ip;
+	f->l4 = NULL;
+	if(type == EtherIp && len >= 14+20 && (ip[0] >> 4) == 4){
+		hlen = (ip[0] & 15) * 4;
+		f->family = AF_INET;
+		f->src = ip+12;
+		f->dst = ip+16;
+		f->proto = ip[9];
+		if((ip[6] & 0x3f) == 0 && ip[7] == 0 && len >= 14+hlen+8){
+			f->l4 = ip+hlen;
+			f->l4len = len - 14-hlen;
+		}
+	} else if(type == EtherIp6 && len >= 14+40 && (ip[0] >> 4) == 6){
+		f->family = AF_INET6;
+		f->src = ip+8;
+		f->dst = ip+24;
+		f->proto = ip[6];
+		if(len >= 14+40+8){
+			f->l4 = ip+40;
+			f->l4len = len - 14-40;
+		}
+	} else {
+		return -1;
+	}
+	if(f->l4 != NULL && f->family == AF_INET && f->proto == IPPROTO_ICMP
+	&& (f->l4[0] == IcmpEcho || f->l4[0] == IcmpEchoreply)){
+		f->sport = f->dport = f->l4[4]<<8 | f->l4[5];
+		return 0;
+	}
+	if(f->proto != IPPROTO_TCP && f->proto != IPPROTO_UDP)
+		f->l4 = NULL;
+	if(f->l4 != NULL){
+		f->sport = f->l4[0]<<8 | f->l4[1];
+		f->dport = f->l4[2]<<8 | f->l4[3];
+	}
+	return 0;
+}
+
+// takes n bytes of old out of the checksum at sum and puts new in.
+static void
+csumfix(uint8_t *sum, uint8_t *old, uint8_t *new, int n)
+{
+	uint32_t s;
+	int i;
+
+	s = ~(sum[0]<<8 | sum[1]) & 0xffff;
+	for(i = 0; i < n; i += 2){
+		s += ~(old[i]<<8 | old[i+1]) & 0xffff;
+		s += new[i]<<8 | new[i+1];
+	}
+	while(s > 0xffff)
+		s = (s & 0xffff) + (s >> 16);
+	s = ~s & 0xffff;
+	sum[0] = s >> 8;
+	sum[1] = s & 0xff;
+}
+
+/*
+ *	puts new for the n bytes of old in the checksum of the transport
+ *	header, if those are summed there.
+ */
+static void
+l4fix(Flow *f, uint8_t *old, uint8_t *new, int n, int pseudo)
+{
+	uint8_t *sum;
+
+	if(f->proto == IPPROTO_TCP && f->l4len >= 18){
+		csumfix(f->l4+16, old, new, n);
+	} else if(f->proto == IPPROTO_UDP){
+		sum = f->l4+6;
+		// no checksum is allowed over ipv4, and has to stay that way.
+		if(f->family == AF_INET && sum[0] == 0 && sum[1] == 0)
+			return;
+		csumfix(sum, old, new, n);
+		if(sum[0] == 0 && sum[1] == 0)
+			sum[0] = sum[1] = 0xff;
+	} else if(f->proto == IPPROTO_ICMP && !pseudo){
+		csumfix(f->l4+2, old, new, n);
+	}
+}
+
+// writes addr over the address at field, and fixes the checksums it is in.
+static void
+rewrite(Flow *f, uint8_t *field, uint8_t *addr)
+{
+	uint8_t old[16];
+	int n;
+
+	n = addrlen(f->family);
+	memcpy(old, field, n);
+	memcpy(field, addr, n);
+	if(f->family == AF_INET)
+		csumfix(f->ip+10, old, addr, n);
+	l4fix(f, old, addr, n, 1);
+}
+
+// the same for the port, or the identifier of an echo, at field.
+static void
+rewriteport(Flow *f, uint8_t *field, int port)
+{
+	uint8_t old[2], new[2];
+
+	new[0] = port >> 8;
+	new[1] = port & 0xff;
+	memcpy(old, field, 2);
+	memcpy(field, new, 2);
+	l4fix(f, old, new, 2, 0);
+}
+
+// the same for a flow wherever it comes in.
+static uint32_t
+flowhash(Flow *f)
+{
+	uint32_t hash;
+	int i, n;
+
+	n = addrlen(f->family);
+	hash = 2166136261u;
+	for(i = 0; i < n; i++)
+		hash = (hash ^ f->src[i]) * 16777619u;
+	for(i = 0; i < n; i++)
+		hash = (hash ^ f->dst[i]) * 16777619u;
+	hash = (hash ^ f->proto) * 16777619u;
+	hash = (hash ^ f->sport) * 16777619u;
+	hash = (hash ^ f->dport) * 16777619u;
+	return hash ^ hash >> 15;
+}
+
+/*
+ *	sends a packet to a service on to a backend. returns 1 if it did, 0
+ *	if the packet is not to a service address, and -1 if it is but to no
+ *	service there, or a fragment.
+ */
+static int
+vipin(Router *r, uint8_t *frame, int len)
+{
+	Vipkey *k;
+	Vip *v;
+	Flow f;
+	int slot;
+
+	if(r->nvips == 0 || parseflow(frame, len, &f) == -1)
+		return 0;
+	if(f.l4 == NULL || (k = vipkeylook(r, f.family, f.dst, f.proto, f.dport)) == NULL)
+		return isvip(r, f.family, f.dst) ? -1 : 0;
+	v = r->vips + k->vip;
+	if((slot = maglevlookup(&v->mg, flowhash(&f))) == -1)
+		return -1;
+	rewrite(&f, f.dst, v->mg.keys[slot]);
+	return 1;
+}
+
+// makes an answer from a backend come from its service.
+static void
+vipout(Router *r, uint8_t *frame, int len)
+{
+	Vipkey *k;
+	Flow f;
+
+	if(r->nvips == 0 || parseflow(frame, len, &f) == -1 || f.l4 == NULL)
+		return;
+	if((k = vipkeylook(r, f.family, f.src, f.proto, f.sport)) == NULL || k->slot == -1)
+		return;
+	rewrite(&f, f.src, r->vips[k->vip].ip);
+}
+
+static int
+tcpflags(Flow *f)
+{
+	return f->proto == IPPROTO_TCP && f->l4len >= 14 ? f->l4[13] : 0;
+}
+
+/*
+ *	sends a packet to the outside address in to the inside host of its
+ *	connection. returns 1 if it did, 0 if the packet is not to the
+ *	outside address, and -1 if it is but for no connection.
+ */
+static int
+natin(Router *r, uint8_t *frame, int len)
+{
+	uint8_t ip[4];
+	Flow f;
+	int port;
+
+	if(!issnat(r, frame+14+16))
+		return 0;
+	if(parseflow(frame, len, &f) == -1 || f.l4 == NULL)
+		return -1;
+	if(snatin(r->snat, f.proto, f.dport, f.src, f.proto == IPPROTO_ICMP ? 0 : f.sport, tcpflags(&f), ip, &port) == -1)
+		return -1;
+	rewrite(&f, f.dst, ip);
+	rewriteport(&f, f.proto == IPPROTO_ICMP ? f.l4+4 : f.l4+2, port);
+	return 1;
+}
+
+/*
+ *	makes a packet from the inside that is sent on by the outside subnet
+ *	come from the outside address and a port of its connection. rt is
+ *	the route the packet went by. returns 1 if it did, 0 if the packet
+ *	goes as it is, and -1 if it can't go.
+ */
+static int
+natout(Router *r, Route *rt, uint8_t *frame, int len)
+{
+	Route *link;
+	Flow f;
+	int port;
+
+	link = onlink(r, AF_INET, rt->connected ? frame+14+16 : rt->gw);
+	if(link == NULL || memcmp(link->gw, r->snat->addr, 4) != 0 || lookup(r, AF_INET, frame+14+12) == link)
+		return 0;
+	if(parseflow(frame, len, &f) == -1 || f.l4 == NULL)
+		return -1;
+	if(snatout(r->snat, f.proto, f.src, f.sport, f.dst, f.proto == IPPROTO_ICMP ? 0 : f.dport, tcpflags(&f), &port) == -1)
+		return -1;
+	rewrite(&f, f.src, r->snat->addr);
+	rewriteport(&f, f.proto == IPPROTO_ICMP ? f.l4+4 : f.l4, port);
+	return 1;
+}
+
+static uint16_t
+icmp6sum(uint8_t *ip6, uint8_t *icmp, int len)
+{
+	uint32_t sum;
+	int i;
+
+	sum = len + Icmp6;
+	for(i = 8; i < 40; i += 2)
+		sum += ip6[i]<<8 | ip6[i+1];
+	for(i = 0; i+1 < len; i += 2)
+		sum += icmp[i]<<8 | icmp[i+1];
+	if(len & 1)
+		sum += icmp[len-1]<<8;
+	while(sum > 0xffff)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+// the link layer address option of type in the nd options at opt.
+static uint8_t *
+ndopt(uint8_t *opt, int len, int type)
+{
+	while(len >= 8 && opt[1] != 0 && opt[1]*8 <= len){
+		if(opt[0] == type && opt[1] == 1)
+			return opt+2;
+		len -= opt[1]*8;
+		opt += opt[1]*8;
+	}
+	return NULL;
+}
+
+/*
+ *	fills in an ipv6 header and an nd message of type about target,
+ *	with our address in an option of opttype, and its checksum.
+ */
+static void
+mknd(uint8_t *frame, uint8_t *src, uint8_t *dst, int type, int flags, uint8_t *target, int opttype, uint8_t *mac)
+{
+	uint8_t *ip, *icmp;
+	uint16_t sum;
+
+	frame[12] = EtherIp6 >> 8;
+	frame[13] = EtherIp6 & 0xff;
+	ip = frame+14;
+	memset(ip, 0, 40+32);
+	ip[0] = 0x60;
+	ip[5] = 32;
+	ip[6] = Icmp6;
+	ip[7] = 255;
+	memmove(ip+24, dst, 16);
+	memmove(ip+8, src, 16);
+	icmp = ip+40;
+	icmp[0] = type;
+	icmp[4] = flags;
+	memcpy(icmp+8, target, 16);
+	icmp[24] = opttype;
+	icmp[25] = 1;
+	memcpy(icmp+26, mac, 6);
+	sum = icmp6sum(ip, icmp, 32);
+	icmp[2] = sum >> 8;
+	icmp[3] = sum & 0xff;
+}
+
+/*
+ *	turns frame into a request for target from our address src on its
+ *	subnet, to go everywhere, unless one went out this interval already.
+ */
+static int
+resolve(Router *r, int family, uint8_t *target, uint8_t *src, uint8_t *frame, int *lenp)
+{
+	uint8_t tgt[16], from[16], dst[16], *a;
+	Neigh *n;
+
+	if((n = neighlook(r, family, target)) == NULL || n->state == NeighAsked)
+		return RouteDrop;
+	memcpy(n->ip, target, addrlen(family));
+	n->family = family;
+	n->state = NeighAsked;
+	n->age = 0;
+
+	memcpy(tgt, target, addrlen(family));
+	memcpy(from, src, addrlen(family));
+	if(family == AF_INET){
+		memcpy(frame, broadcast, 6);
+		memcpy(frame+6, r->selfmac, 6);
+		frame[12] = EtherArp >> 8;
+		frame[13] = EtherArp & 0xff;
+		a = frame+14;
+		memset(a, 0, Arpsize-14);
+		a[1] = 1;
+		a[2] = EtherIp >> 8;
+		a[4] = 6;
+		a[5] = 4;
+		a[7] = 1;
+		memcpy(a+8, r->selfmac, 6);
+		memcpy(a+14, from, 4);
+		memcpy(a+24, tgt, 4);
+		*lenp = Arpsize;
+		return RouteFlood;
+	}
+	// to the solicited node group of target.
+	memcpy(dst, (uint8_t[]){0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0xff}, 13);
+	memcpy(dst+13, tgt+13, 3);
+	frame[0] = 0x33;
+	frame[1] = 0x33;
+	memcpy(frame+2, dst+12, 4);
+	memcpy(frame+6, r->selfmac, 6);
+	mknd(frame, from, dst, NdSolicit, 0, tgt, NdSrclladdr, r->selfmac);
+	*lenp = Ndsize;
+	return RouteFlood;
+}
+
+/*
+ *	learns the sender of any arp, and answers requests for a gateway
+ *	address with the gateway's mac, or for the outside address of source
+ *	nat with this switch's.
+ */
+static int
+arp(Router *r, uint8_t *frame, int *lenp, int ours)
+{
+	uint8_t *a, *mac, ip[4];
+
+	a = frame+14;
+	if(*lenp < 42 || a[0] != 0 || a[1] != 1 || a[2] != (EtherIp >> 8) || a[3] != 0 || a[4] != 6 || a[5] != 4)
+		return ours ? RouteDrop : RouteSwitch;
+	glean(r, AF_INET, a+14, a+8);
+	if(a[6] == 0 && a[7] == 1 && (isgateway(r, AF_INET, a+24) || isvip(r, AF_INET, a+24))){
+		mac = issnat(r, a+24) ? r->selfmac : r->mac;
+		memcpy(frame, frame+6, 6);
+		memcpy(frame+6, mac, 6);
+		a[7] = 2;
+		memcpy(a+18, a+8, 6);
+		memcpy(a+8, mac, 6);
+		memcpy(ip, a+24, 4);
+		memcpy(a+24, a+14, 4);
+		memcpy(a+14, ip, 4);
+		return RouteReply;
+	}
+	return ours ? RouteDrop : RouteSwitch;
+}
+
+/*
+ *	the ipv6 side of arp: learns from solicitations and advertisements,
+ *	and answers solicitations for a gateway address.
+ */
+static int
+nd(Router *r, uint8_t *frame, int *lenp, int ours)
+{
+	uint8_t *ip, *icmp, *lladdr, src[16], target[16];
+	int len;
+
+	ip = frame+14;
+	icmp = ip+40;
+	len = ip[4]<<8 | ip[5];
+	if(len < 24 || 14+40+len > *lenp || ip[7] != 255)
+		return ours ? RouteDrop : RouteSwitch;
+	memcpy(target, icmp+8, 16);
+	if(icmp[0] == NdAdvert){
+		if((lladdr = ndopt(icmp+24, len-24, NdTgtlladdr)) != NULL)
+			glean(r, AF_INET6, target, lladdr);
+		return ours ? RouteDrop : RouteSwitch;
+	}
+	memcpy(src, ip+8, 16);
+	if((lladdr = ndopt(icmp+24, len-24, NdSrclladdr)) != NULL)
+		glean(r, AF_INET6, src, lladdr);
+	// a solicitation from :: is duplicate address detection.
+	if((!isgateway(r, AF_INET6, target) && !isvip(r, AF_INET6, target)) || memcmp(src, (uint8_t[16]){0}, 16) == 0)
+		return ours ? RouteDrop : RouteSwitch;
+	memcpy(frame, lladdr != NULL ? lladdr : frame+6, 6);
+	memcpy(frame+6, r->mac, 6);
+	// from a router, solicited, override.
+	mknd(frame, target, src, NdAdvert, 0xe0, target, NdTgtlladdr, r->mac);
+	*lenp = Ndsize;
+	return RouteReply;
+}
+
+/*
+ *	sends frame on to the host at target, or asks for it, from our
+ *	address on the subnet of target.
+ */
+static int
+nexthop(Router *r, int family, Route *rt, uint8_t *dst, uint8_t *frame, int *lenp)
+{
+	uint8_t *target;
+	Route *link;
+	Neigh *n;
+
+	target = rt->connected ? dst : rt->gw;
+	if((link = onlink(r, family, target)) == NULL)
+		return RouteDrop;
+	n = neighlook(r, family, target);
+	if(n == NULL || n->state != NeighKnown)
+		return resolve(r, family, target, link->gw, frame, lenp);
+	memcpy(frame, n->mac, 6);
+	memcpy(frame+6, r->mac, 6);
+	return RouteForward;
+}
+
+static int
+route4(Router *r, uint8_t *frame, int *lenp)
+{
+	uint8_t *ip;
+	uint32_t sum;
+	Route *rt;
+	int rv;
+
+	ip = frame+14;
+	if(*lenp < 14+20 || (ip[0] >> 4) != 4 || (ip[0] & 15) < 5)
+		return RouteDrop;
+	if(ip[8] <= 1 || vipin(r, frame, *lenp) == -1 || (r->snat != NULL && natin(r, frame, *lenp) == -1))
+		return RouteDrop;
+	if((rt = lookup(r, AF_INET, ip+16)) == NULL)
+		return RouteDrop;
+	if((rv = nexthop(r, AF_INET, rt, ip+16, frame, lenp)) != RouteForward)
+		return rv;
+	if(r->snat != NULL && (rv = natout(r, rt, frame, *lenp)) != 0){
+		if(rv == -1)
+			return RouteDrop;
+		// from this switch, and not the gateway every switch is.
+		memcpy(frame+6, r->selfmac, 6);
+	}
+	// the checksum goes up by what the ttl went down, as in rfc 1141.
+	ip[8]--;
+	sum = (ip[10]<<8 | ip[11]) + 0x100;
+	sum += sum >= 0xffff;
+	ip[10] = sum >> 8;
+	ip[11] = sum & 0xff;
+	return RouteForward;
+}
+
+static int
+route6(Router *r, uint8_t *frame, int *lenp)
+{
+	uint8_t *ip;
+	Route *rt;
+	int rv;
+
+	ip = frame+14;
+	if(*lenp < 14+40 || (ip[0] >> 4) != 6)
+		return RouteDrop;
+	// multicast and link local are not for routing.
+	if(ip[24] == 0xff || (ip[24] == 0xfe && (ip[25] & 0xc0) == 0x80))
+		return RouteDrop;
+	if(ip[7] <= 1 || vipin(r, frame, *lenp) == -1 || (rt = lookup(r, AF_INET6, ip+24)) == NULL)
+		return RouteDrop;
+	if((rv = nexthop(r, AF_INET6, rt, ip+24, frame, lenp)) != RouteForward)
+		return rv;
+	ip[7]--;
+	return RouteForward;
+}
+
+/*
+ *	looks at a frame as the router, before it is switched. frames to the
+ *	gateway or this switch are routed, and arp and neighbour discovery
+ *	are listened to. what is done with the frame afterwards depends on
+ *	what this returns. the frame is rewritten in place, and it has room
+ *	for at least RouteFramemin bytes, *lenp is its length.
+ */
+int
+routeframe(Router *r, uint8_t *frame, int *lenp)
+{
+	int type, ours;
+
+	if(*lenp < 14)
+		return RouteSwitch;
+	type = frame[12]<<8 | frame[13];
+	ours = memcmp(frame, r->mac, 6) == 0 || memcmp(frame, r->selfmac, 6) == 0;
+	if(type == EtherArp)
+		return arp(r, frame, lenp, ours);
+	if(type == EtherIp6 && (ours || frame[0] == 0x33) && *lenp >= 14+40+24
+	&& frame[14+6] == Icmp6 && (frame[14+40] == NdSolicit || frame[14+40] == NdAdvert))
+		return nd(r, frame, lenp, ours);
+	if(type == EtherIp || type == EtherIp6)
+		vipout(r, frame, *lenp);
+	if(!ours)
+		return RouteSwitch;
+	if(type == EtherIp)
+		return route4(r, frame, lenp);
+	if(type == EtherIp6)
+		return route6(r, frame, lenp);
+	return RouteDrop;
+}
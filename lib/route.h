@@ -0,0 +1,135 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	the router in the switch. every switch is the gateway of the subnets
+ *	it is given, with the same address and mac, so a frame between two
+ *	subnets is routed by the first switch it gets to. it answers arp
+ *	and neighbour solicitations for its gateway addresses, and finds the
+ *	hosts it routes to with requests of its own, from a mac of its own,
+ *	so that the answers come back to it and not to whichever switch has
+ *	the host. routing a frame rewrites it in place: the destination mac
+ *	becomes the host's, the source the gateway's, and the ttl or hop
+ *	limit goes down by one. like fwd, none of it does i/o.
+ *
+ *	the router is also a load balancer. a service is a virtual address,
+ *	a protocol and a port, and the router answers for the address like
+ *	for a gateway. a packet to a service has its destination rewritten
+ *	to one of the service's backends, chosen by maglev hashing of the
+ *	addresses, protocol and ports, and is then routed to it. answers
+ *	from the service's port on a backend, wherever they go, get their
+ *	source rewritten back to the service. there is no state per
+ *	connection: a connection stays with its backend as long as the
+ *	maglev table keeps it there, which is through most changes to the
+ *	other backends.
+ *
+ *	and the router can be a source nat gateway, with an address of this
+ *	switch's own on a subnet outside, which is answered for with the
+ *	switch's own mac. ipv4 packets from the inside that leave by that
+ *	subnet go out from the outside address, and what comes back to it
+ *	for a connection in snat goes in to the inside host again.
+ */
+enum {
+	RouteMax = 1024, // subnets and routes, of both families
+	RouteNeighs = 4096, // power of two
+	RouteNeighage = 6, // intervals a neighbour is remembered for
+	RouteGroups = 4096, // lpm groups per family
+	RouteFramemin = 128, // room there has to be in a frame for an answer
+	RouteVips = 64, // services
+	RouteVipkeys = 8192, // power of two, well over RouteVips*(MaglevMax+2)
+};
+
+// what routeframe made of a frame.
+enum {
+	RouteSwitch = 0, // not for the router, switch it as it is
+	RouteForward, // routed, switch it to its new destination
+	RouteReply, // now an answer, send it back where it came from
+	RouteFlood, // now a request for a neighbour, send it everywhere
+	RouteDrop,
+};
+
+typedef struct Neigh Neigh;
+typedef struct Route Route;
+typedef struct Router Router;
+typedef struct Vip Vip;
+typedef struct Vipkey Vipkey;
+
+struct Route {
+	int family; // AF_INET or AF_INET6, or 0 for an unused slot
+	uint8_t prefix[16];
+	int len;
+	int connected; // a subnet of ours, with gw our address on it
+	uint8_t gw[16]; // or the router to send to
+};
+
+struct Neigh {
+	uint8_t ip[16]; // ipv4 in the first four
+	uint8_t mac[6];
+	uint8_t family;
+	uint8_t state;
+	uint16_t age;
+};
+
+struct Vip {
+	int family; // 0 for an unused slot
+	uint8_t ip[16];
+	int proto; // IPPROTO_TCP or IPPROTO_UDP
+	int port;
+	Maglev mg; // keyed by the backends' addresses
+};
+
+/*
+ *	what an address, protocol and port is to the load balancer: a
+ *	service, the address of one with proto and port 0, or a backend.
+ */
+struct Vipkey {
+	uint8_t family;
+	uint8_t proto;
+	uint16_t port;
+	uint8_t ip[16];
+	int16_t vip; // index in vips, or -1 for a slot given up
+	int16_t slot; // of the backend in the vip's maglev, or -1
+};
+
+struct Router {
+	uint8_t mac[6]; // the gateway's, the same on every switch
+	uint8_t selfmac[6]; // this switch's own
+	Lpm lpm4;
+	Lpm lpm6;
+	Route routes[RouteMax];
+	Neigh neighs[RouteNeighs];
+	int nvips;
+	Vip vips[RouteVips];
+	Vipkey vipkeys[RouteVipkeys];
+	Snat *snat; // or NULL
+	int snatlen; // of the outside subnet
+};
+
+int routeinit(Router *r, uint8_t *mac, uint8_t *selfmac);
+void routefree(Router *r);
+int routeadd(Router *r, int family, uint8_t *prefix, int len, int connected, uint8_t *gw);
+int routedel(Router *r, int family, uint8_t *prefix, int len);
+void routeage(Router *r);
+int routevipadd(Router *r, int family, uint8_t *vip, int proto, int port, uint8_t *backend);
+int routevipdel(Router *r, int family, uint8_t *vip, int proto, int port, uint8_t *backend);
+int routesnat(Router *r, uint8_t *addr, int len, int minport, int maxport);
+int routeframe(Router *r, uint8_t *frame, int *lenp);
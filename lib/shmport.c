@@ -0,0 +1,317 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include "shmport.h"
+#include "smprintf.h"
+#include "unsocket.h"
+
+#define json(...) #__VA_ARGS__
+
+static size_t
+portsize(uint32_t nslots, uint32_t slotsize)
+{
+	return sizeof(Shmhdr) + 2 * (size_t)nslots*slotsize;
+}
+
+static uint8_t *
+slotbase(Shmport *sp, int ring)
+{
+	return (uint8_t *)(sp->hdr + 1) + (size_t)ring*sp->nslots*sp->slotsize;
+}
+
+static Shmport *
+portmap(int memfd, int rxbell, int txbell, int creator)
+{
+	struct stat st;
+	Shmhdr hdr;
+	Shmport *sp;
+	void *p;
+
+	if(pread(memfd, &hdr, sizeof hdr, 0) != sizeof hdr){
+		fprintf(stderr, "shmport: short read\n");
+		return NULL;
+	}
+	if(hdr.magic != ShmportMagic || hdr.nslots == 0 || (hdr.nslots & (hdr.nslots-1)) != 0 || hdr.slotsize <= 4){
+		fprintf(stderr, "shmport: bad header, magic 0x%x\n", hdr.magic);
+		return NULL;
+	}
+	// touching a page past the end of the memfd is a SIGBUS.
+	if(fstat(memfd, &st) == -1 || (uint64_t)st.st_size < portsize(hdr.nslots, hdr.slotsize)){
+		fprintf(stderr, "shmport: memfd smaller than its %u slots of %u\n", hdr.nslots, hdr.slotsize);
+		return NULL;
+	}
+	p = mmap(NULL, portsize(hdr.nslots, hdr.slotsize), PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0);
+	if(p == MAP_FAILED){
+		fprintf(stderr, "shmport: mmap: %s\n", strerror(errno));
+		return NULL;
+	}
+	sp = malloc(sizeof sp[0]);
+	memset(sp, 0, sizeof sp[0]);
+	sp->hdr = p;
+	sp->size = portsize(hdr.nslots, hdr.slotsize);
+	sp->nslots = hdr.nslots;
+	sp->slotsize = hdr.slotsize;
+	sp->rx = sp->hdr->rings + (creator ? ShmFromswitch : ShmToswitch);
+	sp->tx = sp->hdr->rings + (creator ? ShmToswitch : ShmFromswitch);
+	sp->rxslots = slotbase(sp, creator ? ShmFromswitch : ShmToswitch);
+	sp->txslots = slotbase(sp, creator ? ShmToswitch : ShmFromswitch);
+	sp->rxtail = sp->rx->tail;
+	sp->txhead = sp->tx->head;
+	sp->memfd = memfd;
+	sp->rxbell = rxbell;
+	sp->txbell = txbell;
+	sp->ctlfd = -1;
+	return sp;
+}
+
+// the creator's end, see shmportdial for what to hand to containet.
+Shmport *
+shmportcreate(int nslots, int slotsize)
+{
+	Shmhdr hdr;
+	Shmport *sp;
+	int memfd, bells[2];
+
+	if(nslots <= 0 || (nslots & (nslots-1)) != 0 || slotsize <= 4){
+		errno = EINVAL;
+		return NULL;
+	}
+	memset(&hdr, 0, sizeof hdr);
+	hdr.magic = ShmportMagic;
+	hdr.nslots = nslots;
+	hdr.slotsize = (slotsize + 7) & ~7;
+
+	if((memfd = memfd_create("shmport", MFD_CLOEXEC|MFD_ALLOW_SEALING)) == -1){
+		fprintf(stderr, "shmportcreate: memfd_create: %s\n", strerror(errno));
+		return NULL;
+	}
+	// sealed to its size, so containet knows it can't shrink under it.
+	if(ftruncate(memfd, portsize(hdr.nslots, hdr.slotsize)) == -1 || pwrite(memfd, &hdr, sizeof hdr, 0) != sizeof hdr
+	|| fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW) == -1){
+		fprintf(stderr, "shmportcreate: %s\n", strerror(errno));
+		close(memfd);
+		return NULL;
+	}
+	bells[0] = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	bells[1] = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if(bells[0] == -1 || bells[1] == -1 || (sp = portmap(memfd, bells[1], bells[0], 1)) == NULL){
+		fprintf(stderr, "shmportcreate: %s\n", strerror(errno));
+		if(bells[0] != -1)
+			close(bells[0]);
+		if(bells[1] != -1)
+			close(bells[1]);
+		close(memfd);
+		return NULL;
+	}
+	return sp;
+}
+
+/*
+ *	containet's end, it owns the fds from here on. the memfd has to be
+ *	sealed against changing size, or the other side could truncate it
+ *	and have our threads fault on the pages that went.
+ */
+Shmport *
+shmportopen(int memfd, int rxbell, int txbell)
+{
+	int seals;
+
+	if((seals = fcntl(memfd, F_GET_SEALS)) == -1 || (seals & (F_SEAL_SHRINK|F_SEAL_GROW)) != (F_SEAL_SHRINK|F_SEAL_GROW)){
+		fprintf(stderr, "shmport: memfd not sealed against shrinking and growing\n");
+		return NULL;
+	}
+	return portmap(memfd, rxbell, txbell, 0);
+}
+
+/*
+ *	makes a port and adds it to the containet listening on switchsock.
+ *	the control connection stays open for as long as the port does,
+ *	and containet takes the port down when it goes.
+ */
+Shmport *
+shmportdial(char *switchsock, char *authtoken, char *nodeid, char *ifname)
+{
+	Shmport *sp;
+	char *msg, resp[256];
+	int fds[3];
+	int fd, nrd, respfd;
+
+	if((sp = shmportcreate(ShmportSlots, ShmportSlotsize)) == NULL)
+		return NULL;
+	if((fd = unsocket(SOCK_STREAM, NULL, switchsock)) == -1){
+		shmportclose(sp);
+		return NULL;
+	}
+	fds[0] = sp->memfd;
+	fds[1] = sp->txbell;
+	fds[2] = sp->rxbell;
+	msg = smprintf(json({"authtoken":"%s","add-shmport":{"ifname":"%s","nodeid":"%s"}}), authtoken, ifname, nodeid);
+	if(sendframefds(fd, fds, 3, msg, strlen(msg)) == -1){
+		fprintf(stderr, "shmportdial: send: %s\n", strerror(errno));
+		goto fail;
+	}
+	if((nrd = recvframe(fd, &respfd, resp, sizeof resp - 1)) <= 0){
+		fprintf(stderr, "shmportdial: no answer: %s\n", nrd == 0 ? "eof" : strerror(errno));
+		goto fail;
+	}
+	if(respfd != -1)
+		close(respfd);
+	resp[nrd] = '\0';
+	if(strstr(resp, "\"error\"") != NULL){
+		fprintf(stderr, "shmportdial: %s\n", resp);
+		goto fail;
+	}
+	free(msg);
+	sp->ctlfd = fd;
+	return sp;
+
+fail:
+	free(msg);
+	close(fd);
+	shmportclose(sp);
+	return NULL;
+}
+
+void
+shmportclose(Shmport *sp)
+{
+	munmap(sp->hdr, sp->size);
+	close(sp->memfd);
+	close(sp->rxbell);
+	close(sp->txbell);
+	if(sp->ctlfd != -1)
+		close(sp->ctlfd);
+	free(sp);
+}
+
+/*
+ *	copies a frame into the next free slot. the other side doesn't see
+ *	it before shmportflush. returns -1 if the ring is full.
+ */
+int
+shmportput(Shmport *sp, uint8_t *frame, int len)
+{
+	uint8_t *slot;
+	uint32_t nslots;
+
+	nslots = sp->nslots;
+	if(len > (int)sp->slotsize - 4 || sp->txhead - sp->tx->tail >= nslots)
+		return -1;
+	slot = sp->txslots + (size_t)(sp->txhead & (nslots-1))*sp->slotsize;
+	*(uint32_t *)slot = len;
+	memcpy(slot + 4, frame, len);
+	sp->txhead++;
+	return 0;
+}
+
+// publishes what was put, waking the other side if it sleeps.
+void
+shmportflush(Shmport *sp)
+{
+	uint64_t one;
+
+	if(sp->tx->head == sp->txhead)
+		return;
+	__sync_synchronize();
+	sp->tx->head = sp->txhead;
+	__sync_synchronize();
+	if(sp->tx->sleeping){
+		one = 1;
+		write(sp->txbell, &one, sizeof one);
+	}
+}
+
+/*
+ *	points *framep at the next frame and returns its length, or -1 if
+ *	there is none. the frame stays valid until shmportrelease.
+ */
+int
+shmportget(Shmport *sp, uint8_t **framep)
+{
+	uint8_t *slot;
+	uint32_t head, len;
+
+	// the other side can write anything, so a head that is more than a
+	// ring ahead is taken as nothing to read.
+	head = sp->rx->head;
+	if(sp->rxtail == head || head - sp->rxtail > sp->nslots)
+		return -1;
+	__sync_synchronize();
+	slot = sp->rxslots + (size_t)(sp->rxtail & (sp->nslots-1))*sp->slotsize;
+	len = *(uint32_t *)slot;
+	if(len > sp->slotsize - 4)
+		len = sp->slotsize - 4;
+	*framep = slot + 4;
+	sp->rxtail++;
+	return len;
+}
+
+// gives the slots of everything got so far back to the producer.
+void
+shmportrelease(Shmport *sp)
+{
+	__sync_synchronize();
+	sp->rx->tail = sp->rxtail;
+}
+
+/*
+ *	waits up to msec for frames to come in. returns 1 when there are
+ *	some, 0 on timeout and -1 on error, EINTR included.
+ */
+int
+shmportwait(Shmport *sp, int msec)
+{
+	struct pollfd pfd;
+	uint64_t val;
+	int rv;
+
+	if(sp->rxtail != sp->rx->head)
+		return 1;
+	sp->rx->sleeping = 1;
+	__sync_synchronize();
+	if(sp->rxtail != sp->rx->head){
+		sp->rx->sleeping = 0;
+		return 1;
+	}
+	pfd.fd = sp->rxbell;
+	pfd.events = POLLIN;
+	rv = poll(&pfd, 1, msec);
+	sp->rx->sleeping = 0;
+	if(rv == -1)
+		return -1;
+	// the bell may have come from the other side, so it may block.
+	if(rv > 0)
+		read(sp->rxbell, &val, sizeof val);
+	return sp->rxtail != sp->rx->head;
+}
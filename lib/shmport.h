@@ -0,0 +1,93 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	a port made of two single producer, single consumer rings of frame
+ *	slots in a memfd, one each way, shared by containet and a process
+ *	in a container. frames go in and out without system calls. each
+ *	side has an eventfd doorbell it sleeps on, and a producer rings the
+ *	other side's bell only when it has said it is going to sleep, and at
+ *	most once per batch of frames.
+ *
+ *	the side that creates the port passes the memfd and both bells to
+ *	containet with add-shmport, in that order: memfd, the bell containet
+ *	sleeps on, the bell the creator sleeps on. the memfd is sealed so
+ *	its size can't change under containet.
+ */
+enum {
+	ShmportMagic = 0x73686d70,
+	ShmportSlots = 1024,
+	ShmportSlotsize = 2048,
+};
+
+enum {
+	ShmToswitch = 0,
+	ShmFromswitch = 1,
+};
+
+typedef struct Shmhdr Shmhdr;
+typedef struct Shmport Shmport;
+typedef struct Shmring Shmring;
+
+// each on its own cache line, the producer and consumer ends apart.
+struct Shmring {
+	volatile uint32_t head; // written by the producer only
+	uint32_t pad0[15];
+	volatile uint32_t tail; // written by the consumer only
+	volatile uint32_t sleeping; // the consumer is about to wait on its bell
+	uint32_t pad1[14];
+};
+
+struct Shmhdr {
+	uint32_t magic;
+	uint32_t nslots; // power of two
+	uint32_t slotsize; // including the length in front of each frame
+	uint32_t pad[13];
+	Shmring rings[2];
+};
+
+struct Shmport {
+	Shmhdr *hdr;
+	size_t size;
+	uint32_t nslots; // copied from hdr, which the other side can change
+	uint32_t slotsize;
+	Shmring *rx;
+	Shmring *tx;
+	uint8_t *rxslots;
+	uint8_t *txslots;
+	uint32_t rxtail; // read up to here, not given back yet
+	uint32_t txhead; // written up to here, not published yet
+	int memfd;
+	int rxbell; // we sleep on this one
+	int txbell; // and ring this one
+	int ctlfd; // control connection that keeps the port, or -1
+};
+
+Shmport *shmportcreate(int nslots, int slotsize);
+Shmport *shmportopen(int memfd, int rxbell, int txbell);
+Shmport *shmportdial(char *switchsock, char *authtoken, char *nodeid, char *ifname);
+void shmportclose(Shmport *sp);
+int shmportput(Shmport *sp, uint8_t *frame, int len);
+void shmportflush(Shmport *sp);
+int shmportget(Shmport *sp, uint8_t **framep);
+void shmportrelease(Shmport *sp);
+int shmportwait(Shmport *sp, int msec);
@@ -0,0 +1,264 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "sketch.h"
+
+#define nelem(x) (int)(sizeof(x)/sizeof(x[0]))
+
+// from lookup3.c, by Bob Jenkins, May 2006, Public Domain.
+// http://burtleburtle.net/bob/c/lookup3.c
+#define rot32(x,k) (((x)<<(k)) | ((x)>>(32-(k))))
+#define mix(a,b,c) { \
+	a -= c; a ^= rot32(c, 4); c += b; \
+	b -= a; b ^= rot32(a, 6); a += c; \
+	c -= b; c ^= rot32(b, 8); b += a; \
+	a -= c; a ^= rot32(c,16); c += b; \
+	b -= a; b ^= rot32(a,19); a += c; \
+	c -= b; c ^= rot32(b, 4); b += a; \
+}
+#define final(a,b,c) { \
+	c ^= b; c -= rot32(b,14); \
+	a ^= c; a -= rot32(c,11); \
+	b ^= a; b -= rot32(a,25); \
+	c ^= b; c -= rot32(b,16); \
+	a ^= c; a -= rot32(c,4); \
+	b ^= a; b -= rot32(a,14); \
+	c ^= b; c -= rot32(b,24); \
+}
+
+/*
+ *	hashword2 from lookup3, giving two independent 32-bit hashes.
+ *	the rows of the sketch are indexed by h1 + i*h2.
+ */
+static void
+hashkey(Flowkey *key, uint32_t *h1p, uint32_t *h2p)
+{
+	uint32_t k[sizeof(Flowkey)/4];
+	uint32_t a, b, c;
+
+	memcpy(k, key, sizeof k);
+	a = b = c = 0xdeadbeef + (nelem(k)<<2);
+	a += k[0]; b += k[1]; c += k[2];
+	mix(a, b, c);
+	a += k[3]; b += k[4]; c += k[5];
+	mix(a, b, c);
+	a += k[6];
+	final(a, b, c);
+
+	*h1p = c;
+	*h2p = b | 1;
+}
+
+static uint64_t
+estimate(Sketch *sk, uint32_t h1, uint32_t h2, uint64_t *pktsp)
+{
+	uint64_t bytes, minbytes, minpkts;
+	uint32_t idx;
+	int i;
+
+	minbytes = ~(uint64_t)0;
+	minpkts = ~(uint64_t)0;
+	for(i = 0; i < SketchDepth; i++){
+		idx = (h1 + i*h2) & (SketchWidth-1);
+		bytes = sk->bytes[i][idx];
+		if(bytes < minbytes)
+			minbytes = bytes;
+		if(sk->pkts[i][idx] < minpkts)
+			minpkts = sk->pkts[i][idx];
+	}
+	if(pktsp != NULL)
+		*pktsp = minpkts;
+	return minbytes;
+}
+
+static int
+topmember(Sketch *sk, uint32_t fp)
+{
+	uint32_t i, j;
+
+	for(i = 0; i < (uint32_t)nelem(sk->topfp); i++){
+		j = (fp + i) & (nelem(sk->topfp)-1);
+		if(sk->topfp[j] == fp)
+			return 1;
+		if(sk->topfp[j] == 0)
+			return 0;
+	}
+	return 0;
+}
+
+static void
+toprehash(Sketch *sk)
+{
+	uint32_t h1, h2, j;
+	int i;
+
+	memset(sk->topfp, 0, sizeof sk->topfp);
+	for(i = 0; i < sk->ntop; i++){
+		hashkey(sk->top + i, &h1, &h2);
+		h1 |= 1;
+		for(j = h1; sk->topfp[j & (nelem(sk->topfp)-1)] != 0; j++)
+			;
+		sk->topfp[j & (nelem(sk->topfp)-1)] = h1;
+	}
+}
+
+/*
+ *	called with the lock held, when key looks bigger than the smallest
+ *	member of the top set. recomputes the threshold while at it, since
+ *	the members have kept growing since it was last computed.
+ */
+static void
+topinsert(Sketch *sk, Flowkey *key, uint64_t est)
+{
+	uint64_t bytes, minbytes;
+	uint32_t h1, h2;
+	int i, mini;
+
+	for(i = 0; i < sk->ntop; i++)
+		if(memcmp(sk->top + i, key, sizeof *key) == 0)
+			return;
+
+	if(sk->ntop < SketchTopk){
+		sk->top[sk->ntop++] = *key;
+		toprehash(sk);
+		return;
+	}
+
+	mini = -1;
+	minbytes = ~(uint64_t)0;
+	for(i = 0; i < sk->ntop; i++){
+		hashkey(sk->top + i, &h1, &h2);
+		bytes = estimate(sk, h1, h2, NULL);
+		if(bytes < minbytes){
+			minbytes = bytes;
+			mini = i;
+		}
+	}
+	if(est > minbytes){
+		sk->top[mini] = *key;
+		toprehash(sk);
+		minbytes = est;
+		for(i = 0; i < sk->ntop; i++){
+			hashkey(sk->top + i, &h1, &h2);
+			bytes = estimate(sk, h1, h2, NULL);
+			if(bytes < minbytes)
+				minbytes = bytes;
+		}
+	}
+	sk->minbytes = minbytes;
+}
+
+void
+sketchinit(Sketch *sk)
+{
+	memset(sk, 0, sizeof sk[0]);
+	pthread_mutex_init(&sk->lock, NULL);
+}
+
+void
+sketchreset(Sketch *sk)
+{
+	pthread_mutex_lock(&sk->lock);
+	memset(sk->pkts, 0, sizeof sk->pkts);
+	memset(sk->bytes, 0, sizeof sk->bytes);
+	memset(sk->topfp, 0, sizeof sk->topfp);
+	sk->ntop = 0;
+	sk->minbytes = 0;
+	pthread_mutex_unlock(&sk->lock);
+}
+
+void
+sketchadd(Sketch *sk, Flowkey *key, int nbytes)
+{
+	uint64_t bytes, est;
+	uint32_t h1, h2, idx;
+	int i;
+
+	hashkey(key, &h1, &h2);
+	est = ~(uint64_t)0;
+	for(i = 0; i < SketchDepth; i++){
+		idx = (h1 + i*h2) & (SketchWidth-1);
+		__sync_fetch_and_add(&sk->pkts[i][idx], 1);
+		bytes = __sync_add_and_fetch(&sk->bytes[i][idx], nbytes);
+		if(bytes < est)
+			est = bytes;
+	}
+
+	// the common case, a mouse, or an elephant we already know about.
+	if(sk->ntop == SketchTopk && est <= sk->minbytes)
+		return;
+	if(topmember(sk, h1 | 1))
+		return;
+
+	pthread_mutex_lock(&sk->lock);
+	topinsert(sk, key, est);
+	pthread_mutex_unlock(&sk->lock);
+}
+
+void
+sketchcount(Sketch *sk, Flowkey *key, uint64_t *pktsp, uint64_t *bytesp)
+{
+	uint32_t h1, h2;
+
+	hashkey(key, &h1, &h2);
+	*bytesp = estimate(sk, h1, h2, pktsp);
+}
+
+static int
+cmptalker(const void *a, const void *b)
+{
+	const Talker *ta = a, *tb = b;
+
+	if(ta->bytes != tb->bytes)
+		return ta->bytes < tb->bytes ? 1 : -1;
+	return 0;
+}
+
+/*
+ *	fills tab with up to ntab of the biggest talkers, biggest first,
+ *	and returns how many.
+ */
+int
+sketchtop(Sketch *sk, Talker *tab, int ntab)
+{
+	Talker all[SketchTopk];
+	int i, n;
+
+	if(ntab <= 0)
+		return 0;
+	pthread_mutex_lock(&sk->lock);
+	n = sk->ntop;
+	for(i = 0; i < n; i++){
+		all[i].key = sk->top[i];
+		sketchcount(sk, &all[i].key, &all[i].pkts, &all[i].bytes);
+	}
+	pthread_mutex_unlock(&sk->lock);
+
+	qsort(all, n, sizeof all[0], cmptalker);
+	if(n > ntab)
+		n = ntab;
+	memcpy(tab, all, n * sizeof all[0]);
+	return n;
+}
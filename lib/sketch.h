@@ -0,0 +1,70 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	count-min sketch with a small heavy hitter set on the side. memory is
+ *	fixed no matter how many flows there are. counts come from the sketch,
+ *	the set only remembers which keys have been the biggest so far.
+ */
+enum {
+	SketchDepth = 4,
+	SketchWidth = 4096, // power of two
+	SketchTopk = 32,
+};
+
+typedef struct Flowkey Flowkey;
+typedef struct Sketch Sketch;
+typedef struct Talker Talker;
+
+// ip fields are left zero when accounting by mac pair only.
+struct Flowkey {
+	uint8_t dstmac[6];
+	uint8_t srcmac[6];
+	uint32_t srcip;
+	uint32_t dstip;
+	uint16_t sport;
+	uint16_t dport;
+	uint32_t proto;
+};
+
+struct Talker {
+	Flowkey key;
+	uint64_t pkts;
+	uint64_t bytes;
+};
+
+struct Sketch {
+	uint32_t pkts[SketchDepth][SketchWidth];
+	uint64_t bytes[SketchDepth][SketchWidth];
+
+	pthread_mutex_t lock;
+	uint64_t minbytes; // smallest estimate in the top set, when it is full
+	int ntop;
+	Flowkey top[SketchTopk];
+	uint32_t topfp[2*SketchTopk]; // fingerprints of top[], for the lockless check
+};
+
+void sketchinit(Sketch *sk);
+void sketchreset(Sketch *sk);
+void sketchadd(Sketch *sk, Flowkey *key, int bytes);
+void sketchcount(Sketch *sk, Flowkey *key, uint64_t *pktsp, uint64_t *bytesp);
+int sketchtop(Sketch *sk, Talker *tab, int ntab);
@@ -0,0 +1,339 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include "snat.h"
+
+enum {
+	TcpFin = 0x01,
+	TcpSyn = 0x02,
+	TcpRst = 0x04,
+	TcpAck = 0x10,
+
+	// the end of a tcp connection, in Snatconn.flags.
+	FinOut = 1,
+	FinIn = 2,
+	Reset = 4,
+};
+
+static int
+protoindex(int proto)
+{
+	switch(proto){
+	case IPPROTO_TCP:
+		return 0;
+	case IPPROTO_UDP:
+		return 1;
+	case IPPROTO_ICMP:
+		return 2;
+	}
+	return -1;
+}
+
+static uint32_t
+connhash(int proto, uint8_t *src, int sport, uint8_t *dst, int dport)
+{
+	uint32_t hash;
+	int i;
+
+	hash = (2166136261u ^ proto) * 16777619u;
+	for(i = 0; i < 4; i++)
+		hash = (hash ^ src[i]) * 16777619u;
+	hash = (hash ^ (sport >> 8)) * 16777619u;
+	hash = (hash ^ (sport & 0xff)) * 16777619u;
+	for(i = 0; i < 4; i++)
+		hash = (hash ^ dst[i]) * 16777619u;
+	hash = (hash ^ (dport >> 8)) * 16777619u;
+	hash = (hash ^ (dport & 0xff)) * 16777619u;
+	return hash ^ hash >> 15;
+}
+
+static Snatshard *
+shardof(Snat *s, uint32_t hash)
+{
+	return s->shards + (hash >> 24 & (SnatShards-1));
+}
+
+static int
+expired(Snat *s, Snatconn *c)
+{
+	uint32_t limit;
+
+	if(c->proto != IPPROTO_TCP)
+		limit = SnatUdptime;
+	else if((c->flags & Reset) != 0 || (c->flags & (FinOut|FinIn)) == (FinOut|FinIn))
+		limit = SnatClosetime;
+	else
+		limit = SnatTcptime;
+	return s->now - c->seen > limit;
+}
+
+int
+snatinit(Snat *s, uint8_t *addr, int minport, int maxport)
+{
+	int i;
+
+	if(minport < 1 || maxport > 65535 || maxport-minport+1 < SnatShards*SnatBlock)
+		return -1;
+	memset(s, 0, sizeof s[0]);
+	memcpy(s->addr, addr, 4);
+	s->minport = minport;
+	s->maxport = maxport;
+	memset(s->owner, -1, sizeof s->owner);
+	memset(s->ports, 0xff, sizeof s->ports);
+	for(i = 0; i < SnatShards; i++)
+		pthread_mutex_init(&s->shards[i].lock, NULL);
+	return 0;
+}
+
+void
+snatfree(Snat *s)
+{
+	int i;
+
+	for(i = 0; i < SnatShards; i++)
+		pthread_mutex_destroy(&s->shards[i].lock);
+}
+
+/*
+ *	frees slot i of a shard, and moves the connections after it in the
+ *	same run of slots back over it, so every one stays reachable from
+ *	its hash without slots given up in the way.
+ */
+static void
+connfree(Snat *s, Snatshard *sh, int i)
+{
+	Snatconn *c;
+	uint16_t *slotp;
+	int j, k;
+
+	c = sh->conns + i;
+	slotp = &s->ports[protoindex(c->proto)][c->port];
+	if(*slotp == i)
+		*slotp = SnatNone;
+	for(j = (i+1) & (SnatConns-1); sh->conns[j].proto != 0; j = (j+1) & (SnatConns-1)){
+		c = sh->conns + j;
+		k = connhash(c->proto, c->src, c->sport, c->dst, c->dport) & (SnatConns-1);
+		// leave it if its hash is in the run between i and j.
+		if(i <= j ? i < k && k <= j : i < k || k <= j)
+			continue;
+		sh->conns[i] = *c;
+		slotp = &s->ports[protoindex(c->proto)][c->port];
+		if(*slotp == j)
+			*slotp = i;
+		i = j;
+	}
+	memset(sh->conns + i, 0, sizeof sh->conns[i]);
+}
+
+// the slot of a connection from the inside, or -1.
+static int
+connfind(Snat *s, Snatshard *sh, uint32_t hash, int proto, uint8_t *src, int sport, uint8_t *dst, int dport)
+{
+	Snatconn *c;
+	int i, n;
+
+	i = hash & (SnatConns-1);
+	for(n = 0; n < SnatConns; n++){
+		c = sh->conns + i;
+		if(c->proto == 0)
+			return -1;
+		if(expired(s, c)){
+			// the next one is moved here, if any.
+			connfree(s, sh, i);
+			continue;
+		}
+		if(c->proto == proto && c->sport == sport && c->dport == dport
+		&& memcmp(c->src, src, 4) == 0 && memcmp(c->dst, dst, 4) == 0)
+			return i;
+		i = (i+1) & (SnatConns-1);
+	}
+	return -1;
+}
+
+// takes the first free block of ports for a shard.
+static int
+blockget(Snat *s, Snatshard *sh)
+{
+	int b;
+
+	for(b = s->minport / SnatBlock; b <= s->maxport / SnatBlock; b++){
+		if(s->owner[b] == -1 && __sync_bool_compare_and_swap(&s->owner[b], -1, sh - s->shards)){
+			sh->next = sh->nblocks * SnatBlock;
+			sh->blocks[sh->nblocks++] = b;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ *	a port of the shard's free for protocol pi, taken from a connection
+ *	that has expired if need be, or from a new block once every port of
+ *	the shard's blocks is used.
+ */
+static int
+portget(Snat *s, Snatshard *sh, int pi)
+{
+	int i, n, pos, port, slot;
+
+	for(;;){
+		n = sh->nblocks * SnatBlock;
+		for(i = 0; i < n; i++){
+			pos = sh->next;
+			sh->next = (pos+1) % n;
+			port = sh->blocks[pos / SnatBlock] * SnatBlock + pos % SnatBlock;
+			if(port < s->minport || port > s->maxport)
+				continue;
+			if((slot = s->ports[pi][port]) == SnatNone)
+				return port;
+			if(expired(s, sh->conns + slot)){
+				connfree(s, sh, slot);
+				return port;
+			}
+		}
+		if(blockget(s, sh) == -1)
+			return -1;
+	}
+}
+
+/*
+ *	the outside port of a packet from src and sport on the inside to dst
+ *	and dport, for a connection that is there or a new one, or -1 if
+ *	there is no room for one. tcpflags are those of a tcp packet, and 0
+ *	for the others.
+ */
+int
+snatout(Snat *s, int proto, uint8_t *src, int sport, uint8_t *dst, int dport, int tcpflags, int *portp)
+{
+	Snatshard *sh;
+	Snatconn *c;
+	uint32_t hash;
+	int i, n, pi, port;
+
+	if((pi = protoindex(proto)) == -1)
+		return -1;
+	hash = connhash(proto, src, sport, dst, dport);
+	sh = shardof(s, hash);
+	pthread_mutex_lock(&sh->lock);
+	if((i = connfind(s, sh, hash, proto, src, sport, dst, dport)) == -1){
+		// the port first, as taking it may move slots about.
+		if((port = portget(s, sh, pi)) == -1){
+			pthread_mutex_unlock(&sh->lock);
+			return -1;
+		}
+		i = hash & (SnatConns-1);
+		for(n = 0; n < SnatConns && sh->conns[i].proto != 0; n++)
+			i = (i+1) & (SnatConns-1);
+		if(n == SnatConns){
+			pthread_mutex_unlock(&sh->lock);
+			return -1;
+		}
+		c = sh->conns + i;
+		c->proto = proto;
+		c->flags = 0;
+		c->sport = sport;
+		c->dport = dport;
+		c->port = port;
+		memcpy(c->src, src, 4);
+		memcpy(c->dst, dst, 4);
+		s->ports[pi][port] = i;
+	}
+	c = sh->conns + i;
+	if(proto == IPPROTO_TCP){
+		// a new connection of the same ends starts over.
+		if((tcpflags & (TcpSyn|TcpAck)) == TcpSyn)
+			c->flags = 0;
+		if((tcpflags & TcpFin) != 0)
+			c->flags |= FinOut;
+		if((tcpflags & TcpRst) != 0)
+			c->flags |= Reset;
+	}
+	c->seen = s->now;
+	*portp = c->port;
+	pthread_mutex_unlock(&sh->lock);
+	return 0;
+}
+
+/*
+ *	the inside host and port, into ip and *portp, of a packet from src
+ *	and sport to the outside port, or -1 if no connection went out to
+ *	them from it.
+ */
+int
+snatin(Snat *s, int proto, int port, uint8_t *src, int sport, int tcpflags, uint8_t *ip, int *portp)
+{
+	Snatshard *sh;
+	Snatconn *c;
+	int pi, shard, slot;
+
+	if((pi = protoindex(proto)) == -1 || port < s->minport || port > s->maxport)
+		return -1;
+	if((shard = s->owner[port / SnatBlock]) == -1)
+		return -1;
+	sh = s->shards + shard;
+	pthread_mutex_lock(&sh->lock);
+	if((slot = s->ports[pi][port]) == SnatNone){
+		pthread_mutex_unlock(&sh->lock);
+		return -1;
+	}
+	c = sh->conns + slot;
+	if(expired(s, c)){
+		connfree(s, sh, slot);
+		pthread_mutex_unlock(&sh->lock);
+		return -1;
+	}
+	if(memcmp(c->dst, src, 4) != 0 || c->dport != sport){
+		pthread_mutex_unlock(&sh->lock);
+		return -1;
+	}
+	if((tcpflags & TcpFin) != 0)
+		c->flags |= FinIn;
+	if((tcpflags & TcpRst) != 0)
+		c->flags |= Reset;
+	c->seen = s->now;
+	memcpy(ip, c->src, 4);
+	*portp = c->sport;
+	pthread_mutex_unlock(&sh->lock);
+	return 0;
+}
+
+// the connections that have not expired.
+int
+snatcount(Snat *s)
+{
+	Snatshard *sh;
+	int i, j, n;
+
+	n = 0;
+	for(i = 0; i < SnatShards; i++){
+		sh = s->shards + i;
+		pthread_mutex_lock(&sh->lock);
+		for(j = 0; j < SnatConns; j++)
+			if(sh->conns[j].proto != 0 && !expired(s, sh->conns + j))
+				n++;
+		pthread_mutex_unlock(&sh->lock);
+	}
+	return n;
+}
@@ -0,0 +1,90 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	connection tracking for source nat. connections from the inside go
+ *	out from one outside address, each with a port of its own, and what
+ *	comes back to that port from the host and port it went to is let in,
+ *	to the inside host and port again. tcp and udp have their ports, and
+ *	icmp echoes their identifiers instead.
+ *
+ *	the table is split in shards, each with a lock of its own, by a hash
+ *	of the inside end of a connection, so readers on different cores
+ *	seldom wait for each other. ports are handed out to the shards in
+ *	blocks, and stay with a shard once it has them, so the block of a
+ *	port that comes back tells which shard its connection is in without
+ *	a lock. nothing goes through the table to expire connections: one
+ *	past its time is treated as gone, and its slot is freed by the first
+ *	lookup that comes across it, and its port by the first connection
+ *	that needs one.
+ *
+ *	now is in seconds on a clock the user keeps. none of it does i/o.
+ */
+enum {
+	SnatShards = 8, // power of two
+	SnatConns = 8192, // per shard, power of two
+	SnatBlock = 64, // ports a shard takes at a time, and there are a block for every shard at least
+	SnatBlocks = 65536/SnatBlock,
+	SnatNone = 0xffff, // no connection with a port
+	SnatUdptime = 60, // seconds an idle connection is kept, and echoes too
+	SnatTcptime = 7200,
+	SnatClosetime = 10, // a tcp connection with a reset or fins both ways
+};
+
+typedef struct Snat Snat;
+typedef struct Snatconn Snatconn;
+typedef struct Snatshard Snatshard;
+
+struct Snatconn {
+	uint8_t proto; // 0 for a free slot
+	uint8_t flags; // what has been seen of the end of a tcp connection
+	uint16_t sport; // the inside host's
+	uint16_t dport; // of the host outside, 0 for echoes
+	uint16_t port; // the outside port
+	uint8_t src[4]; // the inside host
+	uint8_t dst[4]; // the host outside
+	uint32_t seen;
+};
+
+struct Snatshard {
+	pthread_mutex_t lock;
+	int nblocks;
+	int next; // where the search for a free port goes on, over the blocks
+	uint16_t blocks[SnatBlocks];
+	Snatconn conns[SnatConns]; // by a hash of the inside end, probed in line
+};
+
+struct Snat {
+	uint8_t addr[4]; // outside
+	int minport;
+	int maxport;
+	uint32_t now;
+	int8_t owner[SnatBlocks]; // the shard with a block of ports, or -1
+	uint16_t ports[3][65536]; // slot of the connection with a port, by protocol
+	Snatshard shards[SnatShards];
+};
+
+int snatinit(Snat *s, uint8_t *addr, int minport, int maxport);
+void snatfree(Snat *s);
+int snatout(Snat *s, int proto, uint8_t *src, int sport, uint8_t *dst, int dport, int tcpflags, int *portp);
+int snatin(Snat *s, int proto, int port, uint8_t *src, int sport, int tcpflags, uint8_t *ip, int *portp);
+int snatcount(Snat *s);
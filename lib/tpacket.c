@@ -0,0 +1,353 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <linux/if_packet.h>
+#include "tpacket.h"
+
+// where the frame goes in a send ring slot.
+#define TXOFF TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+
+static struct tpacket_block_desc *
+blockdesc(Tpacket *tp, int i)
+{
+	return (struct tpacket_block_desc *)(tp->rx + (size_t)i*TpacketBlocksize);
+}
+
+static struct tpacket3_hdr *
+txframe(Tpacket *tp, int i)
+{
+	return (struct tpacket3_hdr *)(tp->tx + (size_t)i*TpacketFramesize);
+}
+
+/*
+ *	opens the socket with both rings on ifname. with fanout set, it joins
+ *	the fanout group of the interface, which is numbered after its index
+ *	so that any process can join it.
+ */
+Tpacket *
+tpacketopen(char *ifname, int fanout)
+{
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	struct packet_mreq mr;
+	Tpacket *tp;
+	size_t rxsize, txsize;
+	int fd, ifindex, val;
+
+	if((ifindex = if_nametoindex(ifname)) == 0){
+		fprintf(stderr, "tpacket: no interface %s\n", ifname);
+		return NULL;
+	}
+	// no protocol until the rings are there, so nothing comes in before.
+	if((fd = socket(AF_PACKET, SOCK_RAW|SOCK_CLOEXEC, 0)) == -1){
+		fprintf(stderr, "tpacket: socket: %s\n", strerror(errno));
+		return NULL;
+	}
+	val = TPACKET_V3;
+	if(setsockopt(fd, SOL_PACKET, PACKET_VERSION, &val, sizeof val) == -1){
+		fprintf(stderr, "tpacket: TPACKET_V3: %s\n", strerror(errno));
+		goto fail;
+	}
+	val = 1;
+	if(setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &val, sizeof val) == -1){
+		fprintf(stderr, "tpacket: PACKET_IGNORE_OUTGOING: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	memset(&req, 0, sizeof req);
+	req.tp_block_size = TpacketBlocksize;
+	req.tp_block_nr = TpacketBlocks;
+	req.tp_frame_size = TpacketFramesize;
+	req.tp_frame_nr = TpacketBlocksize / TpacketFramesize * TpacketBlocks;
+	req.tp_retire_blk_tov = TpacketRetirems;
+	if(setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof req) == -1){
+		fprintf(stderr, "tpacket: PACKET_RX_RING: %s\n", strerror(errno));
+		goto fail;
+	}
+	rxsize = (size_t)req.tp_block_size * req.tp_block_nr;
+	memset(&req, 0, sizeof req);
+	req.tp_block_size = TpacketBlocksize;
+	req.tp_block_nr = (size_t)TpacketTxframes*TpacketFramesize / TpacketBlocksize;
+	req.tp_frame_size = TpacketFramesize;
+	req.tp_frame_nr = TpacketTxframes;
+	if(setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof req) == -1){
+		fprintf(stderr, "tpacket: PACKET_TX_RING: %s\n", strerror(errno));
+		goto fail;
+	}
+	txsize = (size_t)req.tp_block_size * req.tp_block_nr;
+
+	tp = malloc(sizeof tp[0]);
+	memset(tp, 0, sizeof tp[0]);
+	tp->fd = fd;
+	tp->ifindex = ifindex;
+	tp->mapsize = rxsize + txsize;
+	tp->map = mmap(NULL, tp->mapsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, 0);
+	if(tp->map == MAP_FAILED){
+		fprintf(stderr, "tpacket: mmap: %s\n", strerror(errno));
+		free(tp);
+		goto fail;
+	}
+	tp->rx = tp->map;
+	tp->tx = tp->map + rxsize;
+
+	memset(&sll, 0, sizeof sll);
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = ifindex;
+	if(bind(fd, (struct sockaddr *)&sll, sizeof sll) == -1){
+		fprintf(stderr, "tpacket: bind %s: %s\n", ifname, strerror(errno));
+		goto fail_unmap;
+	}
+	memset(&mr, 0, sizeof mr);
+	mr.mr_ifindex = ifindex;
+	mr.mr_type = PACKET_MR_PROMISC;
+	if(setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr, sizeof mr) == -1){
+		fprintf(stderr, "tpacket: promiscuous %s: %s\n", ifname, strerror(errno));
+		goto fail_unmap;
+	}
+	if(fanout){
+		val = (ifindex & 0xffff) | PACKET_FANOUT_HASH << 16;
+		if(setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &val, sizeof val) == -1){
+			fprintf(stderr, "tpacket: PACKET_FANOUT: %s\n", strerror(errno));
+			goto fail_unmap;
+		}
+	}
+	return tp;
+
+fail_unmap:
+	munmap(tp->map, tp->mapsize);
+	free(tp);
+fail:
+	close(fd);
+	return NULL;
+}
+
+void
+tpacketclose(Tpacket *tp)
+{
+	munmap(tp->map, tp->mapsize);
+	close(tp->fd);
+	free(tp);
+}
+
+/*
+ *	waits up to msec for a block to be handed over. returns 1 when one
+ *	is, 0 if not, and -1 if the interface is gone. an error on the
+ *	socket, like the interface going down for a while, is cleared.
+ */
+int
+tpacketwait(Tpacket *tp, int msec)
+{
+	struct pollfd pfd;
+	socklen_t errlen;
+	char name[IF_NAMESIZE];
+	int err;
+
+	if(blockdesc(tp, tp->block)->hdr.bh1.block_status & TP_STATUS_USER)
+		return 1;
+	pfd.fd = tp->fd;
+	pfd.events = POLLIN;
+	if(poll(&pfd, 1, msec) == -1)
+		return 0;
+	if(pfd.revents & POLLERR){
+		errlen = sizeof err;
+		getsockopt(tp->fd, SOL_SOCKET, SO_ERROR, &err, &errlen);
+		if(if_indextoname(tp->ifindex, name) == NULL)
+			return -1;
+	}
+	return (blockdesc(tp, tp->block)->hdr.bh1.block_status & TP_STATUS_USER) != 0;
+}
+
+/*
+ *	fills in the tcp or udp checksum of a frame sent with it left to
+ *	offload, as a veth or a local bridge hands them over. the checksum
+ *	field holds the sum of the pseudo header already, so it's the sum
+ *	from the start of the tcp or udp header to the end of the frame.
+ */
+static void
+csumfill(uint8_t *frame, int len)
+{
+	uint32_t sum;
+	uint16_t csum;
+	int off, proto, csumoff, i;
+
+	off = 12;
+	if(frame[off] == 0x81 && frame[off+1] == 0x00)
+		off += 4;
+	if(off + 2 > len)
+		return;
+	if(frame[off] == 0x08 && frame[off+1] == 0x00){
+		off += 2;
+		if(off + 20 > len)
+			return;
+		proto = frame[off+9];
+		off += (frame[off] & 15) * 4;
+	} else if(frame[off] == 0x86 && frame[off+1] == 0xdd){
+		off += 2;
+		if(off + 40 > len)
+			return;
+		proto = frame[off+6];
+		off += 40;
+	} else {
+		return;
+	}
+	if(proto == IPPROTO_TCP)
+		csumoff = 16;
+	else if(proto == IPPROTO_UDP)
+		csumoff = 6;
+	else
+		return;
+	if(off + csumoff + 2 > len)
+		return;
+
+	sum = 0;
+	for(i = off; i + 1 < len; i += 2)
+		sum += frame[i] << 8 | frame[i+1];
+	if(i < len)
+		sum += frame[i] << 8;
+	while(sum > 0xffff)
+		sum = (sum & 0xffff) + (sum >> 16);
+	csum = ~sum;
+	if(csum == 0 && proto == IPPROTO_UDP)
+		csum = 0xffff;
+	frame[off+csumoff] = csum >> 8;
+	frame[off+csumoff+1] = csum;
+}
+
+/*
+ *	copies the next frame of the block being read to buf, and returns
+ *	its length, or -1 at the end of the block. a vlan tag the driver
+ *	took off is put back, and a checksum left to offload filled in.
+ *	frames cut short are skipped, with length 0.
+ */
+int
+tpacketrecv(Tpacket *tp, uint8_t *buf, int cap)
+{
+	struct tpacket_block_desc *bd;
+	struct tpacket3_hdr *hdr;
+	uint8_t *frame;
+	uint16_t tpid, tci;
+	int len;
+
+	bd = blockdesc(tp, tp->block);
+	if(!(bd->hdr.bh1.block_status & TP_STATUS_USER))
+		return -1;
+	if(tp->pkt == NULL){
+		__sync_synchronize();
+		tp->npkts = bd->hdr.bh1.num_pkts;
+		tp->pkt = (uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt;
+	}
+	if(tp->npkts == 0)
+		return -1;
+	hdr = (struct tpacket3_hdr *)tp->pkt;
+	tp->pkt += hdr->tp_next_offset;
+	tp->npkts--;
+
+	frame = (uint8_t *)hdr + hdr->tp_mac;
+	len = hdr->tp_snaplen;
+	if(hdr->tp_snaplen != hdr->tp_len || len < 14)
+		return 0;
+	if(hdr->tp_status & TP_STATUS_VLAN_VALID){
+		if(len + 4 > cap)
+			return 0;
+		tpid = hdr->tp_status & TP_STATUS_VLAN_TPID_VALID ? hdr->hv1.tp_vlan_tpid : ETH_P_8021Q;
+		tci = hdr->hv1.tp_vlan_tci;
+		memcpy(buf, frame, 12);
+		buf[12] = tpid >> 8;
+		buf[13] = tpid;
+		buf[14] = tci >> 8;
+		buf[15] = tci;
+		memcpy(buf + 16, frame + 12, len - 12);
+		len += 4;
+	} else {
+		if(len > cap)
+			return 0;
+		memcpy(buf, frame, len);
+	}
+	if(hdr->tp_status & TP_STATUS_CSUMNOTREADY)
+		csumfill(buf, len);
+	return len;
+}
+
+// gives the block that was read back to the kernel.
+void
+tpacketrelease(Tpacket *tp)
+{
+	if(tp->pkt == NULL)
+		return;
+	__sync_synchronize();
+	blockdesc(tp, tp->block)->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	tp->block = (tp->block + 1) % TpacketBlocks;
+	tp->pkt = NULL;
+}
+
+/*
+ *	copies a frame to the send ring. frames too big for a slot are sent
+ *	on their own. returns -1 if the ring is full.
+ */
+int
+tpacketput(Tpacket *tp, uint8_t *frame, int len)
+{
+	struct tpacket3_hdr *hdr;
+
+	if(len > TpacketFramesize - (int)TXOFF){
+		tpacketflush(tp);
+		return send(tp->fd, frame, len, MSG_DONTWAIT) == len ? 0 : -1;
+	}
+	hdr = txframe(tp, tp->txhead);
+	if(hdr->tp_status & (TP_STATUS_SEND_REQUEST|TP_STATUS_SENDING)){
+		tpacketflush(tp);
+		return -1;
+	}
+	memcpy((uint8_t *)hdr + TXOFF, frame, len);
+	hdr->tp_len = len;
+	hdr->tp_snaplen = len;
+	hdr->tp_next_offset = 0;
+	__sync_synchronize();
+	hdr->tp_status = TP_STATUS_SEND_REQUEST;
+	tp->txhead = (tp->txhead + 1) % TpacketTxframes;
+	tp->ntx++;
+	return 0;
+}
+
+// has the kernel send what was put.
+void
+tpacketflush(Tpacket *tp)
+{
+	if(tp->ntx == 0)
+		return;
+	send(tp->fd, NULL, 0, MSG_DONTWAIT);
+	tp->ntx = 0;
+}
@@ -0,0 +1,61 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	an AF_PACKET socket on a host interface with TPACKET_V3 rings mapped
+ *	in: a receive ring the kernel fills a block of frames at a time, and
+ *	a send ring of fixed size frames the kernel sends on one kick. the
+ *	interface is put in promiscuous mode, and frames this socket sends
+ *	are not received back. sockets in the fanout group of an interface
+ *	split what comes in by flow hash.
+ */
+enum {
+	TpacketBlocksize = 1<<18,
+	TpacketBlocks = 16,
+	TpacketRetirems = 2, // how long a block that isn't full waits
+	TpacketFramesize = 2048, // of the send ring
+	TpacketTxframes = 512,
+};
+
+typedef struct Tpacket Tpacket;
+
+struct Tpacket {
+	int fd;
+	int ifindex;
+	uint8_t *map;
+	size_t mapsize;
+	uint8_t *rx;
+	uint8_t *tx;
+	int block; // the block being read
+	uint8_t *pkt; // next frame in it, NULL before it is started
+	uint32_t npkts; // frames left in it
+	int txhead;
+	int ntx; // frames put since the last kick
+};
+
+Tpacket *tpacketopen(char *ifname, int fanout);
+void tpacketclose(Tpacket *tp);
+int tpacketwait(Tpacket *tp, int msec);
+int tpacketrecv(Tpacket *tp, uint8_t *buf, int cap);
+void tpacketrelease(Tpacket *tp);
+int tpacketput(Tpacket *tp, uint8_t *frame, int len);
+void tpacketflush(Tpacket *tp);
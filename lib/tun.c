@@ -40,7 +40,9 @@
 #include <linux/if_tun.h>
 #include <linux/if.h>
 #include <linux/sockios.h>
+#include <linux/ethtool.h>
 #include <netinet/in.h>
+#include <net/route.h>
 #include <arpa/inet.h>
 
 #include "tun.h"
@@ -118,8 +120,166 @@ error_out:
 	return -1;
 }
 
+/*
+ *	ifconfig sets a 64k mtu, which is good for taps, but more than xdp
+ *	can take on a veth.
+ */
+int
+ifmtu(char *devname, int mtu)
+{
+	struct ifreq ifr;
+	int cfgfd;
+
+	if((cfgfd = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP)) == -1){
+		fprintf(stderr, "socket SOCK_DGRAM: %s\n", strerror(errno));
+		return -1;
+	}
+	memset(&ifr, 0, sizeof ifr);
+	strncpy(ifr.ifr_name, devname, sizeof ifr.ifr_name-1);
+	ifr.ifr_mtu = mtu;
+	if(ioctl(cfgfd, SIOCSIFMTU, &ifr) == -1){
+		fprintf(stderr, "ioctl SIOCSIFMTU %s: %s\n", ifr.ifr_name, strerror(errno));
+		close(cfgfd);
+		return -1;
+	}
+	close(cfgfd);
+	return 0;
+}
+
+/*
+ *	turns off checksum offload on a veth, since frames that leave it
+ *	through xdp would go with their checksums never filled in.
+ */
+int
+ifnocsum(char *devname)
+{
+	struct ethtool_value ev;
+	struct ifreq ifr;
+	int cfgfd;
+
+	if((cfgfd = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP)) == -1){
+		fprintf(stderr, "socket SOCK_DGRAM: %s\n", strerror(errno));
+		return -1;
+	}
+	memset(&ifr, 0, sizeof ifr);
+	strncpy(ifr.ifr_name, devname, sizeof ifr.ifr_name-1);
+	ifr.ifr_data = (void *)&ev;
+	ev.cmd = ETHTOOL_STXCSUM;
+	ev.data = 0;
+	if(ioctl(cfgfd, SIOCETHTOOL, &ifr) == -1){
+		fprintf(stderr, "ioctl ETHTOOL_STXCSUM %s: %s\n", ifr.ifr_name, strerror(errno));
+		close(cfgfd);
+		return -1;
+	}
+	close(cfgfd);
+	return 0;
+}
+
+/*
+ *	sends everything not on a subnet of devname through the ipv4 or
+ *	ipv6 router at gw.
+ */
 int
-tunopen(char *gotdev, char *wantdev, char *addr)
+ifgateway(char *devname, char *gw)
+{
+	struct in6_rtmsg rt6;
+	struct rtentry rt;
+	struct sockaddr_in *sin;
+	struct ifreq ifr;
+	int cfgfd, family;
+	void *req;
+
+	family = strchr(gw, ':') != NULL ? AF_INET6 : AF_INET;
+	if((cfgfd = socket(family, SOCK_DGRAM, 0)) == -1){
+		fprintf(stderr, "socket SOCK_DGRAM: %s\n", strerror(errno));
+		return -1;
+	}
+	if(family == AF_INET){
+		memset(&rt, 0, sizeof rt);
+		rt.rt_dst.sa_family = AF_INET;
+		rt.rt_genmask.sa_family = AF_INET;
+		sin = (struct sockaddr_in *)&rt.rt_gateway;
+		sin->sin_family = AF_INET;
+		if(inet_pton(AF_INET, gw, &sin->sin_addr) != 1)
+			goto badaddr;
+		rt.rt_flags = RTF_UP|RTF_GATEWAY;
+		rt.rt_dev = devname;
+		req = &rt;
+	} else {
+		memset(&rt6, 0, sizeof rt6);
+		if(inet_pton(AF_INET6, gw, &rt6.rtmsg_gateway) != 1)
+			goto badaddr;
+		memset(&ifr, 0, sizeof ifr);
+		strncpy(ifr.ifr_name, devname, sizeof ifr.ifr_name-1);
+		if(ioctl(cfgfd, SIOCGIFINDEX, &ifr) == -1){
+			fprintf(stderr, "ioctl SIOCGIFINDEX %s: %s\n", devname, strerror(errno));
+			close(cfgfd);
+			return -1;
+		}
+		rt6.rtmsg_flags = RTF_UP|RTF_GATEWAY;
+		rt6.rtmsg_metric = 1;
+		rt6.rtmsg_ifindex = ifr.ifr_ifindex;
+		req = &rt6;
+	}
+	if(ioctl(cfgfd, SIOCADDRT, req) == -1){
+		fprintf(stderr, "ioctl SIOCADDRT %s via %s: %s\n", devname, gw, strerror(errno));
+		close(cfgfd);
+		return -1;
+	}
+	close(cfgfd);
+	return 0;
+
+badaddr:
+	fprintf(stderr, "ifgateway: bad address %s\n", gw);
+	close(cfgfd);
+	return -1;
+}
+
+/*
+ *	takes devname down and its ipv4 addresses off, and the routes and
+ *	neighbours through it go with them, so the next one to bring it up
+ *	starts with nothing left over.
+ */
+int
+ifreset(char *devname)
+{
+	struct sockaddr_in *sin;
+	struct ifreq ifr;
+	int cfgfd, i;
+
+	if((cfgfd = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP)) == -1){
+		fprintf(stderr, "socket SOCK_DGRAM: %s\n", strerror(errno));
+		return -1;
+	}
+	memset(&ifr, 0, sizeof ifr);
+	strncpy(ifr.ifr_name, devname, sizeof ifr.ifr_name-1);
+	// setting an address of zero removes the first one there is.
+	for(i = 0; i < 256 && ioctl(cfgfd, SIOCGIFADDR, &ifr) == 0; i++){
+		sin = (struct sockaddr_in *)&ifr.ifr_addr;
+		sin->sin_family = AF_INET;
+		sin->sin_addr.s_addr = 0;
+		if(ioctl(cfgfd, SIOCSIFADDR, &ifr) == -1){
+			fprintf(stderr, "ioctl SIOCSIFADDR %s: %s\n", ifr.ifr_name, strerror(errno));
+			close(cfgfd);
+			return -1;
+		}
+	}
+	ifr.ifr_flags = 0;
+	if(ioctl(cfgfd, SIOCSIFFLAGS, &ifr) == -1){
+		fprintf(stderr, "ioctl SIOCSIFFLAGS %s: %s\n", ifr.ifr_name, strerror(errno));
+		close(cfgfd);
+		return -1;
+	}
+	close(cfgfd);
+	return 0;
+}
+
+/*
+ *	opens a tap, or a tun that passes ip packets with nothing in front
+ *	of them if l3 is set.
+ */
+int
+tunopen(char *gotdev, char *wantdev, char *addr, int l3)
 {
 	struct ifreq ifr;
 	int tunfd;
@@ -127,9 +287,7 @@ tunopen(char *gotdev, char *wantdev, char *addr)
 	tunfd = -1;
 	memset(&ifr, 0, sizeof ifr);
 
-	ifr.ifr_flags = IFF_TAP;
-	//ifr.ifr_flags = IFF_TUN;
-	//ifr.ifr_flags = IFF_NO_PI;
+	ifr.ifr_flags = l3 ? IFF_TUN|IFF_NO_PI : IFF_TAP;
 	if(wantdev != NULL)
 		strncpy(ifr.ifr_name, wantdev, IFNAMSIZ);
 
@@ -167,3 +325,29 @@ error_out:
 		close(tunfd);
 	return -1;
 }
+
+// the IFF_ flags of the tun or tap behind fd, or -1 if it is not one.
+int
+tunflags(int fd)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof ifr);
+	if(ioctl(fd, TUNGETIFF, (void *)&ifr) == -1)
+		return -1;
+	return (uint16_t)ifr.ifr_flags;
+}
+
+/*
+ *	keeps the tun or tap behind fd after the last fd on it is closed, or
+ *	lets it go with that if persist is 0.
+ */
+int
+tunpersist(int fd, int persist)
+{
+	if(ioctl(fd, TUNSETPERSIST, (unsigned long)persist) == -1){
+		fprintf(stderr, "ioctl TUNSETPERSIST: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
@@ -19,5 +19,11 @@
  *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  *	THE SOFTWARE.
  */
-int tunopen(char *gotdev, char *wantdev, char *addr);
+int tunopen(char *gotdev, char *wantdev, char *addr, int l3);
+int tunflags(int fd);
+int tunpersist(int fd, int persist);
 int ifconfig(char *devname, char *addr);
+int ifmtu(char *devname, int mtu);
+int ifnocsum(char *devname);
+int ifgateway(char *devname, char *gw);
+int ifreset(char *devname);
@@ -20,6 +20,7 @@
  *	THE SOFTWARE.
  */
 #include <string.h>
+#include <stdint.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <sys/un.h>
@@ -29,6 +30,8 @@
 #include <string.h>
 #include "unsocket.h"
 
+#define nelem(x) (int)(sizeof(x)/sizeof(x[0]))
+
 int
 unsocket(int socktype, char *srcpath, char *dstpath)
 {
@@ -77,29 +80,41 @@ err_out:
 
 int
 sendfd(int fd, int passfd, char *buf, int len)
+{
+	return sendfds(fd, &passfd, passfd != -1, buf, len);
+}
+
+// sends buf with nfds fds in one sendmsg, at most FrameMaxfds of them.
+int
+sendfds(int fd, int *fds, int nfds, char *buf, int len)
 {
 	struct msghdr msg;
 	struct iovec io = {.iov_base = buf, .iov_len = len};
 	struct cmsghdr *cmsg;
-	char cbuf[CMSG_SPACE(sizeof passfd)];
+	char cbuf[CMSG_SPACE(FrameMaxfds * sizeof(int))];
+
+	if(nfds > FrameMaxfds){
+		errno = EINVAL;
+		return -1;
+	}
 
 	memset(&msg, 0, sizeof msg);
 	msg.msg_iov = &io;
 	msg.msg_iovlen = 1;
 
-	if(passfd != -1){
+	if(nfds > 0){
 		memset(cbuf, 0, sizeof cbuf);
 		msg.msg_control = cbuf;
-		msg.msg_controllen = sizeof cbuf;
+		msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
 		cmsg = CMSG_FIRSTHDR(&msg);
 		cmsg->cmsg_level = SOL_SOCKET;
 		cmsg->cmsg_type = SCM_RIGHTS;
-		cmsg->cmsg_len = CMSG_LEN(sizeof passfd);
-		memcpy(CMSG_DATA(cmsg), &passfd, sizeof passfd);
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
 		msg.msg_controllen = cmsg->cmsg_len;
 	}
 
-	return sendmsg(fd, &msg, 0);
+	return sendmsg(fd, &msg, MSG_NOSIGNAL);
 }
 
 int
@@ -130,3 +145,202 @@ recvfd(int fd, int *passfdp, char *buf, int len)
 
 	return nrd;
 }
+
+/*
+ *	fds that don't fit in maxfds, or that the kernel couldn't pass, would
+ *	leave the rest out of step with the messages they came for, so then
+ *	it closes all of them and fails with EMSGSIZE.
+ */
+static int
+recvmsgfds(int fd, char *buf, int len, int *fds, int maxfds, int *nfdsp, int flags)
+{
+	struct msghdr msg;
+	struct iovec io = {.iov_base = buf, .iov_len = len};
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE(FrameMaxfds * sizeof(int))];
+	int i, n, nfds, nrd, lost;
+
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &io;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof cbuf;
+
+	*nfdsp = 0;
+	if((nrd = recvmsg(fd, &msg, flags|MSG_CMSG_CLOEXEC)) == -1)
+		return -1;
+
+	nfds = 0;
+	lost = (msg.msg_flags & MSG_CTRUNC) != 0;
+	for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+		if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for(i = 0; i < n; i++){
+			int passfd;
+			memcpy(&passfd, CMSG_DATA(cmsg) + i*sizeof(int), sizeof passfd);
+			if(nfds < maxfds){
+				fds[nfds++] = passfd;
+			} else {
+				close(passfd);
+				lost = 1;
+			}
+		}
+	}
+	if(lost){
+		fprintf(stderr, "recvfds: more fds than room for them, fds lost\n");
+		for(i = 0; i < nfds; i++)
+			close(fds[i]);
+		errno = EMSGSIZE;
+		return -1;
+	}
+	*nfdsp = nfds;
+
+	return nrd;
+}
+
+/*
+ *	one recvmsg, keeping every fd that comes with it, in order, or
+ *	failing with EMSGSIZE if there are more than maxfds. with
+ *	MSG_DONTWAIT so it can be used on sockets in an event loop.
+ */
+int
+recvfds(int fd, char *buf, int len, int *fds, int maxfds, int *nfdsp)
+{
+	return recvmsgfds(fd, buf, len, fds, maxfds, nfdsp, MSG_DONTWAIT);
+}
+
+static void
+puthdr(uint8_t *hdr, uint32_t len, uint32_t nfds)
+{
+	hdr[0] = len >> 24;
+	hdr[1] = len >> 16;
+	hdr[2] = len >> 8;
+	hdr[3] = len;
+	hdr[4] = nfds >> 24;
+	hdr[5] = nfds >> 16;
+	hdr[6] = nfds >> 8;
+	hdr[7] = nfds;
+}
+
+static uint32_t
+gethdr(uint8_t *p)
+{
+	return ((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | ((uint32_t)p[2]<<8) | p[3];
+}
+
+// sends a whole framed message, blocking until it is out.
+int
+sendframe(int fd, int passfd, char *buf, int len)
+{
+	return sendframefds(fd, &passfd, passfd != -1, buf, len);
+}
+
+int
+sendframefds(int fd, int *fds, int nfds, char *buf, int len)
+{
+	char *msg;
+	int nwr, off, oerr;
+
+	if((msg = malloc(FrameHdrlen + len)) == NULL)
+		return -1;
+	puthdr((uint8_t *)msg, len, nfds);
+	memcpy(msg + FrameHdrlen, buf, len);
+
+	// the fds go with the first bytes, the rest follows as plain writes.
+	nwr = sendfds(fd, fds, nfds, msg, FrameHdrlen + len);
+	for(off = 0; nwr != -1 && (off += nwr) < FrameHdrlen + len; ){
+		if((nwr = write(fd, msg + off, FrameHdrlen + len - off)) == -1 && errno == EINTR)
+			nwr = 0;
+	}
+	oerr = errno;
+	free(msg);
+	if(nwr == -1){
+		errno = oerr;
+		return -1;
+	}
+	return len;
+}
+
+static int
+readfull(int fd, char *buf, int len)
+{
+	int nrd, off;
+
+	for(off = 0; off < len; off += nrd){
+		if((nrd = read(fd, buf + off, len - off)) == -1){
+			if(errno == EINTR){
+				nrd = 0;
+				continue;
+			}
+			return -1;
+		}
+		if(nrd == 0)
+			return off;
+	}
+	return off;
+}
+
+static void
+closefds(int *fds, int nfds)
+{
+	int i;
+
+	for(i = 0; i < nfds; i++)
+		close(fds[i]);
+}
+
+/*
+ *	reads one framed message into buf, and the fd that came with it into
+ *	*passfdp, or -1. a message longer than len is read off the socket
+ *	but fails with EMSGSIZE. returns 0 on eof.
+ */
+int
+recvframe(int fd, int *passfdp, char *buf, int len)
+{
+	int fds[FrameMaxfds];
+	int nfds, nrd;
+
+	nrd = recvframefds(fd, fds, nelem(fds), &nfds, buf, len);
+	*passfdp = nfds > 0 ? fds[0] : -1;
+	if(nfds > 1)
+		closefds(fds + 1, nfds - 1);
+	return nrd;
+}
+
+// like recvframe, but keeps up to maxfds fds, and fails with more.
+int
+recvframefds(int fd, int *fds, int maxfds, int *nfdsp, char *buf, int len)
+{
+	uint8_t hdr[FrameHdrlen];
+	char skip[256];
+	uint32_t msglen;
+	int nrd, n;
+
+	*nfdsp = 0;
+	if((nrd = recvmsgfds(fd, (char *)hdr, sizeof hdr, fds, maxfds, nfdsp, 0)) <= 0)
+		return nrd;
+	if(nrd < FrameHdrlen && readfull(fd, (char *)hdr + nrd, FrameHdrlen - nrd) != FrameHdrlen - nrd)
+		goto eof;
+	msglen = gethdr(hdr);
+	if(msglen > (uint32_t)len){
+		for(; msglen > 0; msglen -= n){
+			n = msglen < sizeof skip ? (int)msglen : (int)sizeof skip;
+			if(readfull(fd, skip, n) != n)
+				goto eof;
+		}
+		closefds(fds, *nfdsp);
+		*nfdsp = 0;
+		errno = EMSGSIZE;
+		return -1;
+	}
+	if(readfull(fd, buf, msglen) != (int)msglen)
+		goto eof;
+	return msglen;
+
+eof:
+	closefds(fds, *nfdsp);
+	*nfdsp = 0;
+	errno = EPIPE;
+	return -1;
+}
@@ -23,3 +23,20 @@
 int unsocket(int socktype, char *srcpath, char *dstpath);
 int sendfd(int fd, int passfd, char *buf, int len);
 int recvfd(int fd, int *passfdp, char *buf, int len);
+int sendfds(int fd, int *fds, int nfds, char *buf, int len);
+int recvfds(int fd, char *buf, int len, int *fds, int maxfds, int *nfdsp);
+
+/*
+ *	control messages are framed with an 8 byte header, the length of the
+ *	message and the number of fds that come with it, both big endian.
+ *	the fds ride on the header.
+ */
+enum {
+	FrameHdrlen = 8,
+	FrameMaxfds = 253, // SCM_MAX_FD
+};
+
+int sendframe(int fd, int passfd, char *buf, int len);
+int recvframe(int fd, int *passfdp, char *buf, int len);
+int sendframefds(int fd, int *fds, int nfds, char *buf, int len);
+int recvframefds(int fd, int *fds, int maxfds, int *nfdsp, char *buf, int len);
@@ -0,0 +1,403 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include "vxlan.h"
+
+/*
+ *	parses a.b.c.d or a.b.c.d:port into sin, with VxlanPort if there is
+ *	no port.
+ */
+static int
+parseaddr(char *str, struct sockaddr_in *sin)
+{
+	char host[64], *p;
+	int port;
+
+	snprintf(host, sizeof host, "%s", str);
+	port = VxlanPort;
+	if((p = strchr(host, ':')) != NULL){
+		*p++ = '\0';
+		port = strtol(p, &p, 10);
+		if(*p != '\0' || port <= 0 || port > 65535)
+			goto bad;
+	}
+	memset(sin, 0, sizeof sin[0]);
+	sin->sin_family = AF_INET;
+	sin->sin_port = htons(port);
+	if(inet_pton(AF_INET, host, &sin->sin_addr) == 1)
+		return 0;
+bad:
+	fprintf(stderr, "vxlan: bad address %s\n", str);
+	return -1;
+}
+
+// the mtu of the route to sin, or that of ethernet if it can't be had.
+static int
+pathmtu(struct sockaddr_in *sin)
+{
+	socklen_t len;
+	int fd, mtu;
+
+	mtu = 1500;
+	if((fd = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0)) == -1)
+		return mtu;
+	len = sizeof mtu;
+	if(connect(fd, (struct sockaddr *)sin, sizeof sin[0]) == -1 || getsockopt(fd, IPPROTO_IP, IP_MTU, &mtu, &len) == -1)
+		mtu = 1500;
+	close(fd);
+	return mtu;
+}
+
+/*
+ *	opens a socket bound to laddr, a.b.c.d[:port], for the vni, to
+ *	trade frames with the peers, given the same way.
+ */
+Vxlan *
+vxlanopen(char *laddr, uint32_t vni, char **peers, int npeers)
+{
+	struct sockaddr_in sin;
+	Vxlan *vx;
+	int fd, val;
+
+	if(parseaddr(laddr, &sin) == -1)
+		return NULL;
+	if((fd = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0)) == -1){
+		fprintf(stderr, "vxlan: socket: %s\n", strerror(errno));
+		return NULL;
+	}
+	if(bind(fd, (struct sockaddr *)&sin, sizeof sin) == -1){
+		fprintf(stderr, "vxlan: bind %s: %s\n", laddr, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	// coalescing is only an optimization, so no matter if it's not there.
+	val = 1;
+	setsockopt(fd, SOL_UDP, UDP_GRO, &val, sizeof val);
+	val = 4*1024*1024;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof val);
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &val, sizeof val);
+	if((vx = vxlanadopt(fd, vni, peers, npeers)) == NULL)
+		close(fd);
+	return vx;
+}
+
+/*
+ *	makes a tunnel end of a socket vxlanopen made, one that was handed
+ *	over from another process for example.
+ */
+Vxlan *
+vxlanadopt(int fd, uint32_t vni, char **peers, int npeers)
+{
+	Vxlan *vx;
+	int i, ntx;
+
+	if(npeers < 1 || npeers > VxlanMaxpeers){
+		fprintf(stderr, "vxlan: %d peers, can have 1 to %d\n", npeers, VxlanMaxpeers);
+		return NULL;
+	}
+	if(vni > 0xffffff){
+		fprintf(stderr, "vxlan: vni %u does not fit in 24 bits\n", vni);
+		return NULL;
+	}
+	vx = malloc(sizeof vx[0]);
+	memset(vx, 0, sizeof vx[0]);
+	vx->peers = malloc(npeers * sizeof vx->peers[0]);
+	vx->peermtu = malloc(npeers * sizeof vx->peermtu[0]);
+	for(i = 0; i < npeers; i++){
+		if(parseaddr(peers[i], vx->peers + i) == -1){
+			free(vx->peers);
+			free(vx->peermtu);
+			free(vx);
+			return NULL;
+		}
+		vx->peermtu[i] = pathmtu(vx->peers + i);
+	}
+	vx->npeers = npeers;
+	vx->fd = fd;
+	vx->vni = vni;
+
+	vx->rxbuf = malloc((size_t)VxlanBatch * VxlanBufsize);
+	vx->rxmsg = malloc(VxlanBatch * sizeof vx->rxmsg[0]);
+	vx->rxiov = malloc(VxlanBatch * sizeof vx->rxiov[0]);
+	vx->rxfrom = malloc(VxlanBatch * sizeof vx->rxfrom[0]);
+	vx->rxctl = malloc(VxlanBatch * CMSG_SPACE(sizeof(int)));
+
+	// a flood puts a frame to every peer, and each can be a datagram.
+	ntx = VxlanBatch * VxlanMaxpeers;
+	vx->tx = malloc(ntx * sizeof vx->tx[0]);
+	vx->txmsg = malloc(ntx * sizeof vx->txmsg[0]);
+	vx->txnseg = malloc(ntx * sizeof vx->txnseg[0]);
+	vx->txiov = malloc(2 * ntx * sizeof vx->txiov[0]);
+	vx->txctl = malloc(ntx * CMSG_SPACE(sizeof(uint16_t)));
+
+	vx->txhdr[0] = 0x08; // the vni is valid
+	vx->txhdr[4] = vni >> 16;
+	vx->txhdr[5] = vni >> 8;
+	vx->txhdr[6] = vni;
+	return vx;
+}
+
+void
+vxlanclose(Vxlan *vx)
+{
+	close(vx->fd);
+	free(vx->peers);
+	free(vx->peermtu);
+	free(vx->rxbuf);
+	free(vx->rxmsg);
+	free(vx->rxiov);
+	free(vx->rxfrom);
+	free(vx->rxctl);
+	free(vx->tx);
+	free(vx->txmsg);
+	free(vx->txnseg);
+	free(vx->txiov);
+	free(vx->txctl);
+	free(vx);
+}
+
+// writes the address of peer as a.b.c.d:port to buf.
+int
+vxlanpeername(Vxlan *vx, int peer, char *buf, int cap)
+{
+	char host[INET_ADDRSTRLEN];
+
+	inet_ntop(AF_INET, &vx->peers[peer].sin_addr, host, sizeof host);
+	return snprintf(buf, cap, "%s:%d", host, ntohs(vx->peers[peer].sin_port));
+}
+
+/*
+ *	waits up to msec for datagrams. returns 1 when there are some, 0 if
+ *	not.
+ */
+int
+vxlanwait(Vxlan *vx, int msec)
+{
+	struct pollfd pfd;
+
+	pfd.fd = vx->fd;
+	pfd.events = POLLIN;
+	if(poll(&pfd, 1, msec) <= 0)
+		return 0;
+	return (pfd.revents & POLLIN) != 0;
+}
+
+// sets up to read the datagram at rxi, if there is one.
+static void
+rxstart(Vxlan *vx)
+{
+	struct mmsghdr *mm;
+	struct cmsghdr *cm;
+	struct sockaddr_in *from;
+	int i;
+
+	vx->rxoff = 0;
+	if(vx->rxi >= vx->nrx)
+		return;
+	mm = vx->rxmsg + vx->rxi;
+	from = vx->rxfrom + vx->rxi;
+	vx->rxpeer = -1;
+	if(!(mm->msg_hdr.msg_flags & MSG_TRUNC))
+		for(i = 0; i < vx->npeers; i++)
+			if(vx->peers[i].sin_addr.s_addr == from->sin_addr.s_addr && vx->peers[i].sin_port == from->sin_port)
+				vx->rxpeer = i;
+	vx->rxseg = mm->msg_len;
+	for(cm = CMSG_FIRSTHDR(&mm->msg_hdr); cm != NULL; cm = CMSG_NXTHDR(&mm->msg_hdr, cm))
+		if(cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+			memcpy(&vx->rxseg, CMSG_DATA(cm), sizeof(int));
+	if(vx->rxseg <= 0)
+		vx->rxseg = mm->msg_len;
+}
+
+/*
+ *	receives a batch of datagrams without waiting, for vxlannext to go
+ *	through. returns how many there were.
+ */
+int
+vxlanrecv(Vxlan *vx)
+{
+	struct msghdr *mh;
+	int i, n;
+
+	for(i = 0; i < VxlanBatch; i++){
+		vx->rxiov[i].iov_base = vx->rxbuf + (size_t)i*VxlanBufsize;
+		vx->rxiov[i].iov_len = VxlanBufsize;
+		mh = &vx->rxmsg[i].msg_hdr;
+		memset(mh, 0, sizeof mh[0]);
+		mh->msg_name = vx->rxfrom + i;
+		mh->msg_namelen = sizeof vx->rxfrom[0];
+		mh->msg_iov = vx->rxiov + i;
+		mh->msg_iovlen = 1;
+		mh->msg_control = vx->rxctl + i*CMSG_SPACE(sizeof(int));
+		mh->msg_controllen = CMSG_SPACE(sizeof(int));
+	}
+	n = recvmmsg(vx->fd, vx->rxmsg, VxlanBatch, MSG_DONTWAIT, NULL);
+	vx->nrx = n > 0 ? n : 0;
+	vx->rxi = 0;
+	rxstart(vx);
+	return vx->nrx;
+}
+
+/*
+ *	points *framep at the next frame of what vxlanrecv got and returns
+ *	its length, with the peer it came from in *peerp, or -1 when there
+ *	are no more. frames that are not for the vni, or are from someone
+ *	who is not a peer, are skipped with length 0.
+ */
+int
+vxlannext(Vxlan *vx, uint8_t **framep, int *peerp)
+{
+	struct mmsghdr *mm;
+	uint8_t *p;
+	uint32_t vni;
+	int len;
+
+	while(vx->rxi < vx->nrx){
+		mm = vx->rxmsg + vx->rxi;
+		if(vx->rxoff >= (int)mm->msg_len || vx->rxpeer == -1){
+			vx->rxi++;
+			rxstart(vx);
+			continue;
+		}
+		p = vx->rxbuf + (size_t)vx->rxi*VxlanBufsize + vx->rxoff;
+		len = mm->msg_len - vx->rxoff;
+		if(len > vx->rxseg)
+			len = vx->rxseg;
+		vx->rxoff += len;
+		vni = p[4] << 16 | p[5] << 8 | p[6];
+		if(len < VxlanHdrsize + 14 || !(p[0] & 0x08) || vni != vx->vni)
+			return 0;
+		*framep = p + VxlanHdrsize;
+		*peerp = vx->rxpeer;
+		return len - VxlanHdrsize;
+	}
+	return -1;
+}
+
+/*
+ *	puts a frame to go to peer, or to every peer if it is -1, on the next
+ *	flush. the frame is not copied, so it has to stay until then.
+ *	returns -1 if there is no room.
+ */
+int
+vxlanput(Vxlan *vx, int peer, uint8_t *frame, int len)
+{
+	Vxlanframe *fp;
+	int i, n;
+
+	n = peer == -1 ? vx->npeers : 1;
+	if(vx->ntx + n > VxlanBatch * VxlanMaxpeers || len + VxlanHdrsize > VxlanMaxudp)
+		return -1;
+	for(i = 0; i < n; i++){
+		fp = vx->tx + vx->ntx++;
+		fp->frame = frame;
+		fp->len = len;
+		fp->peer = peer == -1 ? i : peer;
+	}
+	return 0;
+}
+
+/*
+ *	sends what was put. a run of frames to the same peer, each no larger
+ *	than the first, goes as one datagram for the kernel to cut up, as
+ *	long as the pieces fit the path. returns the number of frames that
+ *	could not be sent.
+ */
+int
+vxlanflush(Vxlan *vx)
+{
+	struct msghdr *mh;
+	struct cmsghdr *cm;
+	struct iovec *iov;
+	Vxlanframe *fp;
+	int i, nmsg, niov, nseg, seg, total, drops, rv, sent;
+
+	nmsg = 0;
+	niov = 0;
+	for(i = 0; i < vx->ntx; ){
+		fp = vx->tx + i;
+		seg = fp->len + VxlanHdrsize;
+		mh = &vx->txmsg[nmsg].msg_hdr;
+		memset(mh, 0, sizeof mh[0]);
+		mh->msg_name = vx->peers + fp->peer;
+		mh->msg_namelen = sizeof vx->peers[0];
+		mh->msg_iov = vx->txiov + niov;
+		nseg = 0;
+		total = 0;
+		for(;;){
+			iov = vx->txiov + niov;
+			iov[0].iov_base = vx->txhdr;
+			iov[0].iov_len = VxlanHdrsize;
+			iov[1].iov_base = vx->tx[i].frame;
+			iov[1].iov_len = vx->tx[i].len;
+			niov += 2;
+			total += vx->tx[i].len + VxlanHdrsize;
+			nseg++;
+			i++;
+			// only the last piece can be shorter.
+			if(vx->tx[i-1].len + VxlanHdrsize < seg)
+				break;
+			if(i == vx->ntx || vx->tx[i].peer != fp->peer || nseg == VxlanMaxsegs)
+				break;
+			if(vx->tx[i].len + VxlanHdrsize > seg || total + vx->tx[i].len + VxlanHdrsize > VxlanMaxudp)
+				break;
+			if(20 + 8 + seg > vx->peermtu[fp->peer])
+				break;
+		}
+		mh->msg_iovlen = 2*nseg;
+		if(nseg > 1){
+			mh->msg_control = vx->txctl + nmsg*CMSG_SPACE(sizeof(uint16_t));
+			mh->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+			cm = CMSG_FIRSTHDR(mh);
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			*(uint16_t *)CMSG_DATA(cm) = seg;
+		}
+		vx->txnseg[nmsg++] = nseg;
+	}
+
+	drops = 0;
+	for(sent = 0; sent < nmsg; ){
+		rv = sendmmsg(vx->fd, vx->txmsg + sent, nmsg - sent, MSG_DONTWAIT);
+		if(rv <= 0){
+			// the one that failed is dropped, and the rest are tried again.
+			drops += vx->txnseg[sent++];
+			continue;
+		}
+		sent += rv;
+	}
+	vx->ntx = 0;
+	return drops;
+}
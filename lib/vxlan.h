@@ -0,0 +1,88 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	a VXLAN tunnel end on a UDP socket, with a fixed set of peers that
+ *	frames go to and are taken from. datagrams are received a batch at
+ *	a time with recvmmsg and, where the kernel does it, coalesced with
+ *	UDP_GRO, so one datagram can hold many frames of the same size.
+ *	frames to send are put on a list and go out with one sendmmsg, runs
+ *	of them to the same peer as one UDP_SEGMENT datagram.
+ */
+enum {
+	VxlanPort = 4789,
+	VxlanHdrsize = 8,
+	VxlanOverhead = 20 + 8 + VxlanHdrsize, // ip, udp and vxlan headers
+	VxlanMaxpeers = 16,
+	VxlanBatch = 32, // datagrams to a recvmmsg, frames to a sendmmsg
+	VxlanMaxsegs = 64, // frames in one coalesced datagram
+	VxlanBufsize = 64*1024,
+	VxlanMaxudp = 65507,
+};
+
+typedef struct Vxlan Vxlan;
+typedef struct Vxlanframe Vxlanframe;
+
+struct Vxlanframe {
+	uint8_t *frame;
+	int len;
+	int peer;
+};
+
+struct Vxlan {
+	int fd;
+	uint32_t vni;
+	int npeers;
+	struct sockaddr_in *peers;
+	int *peermtu; // of the path, datagrams that don't fit are not coalesced
+
+	// what the last vxlanrecv got, and where vxlannext is in it.
+	uint8_t *rxbuf;
+	struct mmsghdr *rxmsg;
+	struct iovec *rxiov;
+	struct sockaddr_in *rxfrom;
+	uint8_t *rxctl;
+	int nrx;
+	int rxi;
+	int rxoff;
+	int rxpeer; // of the datagram being read, -1 to skip it
+	int rxseg; // size of the frames coalesced in it
+
+	// what was put since the last flush.
+	Vxlanframe *tx;
+	int ntx;
+	struct mmsghdr *txmsg;
+	int *txnseg; // frames in each
+	struct iovec *txiov;
+	uint8_t *txctl;
+	uint8_t txhdr[VxlanHdrsize];
+};
+
+Vxlan *vxlanopen(char *laddr, uint32_t vni, char **peers, int npeers);
+Vxlan *vxlanadopt(int fd, uint32_t vni, char **peers, int npeers);
+void vxlanclose(Vxlan *vx);
+int vxlanpeername(Vxlan *vx, int peer, char *buf, int cap);
+int vxlanwait(Vxlan *vx, int msec);
+int vxlanrecv(Vxlan *vx);
+int vxlannext(Vxlan *vx, uint8_t **framep, int *peerp);
+int vxlanput(Vxlan *vx, int peer, uint8_t *frame, int len);
+int vxlanflush(Vxlan *vx);
@@ -0,0 +1,552 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+#include <linux/bpf.h>
+#include "netlink.h"
+#include "xsk.h"
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+static int
+bpfcall(int cmd, union bpf_attr *attr)
+{
+	return syscall(SYS_bpf, cmd, attr, sizeof attr[0]);
+}
+
+/*
+ *	loads the program that sends every frame coming in on a queue to the
+ *	socket in the map at its index, and lets the rest through. it is the
+ *	same few instructions libxdp would load, so there is no need for it.
+ *	frames to an address in passfd are counted and let through instead,
+ *	for the kernel to forward.
+ */
+static int
+loadprog(int mapfd, int passfd)
+{
+	union bpf_attr attr;
+	char log[1024];
+	int progfd;
+
+	struct bpf_insn prog[] = {
+		{.code = BPF_ALU64|BPF_MOV|BPF_X, .dst_reg = BPF_REG_6, .src_reg = BPF_REG_1},
+		// r2 = ctx->data, r3 = ctx->data_end, to redirect if there is no destination
+		{.code = BPF_LDX|BPF_W|BPF_MEM, .dst_reg = BPF_REG_2, .src_reg = BPF_REG_6, .off = offsetof(struct xdp_md, data)},
+		{.code = BPF_LDX|BPF_W|BPF_MEM, .dst_reg = BPF_REG_3, .src_reg = BPF_REG_6, .off = offsetof(struct xdp_md, data_end)},
+		{.code = BPF_ALU64|BPF_MOV|BPF_X, .dst_reg = BPF_REG_4, .src_reg = BPF_REG_2},
+		{.code = BPF_ALU64|BPF_ADD|BPF_K, .dst_reg = BPF_REG_4, .imm = 6},
+		{.code = BPF_JMP|BPF_JGT|BPF_X, .dst_reg = BPF_REG_4, .src_reg = BPF_REG_3, .off = 14},
+		// the destination to the stack at fp-8, and look it up
+		{.code = BPF_LDX|BPF_W|BPF_MEM, .dst_reg = BPF_REG_4, .src_reg = BPF_REG_2, .off = 0},
+		{.code = BPF_STX|BPF_W|BPF_MEM, .dst_reg = BPF_REG_10, .src_reg = BPF_REG_4, .off = -8},
+		{.code = BPF_LDX|BPF_H|BPF_MEM, .dst_reg = BPF_REG_4, .src_reg = BPF_REG_2, .off = 4},
+		{.code = BPF_STX|BPF_H|BPF_MEM, .dst_reg = BPF_REG_10, .src_reg = BPF_REG_4, .off = -4},
+		{.code = BPF_LD|BPF_DW|BPF_IMM, .dst_reg = BPF_REG_1, .src_reg = BPF_PSEUDO_MAP_FD, .imm = passfd},
+		{.code = 0},
+		{.code = BPF_ALU64|BPF_MOV|BPF_X, .dst_reg = BPF_REG_2, .src_reg = BPF_REG_10},
+		{.code = BPF_ALU64|BPF_ADD|BPF_K, .dst_reg = BPF_REG_2, .imm = -8},
+		{.code = BPF_JMP|BPF_CALL, .imm = BPF_FUNC_map_lookup_elem},
+		{.code = BPF_JMP|BPF_JEQ|BPF_K, .dst_reg = BPF_REG_0, .imm = 0, .off = 4},
+		// found, count it and pass it
+		{.code = BPF_ALU64|BPF_MOV|BPF_K, .dst_reg = BPF_REG_1, .imm = 1},
+		{.code = BPF_STX|BPF_DW|BPF_ATOMIC, .dst_reg = BPF_REG_0, .src_reg = BPF_REG_1, .imm = BPF_ADD},
+		{.code = BPF_ALU64|BPF_MOV|BPF_K, .dst_reg = BPF_REG_0, .imm = XDP_PASS},
+		{.code = BPF_JMP|BPF_EXIT},
+		// r2 = ctx->rx_queue_index
+		{.code = BPF_LDX|BPF_W|BPF_MEM, .dst_reg = BPF_REG_2, .src_reg = BPF_REG_6, .off = offsetof(struct xdp_md, rx_queue_index)},
+		// r1 = the map, a two instruction load
+		{.code = BPF_LD|BPF_DW|BPF_IMM, .dst_reg = BPF_REG_1, .src_reg = BPF_PSEUDO_MAP_FD, .imm = mapfd},
+		{.code = 0},
+		// r3 = what to do when the queue has no socket
+		{.code = BPF_ALU64|BPF_MOV|BPF_K, .dst_reg = BPF_REG_3, .imm = XDP_PASS},
+		{.code = BPF_JMP|BPF_CALL, .imm = BPF_FUNC_redirect_map},
+		{.code = BPF_JMP|BPF_EXIT},
+	};
+
+	memset(&attr, 0, sizeof attr);
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uintptr_t)prog;
+	attr.insn_cnt = sizeof prog / sizeof prog[0];
+	attr.license = (uintptr_t)"Dual MIT/GPL";
+	if((progfd = bpfcall(BPF_PROG_LOAD, &attr)) != -1)
+		return progfd;
+	// again with the verifier's log, a passing one would not fit in it.
+	attr.log_buf = (uintptr_t)log;
+	attr.log_size = sizeof log;
+	attr.log_level = 1;
+	log[0] = '\0';
+	if((progfd = bpfcall(BPF_PROG_LOAD, &attr)) == -1)
+		fprintf(stderr, "xsk: load program: %s\n%s", strerror(errno), log);
+	return progfd;
+}
+
+static int
+ringmap(Xskring *r, int fd, struct xdp_ring_offset *off, size_t descsize, off_t pgoff)
+{
+	uint8_t *p;
+
+	r->mapsize = off->desc + XskRing*descsize;
+	p = mmap(NULL, r->mapsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, pgoff);
+	if(p == MAP_FAILED){
+		fprintf(stderr, "xsk: mmap ring: %s\n", strerror(errno));
+		return -1;
+	}
+	r->map = p;
+	r->producer = (uint32_t *)(p + off->producer);
+	r->consumer = (uint32_t *)(p + off->consumer);
+	r->desc = p + off->desc;
+	return 0;
+}
+
+// maps the umem and the rings of a socket that is set up already.
+static Xsk *
+xskmap(int fd, int memfd, int ifindex)
+{
+	struct xdp_mmap_offsets off;
+	socklen_t optlen;
+	Xsk *x;
+
+	x = malloc(sizeof x[0]);
+	memset(x, 0, sizeof x[0]);
+	x->fd = fd;
+	x->memfd = memfd;
+	x->ifindex = ifindex;
+	x->passfd = -1;
+	x->umemsize = (size_t)XskFrames*XskFramesize;
+	x->umem = mmap(NULL, x->umemsize, PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0);
+	if(x->umem == MAP_FAILED){
+		fprintf(stderr, "xsk: mmap umem: %s\n", strerror(errno));
+		free(x);
+		return NULL;
+	}
+	optlen = sizeof off;
+	if(getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) == -1){
+		fprintf(stderr, "xsk: XDP_MMAP_OFFSETS: %s\n", strerror(errno));
+		goto fail;
+	}
+	if(ringmap(&x->rx, fd, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) == -1
+	|| ringmap(&x->tx, fd, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) == -1
+	|| ringmap(&x->fill, fd, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) == -1
+	|| ringmap(&x->comp, fd, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) == -1)
+		goto fail;
+	x->rx.cached = *x->rx.consumer;
+	x->fill.cached = *x->fill.producer;
+	x->tx.cached = *x->tx.producer;
+	x->comp.cached = *x->comp.consumer;
+	return x;
+
+fail:
+	if(x->rx.map != NULL)
+		munmap(x->rx.map, x->rx.mapsize);
+	if(x->tx.map != NULL)
+		munmap(x->tx.map, x->tx.mapsize);
+	if(x->fill.map != NULL)
+		munmap(x->fill.map, x->fill.mapsize);
+	munmap(x->umem, x->umemsize);
+	free(x);
+	return NULL;
+}
+
+static int
+linkup(char *ifname)
+{
+	struct ifreq ifr;
+	int fd, rv;
+
+	if((fd = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0)) == -1)
+		return -1;
+	memset(&ifr, 0, sizeof ifr);
+	snprintf(ifr.ifr_name, sizeof ifr.ifr_name, "%s", ifname);
+	rv = ioctl(fd, SIOCGIFFLAGS, &ifr);
+	if(rv != -1){
+		ifr.ifr_flags |= IFF_UP;
+		rv = ioctl(fd, SIOCSIFFLAGS, &ifr);
+	}
+	close(fd);
+	return rv;
+}
+
+/*
+ *	brings ifname up and takes over its first queue, in native xdp mode
+ *	where the driver has it and in generic mode where not, and in zero
+ *	copy mode where the driver can do that.
+ */
+Xsk *
+xskopen(char *ifname)
+{
+	struct xdp_umem_reg reg;
+	struct sockaddr_xdp sxdp;
+	union bpf_attr attr;
+	uint8_t *umem;
+	Xsk *x;
+	int fd, memfd, mapfd, passfd, progfd, ifindex, n, key, i;
+	uint64_t *fill;
+
+	fd = memfd = mapfd = passfd = progfd = -1;
+	x = NULL;
+	umem = MAP_FAILED;
+	if((ifindex = if_nametoindex(ifname)) == 0){
+		fprintf(stderr, "xsk: no interface %s\n", ifname);
+		return NULL;
+	}
+	if(linkup(ifname) == -1){
+		fprintf(stderr, "xsk: could not bring %s up: %s\n", ifname, strerror(errno));
+		return NULL;
+	}
+	if((fd = socket(AF_XDP, SOCK_RAW|SOCK_CLOEXEC, 0)) == -1){
+		fprintf(stderr, "xsk: socket: %s\n", strerror(errno));
+		return NULL;
+	}
+	if((memfd = memfd_create("xsk", MFD_CLOEXEC)) == -1 || ftruncate(memfd, (off_t)XskFrames*XskFramesize) == -1){
+		fprintf(stderr, "xsk: umem: %s\n", strerror(errno));
+		goto fail;
+	}
+	umem = mmap(NULL, (size_t)XskFrames*XskFramesize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, memfd, 0);
+	if(umem == MAP_FAILED){
+		fprintf(stderr, "xsk: mmap umem: %s\n", strerror(errno));
+		goto fail;
+	}
+	memset(&reg, 0, sizeof reg);
+	reg.addr = (uintptr_t)umem;
+	reg.len = (uint64_t)XskFrames*XskFramesize;
+	reg.chunk_size = XskFramesize;
+	n = XskRing;
+	if(setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof reg) == -1
+	|| setsockopt(fd, SOL_XDP, XDP_UMEM_FILL_RING, &n, sizeof n) == -1
+	|| setsockopt(fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &n, sizeof n) == -1
+	|| setsockopt(fd, SOL_XDP, XDP_RX_RING, &n, sizeof n) == -1
+	|| setsockopt(fd, SOL_XDP, XDP_TX_RING, &n, sizeof n) == -1){
+		fprintf(stderr, "xsk: setsockopt: %s\n", strerror(errno));
+		goto fail;
+	}
+	// the rings hold their own reference to the umem, which is mapped again below.
+	munmap(umem, (size_t)XskFrames*XskFramesize);
+	umem = MAP_FAILED;
+	if((x = xskmap(fd, memfd, ifindex)) == NULL)
+		goto fail;
+
+	// lend the first half of the umem to the kernel to receive in.
+	fill = x->fill.desc;
+	for(i = 0; i < XskRing; i++)
+		fill[i] = (uint64_t)i*XskFramesize;
+	x->fill.cached += XskRing;
+	__sync_synchronize();
+	*x->fill.producer = x->fill.cached;
+	for(i = 0; i < XskFrames/2; i++)
+		x->txfree[x->ntxfree++] = (uint64_t)(XskFrames/2 + i)*XskFramesize;
+
+	memset(&sxdp, 0, sizeof sxdp);
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = ifindex;
+	sxdp.sxdp_queue_id = 0;
+	sxdp.sxdp_flags = XDP_ZEROCOPY;
+	if(bind(fd, (struct sockaddr *)&sxdp, sizeof sxdp) == -1){
+		sxdp.sxdp_flags = XDP_COPY;
+		if(bind(fd, (struct sockaddr *)&sxdp, sizeof sxdp) == -1){
+			fprintf(stderr, "xsk: bind %s: %s\n", ifname, strerror(errno));
+			goto fail;
+		}
+	}
+
+	memset(&attr, 0, sizeof attr);
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = 4;
+	attr.value_size = 4;
+	attr.max_entries = 1;
+	if((mapfd = bpfcall(BPF_MAP_CREATE, &attr)) == -1){
+		fprintf(stderr, "xsk: create map: %s\n", strerror(errno));
+		goto fail;
+	}
+	key = 0;
+	memset(&attr, 0, sizeof attr);
+	attr.map_fd = mapfd;
+	attr.key = (uintptr_t)&key;
+	attr.value = (uintptr_t)&fd;
+	if(bpfcall(BPF_MAP_UPDATE_ELEM, &attr) == -1){
+		fprintf(stderr, "xsk: update map: %s\n", strerror(errno));
+		goto fail;
+	}
+	memset(&attr, 0, sizeof attr);
+	attr.map_type = BPF_MAP_TYPE_HASH;
+	attr.key_size = 6;
+	attr.value_size = sizeof(uint64_t);
+	attr.max_entries = XskPassmax;
+	if((passfd = bpfcall(BPF_MAP_CREATE, &attr)) == -1){
+		fprintf(stderr, "xsk: create pass map: %s\n", strerror(errno));
+		goto fail;
+	}
+	if((progfd = loadprog(mapfd, passfd)) == -1)
+		goto fail;
+	x->mode = XDP_FLAGS_DRV_MODE;
+	if(linkxdp(ifindex, progfd, XDP_FLAGS_UPDATE_IF_NOEXIST|x->mode) == -1){
+		x->mode = XDP_FLAGS_SKB_MODE;
+		if(linkxdp(ifindex, progfd, XDP_FLAGS_UPDATE_IF_NOEXIST|x->mode) == -1){
+			fprintf(stderr, "xsk: attach to %s: %s\n", ifname, strerror(errno));
+			goto fail;
+		}
+	}
+	// the interface keeps the program and the program the maps.
+	close(progfd);
+	close(mapfd);
+	x->passfd = passfd;
+	return x;
+
+fail:
+	if(progfd != -1)
+		close(progfd);
+	if(mapfd != -1)
+		close(mapfd);
+	if(passfd != -1)
+		close(passfd);
+	if(umem != MAP_FAILED)
+		munmap(umem, (size_t)XskFrames*XskFramesize);
+	if(x != NULL){
+		x->mode = 0;
+		xskclose(x);
+		return NULL;
+	}
+	if(memfd != -1)
+		close(memfd);
+	close(fd);
+	return NULL;
+}
+
+/*
+ *	takes over a socket that xskopen made in another process, on the
+ *	interface ifindex with the program it attached in mode, and its pass
+ *	map. what is being sent is worked out from the rings, and the rest
+ *	of the sending half of the umem is free.
+ */
+Xsk *
+xskadopt(int fd, int memfd, int passfd, int ifindex, int mode)
+{
+	uint8_t busy[XskFrames/2];
+	struct xdp_desc *txd;
+	uint64_t *comp, addr;
+	uint32_t i;
+	Xsk *x;
+	int j;
+
+	if((x = xskmap(fd, memfd, ifindex)) == NULL)
+		return NULL;
+	x->mode = mode;
+	x->passfd = passfd;
+	memset(busy, 0, sizeof busy);
+	txd = x->tx.desc;
+	comp = x->comp.desc;
+	for(i = *x->tx.consumer; i != x->tx.cached; i++){
+		addr = txd[i & (XskRing-1)].addr / XskFramesize;
+		if(addr >= XskFrames/2 && addr < XskFrames)
+			busy[addr - XskFrames/2] = 1;
+	}
+	for(i = x->comp.cached; i != *x->comp.producer; i++){
+		addr = comp[i & (XskRing-1)] / XskFramesize;
+		if(addr >= XskFrames/2 && addr < XskFrames)
+			busy[addr - XskFrames/2] = 1;
+	}
+	for(j = 0; j < XskFrames/2; j++)
+		if(!busy[j])
+			x->txfree[x->ntxfree++] = (uint64_t)(XskFrames/2 + j)*XskFramesize;
+	// what had completed is free already.
+	x->comp.cached = *x->comp.producer;
+	*x->comp.consumer = x->comp.cached;
+	return x;
+}
+
+void
+xskclose(Xsk *x)
+{
+	if(x->mode != 0)
+		linkxdp(x->ifindex, -1, x->mode);
+	munmap(x->rx.map, x->rx.mapsize);
+	munmap(x->tx.map, x->tx.mapsize);
+	munmap(x->fill.map, x->fill.mapsize);
+	munmap(x->comp.map, x->comp.mapsize);
+	munmap(x->umem, x->umemsize);
+	close(x->fd);
+	close(x->memfd);
+	if(x->passfd != -1)
+		close(x->passfd);
+	free(x);
+}
+
+/*
+ *	has frames to mac let through to the kernel, or taken to the socket
+ *	again when on is zero.
+ */
+int
+xskpass(Xsk *x, uint8_t *mac, int on)
+{
+	union bpf_attr attr;
+	uint64_t count;
+
+	count = 0;
+	memset(&attr, 0, sizeof attr);
+	attr.map_fd = x->passfd;
+	attr.key = (uintptr_t)mac;
+	if(on)
+		attr.value = (uintptr_t)&count;
+	if(bpfcall(on ? BPF_MAP_UPDATE_ELEM : BPF_MAP_DELETE_ELEM, &attr) == -1){
+		fprintf(stderr, "xsk: %s pass map: %s\n", on ? "update" : "delete", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// how many frames to mac were let through since xskpass.
+int
+xskpasscount(Xsk *x, uint8_t *mac, uint64_t *countp)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof attr);
+	attr.map_fd = x->passfd;
+	attr.key = (uintptr_t)mac;
+	attr.value = (uintptr_t)countp;
+	return bpfcall(BPF_MAP_LOOKUP_ELEM, &attr);
+}
+
+/*
+ *	points *framep at the next frame received and returns its length,
+ *	or -1 if there is none. the frame stays valid until xskrelease.
+ */
+int
+xskrecv(Xsk *x, uint8_t **framep)
+{
+	struct xdp_desc *d;
+
+	if(x->rx.cached == *x->rx.producer)
+		return -1;
+	__sync_synchronize();
+	d = (struct xdp_desc *)x->rx.desc + (x->rx.cached & (XskRing-1));
+	x->rx.cached++;
+	if(d->addr + d->len > x->umemsize)
+		return 0;
+	*framep = x->umem + d->addr;
+	return d->len;
+}
+
+// gives the frames of everything received so far back to the kernel.
+void
+xskrelease(Xsk *x)
+{
+	struct xdp_desc *rxd;
+	uint64_t *fill;
+	uint32_t i;
+
+	rxd = x->rx.desc;
+	fill = x->fill.desc;
+	for(i = *x->rx.consumer; i != x->rx.cached; i++)
+		fill[x->fill.cached++ & (XskRing-1)] = rxd[i & (XskRing-1)].addr & ~(uint64_t)(XskFramesize-1);
+	__sync_synchronize();
+	*x->fill.producer = x->fill.cached;
+	*x->rx.consumer = x->rx.cached;
+}
+
+// takes back the frames the kernel is done sending.
+static void
+reclaim(Xsk *x)
+{
+	uint64_t *comp;
+
+	comp = x->comp.desc;
+	while(x->comp.cached != *x->comp.producer && x->ntxfree < XskFrames/2)
+		x->txfree[x->ntxfree++] = comp[x->comp.cached++ & (XskRing-1)];
+	__sync_synchronize();
+	*x->comp.consumer = x->comp.cached;
+}
+
+/*
+ *	copies a frame to the sending half of the umem and queues it. the
+ *	kernel doesn't see it before xskflush. returns -1 if everything is
+ *	in flight.
+ */
+int
+xskput(Xsk *x, uint8_t *frame, int len)
+{
+	struct xdp_desc *d;
+	uint64_t addr;
+
+	if(len > XskFramesize)
+		return -1;
+	if(x->ntxfree == 0)
+		reclaim(x);
+	if(x->ntxfree == 0)
+		return -1;
+	addr = x->txfree[--x->ntxfree];
+	memcpy(x->umem + addr, frame, len);
+	d = (struct xdp_desc *)x->tx.desc + (x->tx.cached & (XskRing-1));
+	d->addr = addr;
+	d->len = len;
+	d->options = 0;
+	x->tx.cached++;
+	return 0;
+}
+
+// publishes what was put and has the kernel send it.
+void
+xskflush(Xsk *x)
+{
+	if(*x->tx.producer != x->tx.cached){
+		__sync_synchronize();
+		*x->tx.producer = x->tx.cached;
+		sendto(x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+	}
+	reclaim(x);
+}
+
+/*
+ *	waits up to msec for frames to come in. returns 1 when there are
+ *	some, 0 on timeout and -1 when the interface has gone away.
+ */
+int
+xskwait(Xsk *x, int msec)
+{
+	struct pollfd pfd;
+
+	if(x->rx.cached != *x->rx.producer)
+		return 1;
+	pfd.fd = x->fd;
+	pfd.events = POLLIN;
+	if(poll(&pfd, 1, msec) == -1)
+		return errno == EINTR ? 0 : -1;
+	if(pfd.revents & (POLLERR|POLLHUP|POLLNVAL))
+		return -1;
+	return x->rx.cached != *x->rx.producer;
+}
@@ -0,0 +1,76 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	an AF_XDP socket on the first queue of a network interface, with
+ *	its frames in a umem of XskFrames frames, the first half of them
+ *	lent to the kernel for receiving and the other half for sending.
+ *	the umem is a memfd, so that a socket can be handed over to another
+ *	process with it. receiving and sending each use a pair of rings of
+ *	their own, so one thread can do each. frames to the addresses in the
+ *	pass map skip the socket and go on into the kernel.
+ */
+enum {
+	XskFrames = 2048,
+	XskFramesize = 2048,
+	XskRing = XskFrames/2, // descriptors in each ring
+	XskPassmax = 256,
+};
+
+typedef struct Xsk Xsk;
+typedef struct Xskring Xskring;
+
+struct Xskring {
+	volatile uint32_t *producer;
+	volatile uint32_t *consumer;
+	void *desc;
+	void *map;
+	size_t mapsize;
+	uint32_t cached; // our end of the ring, ahead of what is published
+};
+
+struct Xsk {
+	uint8_t *umem;
+	size_t umemsize;
+	Xskring rx;
+	Xskring fill;
+	Xskring tx;
+	Xskring comp;
+	uint64_t txfree[XskFrames/2];
+	int ntxfree;
+	int fd;
+	int memfd;
+	int ifindex;
+	int mode; // XDP_FLAGS_DRV_MODE or XDP_FLAGS_SKB_MODE
+	int passfd; // the pass map, a count of frames let through by address
+};
+
+Xsk *xskopen(char *ifname);
+Xsk *xskadopt(int fd, int memfd, int passfd, int ifindex, int mode);
+void xskclose(Xsk *x);
+int xskrecv(Xsk *x, uint8_t **framep);
+void xskrelease(Xsk *x);
+int xskput(Xsk *x, uint8_t *frame, int len);
+void xskflush(Xsk *x);
+int xskwait(Xsk *x, int msec);
+int xskpass(Xsk *x, uint8_t *mac, int on);
+int xskpasscount(Xsk *x, uint8_t *mac, uint64_t *countp);
@@ -0,0 +1,301 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+// example use: ./netdump -s /tmp/containet.sock -n nodeid -w out.pcapng
+
+#include "os.h"
+#include <signal.h>
+#include <sys/mman.h>
+#include "unsocket.h"
+#include "smprintf.h"
+#include "pktring.h"
+
+#define json(...) #__VA_ARGS__
+
+enum {
+	PcapngSHB = 0x0a0d0d0a,
+	PcapngIDB = 1,
+	PcapngEPB = 6,
+	LinkEthernet = 1,
+};
+
+static volatile int stop;
+
+static void
+pcapngblock(FILE *fp, uint32_t type, uint8_t *body, uint32_t len)
+{
+	uint8_t pad[4] = {0};
+	uint32_t tot;
+
+	tot = 12 + ((len + 3) & ~3);
+	fwrite(&type, 4, 1, fp);
+	fwrite(&tot, 4, 1, fp);
+	fwrite(body, 1, len, fp);
+	fwrite(pad, 1, tot - 12 - len, fp);
+	fwrite(&tot, 4, 1, fp);
+}
+
+static void
+pcapngshb(FILE *fp)
+{
+	uint8_t body[16];
+	uint32_t bom = 0x1a2b3c4d;
+	uint16_t major = 1, minor = 0;
+	int64_t seclen = -1;
+
+	memcpy(body, &bom, 4);
+	memcpy(body+4, &major, 2);
+	memcpy(body+6, &minor, 2);
+	memcpy(body+8, &seclen, 8);
+	pcapngblock(fp, PcapngSHB, body, sizeof body);
+}
+
+static void
+pcapngidb(FILE *fp, char *name, uint32_t snaplen)
+{
+	uint8_t body[8+4+64+8+4];
+	uint16_t linktype = LinkEthernet, code, len;
+	int off;
+
+	memset(body, 0, sizeof body);
+	memcpy(body, &linktype, 2);
+	memcpy(body+4, &snaplen, 4);
+	off = 8;
+
+	// if_name
+	code = 2;
+	len = strnlen(name, 63);
+	memcpy(body+off, &code, 2);
+	memcpy(body+off+2, &len, 2);
+	memcpy(body+off+4, name, len);
+	off += 4 + ((len + 3) & ~3);
+
+	// if_tsresol, nanoseconds
+	code = 9;
+	len = 1;
+	memcpy(body+off, &code, 2);
+	memcpy(body+off+2, &len, 2);
+	body[off+4] = 9;
+	off += 8;
+
+	// opt_endofopt
+	off += 4;
+	pcapngblock(fp, PcapngIDB, body, off);
+}
+
+static void
+pcapngepb(FILE *fp, uint32_t ifid, Pktslot *slot)
+{
+	uint32_t hdr[5];
+	uint8_t pad[4] = {0};
+	uint32_t tot, type = PcapngEPB;
+	int padlen;
+
+	padlen = ((slot->caplen + 3) & ~3) - slot->caplen;
+	tot = 12 + sizeof hdr + slot->caplen + padlen;
+	hdr[0] = ifid;
+	hdr[1] = slot->nsec >> 32;
+	hdr[2] = slot->nsec;
+	hdr[3] = slot->caplen;
+	hdr[4] = slot->len;
+	fwrite(&type, 4, 1, fp);
+	fwrite(&tot, 4, 1, fp);
+	fwrite(hdr, sizeof hdr, 1, fp);
+	fwrite(slot->data, 1, slot->caplen, fp);
+	fwrite(pad, 1, padlen, fp);
+	fwrite(&tot, 4, 1, fp);
+}
+
+static int
+ctrlcall(int ctrlsock, char *msg, int *respfdp)
+{
+	char buf[256];
+	int nrd, respfd;
+
+	if(sendframe(ctrlsock, -1, msg, strlen(msg)) == -1){
+		fprintf(stderr, "failed to send: '%s' to switch: %s\n", msg, strerror(errno));
+		return -1;
+	}
+	memset(buf, 0, sizeof buf);
+	if((nrd = recvframe(ctrlsock, &respfd, buf, sizeof buf-1)) <= 0){
+		fprintf(stderr, "failed to read response: %s\n", strerror(errno));
+		return -1;
+	}
+	if(strstr(buf, "error") != NULL){
+		fprintf(stderr, "switch says: %s\n", buf);
+		if(respfd != -1)
+			close(respfd);
+		return -1;
+	}
+	if(respfdp != NULL)
+		*respfdp = respfd;
+	else if(respfd != -1)
+		close(respfd);
+	return 0;
+}
+
+static void
+sigint(int sig)
+{
+	stop = sig;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sigaction sa;
+	Pktring *ring;
+	Pktslot *slot;
+	FILE *fp;
+	char *swtchname, *authtoken, *nodeid, *outname, *msg, *nodeidopt;
+	int ifids[PktringNames+1]; // the last for ports with no name
+	char *ifname;
+	uint32_t idx;
+	int opt, ctrlsock, ringfd, ethertype, nslots, snaplen, nifs, nfrm;
+
+	swtchname = NULL;
+	authtoken = "netdump";
+	nodeid = NULL;
+	outname = NULL;
+	ethertype = 0;
+	nslots = 4096;
+	snaplen = 2048;
+	while((opt = getopt(argc, argv, "s:a:n:e:c:S:w:")) != -1) {
+		switch(opt){
+		case 's':
+			swtchname = optarg;
+			break;
+		case 'a':
+			authtoken = optarg;
+			break;
+		case 'n':
+			nodeid = optarg;
+			break;
+		case 'e':
+			ethertype = strtol(optarg, NULL, 0);
+			break;
+		case 'c':
+			nslots = strtol(optarg, NULL, 0);
+			break;
+		case 'S':
+			snaplen = strtol(optarg, NULL, 0);
+			break;
+		case 'w':
+			outname = optarg;
+			break;
+		default:
+		caseusage:
+			fprintf(stderr, "usage: %s -s path/to/switch-sock [-a authtoken] [-n nodeid] [-e ethertype] [-c slots] [-S snaplen] [-w out.pcapng]\n", argv[0]);
+			exit(1);
+		}
+	}
+	if(swtchname == NULL)
+		goto caseusage;
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = &sigint;
+	sigfillset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if(outname != NULL){
+		if((fp = fopen(outname, "wb")) == NULL){
+			fprintf(stderr, "open %s: %s\n", outname, strerror(errno));
+			exit(1);
+		}
+	} else {
+		fp = stdout;
+	}
+
+	if((ctrlsock = unsocket(SOCK_STREAM, NULL, swtchname)) == -1){
+		fprintf(stderr, "could not connect to switch %s\n", swtchname);
+		exit(1);
+	}
+
+	nodeidopt = nodeid != NULL ? smprintf(json("nodeid":"%s",), nodeid) : strdup("");
+	msg = smprintf(
+		json({
+			"authtoken": "%s",
+			"mirror":{
+				%s
+				"ethertype":%d,
+				"slots":%d,
+				"snaplen":%d
+			}
+		}),
+		authtoken,
+		nodeidopt,
+		ethertype,
+		nslots,
+		snaplen
+	);
+	free(nodeidopt);
+	if(ctrlcall(ctrlsock, msg, &ringfd) == -1 || ringfd == -1){
+		fprintf(stderr, "mirror request failed\n");
+		exit(1);
+	}
+	free(msg);
+
+	if((ring = pktringmap(ringfd)) == NULL)
+		exit(1);
+	close(ringfd);
+
+	memset(ifids, 0xff, sizeof ifids);
+	nifs = 0;
+	nfrm = 0;
+	pcapngshb(fp);
+	while(!stop){
+		if((slot = pktringpeek(ring)) == NULL){
+			if(ring->closed)
+				break;
+			fflush(fp);
+			usleep(1000);
+			continue;
+		}
+		// an index out of the table, or with no name yet, still gets an interface.
+		idx = slot->port;
+		if(idx >= PktringNames || ring->names[idx][0] == '\0')
+			idx = PktringNames;
+		if(ifids[idx] == -1){
+			ifids[idx] = nifs++;
+			ifname = idx < PktringNames ? ring->names[idx] : "unknown";
+			pcapngidb(fp, ifname, ring->slotsize - sizeof(Pktslot));
+		}
+		pcapngepb(fp, ifids[idx], slot);
+		nfrm++;
+		pktringpop(ring);
+	}
+	fflush(fp);
+
+	if(!ring->closed){
+		msg = smprintf(json({"authtoken": "%s", "unmirror":{}}), authtoken);
+		ctrlcall(ctrlsock, msg, NULL);
+		free(msg);
+	}
+	fprintf(stderr, "%d frames captured, %llu dropped\n", nfrm, (unsigned long long)ring->drops);
+
+	pktringfree(ring);
+	close(ctrlsock);
+	if(fp != stdout)
+		fclose(fp);
+	return 0;
+}
@@ -0,0 +1,401 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+// example use: ./netpool -s /tmp/netpool.sock -n 16
+
+#include "os.h"
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include "unsocket.h"
+#include "smprintf.h"
+#include "file.h"
+#include "tun.h"
+#include "json.h"
+
+#define json(...) #__VA_ARGS__
+
+/*
+ *	netpool keeps network namespaces warm for containode, each with a
+ *	persistent tap named eth0 in it, as making a namespace and tearing
+ *	it down is most of what it takes to start and stop a container.
+ *
+ *	a container leases one with a lease request on the pool's socket,
+ *	and gets the namespace and the tap back as fds. the lease lasts as
+ *	long as the connection. when it goes, the namespace is scrubbed and
+ *	goes back in the pool, once the switch has let go of the tap, which
+ *	it does when it closes the port. a namespace with interfaces in it
+ *	that it was not made with is thrown away instead.
+ */
+enum {
+	MaxNetns = 1024,
+	MaxConns = 1024,
+	MaxMsg = 1024,
+	Tick = 1000, // ms between looks at namespaces that were given back
+	DrainTimeout = 60, // s for the tap to be let go of
+};
+
+// what a namespace is doing.
+enum {
+	NsFree = 0,
+	NsWarm,
+	NsLeased,
+	NsDraining, // given back, the tap still held by the switch
+};
+
+typedef struct Netns Netns;
+
+struct Netns {
+	int state;
+	int fd; // the namespace
+	int tapfd; // eth0 while it is warm, -1 otherwise
+	int nifs; // interfaces it was made with
+	int conn; // fd of the connection it is leased on
+	time_t since; // when it was given back
+};
+
+static Netns pool[MaxNetns];
+static int hostns = -1;
+static int nwarm;
+static int target = 8; // namespaces kept warm
+static volatile int stop;
+
+static void
+sigint(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+// the interfaces in the namespace we are in.
+static int
+countifs(void)
+{
+	char buf[16384];
+	int i, n, nrd;
+
+	if((nrd = readfile("/proc/self/net/dev", buf, sizeof buf - 1)) == -1)
+		return -1;
+	// two lines of headers, then one per interface.
+	n = -2;
+	for(i = 0; i < nrd; i++)
+		if(buf[i] == '\n')
+			n++;
+	return n;
+}
+
+/*
+ *	attaches to the tap named eth0 in the namespace we are in, making it
+ *	if there is none. fails with EBUSY while somebody else has it.
+ */
+static int
+tapattach(void)
+{
+	struct ifreq ifr;
+	int fd, oerr;
+
+	if((fd = open("/dev/net/tun", O_RDWR|O_CLOEXEC)) == -1)
+		return -1;
+	memset(&ifr, 0, sizeof ifr);
+	ifr.ifr_flags = IFF_TAP;
+	strcpy(ifr.ifr_name, "eth0");
+	if(ioctl(fd, TUNSETIFF, (void *)&ifr) == -1){
+		oerr = errno;
+		close(fd);
+		errno = oerr;
+		return -1;
+	}
+	return fd;
+}
+
+static int
+enterns(int fd)
+{
+	if(setns(fd, CLONE_NEWNET) == -1){
+		fprintf(stderr, "setns: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// makes a namespace with its tap, in a free slot of the pool.
+static int
+nsmake(Netns *ns)
+{
+	int fd, tapfd, nifs;
+
+	if(unshare(CLONE_NEWNET) == -1){
+		fprintf(stderr, "unshare CLONE_NEWNET: %s\n", strerror(errno));
+		return -1;
+	}
+	fd = open("/proc/self/ns/net", O_RDONLY|O_CLOEXEC);
+	tapfd = fd != -1 ? tapattach() : -1;
+	nifs = countifs();
+	if(fd == -1 || tapfd == -1 || tunpersist(tapfd, 1) == -1 || nifs == -1){
+		fprintf(stderr, "could not make a namespace with a tap: %s\n", strerror(errno));
+		if(tapfd != -1)
+			close(tapfd);
+		if(fd != -1)
+			close(fd);
+		enterns(hostns);
+		return -1;
+	}
+	if(enterns(hostns) == -1)
+		exit(1);
+	ns->state = NsWarm;
+	ns->fd = fd;
+	ns->tapfd = tapfd;
+	ns->nifs = nifs;
+	ns->conn = -1;
+	nwarm++;
+	return 0;
+}
+
+// lets a namespace go, and its tap with the last fd on it.
+static void
+nsdrop(Netns *ns)
+{
+	if(ns->tapfd != -1){
+		tunpersist(ns->tapfd, 0);
+		close(ns->tapfd);
+	}
+	if(ns->state == NsWarm)
+		nwarm--;
+	close(ns->fd);
+	memset(ns, 0, sizeof ns[0]);
+	ns->state = NsFree;
+}
+
+/*
+ *	scrubs a namespace that was given back and makes it warm again, once
+ *	its tap is free. returns 1 if it is warm, 0 if the tap is still held,
+ *	or -1 if it was thrown away.
+ */
+static int
+nsscrub(Netns *ns)
+{
+	int tapfd, oerr;
+
+	if(enterns(ns->fd) == -1)
+		return -1;
+	tapfd = -1;
+	oerr = 0;
+	if(countifs() == ns->nifs && (tapfd = tapattach()) == -1)
+		oerr = errno;
+	if(tapfd != -1 && (ifreset("eth0") == -1 || ifreset("lo") == -1)){
+		close(tapfd);
+		tapfd = -1;
+	}
+	if(enterns(hostns) == -1)
+		exit(1);
+	if(tapfd != -1){
+		ns->tapfd = tapfd;
+		// more than the pool keeps, as leases came faster than they went.
+		if(nwarm >= target){
+			nsdrop(ns);
+			return -1;
+		}
+		ns->state = NsWarm;
+		nwarm++;
+		return 1;
+	}
+	if(oerr == EBUSY && time(NULL) - ns->since < DrainTimeout)
+		return 0;
+	fprintf(stderr, "netpool: namespace %d %s, dropped\n", (int)(ns - pool),
+		oerr == EBUSY ? "still has its tap taken" : "changed");
+	nsdrop(ns);
+	return -1;
+}
+
+/*
+ *	answers a lease request on conn with a warm namespace and its tap,
+ *	making one if there are none.
+ */
+static int
+nslease(int conn)
+{
+	static JsonRoot root;
+	Netns *ns, *spare;
+	char buf[MaxMsg], *resp;
+	int i, fds[2], nrd, passfd;
+
+	if((nrd = recvframe(conn, &passfd, buf, sizeof buf - 1)) <= 0)
+		return -1;
+	if(passfd != -1)
+		close(passfd);
+	buf[nrd] = '\0';
+	jsonparse(&root, buf, nrd);
+	ns = NULL;
+	spare = NULL;
+	for(i = 0; i < MaxNetns && ns == NULL; i++){
+		if(pool[i].state == NsWarm)
+			ns = pool + i;
+		else if(pool[i].state == NsFree && spare == NULL)
+			spare = pool + i;
+	}
+	if(jsonwalk(&root, 0, "lease") == -1){
+		fprintf(stderr, "netpool: not a lease request: %s\n", buf);
+		ns = NULL;
+	} else if(ns == NULL && spare != NULL && nsmake(spare) == 0){
+		ns = spare;
+	}
+	if(ns == NULL){
+		resp = strdup(json({"error":"error"}));
+		sendframe(conn, -1, resp, strlen(resp));
+		free(resp);
+		return -1;
+	}
+	fds[0] = ns->fd;
+	fds[1] = ns->tapfd;
+	resp = smprintf(json({"ns":%d}), (int)(ns - pool));
+	if(sendframefds(conn, fds, 2, resp, strlen(resp)) == -1){
+		fprintf(stderr, "netpool: could not send lease: %s\n", strerror(errno));
+		free(resp);
+		return -1;
+	}
+	free(resp);
+	close(ns->tapfd);
+	ns->tapfd = -1;
+	ns->state = NsLeased;
+	ns->conn = conn;
+	nwarm--;
+	return 0;
+}
+
+// the lease on conn is over.
+static void
+nsreturn(int conn)
+{
+	int i;
+
+	for(i = 0; i < MaxNetns; i++){
+		if(pool[i].state == NsLeased && pool[i].conn == conn){
+			pool[i].state = NsDraining;
+			pool[i].conn = -1;
+			pool[i].since = time(NULL);
+			nsscrub(pool + i);
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sigaction sa;
+	struct pollfd pfds[1+MaxConns];
+	char *poolname;
+	int opt, i, n, lsock, fd, nconns, timeout;
+	time_t last;
+
+	poolname = NULL;
+	while((opt = getopt(argc, argv, "s:n:")) != -1) {
+		switch(opt){
+		case 's':
+			poolname = optarg;
+			break;
+		case 'n':
+			target = strtol(optarg, NULL, 10);
+			break;
+		default:
+		caseusage:
+			fprintf(stderr, "usage: %s -s path/to/pool-sock [-n warm namespaces]\n", argv[0]);
+			exit(1);
+		}
+	}
+	if(poolname == NULL || target < 0 || target > MaxNetns)
+		goto caseusage;
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = &sigint;
+	sigfillset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if((hostns = open("/proc/self/ns/net", O_RDONLY|O_CLOEXEC)) == -1){
+		fprintf(stderr, "open /proc/self/ns/net: %s\n", strerror(errno));
+		exit(1);
+	}
+	// gives a perf kick for namespace creation and teardown.
+	writefile("/sys/kernel/rcu_expedited", "1", 1);
+
+	if((lsock = unsocket(SOCK_STREAM, poolname, NULL)) == -1){
+		fprintf(stderr, "could not post %s\n", poolname);
+		exit(1);
+	}
+	if(listen(lsock, 64) == -1){
+		fprintf(stderr, "could not listen %s\n", poolname);
+		exit(1);
+	}
+	pfds[0].fd = lsock;
+	pfds[0].events = POLLIN;
+	nconns = 0;
+	last = 0;
+	while(!stop){
+		// fill the pool one at a time, so leases are not kept waiting.
+		timeout = Tick;
+		if(nwarm < target){
+			for(i = 0; i < MaxNetns && pool[i].state != NsFree; i++)
+				;
+			if(i < MaxNetns && nsmake(pool + i) == 0)
+				timeout = 0;
+		}
+		if((n = poll(pfds, 1+nconns, timeout)) == -1){
+			if(errno == EINTR)
+				continue;
+			fprintf(stderr, "poll: %s\n", strerror(errno));
+			exit(1);
+		}
+		if(n > 0 && (pfds[0].revents & POLLIN) != 0 && nconns < MaxConns){
+			if((fd = accept4(lsock, NULL, NULL, SOCK_CLOEXEC)) != -1){
+				pfds[1+nconns].fd = fd;
+				pfds[1+nconns].events = POLLIN;
+				pfds[1+nconns].revents = 0;
+				nconns++;
+			}
+		}
+		for(i = 1; n > 0 && i < 1+nconns; i++){
+			if(pfds[i].revents == 0)
+				continue;
+			// a request the first time, eof or anything else after.
+			if((pfds[i].revents & POLLIN) != 0 && pfds[i].events == POLLIN && nslease(pfds[i].fd) == 0){
+				pfds[i].events = POLLRDHUP;
+				continue;
+			}
+			nsreturn(pfds[i].fd);
+			close(pfds[i].fd);
+			pfds[i] = pfds[nconns--];
+			i--;
+		}
+		if(time(NULL) != last){
+			last = time(NULL);
+			for(i = 0; i < MaxNetns; i++)
+				if(pool[i].state == NsDraining)
+					nsscrub(pool + i);
+		}
+	}
+	for(i = 0; i < MaxNetns; i++)
+		if(pool[i].state != NsFree)
+			nsdrop(pool + i);
+	unlink(poolname);
+	return 0;
+}
@@ -0,0 +1,672 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+
+/*
+ *	pktgen sends and sinks test traffic from inside containers, so that
+ *	a measurement goes through the taps, the switch and the namespaces
+ *	together. the sender puts a flow number, a sequence number and a
+ *	timestamp in every packet, the sink counts, looks for holes and
+ *	measures one-way latency, which works because containers share the
+ *	host's monotonic clock. both print one line of json when done, and
+ *	-A adds up those lines into one.
+ *
+ *	example use:
+ *	./containode -s /tmp/containet.sock -4 10.77.0.1/16 -- ./pktgen -l
+ *	./containode -s /tmp/containet.sock -4 10.77.1.1/16 -- ./pktgen -c 10.77.0.1 -r 100000 -d 5
+ *	cat *.json | ./pktgen -A
+ *
+ *	with -S, pktgen skips the taps and plugs itself into containet as a
+ *	shared memory port, sending and receiving raw frames like -i does.
+ *	./pktgen -S /tmp/containet.sock -l
+ *	./pktgen -S /tmp/containet.sock -c 02:xx:xx:xx:xx:xx -d 5
+ */
+#include "os.h"
+#include <poll.h>
+#include <time.h>
+#include <math.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include "json.h"
+#include "shmport.h"
+
+enum {
+	PktMagic = 0x50474e31, // PGN1
+	WarmMagic = 0x5741524d, // WARM
+	PktType = 0x88b5, // local experimental ethertype
+	UdpOverhead = 14+20+8, // ethernet, ip and udp headers
+
+	MaxFrame = 9000,
+	MaxFlows = 1024, // power of two
+	Nlatency = 64*16,
+	IdleMsec = 2000,
+	ShmBatch = 32,
+};
+
+// packed so that it fits a 64 byte udp frame.
+typedef struct Pkthdr Pkthdr;
+struct __attribute__((packed)) Pkthdr {
+	uint32_t magic;
+	uint32_t sender;
+	uint32_t seq;
+	uint16_t flow;
+	uint64_t nsec;
+};
+
+typedef struct Flow Flow;
+struct Flow {
+	uint32_t sender;
+	uint32_t flow;
+	uint32_t nextseq;
+	uint64_t rx;
+	int used;
+};
+
+static Flow flows[MaxFlows];
+static uint64_t latency[Nlatency];
+static Shmport *shm;
+
+static uint64_t
+nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+// log-linear buckets, 16 per power of two, same as bench/switchbench.
+static int
+latbucket(uint64_t ns)
+{
+	int e;
+
+	if(ns < 16)
+		return ns;
+	e = 63 - __builtin_clzll(ns);
+	return e*16 + ((ns >> (e-4)) & 15);
+}
+
+static uint64_t
+latvalue(int bucket)
+{
+	int e;
+
+	if(bucket < 16)
+		return bucket;
+	e = bucket / 16;
+	return ((uint64_t)16 + (bucket & 15)) << (e-4);
+}
+
+static double
+percentile(double p)
+{
+	uint64_t n, want, acc;
+	int i;
+
+	n = 0;
+	for(i = 0; i < Nlatency; i++)
+		n += latency[i];
+	if(n == 0)
+		return 0.0;
+	want = (uint64_t)ceil(p * n);
+	acc = 0;
+	for(i = 0; i < Nlatency; i++){
+		acc += latency[i];
+		if(acc >= want)
+			return latvalue(i) / 1000.0;
+	}
+	return latvalue(Nlatency-1) / 1000.0;
+}
+
+static void
+printlatency(void)
+{
+	printf("\"lat_p50_us\":%.2f,\"lat_p90_us\":%.2f,\"lat_p99_us\":%.2f,\"lat_p999_us\":%.2f",
+		percentile(0.50), percentile(0.90), percentile(0.99), percentile(0.999));
+}
+
+static int
+parsemac(uint8_t *mac, char *str)
+{
+	unsigned int m[6];
+	int i;
+
+	if(sscanf(str, "%x:%x:%x:%x:%x:%x", m+0, m+1, m+2, m+3, m+4, m+5) != 6)
+		return -1;
+	for(i = 0; i < 6; i++)
+		mac[i] = m[i];
+	return 0;
+}
+
+/*
+ *	a raw socket on ifname that sends and receives frames of our own
+ *	ethertype. the interface mac goes to srcmac.
+ */
+static int
+rawopen(char *ifname, struct sockaddr_ll *sll, uint8_t *srcmac)
+{
+	struct ifreq ifr;
+	int fd;
+
+	if((fd = socket(AF_PACKET, SOCK_RAW, htons(PktType))) == -1){
+		fprintf(stderr, "socket AF_PACKET: %s\n", strerror(errno));
+		return -1;
+	}
+	memset(&ifr, 0, sizeof ifr);
+	snprintf(ifr.ifr_name, sizeof ifr.ifr_name, "%s", ifname);
+	if(ioctl(fd, SIOCGIFINDEX, &ifr) == -1){
+		fprintf(stderr, "SIOCGIFINDEX %s: %s\n", ifname, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	memset(sll, 0, sizeof sll[0]);
+	sll->sll_family = AF_PACKET;
+	sll->sll_protocol = htons(PktType);
+	sll->sll_ifindex = ifr.ifr_ifindex;
+	sll->sll_halen = 6;
+	if(bind(fd, (struct sockaddr *)sll, sizeof sll[0]) == -1){
+		fprintf(stderr, "bind %s: %s\n", ifname, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if(ioctl(fd, SIOCGIFHWADDR, &ifr) == -1){
+		fprintf(stderr, "SIOCGIFHWADDR %s: %s\n", ifname, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	memcpy(srcmac, ifr.ifr_hwaddr.sa_data, 6);
+	return fd;
+}
+
+static int
+udpopen(char *host, int port, int srcport)
+{
+	struct sockaddr_in sin;
+	int fd, one;
+
+	if((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1){
+		fprintf(stderr, "socket: %s\n", strerror(errno));
+		return -1;
+	}
+	one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+	memset(&sin, 0, sizeof sin);
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(srcport);
+	if(bind(fd, (struct sockaddr *)&sin, sizeof sin) == -1){
+		fprintf(stderr, "bind port %d: %s\n", srcport, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if(host == NULL)
+		return fd;
+	sin.sin_port = htons(port);
+	if(inet_pton(AF_INET, host, &sin.sin_addr) != 1){
+		fprintf(stderr, "bad address %s\n", host);
+		close(fd);
+		return -1;
+	}
+	if(connect(fd, (struct sockaddr *)&sin, sizeof sin) == -1){
+		fprintf(stderr, "connect %s: %s\n", host, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ *	connects to containet as a shared memory port, with a random locally
+ *	administered mac in srcmac.
+ */
+static int
+shmopen(char *switchsock, uint8_t *srcmac)
+{
+	char nodeid[32];
+	uint32_t r;
+	int i;
+
+	r = getpid() ^ (uint32_t)nsec();
+	snprintf(nodeid, sizeof nodeid, "pktgen-%08x", r);
+	if((shm = shmportdial(switchsock, "containet", nodeid, "shm0")) == NULL)
+		return -1;
+	srcmac[0] = 0x02;
+	for(i = 1; i < 6; i++){
+		r = r * 1103515245 + 12345;
+		srcmac[i] = r >> 16;
+	}
+	return 0;
+}
+
+// puts a frame in the ring, waiting for room like a blocking send.
+static int
+shmsend(uint8_t *frame, int len)
+{
+	while(shmportput(shm, frame, len) == -1){
+		if(len > (int)shm->slotsize - 4)
+			return -1;
+		shmportflush(shm);
+		sched_yield();
+	}
+	return len;
+}
+
+/*
+ *	sends size byte frames round robin over nflows flows, paced to rate
+ *	frames per second (0 is as fast as it goes) for duration seconds.
+ *	udp flows differ by source port, raw ones only by the flow number.
+ */
+static int
+sender(char *dst, char *ifname, uint8_t *shmmac, int port, int size, double rate, double duration, int nflows)
+{
+	struct sockaddr_ll sll;
+	uint8_t frame[MaxFrame];
+	uint64_t start, now, txpkts, txerrors;
+	uint32_t seqs[MaxFlows];
+	Pkthdr *hdr;
+	uint32_t id;
+	int fds[MaxFlows];
+	int i, fd, hdroff, len, flow;
+
+	hdroff = 0;
+	len = size - UdpOverhead;
+	memset(frame, 0, sizeof frame);
+	fd = -1;
+	if(shm != NULL || ifname != NULL){
+		if(shm == NULL && (fd = rawopen(ifname, &sll, frame+6)) == -1)
+			return -1;
+		if(shm != NULL)
+			memcpy(frame+6, shmmac, 6);
+		if(parsemac(frame, dst) == -1){
+			fprintf(stderr, "bad mac address %s\n", dst);
+			return -1;
+		}
+		frame[12] = PktType >> 8;
+		frame[13] = PktType & 0xff;
+		hdroff = 14;
+		len = size;
+		nflows = 1;
+		fds[0] = fd;
+	} else {
+		for(i = 0; i < nflows; i++)
+			if((fds[i] = udpopen(dst, port, port+1+i)) == -1)
+				return -1;
+	}
+	if(len < hdroff + (int)sizeof hdr[0]){
+		fprintf(stderr, "frame size %d is too small\n", size);
+		return -1;
+	}
+
+	id = getpid() ^ (uint32_t)nsec();
+	hdr = (Pkthdr *)(frame + hdroff);
+	hdr->magic = PktMagic;
+	hdr->sender = id;
+	memset(seqs, 0, sizeof seqs);
+
+	// get arp and the cams out of the way before anything is measured.
+	hdr->magic = WarmMagic;
+	for(i = 0; i < nflows; i++){
+		if(shm != NULL)
+			shmsend(frame, len);
+		else if(ifname != NULL)
+			sendto(fds[0], frame, len, 0, (struct sockaddr *)&sll, sizeof sll);
+		else
+			send(fds[i], frame, len, 0);
+	}
+	if(shm != NULL)
+		shmportflush(shm);
+	usleep(200000);
+	hdr->magic = PktMagic;
+
+	txpkts = 0;
+	txerrors = 0;
+	flow = 0;
+	start = nsec();
+	for(;;){
+		now = nsec();
+		if(now - start >= duration * 1e9)
+			break;
+		if(rate > 0 && txpkts >= (now - start) * rate / 1e9){
+			struct timespec ts = { 0, 20000 };
+			if(shm != NULL)
+				shmportflush(shm);
+			nanosleep(&ts, NULL);
+			continue;
+		}
+		hdr->flow = flow;
+		hdr->seq = seqs[flow];
+		hdr->nsec = now;
+		if(shm != NULL){
+			i = shmsend(frame, len);
+			if(txpkts % ShmBatch == ShmBatch-1)
+				shmportflush(shm);
+		} else if(ifname != NULL)
+			i = sendto(fds[0], frame, len, 0, (struct sockaddr *)&sll, sizeof sll);
+		else
+			i = send(fds[flow], frame, len, 0);
+		if(i == len){
+			seqs[flow]++;
+			txpkts++;
+		} else {
+			txerrors++;
+		}
+		if(++flow == nflows)
+			flow = 0;
+	}
+	if(shm != NULL)
+		shmportflush(shm);
+	now = nsec();
+
+	printf("{\"role\":\"sender\",\"mode\":\"%s\",\"flows\":%d,\"frame\":%d,\"seconds\":%.3f,\"txpkts\":%llu,\"txerrors\":%llu,\"pps\":%.0f,\"mbps\":%.2f}\n",
+		shm != NULL ? "shm" : ifname != NULL ? "raw" : "udp", nflows, size, (now - start) / 1e9,
+		(unsigned long long)txpkts, (unsigned long long)txerrors,
+		txpkts / ((now - start) / 1e9), txpkts * size * 8 / ((now - start) / 1e3));
+	return 0;
+}
+
+static Flow *
+flowlook(uint32_t sender, uint32_t flow)
+{
+	Flow *fp;
+	uint32_t h;
+	int i;
+
+	h = (sender * 0x9e3779b1 + flow) & (MaxFlows-1);
+	for(i = 0; i < MaxFlows; i++){
+		fp = flows + ((h + i) & (MaxFlows-1));
+		if(!fp->used){
+			fp->used = 1;
+			fp->sender = sender;
+			fp->flow = flow;
+			return fp;
+		}
+		if(fp->sender == sender && fp->flow == flow)
+			return fp;
+	}
+	return NULL;
+}
+
+/*
+ *	receives until nothing has come in for IdleMsec after the first
+ *	packet, or until timeout seconds have passed. lost is what is
+ *	missing below the highest sequence number seen on each flow, so
+ *	losses at the very end only show up against the sender's count.
+ */
+static int
+sink(char *ifname, uint8_t *shmmac, int port, double timeout)
+{
+	struct sockaddr_ll sll;
+	struct pollfd pfd;
+	uint8_t frame[MaxFrame], mac[6], *fp8;
+	uint64_t start, first, last, now, rxpkts, rxbytes, expected, reordered, ignored;
+	Pkthdr *hdr;
+	Flow *fp;
+	int i, fd, nrd, hdroff, overhead, nflows;
+
+	fd = -1;
+	if(shm != NULL){
+		// a broadcast with our mac, so that containet learns where we are.
+		memcpy(mac, shmmac, 6);
+		memset(frame, 0xff, 6);
+		memcpy(frame+6, mac, 6);
+		frame[12] = PktType >> 8;
+		frame[13] = PktType & 0xff;
+		memset(frame+14, 0, 50);
+		shmsend(frame, 64);
+		shmportflush(shm);
+		ifname = "shm";
+		hdroff = 14;
+		overhead = 0;
+	} else if(ifname != NULL){
+		if((fd = rawopen(ifname, &sll, mac)) == -1)
+			return -1;
+		hdroff = 14;
+		overhead = 0;
+	} else {
+		if((fd = udpopen(NULL, 0, port)) == -1)
+			return -1;
+		hdroff = 0;
+		overhead = UdpOverhead;
+	}
+	if(ifname != NULL)
+		fprintf(stderr, "pktgen: sink ready on %s %02x:%02x:%02x:%02x:%02x:%02x\n", ifname, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+	else
+		fprintf(stderr, "pktgen: sink ready on udp port %d\n", port);
+
+	rxpkts = 0;
+	rxbytes = 0;
+	reordered = 0;
+	ignored = 0;
+	first = 0;
+	last = 0;
+	start = nsec();
+	for(;;){
+		now = nsec();
+		if(now - start >= timeout * 1e9)
+			break;
+		if(rxpkts > 0 && now - last >= IdleMsec * 1000000ull)
+			break;
+		if(shm != NULL){
+			if((nrd = shmportget(shm, &fp8)) == -1){
+				shmportrelease(shm);
+				shmportwait(shm, 100);
+				continue;
+			}
+		} else {
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			if(poll(&pfd, 1, 100) <= 0)
+				continue;
+			nrd = recv(fd, frame, sizeof frame, 0);
+			fp8 = frame;
+		}
+		now = nsec();
+		if(nrd < hdroff + (int)sizeof hdr[0])
+			continue;
+		hdr = (Pkthdr *)(fp8 + hdroff);
+		if(hdr->magic == WarmMagic)
+			continue;
+		if(hdr->magic != PktMagic || (fp = flowlook(hdr->sender, hdr->flow)) == NULL){
+			ignored++;
+			continue;
+		}
+		if(rxpkts == 0)
+			first = now;
+		last = now;
+		rxpkts++;
+		rxbytes += nrd + overhead;
+		latency[latbucket(now - hdr->nsec)]++;
+		fp->rx++;
+		if(hdr->seq < fp->nextseq)
+			reordered++;
+		else
+			fp->nextseq = hdr->seq + 1;
+	}
+	if(fd != -1)
+		close(fd);
+
+	expected = 0;
+	nflows = 0;
+	for(i = 0; i < MaxFlows; i++){
+		if(flows[i].used){
+			expected += flows[i].nextseq;
+			nflows++;
+		}
+	}
+	// measure over the time traffic was flowing, not the idle wait.
+	if(last <= first)
+		last = first + 1;
+
+	printf("{\"role\":\"sink\",\"mode\":\"%s\",\"flows\":%d,\"seconds\":%.3f,\"rxpkts\":%llu,\"rxbytes\":%llu,\"expected\":%llu,\"lost\":%llu,\"reordered\":%llu,\"ignored\":%llu,\"pps\":%.0f,\"mbps\":%.2f,",
+		shm != NULL ? "shm" : ifname != NULL ? "raw" : "udp", nflows, (last - first) / 1e9,
+		(unsigned long long)rxpkts, (unsigned long long)rxbytes,
+		(unsigned long long)expected,
+		(unsigned long long)(expected > rxpkts ? expected - rxpkts : 0),
+		(unsigned long long)reordered, (unsigned long long)ignored,
+		rxpkts / ((last - first) / 1e9), rxbytes * 8 / ((last - first) / 1e3));
+	printlatency();
+	printf(",\"hist\":[");
+	for(i = 0, nrd = 0; i < Nlatency; i++)
+		if(latency[i] != 0)
+			printf("%s[%d,%llu]", nrd++ > 0 ? "," : "", i, (unsigned long long)latency[i]);
+	printf("]}\n");
+	return 0;
+}
+
+static double
+jsonnum(JsonRoot *root, char *buf, int off)
+{
+	if(off == -1 || root->ast.buf[off].type != JsonNumber)
+		return 0.0;
+	return strtod(buf + root->ast.buf[off].off, NULL);
+}
+
+/*
+ *	reads sender and sink lines from stdin and prints the totals.
+ *	rates add up, since the sinks run side by side, and latency
+ *	percentiles come from the merged histograms.
+ */
+static int
+aggregate(void)
+{
+	JsonRoot root;
+	JsonAst *ast;
+	char line[65536], *role;
+	double seconds, pps, mbps, v;
+	uint64_t txpkts, rxpkts, reordered;
+	int off, i, nsenders, nsinks;
+
+	memset(&root, 0, sizeof root);
+	txpkts = rxpkts = reordered = 0;
+	seconds = pps = mbps = 0.0;
+	nsenders = nsinks = 0;
+	while(fgets(line, sizeof line, stdin) != NULL){
+		if(line[0] != '{')
+			continue;
+		if(jsonparse(&root, line, strlen(line)) == -1)
+			continue;
+		if((off = jsonwalk(&root, 0, "role")) == -1 || (role = jsoncstr(&root, off)) == NULL)
+			continue;
+		if(!strcmp(role, "sender")){
+			nsenders++;
+			txpkts += jsonnum(&root, line, jsonwalk(&root, 0, "txpkts"));
+		} else if(!strcmp(role, "sink")){
+			nsinks++;
+			rxpkts += jsonnum(&root, line, jsonwalk(&root, 0, "rxpkts"));
+			reordered += jsonnum(&root, line, jsonwalk(&root, 0, "reordered"));
+			pps += jsonnum(&root, line, jsonwalk(&root, 0, "pps"));
+			mbps += jsonnum(&root, line, jsonwalk(&root, 0, "mbps"));
+			v = jsonnum(&root, line, jsonwalk(&root, 0, "seconds"));
+			if(v > seconds)
+				seconds = v;
+			if((off = jsonwalk(&root, 0, "hist")) != -1 && root.ast.buf[off].type == '['){
+				ast = root.ast.buf;
+				for(off++; ast[off].type == '['; off = ast[off].next){
+					i = jsonnum(&root, line, off+1);
+					if(i >= 0 && i < Nlatency && ast[off+1].type == JsonNumber)
+						latency[i] += jsonnum(&root, line, ast[off+1].next);
+				}
+			}
+		}
+		free(role);
+	}
+
+	printf("{\"senders\":%d,\"sinks\":%d,\"seconds\":%.3f,\"txpkts\":%llu,\"rxpkts\":%llu,\"loss\":%.6f,\"reordered\":%llu,\"pps\":%.0f,\"mbps\":%.2f,",
+		nsenders, nsinks, seconds, (unsigned long long)txpkts, (unsigned long long)rxpkts,
+		txpkts > rxpkts ? (double)(txpkts - rxpkts) / txpkts : 0.0,
+		(unsigned long long)reordered, pps, mbps);
+	printlatency();
+	printf("}\n");
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	char *dst, *ifname, *switchsock;
+	uint8_t shmmac[6];
+	double rate, duration;
+	int opt, lflag, Aflag, port, size, nflows;
+
+	dst = NULL;
+	ifname = NULL;
+	switchsock = NULL;
+	lflag = 0;
+	Aflag = 0;
+	port = 9000;
+	size = 64;
+	rate = 0;
+	duration = 10;
+	nflows = 1;
+	while((opt = getopt(argc, argv, "lAc:i:S:p:s:r:d:f:")) != -1){
+		switch(opt){
+		case 'l':
+			lflag = 1;
+			break;
+		case 'A':
+			Aflag = 1;
+			break;
+		case 'c':
+			dst = optarg;
+			break;
+		case 'i':
+			ifname = optarg;
+			break;
+		case 'S':
+			switchsock = optarg;
+			break;
+		case 'p':
+			port = strtol(optarg, NULL, 10);
+			break;
+		case 's':
+			size = strtol(optarg, NULL, 10);
+			break;
+		case 'r':
+			rate = strtod(optarg, NULL);
+			break;
+		case 'd':
+			duration = strtod(optarg, NULL);
+			break;
+		case 'f':
+			nflows = strtol(optarg, NULL, 10);
+			break;
+		default:
+		caseusage:
+			fprintf(stderr, "usage: %s -l [-i ifname|-S switchsock] [-p port] [-d timeout]\n", argv[0]);
+			fprintf(stderr, "       %s -c ip4addr|mac [-i ifname|-S switchsock] [-p port] [-s framesize] [-r pps] [-d seconds] [-f flows]\n", argv[0]);
+			fprintf(stderr, "       %s -A < results\n", argv[0]);
+			exit(1);
+		}
+	}
+	if(size < 64 || size > MaxFrame || nflows < 1 || nflows > MaxFlows || port < 1 || port + nflows > 65535)
+		goto caseusage;
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	if(Aflag)
+		return aggregate();
+	if((lflag || dst != NULL) && switchsock != NULL && shmopen(switchsock, shmmac) == -1)
+		return 1;
+	if(lflag)
+		return sink(ifname, shmmac, port, duration) == -1;
+	if(dst != NULL)
+		return sender(dst, ifname, shmmac, port, size, rate, duration, nflows) == -1;
+	goto caseusage;
+}
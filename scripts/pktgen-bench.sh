@@ -0,0 +1,109 @@
+#!/bin/sh
+#
+# starts a fresh containet, runs pairs of pktgen sinks and senders in
+# containers started with containode, and prints every result line
+# followed by their sum. run it as root from the top of the tree after
+# make.
+#
+# example use: sudo scripts/pktgen-bench.sh -n 8 -s 1500 -r 20000 -d 5
+#
+
+pairs=1
+size=64
+rate=0
+duration=5
+flows=1
+mode=udp
+
+usage() {
+	echo "usage: $0 [-n pairs] [-s framesize] [-r pps-per-sender] [-d seconds] [-f flows] [-m udp|raw|shm]" 1>&2
+	exit 1
+}
+
+while getopts "n:s:r:d:f:m:" opt; do
+	case $opt in
+	n) pairs=$OPTARG ;;
+	s) size=$OPTARG ;;
+	r) rate=$OPTARG ;;
+	d) duration=$OPTARG ;;
+	f) flows=$OPTARG ;;
+	m) mode=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+[ "$mode" = udp ] || [ "$mode" = raw ] || [ "$mode" = shm ] || usage
+
+top=$(pwd)
+for prog in containet containode pktgen; do
+	[ -x "$top/$prog" ] || { echo "$0: no ./$prog, run make first" 1>&2; exit 1; }
+done
+
+dir=$(mktemp -d /tmp/pktgen-bench.XXXXXX) || exit 1
+sock=$dir/containet.sock
+"$top/containet" -s "$sock" 2> "$dir/containet.log" &
+swpid=$!
+trap 'kill $swpid 2>/dev/null; wait $swpid 2>/dev/null; rm -rf "$dir"' EXIT INT TERM
+
+n=0
+while [ ! -S "$sock" ]; do
+	n=$((n+1))
+	[ $n -gt 50 ] && { echo "$0: containet did not start" 1>&2; cat "$dir/containet.log" 1>&2; exit 1; }
+	sleep 0.1
+done
+
+# sink i is 10.1.x.y and sender i is 10.2.x.y, all in 10/8.
+addr() {
+	echo "10.$1.$(($2 / 250)).$(($2 % 250 + 1))"
+}
+
+# waits for the ready line of a sink and prints its address, which is
+# a mac address in raw and shm modes.
+sinkready() {
+	n=0
+	while ! grep -q "pktgen: sink ready" "$dir/sink.$1.log" 2>/dev/null; do
+		n=$((n+1))
+		[ $n -gt 300 ] && { echo "$0: sink $1 did not start" 1>&2; cat "$dir/sink.$1.log" 1>&2; exit 1; }
+		sleep 0.1
+	done
+	if [ "$mode" != udp ]; then
+		grep "pktgen: sink ready" "$dir/sink.$1.log" | awk '{ print $NF }'
+	else
+		addr 1 "$1"
+	fi
+}
+
+# shm mode plugs pktgen straight into containet, with no container.
+if [ "$mode" = raw ]; then
+	ifopt="-i eth0"
+fi
+if [ "$mode" = shm ]; then
+	ifopt="-S $sock"
+	run() { shift 5; "$@"; }
+else
+	run() { "$top/containode" "$@"; }
+fi
+
+pids=""
+i=0
+while [ $i -lt "$pairs" ]; do
+	run -s "$sock" -4 "$(addr 1 $i)/8" -- \
+		"$top/pktgen" -l $ifopt -d $((duration + 60)) > "$dir/sink.$i.json" 2> "$dir/sink.$i.log" &
+	pids="$pids $!"
+	i=$((i+1))
+done
+
+i=0
+while [ $i -lt "$pairs" ]; do
+	dst=$(sinkready $i) || exit 1
+	run -s "$sock" -4 "$(addr 2 $i)/8" -- \
+		"$top/pktgen" -c "$dst" $ifopt -s "$size" -r "$rate" -d "$duration" -f "$flows" > "$dir/sender.$i.json" 2> "$dir/sender.$i.log" &
+	pids="$pids $!"
+	i=$((i+1))
+done
+
+for pid in $pids; do
+	wait $pid
+done
+
+cat "$dir"/sender.*.json "$dir"/sink.*.json
+cat "$dir"/sender.*.json "$dir"/sink.*.json | "$top/pktgen" -A
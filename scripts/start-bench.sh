@@ -0,0 +1,109 @@
+#!/bin/sh
+#
+# starts a fresh containet and n containers with containode -T, one after
+# the other and then all at once, each running true, and prints the p50
+# and p99 of their start and teardown times and of every phase of the
+# start, in microseconds. -P leases the network namespaces from a netpool
+# instead. run it as root from the top of the tree after make.
+#
+# example use: sudo scripts/start-bench.sh -n 100 -P
+#
+# the pid namespace of a container ends with true, so what is timed is
+# from containode starting to true running, and from true exiting to
+# containode being done with its port on the switch.
+#
+
+count=100
+pool=0
+
+usage() {
+	echo "usage: $0 [-n containers] [-P]" 1>&2
+	exit 1
+}
+
+while getopts "n:P" opt; do
+	case $opt in
+	n) count=$OPTARG ;;
+	P) pool=1 ;;
+	*) usage ;;
+	esac
+done
+
+top=$(pwd)
+for prog in containet containode netpool; do
+	[ -x "$top/$prog" ] || { echo "$0: no ./$prog, run make first" 1>&2; exit 1; }
+done
+
+dir=$(mktemp -d /tmp/start-bench.XXXXXX) || exit 1
+sock=$dir/containet.sock
+"$top/containet" -s "$sock" 2> "$dir/containet.log" &
+pids=$!
+if [ $pool = 1 ]; then
+	"$top/netpool" -s "$dir/netpool.sock" -n "$count" 2> "$dir/netpool.log" &
+	pids="$pids $!"
+	poolopt="-P $dir/netpool.sock"
+fi
+trap 'kill $pids 2>/dev/null; wait $pids 2>/dev/null; rm -rf "$dir"' EXIT INT TERM
+
+waitsock() {
+	n=0
+	while [ ! -S "$1" ]; do
+		n=$((n+1))
+		[ $n -gt 50 ] && { echo "$0: no $1" 1>&2; cat "$dir"/*.log 1>&2; exit 1; }
+		sleep 0.1
+	done
+}
+waitsock "$sock"
+[ $pool = 1 ] && waitsock "$dir/netpool.sock"
+
+addr() {
+	echo "10.$(($1 / 62500 % 250 + 1)).$(($1 / 250 % 250)).$(($1 % 250 + 1))/8"
+}
+
+start() {
+	"$top/containode" -T -s "$sock" $poolopt -4 "$(addr $1)" -- /bin/true 2> "$dir/times.$1.log"
+}
+
+# prints the p50 and p99 of every field of the json lines of times.
+summary() {
+	grep -h '^{"identity"' "$dir"/times.*.log > "$dir/times" || { echo "$0: no times" 1>&2; exit 1; }
+	for f in clone tun sendfd mount pivot mounts mknod post exec start teardown; do
+		sed -n "s/.*\"$f\":\([0-9.]*\).*/\1/p" "$dir/times" | sort -n | awk -v mode=$1 -v f=$f '
+			{ v[NR] = $1 }
+			END {
+				if(NR == 0)
+					exit
+				p50 = v[int((NR-1)*0.50)+1]
+				p99 = v[int((NR-1)*0.99)+1]
+				printf("{\"mode\":\"%s\",\"phase\":\"%s\",\"n\":%d,\"p50\":%.1f,\"p99\":%.1f}\n", mode, f, NR, p50, p99)
+			}'
+	done
+}
+
+# pool namespaces are made in the background, so give it time to fill.
+[ $pool = 1 ] && sleep 1
+
+i=0
+while [ $i -lt "$count" ]; do
+	start $i
+	i=$((i+1))
+done
+summary serial
+rm -f "$dir"/times.*.log
+
+[ $pool = 1 ] && sleep 1
+
+t0=$(date +%s%N)
+nodes=""
+i=0
+while [ $i -lt "$count" ]; do
+	start $i &
+	nodes="$nodes $!"
+	i=$((i+1))
+done
+for pid in $nodes; do
+	wait $pid
+done
+t1=$(date +%s%N)
+summary parallel
+echo "{\"mode\":\"parallel\",\"n\":$count,\"wall\":$(( (t1 - t0) / 1000 ))}"
@@ -0,0 +1,265 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include "acl.h"
+#include "check.h"
+
+enum {
+	Nrules = 500,
+	Nkeys = 20000,
+};
+
+static Aclcache cache;
+
+// what aclclassify should say, the slow way.
+static int
+firstmatch(Acl *acl, Aclkey *key)
+{
+	Aclrule *r;
+	uint8_t *k, *v, *m;
+	int i, j;
+
+	for(i = 0; i < acl->nrules; i++){
+		r = acl->rules + i;
+		k = (uint8_t *)key;
+		v = (uint8_t *)&r->value;
+		m = (uint8_t *)&r->mask;
+		for(j = 0; j < (int)sizeof key[0]; j++)
+			if((k[j] & m[j]) != v[j])
+				break;
+		if(j == (int)sizeof key[0] && key->sport >= r->sportlo && key->sport <= r->sporthi
+		&& key->dport >= r->dportlo && key->dport <= r->dporthi)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ *	keys from a small space of addresses and ports, so that rules and
+ *	frames meet often.
+ */
+static void
+randkey(Aclkey *key)
+{
+	memset(key, 0, sizeof key[0]);
+	key->dstmac[5] = random() % 4;
+	key->srcmac[5] = random() % 4;
+	key->vlan = random() % 2 ? AclTagged | random() % 3 : 0;
+	key->family = random() % 3 ? 4 : 6;
+	key->proto = random() % 2 ? IPPROTO_TCP : IPPROTO_UDP;
+	key->sport = random() % 2 ? random() % 2000 : random() % 65536;
+	key->dport = random() % 2 ? random() % 2000 : random() % 65536;
+	key->src[0] = 10;
+	key->src[1] = random() % 4;
+	key->src[3] = random();
+	key->dst[0] = 10;
+	key->dst[1] = random() % 4;
+	key->dst[3] = random();
+}
+
+static void
+randrule(Aclrule *r)
+{
+	int len, lo;
+
+	memset(r, 0, sizeof r[0]);
+	randkey(&r->value);
+	if(random() % 4 == 0)
+		memset(r->mask.dstmac, 0xff, 6);
+	if(random() % 4 == 0)
+		memset(r->mask.srcmac, 0xff, 6);
+	if(random() % 4 == 0)
+		r->mask.vlan = 0xffff;
+	if(random() % 2 == 0){
+		r->mask.family = 0xff;
+		// prefixes of a few lengths, as lists tend to have.
+		len = (random() % 5) * 6 + 2;
+		memset(r->mask.src, 0xff, len/8);
+		r->mask.src[len/8] = 0xff << (8 - len%8);
+		len = (random() % 5) * 6 + 2;
+		memset(r->mask.dst, 0xff, len/8);
+		r->mask.dst[len/8] = 0xff << (8 - len%8);
+	}
+	if(random() % 2 == 0)
+		r->mask.proto = 0xff;
+	r->sporthi = r->dporthi = 65535;
+	if(random() % 3 == 0){
+		lo = random() % 2000;
+		r->sportlo = lo;
+		r->sporthi = lo + random() % 1000;
+	}
+	if(random() % 3 == 0){
+		lo = random() % 2000;
+		r->dportlo = lo;
+		r->dporthi = random() % 2 ? lo : lo + random() % 3000;
+	}
+	r->action = random() % 4;
+	r->mark = random() % 64;
+}
+
+/*
+ *	random lists against a linear search, with and without the cache,
+ *	which has to notice a new list at the same address.
+ */
+static void
+testclassify(void)
+{
+	Acl *acl;
+	Aclrule rule;
+	Aclkey key;
+	int i, round, bad, hit, want;
+
+	for(round = 0; round < 3; round++){
+		acl = aclnew(AclAllow);
+		for(i = 0; i < (round == 0 ? 10 : Nrules); i++){
+			randrule(&rule);
+			check(aclrule(acl, &rule) == i);
+		}
+		check(aclcompile(acl) == 0);
+		check(round == 0 || acl->ntuples < acl->nrules/2);
+		bad = hit = 0;
+		for(i = 0; i < Nkeys; i++){
+			randkey(&key);
+			want = firstmatch(acl, &key);
+			hit += want != -1;
+			bad += aclclassify(acl, NULL, &key) != want;
+			bad += aclclassify(acl, &cache, &key) != want;
+			bad += aclclassify(acl, &cache, &key) != want;
+		}
+		check(bad == 0);
+		check(hit > Nkeys/10);
+		aclfree(acl);
+	}
+
+	// rules that make no sense.
+	acl = aclnew(AclDrop);
+	randrule(&rule);
+	rule.sportlo = 10;
+	rule.sporthi = 9;
+	check(aclrule(acl, &rule) == -1);
+	randrule(&rule);
+	rule.action = AclMark;
+	rule.mark = 64;
+	check(aclrule(acl, &rule) == -1);
+	// an empty list matches nothing.
+	check(aclcompile(acl) == 0);
+	randkey(&key);
+	check(aclclassify(acl, &cache, &key) == -1);
+	aclfree(acl);
+}
+
+static uint16_t
+ipsum(uint8_t *p, int len)
+{
+	uint32_t sum;
+	int i;
+
+	sum = 0;
+	for(i = 0; i < len; i += 2)
+		sum += p[i]<<8 | p[i+1];
+	while(sum > 0xffff)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+// keys from frames, tagged or not, and from packets, and marking them.
+static void
+testframes(void)
+{
+	uint8_t f[128];
+	Aclkey key;
+	uint16_t sum;
+
+	memset(f, 0, sizeof f);
+	f[5] = 0xd;
+	f[11] = 0x5;
+	f[12] = 0x81;
+	f[16] = 0x08;
+	f[14] = 0x20;
+	f[15] = 0x07;
+	f[18] = 0x45;
+	f[18+8] = 64;
+	f[18+9] = IPPROTO_UDP;
+	f[18+12] = 10;
+	f[18+15] = 1;
+	f[18+16] = 10;
+	f[18+19] = 2;
+	f[38] = 0x04;
+	f[39] = 0x01;
+	f[40] = 0x00;
+	f[41] = 0x35;
+	sum = ipsum(f+18, 20);
+	f[18+10] = sum >> 8;
+	f[18+11] = sum & 0xff;
+	check(aclkey(&key, f, 64, 0) == 0);
+	check(key.dstmac[5] == 0xd && key.srcmac[5] == 0x5 && key.vlan == (AclTagged | 7));
+	check(key.family == 4 && key.proto == IPPROTO_UDP && key.src[3] == 1 && key.dst[3] == 2);
+	check(key.sport == 1025 && key.dport == 53);
+
+	aclmark(f, 64, 0, 46);
+	check(f[19] >> 2 == 46 && ipsum(f+18, 20) == 0);
+	aclmark(f, 64, 0, 0);
+	check(f[19] == 0 && ipsum(f+18, 20) == 0);
+
+	// a later fragment has no ports.
+	f[18+7] = 1;
+	check(aclkey(&key, f, 64, 0) == 0 && key.sport == 0 && key.dport == 0);
+
+	// a packet with nothing in front.
+	check(aclkey(&key, f+18, 46, 1) == 0 && key.family == 4 && key.dst[3] == 2 && key.vlan == 0);
+	check(aclkey(&key, f, 10, 0) == -1);
+
+	// ipv6, whose traffic class is across two bytes.
+	memset(f, 0, sizeof f);
+	f[12] = 0x86;
+	f[13] = 0xdd;
+	f[14] = 0x6f;
+	f[15] = 0xff;
+	f[14+6] = IPPROTO_TCP;
+	f[14+23] = 1;
+	f[14+39] = 2;
+	f[57] = 80;
+	check(aclkey(&key, f, 80, 0) == 0 && key.family == 6 && key.proto == IPPROTO_TCP && key.dport == 80);
+	check(key.src[15] == 1 && key.dst[15] == 2 && key.sport == 0);
+	aclmark(f, 80, 0, 0);
+	check(f[14] == 0x60 && f[15] == 0x3f);
+	aclmark(f, 80, 0, 63);
+	check(f[14] == 0x6f && f[15] == 0xff);
+}
+
+int
+main(void)
+{
+	srandom(1);
+	testclassify();
+	testframes();
+	if(nfail > 0){
+		fprintf(stderr, "acl_test: %d checks failed\n", nfail);
+		return 1;
+	}
+	printf("acl_test: ok\n");
+	return 0;
+}
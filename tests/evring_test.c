@@ -0,0 +1,139 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <poll.h>
+#include "evring.h"
+#include "check.h"
+
+enum {
+	Nthreads = 4,
+	Nputs = 100000,
+};
+
+static int
+readable(int fd)
+{
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+	return poll(&pfd, 1, 0) == 1;
+}
+
+static void
+testring(void)
+{
+	Evring ring;
+	Event ev;
+	uint64_t cursor;
+	uint8_t mac[6] = {2, 0, 0, 0, 0, 1};
+	int i;
+
+	check(evringinit(&ring, 6) == -1);
+	check(evringinit(&ring, 8) == 0);
+
+	// nothing to read, and no wakeup before arming.
+	cursor = 0;
+	check(evringget(&ring, &cursor, &ev) == 0);
+	evringput(&ring, EvMacLearn, 3, mac, 0);
+	check(!readable(ring.fd));
+	check(evringget(&ring, &cursor, &ev) == 1);
+	check(ev.type == EvMacLearn && ev.port == 3 && memcmp(ev.mac, mac, 6) == 0);
+	check(cursor == 1);
+
+	// one wakeup per arming, however many events.
+	evringarm(&ring);
+	evringput(&ring, EvPortOpen, 1, NULL, 0);
+	evringput(&ring, EvPortOpen, 2, NULL, 0);
+	check(readable(ring.fd));
+	evringarm(&ring);
+	check(!readable(ring.fd));
+	check(evringget(&ring, &cursor, &ev) == 1 && ev.port == 1);
+	check(evringget(&ring, &cursor, &ev) == 1 && ev.port == 2);
+	check(evringget(&ring, &cursor, &ev) == 0);
+
+	// falling behind by more than the ring loses the oldest.
+	for(i = 0; i < 20; i++)
+		evringput(&ring, EvOverflow, i, NULL, i);
+	check(evringget(&ring, &cursor, &ev) == 1);
+	check(ev.type == EvLost && ev.count == 12);
+	for(i = 12; i < 20; i++)
+		check(evringget(&ring, &cursor, &ev) == 1 && ev.type == EvOverflow && ev.port == (uint32_t)i);
+	check(evringget(&ring, &cursor, &ev) == 0);
+	evringfree(&ring);
+}
+
+static void *
+producer(void *aring)
+{
+	Evring *ring = aring;
+	int i;
+
+	for(i = 0; i < Nputs; i++)
+		evringput(ring, EvMacMove, i, NULL, i);
+	return NULL;
+}
+
+// events read while producers race are whole, or reported lost.
+static void
+testrace(void)
+{
+	pthread_t thr[Nthreads];
+	Evring ring;
+	Event ev;
+	uint64_t cursor, nseen;
+	int i;
+
+	check(evringinit(&ring, 1024) == 0);
+	for(i = 0; i < Nthreads; i++)
+		pthread_create(thr + i, NULL, producer, &ring);
+	cursor = 0;
+	nseen = 0;
+	while(nseen < (uint64_t)Nthreads*Nputs){
+		if(evringget(&ring, &cursor, &ev) == 0)
+			continue;
+		if(ev.type == EvLost){
+			nseen += ev.count;
+			continue;
+		}
+		check(ev.type == EvMacMove && ev.port == ev.count);
+		nseen++;
+	}
+	for(i = 0; i < Nthreads; i++)
+		pthread_join(thr[i], NULL);
+	check(nseen == (uint64_t)Nthreads*Nputs);
+	check(evringget(&ring, &cursor, &ev) == 0);
+	evringfree(&ring);
+}
+
+int
+main(void)
+{
+	testring();
+	testrace();
+	if(nfail > 0){
+		fprintf(stderr, "evring_test: %d checks failed\n", nfail);
+		return 1;
+	}
+	printf("evring_test: ok\n");
+	return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "fwd.h"
+#include "check.h"
+
+struct Port {
+	int id;
+};
+
+static Cam cams[Camsize];
+static Host hosts[Hostsize];
+
+static void
+mkframe(uint8_t *frame, uint8_t dst, uint8_t src)
+{
+	memset(frame, 0, 64);
+	frame[0] = 0x02;
+	frame[5] = dst;
+	frame[6] = 0x02;
+	frame[11] = src;
+	frame[12] = 0x08;
+}
+
+static void
+testfwd(void)
+{
+	struct Port a = {1}, b = {2};
+	uint8_t frame[64];
+	Port *out;
+	int learn;
+
+	memset(cams, 0, sizeof cams);
+
+	// unknown destination floods, and the source is learned.
+	mkframe(frame, 2, 1);
+	out = NULL;
+	check(fwdframe(cams, &a, 0, frame, sizeof frame, &out, &learn) == FwdFlood);
+	check(out == NULL);
+	check(learn == CamNew);
+
+	// the answer goes straight back to where the first one came from.
+	mkframe(frame, 1, 2);
+	check(fwdframe(cams, &b, 0, frame, sizeof frame, &out, NULL) == FwdUnicast);
+	check(out == &a);
+
+	mkframe(frame, 2, 1);
+	check(fwdframe(cams, &a, 0, frame, sizeof frame, &out, &learn) == FwdUnicast);
+	check(out == &b);
+	check(learn == CamKnown);
+
+	// 1 moves to port b, the cam follows right away.
+	mkframe(frame, 0xff, 1);
+	fwdframe(cams, &b, 0, frame, sizeof frame, &out, &learn);
+	check(learn == CamMoved);
+	mkframe(frame, 1, 2);
+	check(fwdframe(cams, &a, 0, frame, sizeof frame, &out, NULL) == FwdUnicast);
+	check(out == &b);
+
+	// as it does when it moves between peers of the same port.
+	mkframe(frame, 0xff, 1);
+	fwdframe(cams, &b, 3, frame, sizeof frame, &out, &learn);
+	check(learn == CamMoved);
+	check(camlook(cams, frame+6)->peer == 3);
+	fwdframe(cams, &b, 3, frame, sizeof frame, &out, &learn);
+	check(learn == CamKnown);
+
+	// runts are dropped without learning anything.
+	mkframe(frame, 1, 3);
+	check(fwdframe(cams, &a, 0, frame, 13, &out, NULL) == FwdDrop);
+	frame[5] = 3;
+	frame[11] = 1;
+	check(fwdframe(cams, &a, 0, frame, sizeof frame, &out, NULL) == FwdFlood);
+}
+
+static void
+mkpacket(uint8_t *pkt, int version, uint8_t dst)
+{
+	memset(pkt, 0, 64);
+	pkt[0] = version<<4;
+	if(version == 4)
+		pkt[19] = dst;
+	else
+		pkt[39] = dst;
+}
+
+static void
+testhost(void)
+{
+	struct Port a = {1}, b = {2};
+	uint8_t pkt[64], ip[16];
+	Port *out;
+	int i;
+
+	memset(hosts, 0, sizeof hosts);
+	memset(ip, 0, sizeof ip);
+
+	// packets go by destination, and nowhere if there is no route.
+	ip[3] = 1;
+	check(hostadd(hosts, 4, ip, &a) == 0);
+	ip[3] = 2;
+	check(hostadd(hosts, 4, ip, &b) == 0);
+	mkpacket(pkt, 4, 2);
+	out = NULL;
+	check(fwdpacket(hosts, &a, pkt, sizeof pkt, &out) == FwdUnicast);
+	check(out == &b);
+	mkpacket(pkt, 4, 1);
+	check(fwdpacket(hosts, &b, pkt, sizeof pkt, &out) == FwdUnicast);
+	check(out == &a);
+	check(fwdpacket(hosts, &a, pkt, sizeof pkt, &out) == FwdDrop);
+	mkpacket(pkt, 4, 3);
+	check(fwdpacket(hosts, &a, pkt, sizeof pkt, &out) == FwdDrop);
+
+	// the same low bytes in ipv6 are another address.
+	mkpacket(pkt, 6, 2);
+	check(fwdpacket(hosts, &a, pkt, sizeof pkt, &out) == FwdDrop);
+	memset(ip, 0, sizeof ip);
+	ip[15] = 2;
+	check(hostadd(hosts, 6, ip, &b) == 0);
+	check(fwdpacket(hosts, &a, pkt, sizeof pkt, &out) == FwdUnicast);
+	check(out == &b);
+	check(fwdpacket(hosts, &a, pkt, 39, &out) == FwdDrop);
+
+	// dropping b leaves a, and b's addresses can come back.
+	hostdrop(hosts, &b);
+	check(fwdpacket(hosts, &a, pkt, sizeof pkt, &out) == FwdDrop);
+	mkpacket(pkt, 4, 1);
+	check(fwdpacket(hosts, &b, pkt, sizeof pkt, &out) == FwdUnicast);
+	check(hostadd(hosts, 6, ip, &a) == 0);
+	mkpacket(pkt, 6, 2);
+	check(fwdpacket(hosts, &b, pkt, sizeof pkt, &out) == FwdUnicast);
+	check(out == &a);
+
+	// churn doesn't fill the table up with given up slots.
+	memset(ip, 0, sizeof ip);
+	ip[0] = 10;
+	for(i = 0; i < 4*Hostsize; i++){
+		ip[2] = i>>8;
+		ip[3] = i;
+		check(hostadd(hosts, 4, ip, &b) == 0);
+		if(i % 2 == 0)
+			hostdrop(hosts, &b);
+	}
+	memset(ip, 0, sizeof ip);
+	ip[3] = 1;
+	check(hostlook(hosts, 4, ip) != NULL && hostlook(hosts, 4, ip)->port == &a);
+}
+
+static void
+testqueue(void)
+{
+	Queue q;
+	Buffer bufs[Qsize];
+	int i;
+
+	qinit(&q, NULL);
+
+	// fill and drain a few times, so the indices wrap around.
+	for(i = 0; i < 3*Qsize + Qsize/2; i++){
+		check(qput(&q, bufs + (i % Qsize)) == 0);
+		check(qget(&q) == bufs + (i % Qsize));
+	}
+
+	// holds Qsize-1 buffers in order, no matter where head is.
+	for(i = 0; i < Qsize-1; i++)
+		check(qput(&q, bufs + i) == 0);
+	check(qput(&q, bufs + i) == -1);
+	for(i = 0; i < Qsize-1; i++)
+		check(qget(&q) == bufs + i);
+
+	// a closed queue still hands out what is in it, then NULL.
+	check(qput(&q, bufs) == 0);
+	qclose(&q);
+	check(qget(&q) == bufs);
+	check(qget(&q) == NULL);
+
+	qreopen(&q);
+	check(qput(&q, bufs + 1) == 0);
+	check(qget(&q) == bufs + 1);
+}
+
+int
+main(void)
+{
+	testfwd();
+	testhost();
+	testqueue();
+	if(nfail > 0){
+		fprintf(stderr, "fwd_test: %d checks failed\n", nfail);
+		return 1;
+	}
+	printf("fwd_test: ok\n");
+	return 0;
+}
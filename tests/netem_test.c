@@ -0,0 +1,125 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "netem.h"
+#include "check.h"
+
+enum {
+	Ms = 1000000,
+	Start = 1000*Ms,
+};
+
+// takes out everything due by now, and notes the first bytes of the first max.
+static int
+drain(Netem *ne, uint64_t now, uint8_t *order, int max)
+{
+	Netemnode *np;
+	int n;
+
+	n = 0;
+	while((np = netemget(ne, now)) != NULL){
+		if(n < max)
+			order[n] = np->data[0];
+		n++;
+		netemrelease(ne, np);
+	}
+	return n;
+}
+
+static void
+testdelay(void)
+{
+	Netemconf conf;
+	Netem *ne;
+	uint8_t frame[64], order[16];
+	int i;
+
+	memset(&conf, 0, sizeof conf);
+	conf.delay = 10*Ms;
+	ne = netemcreate(&conf, Start);
+	for(i = 0; i < 4; i++){
+		frame[0] = i;
+		netemput(ne, frame, sizeof frame, Start + i*Ms);
+	}
+	check(netemnext(ne) == Start + 10*Ms);
+	check(drain(ne, Start + 9*Ms, order, 16) == 0);
+	check(drain(ne, Start + 11*Ms, order, 16) == 2);
+	check(order[0] == 0 && order[1] == 1);
+	check(drain(ne, Start + 20*Ms, order, 16) == 2);
+	check(order[0] == 2 && order[1] == 3);
+	check(netemnext(ne) == 0);
+
+	// longer than a turn of the wheel.
+	conf.delay = 2ull * NetemSlots * NetemTick;
+	netemconfig(ne, &conf);
+	frame[0] = 7;
+	netemput(ne, frame, sizeof frame, Start + 30*Ms);
+	check(drain(ne, Start + 30*Ms + conf.delay/2, order, 16) == 0);
+	check(drain(ne, Start + 30*Ms + conf.delay, order, 16) == 1);
+	check(order[0] == 7);
+	netemfree(ne);
+}
+
+static void
+testlossrate(void)
+{
+	Netemconf conf;
+	Netem *ne;
+	uint8_t frame[1250], order[16];
+	int i;
+
+	memset(&conf, 0, sizeof conf);
+	conf.loss = 1000000;
+	ne = netemcreate(&conf, Start);
+	for(i = 0; i < 100; i++)
+		netemput(ne, frame, sizeof frame, Start);
+	check(ne->lost == 100);
+	check(drain(ne, Start, order, 16) == 0);
+
+	// 10 kbit frames go 1 ms apart at 10 Mbit/s, the rest is over the limit of 5.
+	conf.loss = 0;
+	conf.rate = 10000000;
+	conf.limit = 5;
+	netemconfig(ne, &conf);
+	for(i = 0; i < 8; i++)
+		netemput(ne, frame, sizeof frame, Start);
+	check(ne->overlimit == 3);
+	check(drain(ne, Start, order, 16) == 1);
+	check(drain(ne, Start + 2*Ms, order, 16) == 2);
+	check(drain(ne, Start + 10*Ms, order, 16) == 2);
+	netemfree(ne);
+}
+
+int
+main(void)
+{
+	testdelay();
+	testlossrate();
+	if(nfail > 0){
+		fprintf(stderr, "netem_test: %d checks failed\n", nfail);
+		return 1;
+	}
+	printf("netem_test: ok\n");
+	return 0;
+}
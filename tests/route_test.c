@@ -0,0 +1,782 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "lpm.h"
+#include "maglev.h"
+#include "snat.h"
+#include "route.h"
+#include "check.h"
+
+enum {
+	Nrules = 2000,
+	Nlookups = 20000,
+};
+
+typedef struct Rule Rule;
+struct Rule {
+	uint8_t prefix[16];
+	int len;
+	uint32_t value;
+	int live;
+};
+
+static Rule rules[Nrules];
+
+static int
+covers(Rule *rule, uint8_t *addr)
+{
+	int i;
+
+	for(i = 0; i < rule->len; i++)
+		if(((rule->prefix[i/8] ^ addr[i/8]) & (0x80 >> (i%8))) != 0)
+			return 0;
+	return 1;
+}
+
+// what lpmlookup should say, the slow way.
+static uint32_t
+longest(uint8_t *addr)
+{
+	Rule *best;
+	int i;
+
+	best = NULL;
+	for(i = 0; i < Nrules; i++)
+		if(rules[i].live && covers(rules+i, addr) && (best == NULL || rules[i].len > best->len))
+			best = rules + i;
+	return best != NULL ? best->value : 0;
+}
+
+static void
+randaddr(uint8_t *addr, int bits)
+{
+	int i;
+
+	for(i = 0; i < bits/8; i++)
+		addr[i] = random();
+}
+
+/*
+ *	random prefixes, clustered so that they nest, against a linear
+ *	search, before and after deleting half of them.
+ */
+static void
+testlpm(int bits, int maxlen)
+{
+	Lpm lpm;
+	uint8_t addr[16];
+	int i, j, bad;
+
+	// a long ipv6 prefix takes a group for every byte.
+	check(lpminit(&lpm, bits, bits == 32 ? 4096 : 32768) == 0);
+	memset(rules, 0, sizeof rules);
+	for(i = 0; i < Nrules; i++){
+		randaddr(rules[i].prefix, bits);
+		// the first two bytes from a few, so that prefixes overlap.
+		rules[i].prefix[0] = 10 + random() % 3;
+		rules[i].prefix[1] = random() % 4;
+		rules[i].len = i == 0 ? 0 : random() % (maxlen+1);
+		for(j = rules[i].len; j < bits; j++)
+			rules[i].prefix[j/8] &= ~(0x80 >> (j%8));
+		rules[i].value = i+1;
+		for(j = 0; j < i; j++)
+			if(rules[j].live && rules[j].len == rules[i].len && memcmp(rules[j].prefix, rules[i].prefix, 16) == 0)
+				break;
+		if(j < i)
+			continue;
+		rules[i].live = 1;
+		check(lpmadd(&lpm, rules[i].prefix, rules[i].len, rules[i].value) == 0);
+	}
+	for(i = 0; i < Nrules; i++)
+		if(rules[i].live)
+			check(lpmget(&lpm, rules[i].prefix, rules[i].len) == rules[i].value);
+
+	for(j = 0; j < 2; j++){
+		bad = 0;
+		for(i = 0; i < Nlookups/Nrules*Nrules; i++){
+			// around a rule, or anywhere.
+			if(i & 1){
+				memcpy(addr, rules[i % Nrules].prefix, 16);
+				addr[bits/8 - 1] ^= random() & 3;
+			} else {
+				randaddr(addr, bits);
+				addr[0] = 10 + random() % 3;
+			}
+			bad += lpmlookup(&lpm, addr) != longest(addr);
+		}
+		check(bad == 0);
+		for(i = 0; i < Nrules; i += 2){
+			if(rules[i].live){
+				check(lpmdel(&lpm, rules[i].prefix, rules[i].len) == 0);
+				rules[i].live = 0;
+			}
+		}
+	}
+	check(lpmdel(&lpm, rules[0].prefix, rules[0].len) == -1);
+
+	// with everything gone, every group is back.
+	for(i = 0; i < Nrules; i++)
+		if(rules[i].live)
+			check(lpmdel(&lpm, rules[i].prefix, rules[i].len) == 0);
+	check(lpm.nfree == lpm.maxgroups);
+	randaddr(addr, bits);
+	check(lpmlookup(&lpm, addr) == 0);
+	lpmfree(&lpm);
+}
+
+static uint8_t gwmac[6] = {2, 0, 0, 0, 0, 0xfe};
+static uint8_t selfmac[6] = {2, 0, 0, 0, 0, 0xfd};
+static uint8_t amac[6] = {2, 0, 0, 0, 0, 0xa};
+static uint8_t bmac[6] = {2, 0, 0, 0, 0, 0xb};
+
+static uint16_t
+ipsum(uint8_t *p, int len)
+{
+	uint32_t sum;
+	int i;
+
+	sum = 0;
+	for(i = 0; i < len; i += 2)
+		sum += p[i]<<8 | p[i+1];
+	while(sum > 0xffff)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+static int
+mkarp(uint8_t *f, uint8_t *dst, uint8_t *src, int op, char *spa, char *tpa)
+{
+	memset(f, 0, 60);
+	memcpy(f, dst, 6);
+	memcpy(f+6, src, 6);
+	f[12] = 0x08;
+	f[13] = 0x06;
+	f[15] = 1;
+	f[16] = 0x08;
+	f[18] = 6;
+	f[19] = 4;
+	f[21] = op;
+	memcpy(f+22, src, 6);
+	inet_pton(AF_INET, spa, f+28);
+	inet_pton(AF_INET, tpa, f+38);
+	return 60;
+}
+
+static int
+mkip(uint8_t *f, uint8_t *src, char *sip, char *dip, int ttl)
+{
+	uint16_t sum;
+
+	memset(f, 0, 64);
+	memcpy(f, gwmac, 6);
+	memcpy(f+6, src, 6);
+	f[12] = 0x08;
+	f[14] = 0x45;
+	f[17] = 50;
+	f[22] = ttl;
+	f[23] = 17;
+	inet_pton(AF_INET, sip, f+26);
+	inet_pton(AF_INET, dip, f+30);
+	sum = ipsum(f+14, 20);
+	f[24] = sum >> 8;
+	f[25] = sum & 0xff;
+	return 64;
+}
+
+static void
+testroute4(void)
+{
+	Router *r;
+	uint8_t f[256], addr[4], bcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+	int len;
+
+	r = malloc(sizeof r[0]);
+	check(routeinit(r, gwmac, selfmac) == 0);
+	inet_pton(AF_INET, "10.1.0.0", addr);
+	check(routeadd(r, AF_INET, addr, 24, 1, (uint8_t[]){10, 1, 0, 1}) == 0);
+	inet_pton(AF_INET, "10.2.0.0", addr);
+	check(routeadd(r, AF_INET, addr, 24, 1, (uint8_t[]){10, 2, 0, 1}) == 0);
+
+	// a's request for its gateway is answered, and a is learned.
+	len = mkarp(f, bcast, amac, 1, "10.1.0.5", "10.1.0.1");
+	check(routeframe(r, f, &len) == RouteReply);
+	check(memcmp(f, amac, 6) == 0 && memcmp(f+6, gwmac, 6) == 0);
+	check(f[21] == 2 && memcmp(f+22, gwmac, 6) == 0 && memcmp(f+32, amac, 6) == 0);
+	check(memcmp(f+28, (uint8_t[]){10, 1, 0, 1}, 4) == 0 && memcmp(f+38, (uint8_t[]){10, 1, 0, 5}, 4) == 0);
+
+	// a request between hosts is switched.
+	len = mkarp(f, bcast, amac, 1, "10.1.0.5", "10.1.0.6");
+	check(routeframe(r, f, &len) == RouteSwitch);
+
+	// to b, who isn't known yet: the frame becomes a request from us, once.
+	len = mkip(f, amac, "10.1.0.5", "10.2.0.7", 64);
+	check(routeframe(r, f, &len) == RouteFlood);
+	check(len == 60 && memcmp(f, bcast, 6) == 0 && memcmp(f+6, selfmac, 6) == 0);
+	check(f[21] == 1 && memcmp(f+22, selfmac, 6) == 0);
+	check(memcmp(f+28, (uint8_t[]){10, 2, 0, 1}, 4) == 0 && memcmp(f+38, (uint8_t[]){10, 2, 0, 7}, 4) == 0);
+	len = mkip(f, amac, "10.1.0.5", "10.2.0.7", 64);
+	check(routeframe(r, f, &len) == RouteDrop);
+
+	// b answers to this switch, and the next frame goes through.
+	len = mkarp(f, selfmac, bmac, 2, "10.2.0.7", "10.2.0.1");
+	check(routeframe(r, f, &len) == RouteDrop);
+	len = mkip(f, amac, "10.1.0.5", "10.2.0.7", 64);
+	check(routeframe(r, f, &len) == RouteForward);
+	check(memcmp(f, bmac, 6) == 0 && memcmp(f+6, gwmac, 6) == 0);
+	check(f[22] == 63 && ipsum(f+14, 20) == 0);
+	check(len == 64);
+
+	// and back, a having been learned from its request.
+	len = mkip(f, bmac, "10.2.0.7", "10.1.0.5", 2);
+	check(routeframe(r, f, &len) == RouteForward);
+	check(memcmp(f, amac, 6) == 0 && f[22] == 1 && ipsum(f+14, 20) == 0);
+
+	// out of ttl, to the gateway itself, and nowhere.
+	len = mkip(f, bmac, "10.2.0.7", "10.1.0.5", 1);
+	check(routeframe(r, f, &len) == RouteDrop);
+	len = mkip(f, bmac, "10.2.0.7", "10.1.0.1", 64);
+	check(routeframe(r, f, &len) == RouteDrop);
+	len = mkip(f, bmac, "10.2.0.7", "10.3.0.1", 64);
+	check(routeframe(r, f, &len) == RouteDrop);
+
+	// a default route through b, and then without the subnet b is on.
+	inet_pton(AF_INET, "0.0.0.0", addr);
+	check(routeadd(r, AF_INET, addr, 0, 0, (uint8_t[]){10, 2, 0, 7}) == 0);
+	len = mkip(f, amac, "10.1.0.5", "192.0.2.1", 64);
+	check(routeframe(r, f, &len) == RouteForward && memcmp(f, bmac, 6) == 0);
+	inet_pton(AF_INET, "10.2.0.0", addr);
+	check(routedel(r, AF_INET, addr, 24) == 0);
+	check(routedel(r, AF_INET, addr, 24) == -1);
+	len = mkip(f, amac, "10.1.0.5", "192.0.2.1", 64);
+	check(routeframe(r, f, &len) == RouteDrop);
+
+	// neighbours are forgotten in time.
+	inet_pton(AF_INET, "10.2.0.0", addr);
+	check(routeadd(r, AF_INET, addr, 24, 1, (uint8_t[]){10, 2, 0, 1}) == 0);
+	for(len = 0; len < RouteNeighage; len++)
+		routeage(r);
+	len = mkip(f, amac, "10.1.0.5", "10.2.0.7", 64);
+	check(routeframe(r, f, &len) == RouteFlood);
+
+	routefree(r);
+	free(r);
+}
+
+static void
+testroute6(void)
+{
+	Router *r;
+	uint8_t f[256], prefix[16], gw[16], *ip, *icmp;
+	int len;
+
+	r = malloc(sizeof r[0]);
+	check(routeinit(r, gwmac, selfmac) == 0);
+	inet_pton(AF_INET6, "fd00:1::", prefix);
+	inet_pton(AF_INET6, "fd00:1::1", gw);
+	check(routeadd(r, AF_INET6, prefix, 64, 1, gw) == 0);
+
+	// a solicitation for the gateway from a, to its solicited node group.
+	memset(f, 0, sizeof f);
+	memcpy(f, (uint8_t[]){0x33, 0x33, 0xff, 0, 0, 1}, 6);
+	memcpy(f+6, amac, 6);
+	f[12] = 0x86;
+	f[13] = 0xdd;
+	ip = f+14;
+	ip[0] = 0x60;
+	ip[5] = 32;
+	ip[6] = 58;
+	ip[7] = 255;
+	inet_pton(AF_INET6, "fd00:1::5", ip+8);
+	inet_pton(AF_INET6, "ff02::1:ff00:1", ip+24);
+	icmp = ip+40;
+	icmp[0] = 135;
+	memcpy(icmp+8, gw, 16);
+	icmp[24] = 1;
+	icmp[25] = 1;
+	memcpy(icmp+26, amac, 6);
+	len = 14+40+32;
+	check(routeframe(r, f, &len) == RouteReply);
+	check(len == 14+40+32 && memcmp(f, amac, 6) == 0 && memcmp(f+6, gwmac, 6) == 0);
+	check(icmp[0] == 136 && icmp[4] == 0xe0 && memcmp(icmp+8, gw, 16) == 0);
+	check(icmp[24] == 2 && memcmp(icmp+26, gwmac, 6) == 0);
+	check(memcmp(ip+8, gw, 16) == 0);
+	inet_pton(AF_INET6, "fd00:1::5", prefix);
+	check(memcmp(ip+24, prefix, 16) == 0);
+
+	// the checksum over the pseudo header and the message comes to zero.
+	{
+		uint8_t ph[40+32];
+		memcpy(ph, ip+8, 32);
+		memset(ph+32, 0, 8);
+		ph[35] = 32;
+		ph[39] = 58;
+		memcpy(ph+40, icmp, 32);
+		check(ipsum(ph, sizeof ph) == 0);
+	}
+
+	// a was learned from it, so a frame to it goes straight through.
+	memset(f, 0, sizeof f);
+	memcpy(f, gwmac, 6);
+	memcpy(f+6, bmac, 6);
+	f[12] = 0x86;
+	f[13] = 0xdd;
+	ip[0] = 0x60;
+	ip[6] = 17;
+	ip[7] = 64;
+	inet_pton(AF_INET6, "fd00:2::7", ip+8);
+	inet_pton(AF_INET6, "fd00:1::5", ip+24);
+	len = 14+40+8;
+	check(routeframe(r, f, &len) == RouteForward);
+	check(memcmp(f, amac, 6) == 0 && ip[7] == 63);
+
+	// somebody not known yet gets a solicitation from this switch.
+	memcpy(f, gwmac, 6);
+	inet_pton(AF_INET6, "fd00:1::abcd", ip+24);
+	ip[7] = 64;
+	len = 14+40+8;
+	check(routeframe(r, f, &len) == RouteFlood);
+	check(memcmp(f, (uint8_t[]){0x33, 0x33, 0xff, 0, 0xab, 0xcd}, 6) == 0 && memcmp(f+6, selfmac, 6) == 0);
+	check(icmp[0] == 135 && icmp[24] == 1 && memcmp(icmp+26, selfmac, 6) == 0);
+	check(memcmp(ip+8, gw, 16) == 0);
+
+	routefree(r);
+	free(r);
+}
+
+static void
+testmaglev(void)
+{
+	static Maglev m, m2;
+	uint8_t key[MaglevKeylen], before[MaglevSize];
+	int count[MaglevMax];
+	int i, n, moved;
+
+	maglevinit(&m);
+	check(maglevlookup(&m, 1) == -1);
+
+	// every backend gets its share, to the entry.
+	memset(key, 0, sizeof key);
+	for(i = 0; i < 10; i++){
+		key[3] = i+1;
+		check(maglevadd(&m, key) == i);
+	}
+	check(maglevadd(&m, key) == 9 && m.n == 10);
+	memset(count, 0, sizeof count);
+	for(i = 0; i < MaglevSize; i++)
+		count[m.table[i]]++;
+	for(i = 0; i < 10; i++)
+		check(count[i] == MaglevSize/10 || count[i] == MaglevSize/10 + 1);
+
+	// the same backends in another order make the same table.
+	maglevinit(&m2);
+	for(i = 9; i >= 0; i--){
+		key[3] = i+1;
+		maglevadd(&m2, key);
+	}
+	n = 0;
+	for(i = 0; i < MaglevSize; i++)
+		n += memcmp(m.keys[m.table[i]], m2.keys[m2.table[i]], MaglevKeylen) != 0;
+	check(n == 0);
+
+	// taking one away moves its share, and not much else.
+	for(i = 0; i < MaglevSize; i++)
+		before[i] = m.table[i];
+	key[3] = 4;
+	check(maglevdel(&m, key) == 3);
+	check(maglevdel(&m, key) == -1);
+	moved = 0;
+	for(i = 0; i < MaglevSize; i++){
+		check(m.table[i] != 3);
+		if(before[i] != 3 && m.table[i] != before[i])
+			moved++;
+	}
+	check(moved < MaglevSize/20);
+
+	// and one coming takes about its share.
+	for(i = 0; i < MaglevSize; i++)
+		before[i] = m.table[i];
+	key[3] = 11;
+	check(maglevadd(&m, key) == 3);
+	moved = 0;
+	for(i = 0; i < MaglevSize; i++)
+		moved += m.table[i] != before[i];
+	check(moved < MaglevSize/10 + MaglevSize/20);
+
+	for(i = 0; i < 10; i++){
+		key[3] = i+1;
+		maglevdel(&m, key);
+	}
+	key[3] = 11;
+	maglevdel(&m, key);
+	check(m.n == 0 && maglevlookup(&m, 1) == -1);
+}
+
+static uint8_t cmac[6] = {2, 0, 0, 0, 0, 0xc};
+
+// what the udp checksum comes to over the pseudo header, zero if right.
+static uint16_t
+udpsum(uint8_t *f)
+{
+	uint8_t ph[12+30];
+
+	memcpy(ph, f+26, 8);
+	ph[8] = 0;
+	ph[9] = 17;
+	ph[10] = 0;
+	ph[11] = 30;
+	memcpy(ph+12, f+34, 30);
+	return ipsum(ph, sizeof ph);
+}
+
+static int
+mkudp(uint8_t *f, uint8_t *dst, uint8_t *src, char *sip, int sport, char *dip, int dport)
+{
+	uint8_t *u;
+	uint16_t sum;
+	int i, len;
+
+	len = mkip(f, src, sip, dip, 64);
+	memcpy(f, dst, 6);
+	u = f+34;
+	u[0] = sport >> 8;
+	u[1] = sport & 0xff;
+	u[2] = dport >> 8;
+	u[3] = dport & 0xff;
+	u[5] = 30;
+	for(i = 8; i < 30; i++)
+		u[i] = i*7;
+	sum = udpsum(f);
+	u[6] = sum >> 8;
+	u[7] = sum & 0xff;
+	return len;
+}
+
+static void
+testvip(void)
+{
+	Router *r;
+	uint8_t f[256], addr[4], vip[4], b[4], c[4], bcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+	int i, len, nb, nc, moved;
+	uint8_t chose[64];
+
+	r = malloc(sizeof r[0]);
+	check(routeinit(r, gwmac, selfmac) == 0);
+	inet_pton(AF_INET, "10.1.0.0", addr);
+	check(routeadd(r, AF_INET, addr, 24, 1, (uint8_t[]){10, 1, 0, 1}) == 0);
+	inet_pton(AF_INET, "10.2.0.0", addr);
+	check(routeadd(r, AF_INET, addr, 24, 1, (uint8_t[]){10, 2, 0, 1}) == 0);
+	inet_pton(AF_INET, "10.9.0.1", vip);
+	inet_pton(AF_INET, "10.2.0.7", b);
+	inet_pton(AF_INET, "10.2.0.8", c);
+
+	check(routevipadd(r, AF_INET, vip, IPPROTO_UDP, 53, b) == 0);
+	check(routevipadd(r, AF_INET, vip, IPPROTO_UDP, 53, c) == 0);
+	check(routevipadd(r, AF_INET, vip, IPPROTO_UDP, 53, vip) == -1);
+	check(routevipadd(r, AF_INET, vip, IPPROTO_ICMP, 53, b) == -1);
+	check(routevipadd(r, AF_INET, (uint8_t[]){10, 1, 0, 1}, IPPROTO_UDP, 53, b) == -1);
+	// b can't answer for two services on the same port.
+	check(routevipadd(r, AF_INET, (uint8_t[]){10, 9, 0, 2}, IPPROTO_UDP, 53, b) == -1);
+	check(r->nvips == 1);
+
+	// the service address is answered for, like a gateway.
+	len = mkarp(f, bcast, amac, 1, "10.1.0.5", "10.9.0.1");
+	check(routeframe(r, f, &len) == RouteReply);
+	check(memcmp(f+22, gwmac, 6) == 0 && memcmp(f+28, vip, 4) == 0);
+	len = mkarp(f, selfmac, bmac, 2, "10.2.0.7", "10.2.0.1");
+	check(routeframe(r, f, &len) == RouteDrop);
+	len = mkarp(f, selfmac, cmac, 2, "10.2.0.8", "10.2.0.1");
+	check(routeframe(r, f, &len) == RouteDrop);
+
+	// flows are spread over the backends, and each one stays put.
+	nb = nc = 0;
+	for(i = 0; i < 64; i++){
+		len = mkudp(f, gwmac, amac, "10.1.0.5", 1000+i, "10.9.0.1", 53);
+		check(routeframe(r, f, &len) == RouteForward);
+		check(ipsum(f+14, 20) == 0 && udpsum(f) == 0);
+		if(memcmp(f+30, b, 4) == 0 && memcmp(f, bmac, 6) == 0)
+			nb++;
+		else if(memcmp(f+30, c, 4) == 0 && memcmp(f, cmac, 6) == 0)
+			nc++;
+		chose[i] = f[33];
+		len = mkudp(f, gwmac, amac, "10.1.0.5", 1000+i, "10.9.0.1", 53);
+		check(routeframe(r, f, &len) == RouteForward && f[33] == chose[i]);
+	}
+	check(nb + nc == 64 && nb > 16 && nc > 16);
+
+	// answers come from the service, routed or not.
+	len = mkudp(f, gwmac, bmac, "10.2.0.7", 53, "10.1.0.5", 1000);
+	check(routeframe(r, f, &len) == RouteForward);
+	check(memcmp(f+26, vip, 4) == 0 && memcmp(f, amac, 6) == 0);
+	check(ipsum(f+14, 20) == 0 && udpsum(f) == 0);
+	len = mkudp(f, amac, bmac, "10.2.0.7", 53, "10.2.0.9", 1000);
+	check(routeframe(r, f, &len) == RouteSwitch);
+	check(memcmp(f+26, vip, 4) == 0 && ipsum(f+14, 20) == 0 && udpsum(f) == 0);
+	// but not what b sends from other ports.
+	len = mkudp(f, amac, bmac, "10.2.0.7", 54, "10.2.0.9", 1000);
+	check(routeframe(r, f, &len) == RouteSwitch && memcmp(f+26, b, 4) == 0);
+
+	// udp without a checksum stays without one.
+	len = mkudp(f, gwmac, amac, "10.1.0.5", 999, "10.9.0.1", 53);
+	f[40] = f[41] = 0;
+	check(routeframe(r, f, &len) == RouteForward && f[40] == 0 && f[41] == 0);
+
+	// other ports and fragments of the service address go nowhere.
+	len = mkudp(f, gwmac, amac, "10.1.0.5", 1000, "10.9.0.1", 54);
+	check(routeframe(r, f, &len) == RouteDrop);
+	len = mkudp(f, gwmac, amac, "10.1.0.5", 1000, "10.9.0.1", 53);
+	f[20] = 0x20;
+	check(routeframe(r, f, &len) == RouteDrop);
+
+	// with c gone, b's flows stay with b.
+	check(routevipdel(r, AF_INET, vip, IPPROTO_UDP, 53, c) == 0);
+	check(routevipdel(r, AF_INET, vip, IPPROTO_UDP, 53, c) == -1);
+	moved = 0;
+	for(i = 0; i < 64; i++){
+		len = mkudp(f, gwmac, amac, "10.1.0.5", 1000+i, "10.9.0.1", 53);
+		check(routeframe(r, f, &len) == RouteForward && memcmp(f+30, b, 4) == 0);
+		moved += chose[i] != f[33];
+	}
+	check(moved == nc);
+
+	// and with the last backend, the service and its address go.
+	check(routevipdel(r, AF_INET, vip, IPPROTO_UDP, 53, b) == 0);
+	check(r->nvips == 0);
+	len = mkarp(f, bcast, amac, 1, "10.1.0.5", "10.9.0.1");
+	check(routeframe(r, f, &len) == RouteSwitch);
+	len = mkudp(f, amac, bmac, "10.2.0.7", 53, "10.2.0.9", 1000);
+	check(routeframe(r, f, &len) == RouteSwitch && memcmp(f+26, b, 4) == 0);
+	check(routevipadd(r, AF_INET, (uint8_t[]){10, 9, 0, 2}, IPPROTO_UDP, 53, b) == 0);
+	check(routevipdel(r, AF_INET, (uint8_t[]){10, 9, 0, 2}, IPPROTO_UDP, 53, NULL) == 0);
+	check(r->nvips == 0);
+
+	routefree(r);
+	free(r);
+}
+
+/*
+ *	connections in and out of the table, their ports, and what expiring
+ *	some of them does to the others, which may have been moved.
+ */
+static void
+testsnattab(void)
+{
+	Snat *s;
+	uint8_t addr[4] = {192, 0, 2, 1}, src[4] = {10, 1, 0, 0}, dst[4] = {198, 51, 100, 1}, ip[4];
+	static int ports[4096];
+	static uint8_t used[65536];
+	int i, n, port, bad;
+
+	s = malloc(sizeof s[0]);
+	check(snatinit(s, addr, 1024, 1024+SnatShards*SnatBlock-2) == -1);
+	check(snatinit(s, addr, 1024, 65535) == 0);
+	check(snatout(s, IPPROTO_GRE, src, 0, dst, 0, 0, &port) == -1);
+
+	// every connection its own port, the same every time.
+	bad = 0;
+	for(i = 0; i < 4096; i++){
+		s->now = i < 2048 ? 0 : 50;
+		src[2] = i >> 8;
+		src[3] = i;
+		check(snatout(s, IPPROTO_UDP, src, 5000+i%7, dst, 53, 0, ports+i) == 0);
+		bad += ports[i] < 1024 || ports[i] > 65535 || used[ports[i]]++;
+	}
+	check(bad == 0);
+	check(snatcount(s) == 4096);
+	bad = 0;
+	for(i = 0; i < 4096; i++){
+		s->now = i < 2048 ? 0 : 50;
+		src[2] = i >> 8;
+		src[3] = i;
+		bad += snatout(s, IPPROTO_UDP, src, 5000+i%7, dst, 53, 0, &port) == -1 || port != ports[i];
+		bad += snatin(s, IPPROTO_UDP, ports[i], dst, 53, 0, ip, &port) == -1 || port != 5000+i%7 || memcmp(ip, src, 4) != 0;
+	}
+	check(bad == 0);
+	// only from where it went, and not for another protocol.
+	check(snatin(s, IPPROTO_UDP, ports[0], dst, 54, 0, ip, &port) == -1);
+	check(snatin(s, IPPROTO_UDP, ports[0], addr, 53, 0, ip, &port) == -1);
+	check(snatin(s, IPPROTO_TCP, ports[0], dst, 53, 0, ip, &port) == -1);
+	check(snatin(s, IPPROTO_UDP, 80, dst, 53, 0, ip, &port) == -1);
+
+	// the first half expire, and the rest are still found.
+	s->now = 50 + SnatUdptime;
+	bad = 0;
+	for(i = 0; i < 4096; i += 2){
+		src[2] = i >> 8;
+		src[3] = i;
+		bad += snatin(s, IPPROTO_UDP, ports[i], dst, 53, 0, ip, &port) != (i < 2048 ? -1 : 0);
+	}
+	for(i = 1; i < 4096; i += 2){
+		src[2] = i >> 8;
+		src[3] = i;
+		bad += snatout(s, IPPROTO_UDP, src, 5000+i%7, dst, 53, 0, &port) == -1 || (i >= 2048 && port != ports[i]);
+	}
+	check(bad == 0);
+	n = snatcount(s);
+	check(n == 2048 + 1024);
+
+	// tcp is kept for long, but not once it is closed both ways.
+	src[2] = 0x7f;
+	check(snatout(s, IPPROTO_TCP, src, 80, dst, 80, 0x02, &port) == 0);
+	check(snatin(s, IPPROTO_TCP, port, dst, 80, 0x12, ip, &i) == 0 && i == 80);
+	check(snatout(s, IPPROTO_TCP, src, 81, dst, 80, 0x02, &n) == 0 && n != port);
+	check(snatout(s, IPPROTO_TCP, src, 81, dst, 80, 0x11, &n) == 0);
+	check(snatin(s, IPPROTO_TCP, n, dst, 80, 0x11, ip, &i) == 0 && i == 81);
+	s->now += SnatClosetime+1;
+	check(snatin(s, IPPROTO_TCP, port, dst, 80, 0x10, ip, &i) == 0);
+	check(snatin(s, IPPROTO_TCP, n, dst, 80, 0x10, ip, &i) == -1);
+
+	// with the ports all taken, there are no more connections.
+	snatfree(s);
+	check(snatinit(s, addr, 2048, 2048+SnatShards*SnatBlock-1) == 0);
+	memset(used, 0, sizeof used);
+	bad = 0;
+	for(i = 0; i < 4096; i++){
+		src[2] = i >> 8;
+		src[3] = i;
+		if(snatout(s, IPPROTO_UDP, src, 1, dst, 53, 0, &port) == -1)
+			break;
+		bad += port < 2048 || port >= 2048+SnatShards*SnatBlock || used[port]++;
+	}
+	check(bad == 0 && i >= SnatBlock && i <= SnatShards*SnatBlock);
+	// but there are once the others expire.
+	s->now += SnatUdptime+1;
+	src[2] = 0xff;
+	check(snatout(s, IPPROTO_UDP, src, 1, dst, 53, 0, &port) == 0);
+	snatfree(s);
+	free(s);
+}
+
+/*
+ *	a gateway from the inside subnet 10.1.0.0/24 out to 192.168.1.0/24,
+ *	where the switch is 192.168.1.50 and the router out is b.
+ */
+static void
+testsnat(void)
+{
+	Router *r;
+	uint8_t f[256], addr[4], out[4], bcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+	int len, port;
+
+	r = malloc(sizeof r[0]);
+	check(routeinit(r, gwmac, selfmac) == 0);
+	inet_pton(AF_INET, "10.1.0.0", addr);
+	check(routeadd(r, AF_INET, addr, 24, 1, (uint8_t[]){10, 1, 0, 1}) == 0);
+	inet_pton(AF_INET, "192.168.1.50", out);
+	check(routesnat(r, out, 24, 1024, 65535) == 0);
+	check(routesnat(r, out, 24, 1024, 65535) == 0);
+	check(routesnat(r, out, 24, 2048, 65535) == -1);
+	inet_pton(AF_INET, "0.0.0.0", addr);
+	check(routeadd(r, AF_INET, addr, 0, 0, (uint8_t[]){192, 168, 1, 1}) == 0);
+
+	// the outside address is this switch's own.
+	len = mkarp(f, bcast, bmac, 1, "192.168.1.1", "192.168.1.50");
+	check(routeframe(r, f, &len) == RouteReply);
+	check(memcmp(f+6, selfmac, 6) == 0 && memcmp(f+22, selfmac, 6) == 0);
+	len = mkarp(f, bcast, amac, 1, "10.1.0.5", "10.1.0.1");
+	check(routeframe(r, f, &len) == RouteReply);
+
+	// out, from the outside address, and back in. b was learned from its request.
+	len = mkudp(f, gwmac, amac, "10.1.0.5", 1000, "203.0.113.9", 53);
+	check(routeframe(r, f, &len) == RouteForward);
+	check(memcmp(f, bmac, 6) == 0 && memcmp(f+6, selfmac, 6) == 0);
+	check(memcmp(f+26, out, 4) == 0 && ipsum(f+14, 20) == 0 && udpsum(f) == 0);
+	port = f[34]<<8 | f[35];
+	len = mkudp(f, selfmac, bmac, "203.0.113.9", 53, "192.168.1.50", port);
+	check(routeframe(r, f, &len) == RouteForward);
+	check(memcmp(f, amac, 6) == 0 && memcmp(f+6, gwmac, 6) == 0);
+	check(memcmp(f+30, (uint8_t[]){10, 1, 0, 5}, 4) == 0 && f[36] == 1000 >> 8 && f[37] == (1000 & 0xff));
+	check(ipsum(f+14, 20) == 0 && udpsum(f) == 0);
+
+	// not from elsewhere, nor to ports with no connection.
+	len = mkudp(f, selfmac, bmac, "203.0.113.9", 54, "192.168.1.50", port);
+	check(routeframe(r, f, &len) == RouteDrop);
+	len = mkudp(f, selfmac, bmac, "203.0.113.9", 53, "192.168.1.50", port ^ 1);
+	check(routeframe(r, f, &len) == RouteDrop);
+
+	// echoes go by their identifier.
+	len = mkip(f, amac, "10.1.0.5", "203.0.113.9", 64);
+	f[23] = 1;
+	f[24] = f[25] = 0;
+	port = ipsum(f+14, 20);
+	f[24] = port >> 8;
+	f[25] = port & 0xff;
+	f[34] = 8;
+	f[38] = 0x12;
+	f[39] = 0x34;
+	port = ipsum(f+34, 30);
+	f[36] = port >> 8;
+	f[37] = port & 0xff;
+	check(routeframe(r, f, &len) == RouteForward && memcmp(f+26, out, 4) == 0);
+	check(ipsum(f+14, 20) == 0 && ipsum(f+34, 30) == 0);
+	f[34] = 0;
+	f[36] = f[37] = 0;
+	memcpy(f+30, out, 4);
+	inet_pton(AF_INET, "203.0.113.9", f+26);
+	f[24] = f[25] = 0;
+	port = ipsum(f+14, 20);
+	f[24] = port >> 8;
+	f[25] = port & 0xff;
+	port = ipsum(f+34, 30);
+	f[36] = port >> 8;
+	f[37] = port & 0xff;
+	memcpy(f, selfmac, 6);
+	memcpy(f+6, bmac, 6);
+	check(routeframe(r, f, &len) == RouteForward && memcmp(f+30, (uint8_t[]){10, 1, 0, 5}, 4) == 0);
+	check(f[38] == 0x12 && f[39] == 0x34 && ipsum(f+34, 30) == 0);
+
+	// hosts on the outside subnet go as they are, and it isn't routed around.
+	len = mkudp(f, gwmac, bmac, "192.168.1.1", 53, "10.1.0.5", 1000);
+	check(routeframe(r, f, &len) == RouteForward && memcmp(f+26, (uint8_t[]){192, 168, 1, 1}, 4) == 0);
+	len = mkudp(f, gwmac, amac, "10.1.0.5", 1000, "192.168.1.50", 53);
+	check(routeframe(r, f, &len) == RouteDrop);
+
+	routefree(r);
+	free(r);
+}
+
+int
+main(void)
+{
+	srandom(1);
+	testlpm(32, 32);
+	testlpm(128, 64);
+	testlpm(128, 128);
+	testroute4();
+	testroute6();
+	testmaglev();
+	testvip();
+	testsnattab();
+	testsnat();
+	if(nfail > 0){
+		fprintf(stderr, "route_test: %d checks failed\n", nfail);
+		return 1;
+	}
+	printf("route_test: ok\n");
+	return 0;
+}
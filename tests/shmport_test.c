@@ -0,0 +1,181 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include "shmport.h"
+#include "check.h"
+
+enum {
+	Nframes = 200000,
+};
+
+// both ends of one port in this process, as containet would map it.
+static Shmport *
+peer(Shmport *sp)
+{
+	return shmportopen(dup(sp->memfd), dup(sp->txbell), dup(sp->rxbell));
+}
+
+static void
+testring(void)
+{
+	Shmport *a, *b;
+	uint8_t frame[64], *fp;
+	int i, n;
+
+	check(shmportcreate(6, 128) == NULL);
+	a = shmportcreate(8, 128);
+	check(a != NULL);
+	b = peer(a);
+	check(b != NULL);
+
+	// nothing is seen before a flush.
+	memset(frame, 0xab, sizeof frame);
+	check(shmportput(a, frame, sizeof frame) == 0);
+	check(shmportget(b, &fp) == -1);
+	shmportflush(a);
+	check(shmportget(b, &fp) == sizeof frame && fp[0] == 0xab && fp[63] == 0xab);
+	check(shmportget(b, &fp) == -1);
+	shmportrelease(b);
+
+	// a full ring refuses frames until slots are given back.
+	for(i = 0, n = 0; i < 20; i++){
+		frame[0] = i;
+		if(shmportput(a, frame, sizeof frame) == 0)
+			n++;
+	}
+	check(n == 8);
+	check(shmportput(a, frame, 200) == -1);
+	shmportflush(a);
+	for(i = 0; i < 8; i++)
+		check(shmportget(b, &fp) == sizeof frame && fp[0] == i);
+	check(shmportput(a, frame, sizeof frame) == -1);
+	shmportrelease(b);
+	check(shmportput(a, frame, sizeof frame) == 0);
+
+	// the other way, and a wait that times out.
+	check(shmportwait(a, 0) == 0);
+	check(shmportput(b, frame, 10) == 0);
+	shmportflush(b);
+	check(shmportwait(a, 0) == 1);
+	check(shmportget(a, &fp) == 10);
+
+	shmportclose(b);
+	shmportclose(a);
+}
+
+// a memfd that could change size, or is smaller than it says, is refused.
+static void
+testsize(void)
+{
+	Shmport *a, *b;
+	Shmhdr hdr;
+	int memfd;
+
+	a = shmportcreate(8, 128);
+	check(a != NULL);
+	check(ftruncate(a->memfd, sizeof hdr) == -1);
+
+	memcpy(&hdr, a->hdr, sizeof hdr);
+	memfd = memfd_create("shmport_test", MFD_ALLOW_SEALING);
+	check(pwrite(memfd, &hdr, sizeof hdr, 0) == sizeof hdr);
+	check(shmportopen(memfd, a->txbell, a->rxbell) == NULL);
+	check(fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW) == 0);
+	check(shmportopen(memfd, a->txbell, a->rxbell) == NULL);
+	close(memfd);
+
+	b = peer(a);
+	check(b != NULL);
+	shmportclose(b);
+	shmportclose(a);
+}
+
+static void *
+consumer(void *asp)
+{
+	Shmport *sp = asp;
+	uint8_t *fp;
+	uint32_t next;
+	int len;
+
+	next = 0;
+	while(next < Nframes){
+		if((len = shmportget(sp, &fp)) == -1){
+			shmportrelease(sp);
+			shmportwait(sp, 100);
+			continue;
+		}
+		check(len == 4 + (int)(next % 60));
+		check(*(uint32_t *)fp == next);
+		next++;
+	}
+	shmportrelease(sp);
+	return NULL;
+}
+
+// frames arrive whole and in order across threads, with the bells in use.
+static void
+testrace(void)
+{
+	pthread_t thr;
+	Shmport *a, *b;
+	uint8_t frame[64];
+	uint32_t i;
+
+	a = shmportcreate(64, 128);
+	b = peer(a);
+	pthread_create(&thr, NULL, consumer, b);
+	for(i = 0; i < Nframes; i++){
+		memcpy(frame, &i, 4);
+		while(shmportput(a, frame, 4 + i % 60) == -1){
+			shmportflush(a);
+			sched_yield();
+		}
+		if(i % 16 == 15)
+			shmportflush(a);
+	}
+	shmportflush(a);
+	pthread_join(thr, NULL);
+	shmportclose(b);
+	shmportclose(a);
+}
+
+int
+main(void)
+{
+	testring();
+	testsize();
+	testrace();
+	if(nfail > 0){
+		fprintf(stderr, "shmport_test: %d checks failed\n", nfail);
+		return 1;
+	}
+	printf("shmport_test: ok\n");
+	return 0;
+}
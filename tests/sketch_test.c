@@ -0,0 +1,155 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "sketch.h"
+#include "check.h"
+
+enum {
+	Nflows = 20000,
+	Nelephants = 10,
+};
+
+static Sketch sk;
+static uint64_t truebytes[Nflows];
+static uint32_t truepkts[Nflows];
+
+static uint32_t
+xorshift(uint32_t *state)
+{
+	uint32_t x;
+
+	x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static void
+mkkey(Flowkey *key, int i)
+{
+	memset(key, 0, sizeof key[0]);
+	key->srcmac[0] = 0x02;
+	key->srcmac[5] = i;
+	key->srcip = 0x0a000000 | i;
+	key->dstip = 0x0a010000 | (i * 7);
+	key->sport = 1024 + i;
+	key->dport = 80;
+	key->proto = 6;
+}
+
+/*
+ *	count-min never counts low, and is high by more than e/width of all
+ *	the bytes with a chance of e^-depth, about 2% for a flow.
+ */
+static void
+testbound(void)
+{
+	Flowkey key;
+	uint64_t total, pkts, bytes, slack;
+	uint32_t rnd;
+	int i, n, nbytes, nover;
+
+	sketchinit(&sk);
+	rnd = 0x12345678;
+	total = 0;
+	for(n = 0; n < 4*Nflows; n++){
+		i = xorshift(&rnd) % Nflows;
+		nbytes = 64 + xorshift(&rnd) % 1400;
+		mkkey(&key, i);
+		sketchadd(&sk, &key, nbytes);
+		truebytes[i] += nbytes;
+		truepkts[i]++;
+		total += nbytes;
+	}
+
+	slack = total * 2.718281828 / SketchWidth;
+	nover = 0;
+	for(i = 0; i < Nflows; i++){
+		mkkey(&key, i);
+		sketchcount(&sk, &key, &pkts, &bytes);
+		check(bytes >= truebytes[i]);
+		check(pkts >= truepkts[i]);
+		if(bytes - truebytes[i] > slack)
+			nover++;
+	}
+	check(nover < Nflows / 20);
+}
+
+// the biggest flows come out, in order, over a lot of small ones.
+static void
+testtop(void)
+{
+	Talker tab[SketchTopk+8];
+	Flowkey key;
+	uint32_t rnd;
+	int i, n;
+
+	sketchreset(&sk);
+	check(sketchtop(&sk, tab, SketchTopk+8) == 0);
+	rnd = 0x9e3779b9;
+	for(n = 0; n < 200; n++){
+		for(i = 0; i < Nelephants; i++){
+			mkkey(&key, i);
+			sketchadd(&sk, &key, 1000 * (Nelephants - i));
+		}
+		for(i = 0; i < 100; i++){
+			mkkey(&key, Nelephants + xorshift(&rnd) % (Nflows - Nelephants));
+			sketchadd(&sk, &key, 64);
+		}
+	}
+
+	n = sketchtop(&sk, tab, SketchTopk+8);
+	check(n == SketchTopk);
+	for(i = 0; i < Nelephants; i++){
+		mkkey(&key, i);
+		check(memcmp(&tab[i].key, &key, sizeof key) == 0);
+	}
+	for(i = 1; i < n; i++)
+		check(tab[i-1].bytes >= tab[i].bytes);
+
+	// as many as asked for, and nothing for a count of nothing or less.
+	check(sketchtop(&sk, tab, 3) == 3);
+	mkkey(&key, 0);
+	check(memcmp(&tab[0].key, &key, sizeof key) == 0);
+	memset(tab, 0xaa, sizeof tab);
+	check(sketchtop(&sk, tab, 0) == 0);
+	check(sketchtop(&sk, tab, -1) == 0);
+	check(tab[0].pkts == 0xaaaaaaaaaaaaaaaaull);
+}
+
+int
+main(void)
+{
+	testbound();
+	testtop();
+	if(nfail > 0){
+		fprintf(stderr, "sketch_test: %d checks failed\n", nfail);
+		return 1;
+	}
+	printf("sketch_test: ok\n");
+	return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ *	Copyright (c) 2016 Aki Nyrhinen
+ *
+ *	Permission is hereby granted, free of charge, to any person obtaining a copy
+ *	of this software and associated documentation files (the "Software"), to deal
+ *	in the Software without restriction, including without limitation the rights
+ *	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *	copies of the Software, and to permit persons to whom the Software is
+ *	furnished to do so, subject to the following conditions:
+ *
+ *	The above copyright notice and this permission notice shall be included in
+ *	all copies or substantial portions of the Software.
+ *
+ *	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *	THE SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "vxlan.h"
+#include "check.h"
+
+/*
+ *	a socket on a port the kernel picks, so other runs on the machine
+ *	don't get in the way, and where it is, in vxlanopen's form and in *sin.
+ */
+static int
+bound(char *addr, int addrlen, struct sockaddr_in *sin)
+{
+	socklen_t len;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(sin, 0, sizeof sin[0]);
+	sin->sin_family = AF_INET;
+	inet_pton(AF_INET, "127.0.0.1", &sin->sin_addr);
+	len = sizeof sin[0];
+	check(bind(fd, (struct sockaddr *)sin, sizeof sin[0]) == 0);
+	check(getsockname(fd, (struct sockaddr *)sin, &len) == 0);
+	snprintf(addr, addrlen, "127.0.0.1:%d", ntohs(sin->sin_port));
+	return fd;
+}
+
+// the frames of what b has in, up to max, in lens, and their first bytes in ids.
+static int
+drain(Vxlan *b, int *lens, int *ids, int max)
+{
+	uint8_t *fp;
+	int n, len, peer;
+
+	n = 0;
+	while(n < max && vxlanwait(b, 200) == 1 && vxlanrecv(b) > 0){
+		while((len = vxlannext(b, &fp, &peer)) != -1){
+			if(len == 0 || n == max)
+				continue;
+			check(peer == 0);
+			lens[n] = len;
+			ids[n++] = fp[14];
+		}
+	}
+	return n;
+}
+
+static void
+testtrunk(void)
+{
+	struct sockaddr_in asin, bsin;
+	Vxlan *a, *b;
+	char aaddr[32], baddr[32], *apeer, *bpeer;
+	uint8_t frame[20][1500], dgram[64];
+	int lens[32], ids[32];
+	int i, n, fd;
+
+	fd = bound(aaddr, sizeof aaddr, &asin);
+	apeer = aaddr;
+	bpeer = baddr;
+	b = vxlanadopt(bound(baddr, sizeof baddr, &bsin), 42, &apeer, 1);
+	a = vxlanadopt(fd, 42, &bpeer, 1);
+	check(a != NULL && b != NULL);
+	check(vxlanopen(aaddr, 42, &bpeer, 1) == NULL);
+	check(vxlanadopt(-1, 1<<24, &bpeer, 1) == NULL);
+
+	// a run of the same size and a shorter one at the end, that can all go
+	// as one datagram, and one to every peer, which is the only one.
+	for(i = 0; i < 20; i++){
+		memset(frame[i], 0, sizeof frame[i]);
+		frame[i][14] = i;
+	}
+	for(i = 0; i < 10; i++)
+		check(vxlanput(a, 0, frame[i], 1000) == 0);
+	check(vxlanput(a, 0, frame[10], 600) == 0);
+	check(vxlanput(a, -1, frame[11], 1000) == 0);
+	check(vxlanflush(a) == 0);
+	n = drain(b, lens, ids, 32);
+	check(n == 12);
+	for(i = 0; i < n; i++){
+		check(ids[i] == i);
+		check(lens[i] == (i == 10 ? 600 : 1000));
+	}
+
+	// another vni, and someone who is not a peer, are not heard.
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(dgram, 0, sizeof dgram);
+	dgram[0] = 0x08;
+	dgram[6] = 42;
+	check(sendto(fd, dgram, sizeof dgram, 0, (struct sockaddr *)&bsin, sizeof bsin) == sizeof dgram);
+	close(fd);
+	b->vni = 43;
+	check(vxlanput(a, 0, frame[12], 100) == 0);
+	check(vxlanflush(a) == 0);
+	check(drain(b, lens, ids, 32) == 0);
+	b->vni = 42;
+
+	// and it goes the other way.
+	check(vxlanput(b, -1, frame[13], 64) == 0);
+	check(vxlanflush(b) == 0);
+	check(drain(a, lens, ids, 32) == 1 && ids[0] == 13 && lens[0] == 64);
+
+	vxlanclose(a);
+	vxlanclose(b);
+}
+
+int
+main(void)
+{
+	testtrunk();
+	if(nfail > 0){
+		fprintf(stderr, "vxlan_test: %d checks failed\n", nfail);
+		return 1;
+	}
+	printf("vxlan_test: ok\n");
+	return 0;
+}